@@ -0,0 +1,288 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+#include <VulkanBuffer.hpp>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Clustered light culling - many dynamic point and spot lights, each pixel shades only the lights of its cluster.
+/// The view frustum is split into a grid of clusters (froxels): GRID_X * GRID_Y screen tiles, times GRID_Z slices of view depth
+/// growing exponentially from near to far plane, so clusters are about as deep as they are wide.
+/// Every frame record() bins the lights (cluster_lights.comp, one invocation per cluster): a light goes into the list of every cluster
+/// whose view space box touches its bounding sphere - the sphere of its range, or around the cone of a spot light.
+/// Fragment shaders find their cluster from the pixel and view depth, and loop over its list (see default_material.frag).
+/// Lights are written by the CPU every frame (world space, mapped), they are transformed into view space by binning.
+/// Buffers read by fragment shaders: lights (binding 14), cluster lists (binding 15), params (binding 16) - they exist even
+/// if binning can't run (no compute), with no lights.
+/// A cluster touched by more than MAX_LIGHTS_PER_CLUSTER lights keeps the first ones - such clusters are counted (overflowingClusters),
+/// so a scene too dense for the lists shows up instead of silently losing light.
+/// Binning shader: binding 0 - params, binding 1 - lights, binding 2 - cluster lists, binding 3 - overflow count.
+struct ClusteredLights
+{
+    static constexpr uint32_t GRID_X                 = 16;
+    static constexpr uint32_t GRID_Y                 = 9;
+    static constexpr uint32_t GRID_Z                 = 24;
+    static constexpr uint32_t CLUSTER_COUNT          = GRID_X * GRID_Y * GRID_Z;
+    static constexpr uint32_t MAX_LIGHTS             = 4096;
+    static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 63; // Must match cluster_lights.comp and default_material.frag - with the count, 64 uints per cluster.
+    static constexpr uint32_t WORKGROUP_SIZE         = 64; // Must match local size in cluster_lights.comp.
+
+    static_assert(CLUSTER_COUNT % WORKGROUP_SIZE == 0, "Clusters fill whole workgroups");
+
+    /// As shaders read it (std430) - world space.
+    struct Light
+    {
+        glm::vec4 positionRange;     // xyz - position, w - range, no light beyond it.
+        glm::vec4 colorCosInner;     // rgb - color times intensity, w - cosine of the inner cone angle (spot), full light within.
+        glm::vec4 directionCosOuter; // xyz - direction (spot), w - cosine of the outer cone angle, no light beyond; -1 for point lights.
+
+        static Light point(const glm::vec3& position, float range, const glm::vec3& color, float intensity)
+        {
+            Light light;
+            light.positionRange     = glm::vec4(position, range);
+            light.colorCosInner     = glm::vec4(color * intensity, -1.0f);
+            light.directionCosOuter = glm::vec4(0.0f, -1.0f, 0.0f, -1.0f);
+            return light;
+        }
+
+        /// Angles in radians, from the direction to the cone's side - the outer one up to 90 degrees.
+        static Light spot(const glm::vec3& position, const glm::vec3& direction, float range, const glm::vec3& color, float intensity,
+                          float innerAngle, float outerAngle)
+        {
+            assert(innerAngle <= outerAngle && outerAngle < 0.5f * 3.14159265f);
+            Light light;
+            light.positionRange     = glm::vec4(position, range);
+            light.colorCosInner     = glm::vec4(color * intensity, std::cos(innerAngle));
+            light.directionCosOuter = glm::vec4(glm::normalize(direction), std::cos(outerAngle));
+            return light;
+        }
+
+        bool isSpot() const
+        {
+            return this->directionCosOuter.w > -1.0f;
+        }
+    };
+
+    /// As shaders read it (std140).
+    struct Params
+    {
+        glm::mat4  view;
+        glm::mat4  inverseProjection;
+        glm::vec4  camPos;
+        glm::vec4  screen; // Width, height (of the frame), near, far.
+        glm::uvec4 grid;   // Clusters along x, y, z, light count.
+    };
+
+    vks::VulkanDevice* vulkanDevice = nullptr;
+    VkDevice           device       = VK_NULL_HANDLE;
+
+    bool     isBinning  = false; // Binning pipeline exists - otherwise lists stay empty and nothing is lit.
+    uint32_t lightCount = 0;     // Written by the last setLights().
+    uint32_t overflowingClusters = 0; // Clusters of the last binned frame with lights dropped, read by setLights().
+
+    vks::Buffer params;   // Params, mapped.
+    vks::Buffer lights;   // Light per light, mapped.
+    vks::Buffer clusters; // Per cluster: light count, then MAX_LIGHTS_PER_CLUSTER light indices.
+    vks::Buffer overflow; // Count of overflowing clusters, mapped.
+
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool      descriptorPool      = VK_NULL_HANDLE;
+    VkDescriptorSet       descriptorSet       = VK_NULL_HANDLE;
+    VkPipelineLayout      pipelineLayout      = VK_NULL_HANDLE;
+    VkPipeline            pipeline            = VK_NULL_HANDLE;
+
+// PREPARE {
+
+    /// Creates the buffers, cluster lists are empty. Binning is prepared if its shader stage is given (module != VK_NULL_HANDLE).
+    void prepare(vks::VulkanDevice* dev, VkQueue queue, VkPipelineCache pipelineCache, const VkPipelineShaderStageCreateInfo& binningShaderStage)
+    {
+        this->vulkanDevice = dev;
+        this->device       = dev->logicalDevice;
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->params,
+            sizeof(Params)));
+        VK_CHECK_RESULT(this->params.map());
+        memset(this->params.mapped, 0, sizeof(Params));
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->lights,
+            MAX_LIGHTS * sizeof(Light)));
+        VK_CHECK_RESULT(this->lights.map());
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &this->clusters,
+            CLUSTER_COUNT * (MAX_LIGHTS_PER_CLUSTER + 1) * sizeof(uint32_t)));
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->overflow,
+            sizeof(uint32_t)));
+        VK_CHECK_RESULT(this->overflow.map());
+        memset(this->overflow.mapped, 0, sizeof(uint32_t));
+
+        VkCommandBuffer fillCmd = dev->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vkCmdFillBuffer(fillCmd, this->clusters.buffer, 0, VK_WHOLE_SIZE, 0);
+        dev->flushCommandBuffer(fillCmd, queue, true);
+
+        if (binningShaderStage.module == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0), // Binding 0 : Params
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1), // Binding 1 : Lights
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2), // Binding 2 : Cluster lists
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3), // Binding 3 : Overflow count
+        };
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), setLayoutBindings.size());
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(this->device, &descriptorLayout, nullptr, &this->descriptorSetLayout));
+
+        std::vector<VkDescriptorPoolSize> poolSizes = {
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
+        };
+        VkDescriptorPoolCreateInfo descriptorPoolInfo =
+            vks::initializers::descriptorPoolCreateInfo(poolSizes.size(), poolSizes.data(), 1);
+        VK_CHECK_RESULT(vkCreateDescriptorPool(this->device, &descriptorPoolInfo, nullptr, &this->descriptorPool));
+
+        VkDescriptorSetAllocateInfo descriptorSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(this->descriptorPool, &this->descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(this->device, &descriptorSetAllocInfo, &this->descriptorSet));
+
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &this->params.descriptor),
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &this->lights.descriptor),
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &this->clusters.descriptor),
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &this->overflow.descriptor),
+        };
+        vkUpdateDescriptorSets(this->device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(&this->descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->pipelineLayout));
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo =
+            vks::initializers::computePipelineCreateInfo(this->pipelineLayout, 0);
+        computePipelineCreateInfo.stage = binningShaderStage;
+        VK_CHECK_RESULT(vkCreateComputePipelines(this->device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &this->pipeline));
+
+        this->isBinning = true;
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    /// Lights of the next frame, world space - at most MAX_LIGHTS, the rest are ignored. Reads the overflow count of the previous one.
+    /// The queue must be done with the previous frame (submitFrame() waits for it).
+    void setLights(const Light* sceneLights, uint32_t count)
+    {
+        this->overflowingClusters = this->isBinning ? *static_cast<const uint32_t*>(this->overflow.mapped) : 0;
+        this->lightCount = this->isBinning ? std::min(count, MAX_LIGHTS) : 0;
+        memcpy(this->lights.mapped, sceneLights, this->lightCount * sizeof(Light));
+    }
+
+    /// View of the next frame, its size in pixels. Near and far planes come from the projection
+    /// (perspective, depth zero to one, right handed - as glm::perspective() makes it).
+    void setView(const glm::mat4& view, const glm::mat4& projection, uint32_t width, uint32_t height)
+    {
+        const float nearPlane = projection[3][2] / projection[2][2];
+        const float farPlane  = projection[3][2] / (projection[2][2] + 1.0f);
+
+        Params* p = static_cast<Params*>(this->params.mapped);
+        p->view              = view;
+        p->inverseProjection = glm::inverse(projection);
+        p->camPos            = glm::inverse(view) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        p->screen            = glm::vec4(static_cast<float>(width), static_cast<float>(height), nearPlane, farPlane);
+        p->grid              = glm::uvec4(GRID_X, GRID_Y, GRID_Z, this->lightCount);
+    }
+
+    /// Records binning, outside of render pass, before the draws shading with lights of this frame.
+    void record(VkCommandBuffer cmdBuffer) const
+    {
+        if (!this->isBinning)
+        {
+            return;
+        }
+
+        vkCmdFillBuffer(cmdBuffer, this->overflow.buffer, 0, VK_WHOLE_SIZE, 0);
+
+        // Previous frame's fragment shaders must be done with the lists, the overflow count is zeroed
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipelineLayout, 0, 1, &this->descriptorSet, 0, NULL);
+        vkCmdDispatch(cmdBuffer, CLUSTER_COUNT / WORKGROUP_SIZE, 1, 1);
+
+        // Lists are read by fragment shaders, the overflow count by the CPU
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+    }
+
+// } // RUNTIME
+
+// DESTROY {
+
+    void destroy()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        if (this->isBinning)
+        {
+            vkDestroyPipeline(this->device, this->pipeline, nullptr);
+            vkDestroyPipelineLayout(this->device, this->pipelineLayout, nullptr);
+            vkDestroyDescriptorPool(this->device, this->descriptorPool, nullptr);
+            vkDestroyDescriptorSetLayout(this->device, this->descriptorSetLayout, nullptr);
+        }
+        this->params.destroy();
+        this->lights.destroy();
+        this->clusters.destroy();
+        this->overflow.destroy();
+        this->device = VK_NULL_HANDLE;
+    }
+
+// } // DESTROY
+};
+
+} // namespace vk229
@@ -0,0 +1,496 @@
+#pragma once
+
+#include <assert.h>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+#include "RenderGraph.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Hierarchical depth (Hi-Z) of the frame rendered so far, for two-phase occlusion culling:
+/// * early render pass - objects visible in the previous frame,
+/// * DepthPyramid::record() - depth is reduced into a mip chain, every texel keeps the farthest depth it covers,
+/// * late culling - every object is tested against the pyramid, the ones visible now but not drawn yet are drawn in
+/// * late render pass - it loads what early pass stored.
+/// Level 0 has power of two size, not larger than the depth buffer. Pyramid stays in GENERAL layout,
+/// it is written as storage image and read with texelFetch().
+/// Reduction shader (data/shaders/base/hiz.comp, shared by the examples): binding 0 - sampler2D source level, binding 1 - r32f image destination level,
+/// push constants - source size, destination size.
+struct DepthPyramid
+{
+    vks::VulkanDevice* vulkanDevice = nullptr;
+    VkDevice           device       = VK_NULL_HANDLE;
+
+    VkImage        image     = VK_NULL_HANDLE;
+    VkDeviceMemory memory    = VK_NULL_HANDLE;
+    VkImageView    view      = VK_NULL_HANDLE; // All levels, read by culling.
+    std::vector<VkImageView> levelViews;       // One level, written by reduction and read by the next one.
+    VkSampler      sampler   = VK_NULL_HANDLE;
+    uint32_t       width      = 0;
+    uint32_t       height     = 0;
+    uint32_t       levelCount = 0;
+    VkDescriptorImageInfo descriptor;          // For culling shaders.
+
+    // Depth buffer, source of level 0
+    VkImage     depthImage  = VK_NULL_HANDLE;
+    VkImageView depthView   = VK_NULL_HANDLE;  // Depth aspect only, so it can be sampled.
+    uint32_t    depthWidth  = 0;
+    uint32_t    depthHeight = 0;
+
+    VkDescriptorSetLayout        descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool             descriptorPool      = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> descriptorSets;      // One per level.
+    VkPipelineLayout             pipelineLayout      = VK_NULL_HANDLE;
+    VkPipeline                   pipeline            = VK_NULL_HANDLE;
+
+    struct PushConsts {
+        int32_t srcWidth;
+        int32_t srcHeight;
+        int32_t dstWidth;
+        int32_t dstHeight;
+    };
+
+    static constexpr uint32_t MAX_LEVELS     = 16;
+    static constexpr uint32_t WORKGROUP_SIZE = 8; // Must match local size in hiz.comp.
+
+// PREPARE {
+
+    /// Depth buffer can be a source of the pyramid if its format can be sampled.
+    static bool isDepthFormatSupported(VkPhysicalDevice physicalDevice, VkFormat depthFormat)
+    {
+        VkFormatProperties formatProps;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, depthFormat, &formatProps);
+        return (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+    }
+
+    /// Same depth stencil buffer as VulkanExampleBase::setupDepthStencil() creates, but it can be sampled too.
+    static void createDepthStencil(vks::VulkanDevice* dev, VkFormat depthFormat, uint32_t w, uint32_t h,
+                                   VkImage& outImage, VkDeviceMemory& outMemory, VkImageView& outView)
+    {
+        VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = depthFormat;
+        imageCreateInfo.extent = { w, h, 1 };
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        VK_CHECK_RESULT(vkCreateImage(dev->logicalDevice, &imageCreateInfo, nullptr, &outImage));
+
+        VkMemoryRequirements memReqs;
+        vkGetImageMemoryRequirements(dev->logicalDevice, outImage, &memReqs);
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = memReqs.size;
+        memAlloc.memoryTypeIndex = dev->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkAllocateMemory(dev->logicalDevice, &memAlloc, nullptr, &outMemory));
+        VK_CHECK_RESULT(vkBindImageMemory(dev->logicalDevice, outImage, outMemory, 0));
+
+        VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewCreateInfo.format = depthFormat;
+        viewCreateInfo.subresourceRange = { RenderGraph::getAspect(depthFormat), 0, 1, 0, 1 }; // Depth only formats have no stencil aspect.
+        viewCreateInfo.image = outImage;
+        VK_CHECK_RESULT(vkCreateImageView(dev->logicalDevice, &viewCreateInfo, nullptr, &outView));
+    }
+
+    /// Early and late render passes over the same framebuffers (they are compatible).
+    /// Early one clears and keeps depth readable by compute, late one loads both attachments and presents - or leaves color
+    /// in lateColorLayout, SHADER_READ_ONLY_OPTIMAL for an offscreen frame sampled by fragment shaders next. Then depth is kept
+    /// too, for passes drawing over the frame (motion vectors).
+    static void createRenderPasses(VkDevice dev, VkFormat colorFormat, VkFormat depthFormat, VkRenderPass& outEarly, VkRenderPass& outLate,
+                                   VkImageLayout lateColorLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+    {
+        std::array<VkAttachmentDescription, 2> attachments = {};
+        // Color attachment
+        attachments[0].format = colorFormat;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        // Depth attachment
+        attachments[1].format = depthFormat;
+        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+        VkSubpassDescription subpassDescription = {};
+        subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDescription.colorAttachmentCount = 1;
+        subpassDescription.pColorAttachments = &colorReference;
+        subpassDescription.pDepthStencilAttachment = &depthReference;
+
+        std::array<VkSubpassDependency, 2> dependencies;
+
+        // Early: previous frame's presentation and depth reads by compute
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = 0;
+
+        // Early: depth is reduced by compute, color is continued by the late pass
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+        dependencies[1].dependencyFlags = 0;
+
+        VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpassDescription;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+        VK_CHECK_RESULT(vkCreateRenderPass(dev, &renderPassInfo, nullptr, &outEarly));
+
+        // Late: continues where early pass ended
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachments[0].finalLayout = lateColorLayout;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        // Late: late culling wrote draws, pyramid reads of depth are done before it is written again
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = 0;
+
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+        if (lateColorLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) // Any pixel may be sampled - not by region.
+        {
+            attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+            dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+            dependencies[1].dependencyFlags = 0;
+        }
+
+        VK_CHECK_RESULT(vkCreateRenderPass(dev, &renderPassInfo, nullptr, &outLate));
+    }
+
+    /// Creates everything that doesn't depend on the depth buffer size.
+    void prepare(vks::VulkanDevice* dev, VkPipelineCache pipelineCache, const VkPipelineShaderStageCreateInfo& reduceShaderStage)
+    {
+        this->vulkanDevice = dev;
+        this->device       = dev->logicalDevice;
+
+        // Nearest, no filtering between depths
+        VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
+        samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+        samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+        samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.maxAnisotropy = 1.0f;
+        samplerCreateInfo.minLod = 0.0f;
+        samplerCreateInfo.maxLod = static_cast<float>(MAX_LEVELS);
+        samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        VK_CHECK_RESULT(vkCreateSampler(this->device, &samplerCreateInfo, nullptr, &this->sampler));
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings =
+        {
+            // Binding 0 : Source level
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                0),
+            // Binding 1 : Destination level
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                1),
+        };
+
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(
+                setLayoutBindings.data(),
+                setLayoutBindings.size());
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(this->device, &descriptorLayout, nullptr, &this->descriptorSetLayout));
+
+        std::vector<VkDescriptorPoolSize> poolSizes =
+        {
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_LEVELS),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_LEVELS),
+        };
+        VkDescriptorPoolCreateInfo descriptorPoolInfo =
+            vks::initializers::descriptorPoolCreateInfo(
+                poolSizes.size(),
+                poolSizes.data(),
+                MAX_LEVELS);
+        descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        VK_CHECK_RESULT(vkCreateDescriptorPool(this->device, &descriptorPoolInfo, nullptr, &this->descriptorPool));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(
+                &this->descriptorSetLayout,
+                1);
+        VkPushConstantRange pushConstantRange =
+            vks::initializers::pushConstantRange(
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                sizeof(PushConsts),
+                0);
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->pipelineLayout));
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo =
+            vks::initializers::computePipelineCreateInfo(
+                this->pipelineLayout,
+                0);
+        computePipelineCreateInfo.stage = reduceShaderStage;
+        VK_CHECK_RESULT(vkCreateComputePipelines(this->device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &this->pipeline));
+    }
+
+    /// (Re)creates the pyramid when the depth buffer changed - after window resize - or its power of two size did. A new size
+    /// of the same power of two (dynamic resolution) is only used by the next record().
+    /// Returns true if the pyramid was recreated, so descriptors reading it must be updated.
+    bool update(VkImage srcDepthImage, VkFormat depthFormat, uint32_t srcWidth, uint32_t srcHeight)
+    {
+        if (srcDepthImage == this->depthImage && previousPowerOfTwo(srcWidth) == this->width && previousPowerOfTwo(srcHeight) == this->height)
+        {
+            this->depthWidth  = srcWidth;
+            this->depthHeight = srcHeight;
+            return false;
+        }
+
+        this->destroySizeDependent();
+
+        this->depthImage  = srcDepthImage;
+        this->depthWidth  = srcWidth;
+        this->depthHeight = srcHeight;
+
+        // Largest power of two not larger than the depth buffer - every level is exactly half of the previous one
+        this->width      = previousPowerOfTwo(srcWidth);
+        this->height     = previousPowerOfTwo(srcHeight);
+        this->levelCount = 1;
+        while ((this->levelCount < MAX_LEVELS) && ((this->width >> this->levelCount) > 0 || (this->height >> this->levelCount) > 0))
+        {
+            this->levelCount++;
+        }
+
+        VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewCreateInfo.format = depthFormat;
+        viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        viewCreateInfo.image = this->depthImage;
+        VK_CHECK_RESULT(vkCreateImageView(this->device, &viewCreateInfo, nullptr, &this->depthView));
+
+        VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+        imageCreateInfo.extent = { this->width, this->height, 1 };
+        imageCreateInfo.mipLevels = this->levelCount;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        VK_CHECK_RESULT(vkCreateImage(this->device, &imageCreateInfo, nullptr, &this->image));
+
+        VkMemoryRequirements memReqs;
+        vkGetImageMemoryRequirements(this->device, this->image, &memReqs);
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = memReqs.size;
+        memAlloc.memoryTypeIndex = this->vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkAllocateMemory(this->device, &memAlloc, nullptr, &this->memory));
+        VK_CHECK_RESULT(vkBindImageMemory(this->device, this->image, this->memory, 0));
+
+        viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+        viewCreateInfo.image = this->image;
+        viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, this->levelCount, 0, 1 };
+        VK_CHECK_RESULT(vkCreateImageView(this->device, &viewCreateInfo, nullptr, &this->view));
+
+        this->levelViews.resize(this->levelCount);
+        viewCreateInfo.subresourceRange.levelCount = 1;
+        for (uint32_t level = 0; level < this->levelCount; level++)
+        {
+            viewCreateInfo.subresourceRange.baseMipLevel = level;
+            VK_CHECK_RESULT(vkCreateImageView(this->device, &viewCreateInfo, nullptr, &this->levelViews[level]));
+        }
+
+        this->descriptor.sampler = this->sampler;
+        this->descriptor.imageView = this->view;
+        this->descriptor.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        // Level i is made of level i-1, level 0 of depth buffer
+        std::vector<VkDescriptorSetLayout> setLayouts(this->levelCount, this->descriptorSetLayout);
+        VkDescriptorSetAllocateInfo descriptorSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(this->descriptorPool, setLayouts.data(), this->levelCount);
+        this->descriptorSets.resize(this->levelCount);
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(this->device, &descriptorSetAllocInfo, this->descriptorSets.data()));
+
+        for (uint32_t level = 0; level < this->levelCount; level++)
+        {
+            VkDescriptorImageInfo srcInfo;
+            srcInfo.sampler     = this->sampler;
+            srcInfo.imageView   = level == 0 ? this->depthView : this->levelViews[level - 1];
+            srcInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+            VkDescriptorImageInfo dstInfo;
+            dstInfo.sampler     = VK_NULL_HANDLE;
+            dstInfo.imageView   = this->levelViews[level];
+            dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+                vks::initializers::writeDescriptorSet(this->descriptorSets[level], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &srcInfo), // Binding 0 : Source level
+                vks::initializers::writeDescriptorSet(this->descriptorSets[level], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,          1, &dstInfo), // Binding 1 : Destination level
+            };
+            vkUpdateDescriptorSets(this->device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+        }
+
+        return true;
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    /// Records reduction of the depth buffer, which must be in DEPTH_STENCIL_READ_ONLY_OPTIMAL layout
+    /// with its writes made visible to compute (early render pass does both).
+    /// Pyramid is ready for compute shader reads afterwards.
+    void record(VkCommandBuffer cmdBuffer) const
+    {
+        // Previous contents are not needed, previous frame's culling must be done with them
+        VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+        imageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = this->image;
+        imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, this->levelCount, 0, 1 };
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &imageBarrier);
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipeline);
+
+        // Every level waits for the previous one
+        imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageBarrier.subresourceRange.levelCount = 1;
+
+        PushConsts pushConsts;
+        pushConsts.srcWidth  = this->depthWidth;
+        pushConsts.srcHeight = this->depthHeight;
+        for (uint32_t level = 0; level < this->levelCount; level++)
+        {
+            pushConsts.dstWidth  = std::max(this->width  >> level, 1u);
+            pushConsts.dstHeight = std::max(this->height >> level, 1u);
+
+            vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipelineLayout, 0, 1, &this->descriptorSets[level], 0, NULL);
+            vkCmdPushConstants(cmdBuffer, this->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConsts), &pushConsts);
+            vkCmdDispatch(cmdBuffer, (pushConsts.dstWidth + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, (pushConsts.dstHeight + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+            imageBarrier.subresourceRange.baseMipLevel = level;
+            vkCmdPipelineBarrier(
+                cmdBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &imageBarrier);
+
+            pushConsts.srcWidth  = pushConsts.dstWidth;
+            pushConsts.srcHeight = pushConsts.dstHeight;
+        }
+    }
+
+// } // RUNTIME
+
+// DESTROY {
+
+    void destroy()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        this->destroySizeDependent();
+        vkDestroyPipeline(this->device, this->pipeline, nullptr);
+        vkDestroyPipelineLayout(this->device, this->pipelineLayout, nullptr);
+        vkDestroyDescriptorPool(this->device, this->descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(this->device, this->descriptorSetLayout, nullptr);
+        vkDestroySampler(this->device, this->sampler, nullptr);
+        this->device = VK_NULL_HANDLE;
+    }
+
+// } // DESTROY
+
+private:
+    static uint32_t previousPowerOfTwo(uint32_t value)
+    {
+        uint32_t result = 1;
+        while (result * 2 <= value)
+        {
+            result *= 2;
+        }
+        return result;
+    }
+
+    void destroySizeDependent()
+    {
+        if (!this->descriptorSets.empty())
+        {
+            vkFreeDescriptorSets(this->device, this->descriptorPool, this->descriptorSets.size(), this->descriptorSets.data());
+            this->descriptorSets.clear();
+        }
+        for (VkImageView levelView : this->levelViews)
+        {
+            vkDestroyImageView(this->device, levelView, nullptr);
+        }
+        this->levelViews.clear();
+        vkDestroyImageView(this->device, this->view, nullptr);
+        vkDestroyImageView(this->device, this->depthView, nullptr);
+        vkDestroyImage(this->device, this->image, nullptr);
+        vkFreeMemory(this->device, this->memory, nullptr);
+        this->view      = VK_NULL_HANDLE;
+        this->depthView = VK_NULL_HANDLE;
+        this->image     = VK_NULL_HANDLE;
+        this->memory    = VK_NULL_HANDLE;
+    }
+};
+
+} // namespace vk229
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <VulkanDevice.hpp>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Per-frame instance data, written by CPU every frame.
+/// One buffer split into a ring of slices - one slice per frame in flight, bound by offset in the draw.
+/// Memory is persistently mapped, preferably device local + host visible (ReBAR), so GPU reads it at full speed.
+/// Writes never race with the GPU: every slice has a fence, signaled by the last submission which read it.
+/// Usage:
+/// * ptr = beginWrite(slice) - waits until the GPU is done with the slice,
+/// * write data to ptr (from any number of threads),
+/// * endWrite(slice)         - flushes, if memory is not coherent,
+/// * submit command buffer bound to getSliceOffset(slice) with getFence(slice).
+struct DynamicInstanceBuffer
+{
+    VkDevice       device     = VK_NULL_HANDLE;
+    VkBuffer       buffer     = VK_NULL_HANDLE;
+    VkDeviceMemory memory     = VK_NULL_HANDLE;
+    uint8_t*       mapped     = nullptr;
+    VkDeviceSize   dataSize   = 0;  // Size of data in one slice.
+    VkDeviceSize   sliceSize  = 0;  // Aligned size of one slice.
+    uint32_t       sliceCount = 0;
+    bool           isCoherent = true;
+    bool           isDeviceLocal = false;
+    std::vector<VkFence> fences;
+
+    /// Creates buffer for sliceCount slices of dataSize bytes, all of them filled with initialData (if given).
+    void create(vks::VulkanDevice* vulkanDevice, VkBufferUsageFlags usage, VkDeviceSize size, uint32_t count, const void* initialData = nullptr)
+    {
+        assert(count > 0);
+
+        this->device     = vulkanDevice->logicalDevice;
+        this->dataSize   = size;
+        this->sliceCount = count;
+
+        // Slices can be flushed separately and bound as storage buffers too.
+        const VkPhysicalDeviceLimits& limits = vulkanDevice->properties.limits;
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(std::max(limits.nonCoherentAtomSize, limits.minStorageBufferOffsetAlignment), 1);
+        this->sliceSize = (size + alignment - 1) / alignment * alignment;
+
+        VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usage, this->sliceSize * this->sliceCount);
+        VK_CHECK_RESULT(vkCreateBuffer(this->device, &bufferCreateInfo, nullptr, &this->buffer));
+
+        VkMemoryRequirements memReqs;
+        vkGetBufferMemoryRequirements(this->device, this->buffer, &memReqs);
+
+        // From the best to the worst. Device local + host visible heap is only 256 MB without resizable BAR,
+        // so it is used only when the ring takes at most half of it.
+        const VkMemoryPropertyFlags candidates[] = {
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        };
+
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = memReqs.size;
+        VkBool32 memTypeFound = VK_FALSE;
+        for (VkMemoryPropertyFlags flags : candidates)
+        {
+            uint32_t typeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, flags, &memTypeFound);
+            if (!memTypeFound)
+            {
+                continue;
+            }
+
+            const VkMemoryType& memType = vulkanDevice->memoryProperties.memoryTypes[typeIndex];
+            const VkMemoryHeap& memHeap = vulkanDevice->memoryProperties.memoryHeaps[memType.heapIndex];
+            if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && (memReqs.size * 2 > memHeap.size))
+            {
+                memTypeFound = VK_FALSE;
+                continue;
+            }
+
+            memAlloc.memoryTypeIndex = typeIndex;
+            this->isCoherent    = (memType.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+            this->isDeviceLocal = (memType.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+            break;
+        }
+        if (!memTypeFound)
+        {
+            vks::tools::exitFatal("Could not find host visible memory for dynamic instance buffer!", "Error");
+        }
+
+        VK_CHECK_RESULT(vkAllocateMemory(this->device, &memAlloc, nullptr, &this->memory));
+        VK_CHECK_RESULT(vkBindBufferMemory(this->device, this->buffer, this->memory, 0));
+
+        // Map persistent
+        void* ptr;
+        VK_CHECK_RESULT(vkMapMemory(this->device, this->memory, 0, VK_WHOLE_SIZE, 0, &ptr));
+        this->mapped = static_cast<uint8_t*>(ptr);
+
+        if (initialData)
+        {
+            for (uint32_t slice = 0; slice < this->sliceCount; slice++)
+            {
+                memcpy(this->mapped + this->getSliceOffset(slice), initialData, this->dataSize);
+                this->flush(slice);
+            }
+        }
+
+        // Signaled - no frame has read any slice yet.
+        VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+        this->fences.resize(this->sliceCount);
+        for (VkFence& fence : this->fences)
+        {
+            VK_CHECK_RESULT(vkCreateFence(this->device, &fenceCreateInfo, nullptr, &fence));
+        }
+    }
+
+    VkDeviceSize getSliceOffset(uint32_t slice) const
+    {
+        return slice * this->sliceSize;
+    }
+
+    /// Fence to pass to the submission which reads the slice - it must follow every beginWrite().
+    VkFence getFence(uint32_t slice) const
+    {
+        return this->fences[slice];
+    }
+
+    /// Waits until GPU is done with the slice and returns pointer to its data.
+    void* beginWrite(uint32_t slice)
+    {
+        VK_CHECK_RESULT(vkWaitForFences(this->device, 1, &this->fences[slice], VK_TRUE, UINT64_MAX));
+        VK_CHECK_RESULT(vkResetFences(this->device, 1, &this->fences[slice]));
+        return this->mapped + this->getSliceOffset(slice);
+    }
+
+    void endWrite(uint32_t slice)
+    {
+        this->flush(slice);
+    }
+
+    void flush(uint32_t slice)
+    {
+        if (this->isCoherent)
+        {
+            return;
+        }
+        VkMappedMemoryRange mappedRange = {};
+        mappedRange.sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        mappedRange.memory = this->memory;
+        mappedRange.offset = this->getSliceOffset(slice);
+        mappedRange.size   = this->sliceSize;
+        VK_CHECK_RESULT(vkFlushMappedMemoryRanges(this->device, 1, &mappedRange));
+    }
+
+    void destroy()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        if (!this->fences.empty())
+        {
+            vkWaitForFences(this->device, this->fences.size(), this->fences.data(), VK_TRUE, UINT64_MAX);
+        }
+        for (VkFence fence : this->fences)
+        {
+            vkDestroyFence(this->device, fence, nullptr);
+        }
+        this->fences.clear();
+        if (this->mapped)
+        {
+            vkUnmapMemory(this->device, this->memory);
+            this->mapped = nullptr;
+        }
+        vkDestroyBuffer(this->device, this->buffer, nullptr);
+        vkFreeMemory(this->device, this->memory, nullptr);
+        this->buffer = VK_NULL_HANDLE;
+        this->memory = VK_NULL_HANDLE;
+    }
+};
+
+} // namespace vk229
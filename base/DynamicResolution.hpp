@@ -0,0 +1,470 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Dynamic resolution - the scene is rendered into an offscreen frame, scaled down so that the GPU holds a target frame time,
+/// then upscaled into the swapchain image with sharpening (upscale.frag).
+/// * GPU time of every frame is measured by timestamps at the start and the end of its command buffer (recordBegin(), recordEnd()) -
+///   without timestamps (isSupported()) the scale stays 1, the offscreen frame still serves e.g. temporal upscaling,
+/// * once HISTORY_SIZE frames were measured at the current scale, their median is compared with the target - the new scale assumes
+///   GPU time follows the pixel count, it is raised only with headroom (RAISE_BELOW), so it doesn't oscillate,
+/// * scales are multiples of SCALE_STEP - a change of the render size means command buffers are recorded again (viewport,
+///   render area), which happens a few times per second at most.
+/// The offscreen frame has the window size - the scene is rendered into its top left corner (renderWidth x renderHeight),
+/// with the window's depth buffer, so neither is reallocated when the scale changes - only the depth pyramid of occlusion culling
+/// is, when its power of two size changes (DepthPyramid::update()). It is shared by all command buffers - frames must not overlap
+/// (submitFrame() waits for the queue).
+/// Upscale shader: binding 0 - sampler2D offscreen frame, push constants - PushConsts.
+struct DynamicResolution
+{
+    static constexpr uint32_t HISTORY_SIZE = 16;            // Frames measured before the scale is reconsidered.
+    static constexpr float    SCALE_STEP   = 1.0f / 32.0f;
+    static constexpr float    AIM          = 0.9f;          // Of the target frame time - a new scale is chosen to get there.
+    static constexpr float    RAISE_BELOW  = 0.75f;         // Of the target frame time - scale is raised only below it.
+
+    struct PushConsts
+    {
+        float uvMaxX;     // Rendered part of the offscreen frame, in uv.
+        float uvMaxY;
+        float texelSizeX; // Of the offscreen frame, in uv.
+        float texelSizeY;
+        float outputWidth;
+        float outputHeight;
+        float sharpness;  // 0 .. 1.
+    };
+
+    vks::VulkanDevice* vulkanDevice = nullptr;
+    VkDevice           device       = VK_NULL_HANDLE;
+
+    bool  isEnabled       = false;
+    bool  isMeasured      = false; // GPU time is measured, the scale follows it - set by prepare().
+    float targetFrameTime = 16.6f; // Milliseconds.
+    float minScale        = 0.5f;
+    float sharpness       = 0.5f;
+
+    float    scale        = 1.0f;
+    uint32_t renderWidth  = 0; // Of the scene.
+    uint32_t renderHeight = 0;
+    uint32_t width        = 0; // Of the window - offscreen frame and swapchain images.
+    uint32_t height       = 0;
+
+    // GPU time
+    VkQueryPool                        queryPool       = VK_NULL_HANDLE; // Two timestamps per command buffer.
+    float                              timestampPeriod = 1.0f;           // Nanoseconds per tick.
+    uint64_t                           timestampMask   = ~0ull;          // Valid bits.
+    std::array<float, HISTORY_SIZE>    history;                          // Milliseconds, since the last change of scale.
+    uint32_t                           historyCount    = 0;
+    float                              lastFrameTime   = 0.0f;
+
+    // Offscreen frame
+    VkFormat       colorFormat = VK_FORMAT_UNDEFINED;
+    VkImage        image       = VK_NULL_HANDLE;
+    VkDeviceMemory memory      = VK_NULL_HANDLE;
+    VkImageView    view        = VK_NULL_HANDLE;
+    VkFramebuffer  framebuffer = VK_NULL_HANDLE; // Offscreen frame and the depth buffer - for scene render passes.
+    VkImageView    depthView   = VK_NULL_HANDLE; // Not owned.
+
+    // Upscale
+    VkRenderPass                 renderPass          = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer>   framebuffers;        // Per swapchain image.
+    std::vector<VkImageView>     swapchainViews;      // Not owned.
+    VkSampler                    sampler             = VK_NULL_HANDLE;
+    VkDescriptorSetLayout        descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool             descriptorPool      = VK_NULL_HANDLE;
+    VkDescriptorSet              descriptorSet       = VK_NULL_HANDLE;
+    VkPipelineLayout             pipelineLayout      = VK_NULL_HANDLE;
+    VkPipeline                   pipeline            = VK_NULL_HANDLE;
+
+// PREPARE {
+
+    /// GPU time is measured by timestamps of the graphics queue.
+    static bool isSupported(const vks::VulkanDevice* dev, uint32_t queueFamilyIndex)
+    {
+        return dev->properties.limits.timestampComputeAndGraphics &&
+               dev->queueFamilyProperties[queueFamilyIndex].timestampValidBits > 0;
+    }
+
+    /// Creates everything that doesn't depend on the window size. Stages - fullscreen.vert and upscale.frag.
+    void prepare(vks::VulkanDevice* dev, VkPipelineCache pipelineCache, VkFormat frameFormat, uint32_t commandBufferCount,
+                 const VkPipelineShaderStageCreateInfo& vertexStage, const VkPipelineShaderStageCreateInfo& fragmentStage)
+    {
+        this->vulkanDevice    = dev;
+        this->device          = dev->logicalDevice;
+        this->colorFormat     = frameFormat;
+        this->timestampPeriod = dev->properties.limits.timestampPeriod;
+        const uint32_t validBits = dev->queueFamilyProperties[dev->queueFamilyIndices.graphics].timestampValidBits;
+        this->timestampMask   = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+        this->isMeasured = isSupported(dev, dev->queueFamilyIndices.graphics);
+        if (this->isMeasured)
+        {
+            VkQueryPoolCreateInfo queryPoolInfo = {};
+            queryPoolInfo.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = 2 * commandBufferCount;
+            VK_CHECK_RESULT(vkCreateQueryPool(this->device, &queryPoolInfo, nullptr, &this->queryPool));
+        }
+
+        // Bilinear, the rendered part is clamped to in the shader
+        VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
+        samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.maxAnisotropy = 1.0f;
+        samplerCreateInfo.minLod = 0.0f;
+        samplerCreateInfo.maxLod = 0.0f;
+        samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+        VK_CHECK_RESULT(vkCreateSampler(this->device, &samplerCreateInfo, nullptr, &this->sampler));
+
+        VkDescriptorSetLayoutBinding setLayoutBinding =
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0); // Binding 0 : Offscreen frame
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(&setLayoutBinding, 1);
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(this->device, &descriptorLayout, nullptr, &this->descriptorSetLayout));
+
+        VkDescriptorPoolSize poolSize = vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
+        VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(1, &poolSize, 1);
+        VK_CHECK_RESULT(vkCreateDescriptorPool(this->device, &descriptorPoolInfo, nullptr, &this->descriptorPool));
+
+        VkDescriptorSetAllocateInfo descriptorSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(this->descriptorPool, &this->descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(this->device, &descriptorSetAllocInfo, &this->descriptorSet));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(&this->descriptorSetLayout, 1);
+        VkPushConstantRange pushConstantRange =
+            vks::initializers::pushConstantRange(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(PushConsts), 0);
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->pipelineLayout));
+
+        this->createRenderPass();
+        this->createPipeline(pipelineCache, vertexStage, fragmentStage);
+    }
+
+    /// Offscreen frame and framebuffers follow the window - they are (re)created when its size, depth buffer or swapchain
+    /// images changed. The device must be idle, as on resize. sceneRenderPass - any of the render passes drawing the scene.
+    /// Returns true if they were recreated.
+    bool resize(VkRenderPass sceneRenderPass, VkImageView windowDepthView, const std::vector<VkImageView>& windowSwapchainViews,
+                uint32_t windowWidth, uint32_t windowHeight)
+    {
+        if (windowWidth == this->width && windowHeight == this->height && windowDepthView == this->depthView &&
+            windowSwapchainViews == this->swapchainViews)
+        {
+            return false;
+        }
+
+        this->destroySizeDependent();
+
+        this->width          = windowWidth;
+        this->height         = windowHeight;
+        this->depthView      = windowDepthView;
+        this->swapchainViews = windowSwapchainViews;
+        this->updateRenderSize();
+
+        VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = this->colorFormat;
+        imageCreateInfo.extent = { this->width, this->height, 1 };
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        VK_CHECK_RESULT(vkCreateImage(this->device, &imageCreateInfo, nullptr, &this->image));
+
+        VkMemoryRequirements memReqs;
+        vkGetImageMemoryRequirements(this->device, this->image, &memReqs);
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = memReqs.size;
+        memAlloc.memoryTypeIndex = this->vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkAllocateMemory(this->device, &memAlloc, nullptr, &this->memory));
+        VK_CHECK_RESULT(vkBindImageMemory(this->device, this->image, this->memory, 0));
+
+        VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewCreateInfo.format = this->colorFormat;
+        viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        viewCreateInfo.image = this->image;
+        VK_CHECK_RESULT(vkCreateImageView(this->device, &viewCreateInfo, nullptr, &this->view));
+
+        std::array<VkImageView, 2> attachments = { this->view, this->depthView };
+        VkFramebufferCreateInfo framebufferCreateInfo = vks::initializers::framebufferCreateInfo();
+        framebufferCreateInfo.renderPass = sceneRenderPass;
+        framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        framebufferCreateInfo.pAttachments = attachments.data();
+        framebufferCreateInfo.width = this->width;
+        framebufferCreateInfo.height = this->height;
+        framebufferCreateInfo.layers = 1;
+        VK_CHECK_RESULT(vkCreateFramebuffer(this->device, &framebufferCreateInfo, nullptr, &this->framebuffer));
+
+        framebufferCreateInfo.renderPass = this->renderPass;
+        framebufferCreateInfo.attachmentCount = 1;
+        this->framebuffers.resize(this->swapchainViews.size());
+        for (size_t i = 0; i < this->swapchainViews.size(); i++)
+        {
+            framebufferCreateInfo.pAttachments = &this->swapchainViews[i];
+            VK_CHECK_RESULT(vkCreateFramebuffer(this->device, &framebufferCreateInfo, nullptr, &this->framebuffers[i]));
+        }
+
+        VkDescriptorImageInfo frameDescriptor = vks::initializers::descriptorImageInfo(this->sampler, this->view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        VkWriteDescriptorSet writeDescriptorSet =
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &frameDescriptor); // Binding 0 : Offscreen frame
+        vkUpdateDescriptorSets(this->device, 1, &writeDescriptorSet, 0, NULL);
+
+        return true;
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    /// First command of the command buffer bufferIndex, outside of render pass.
+    void recordBegin(VkCommandBuffer cmdBuffer, uint32_t bufferIndex) const
+    {
+        if (!this->isMeasured)
+        {
+            return;
+        }
+        vkCmdResetQueryPool(cmdBuffer, this->queryPool, 2 * bufferIndex, 2);
+        vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, this->queryPool, 2 * bufferIndex);
+    }
+
+    /// Last command of the command buffer bufferIndex, outside of render pass.
+    void recordEnd(VkCommandBuffer cmdBuffer, uint32_t bufferIndex) const
+    {
+        if (!this->isMeasured)
+        {
+            return;
+        }
+        vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, this->queryPool, 2 * bufferIndex + 1);
+    }
+
+    /// Upscales the offscreen frame, left by the scene's late render pass in SHADER_READ_ONLY_OPTIMAL, into swapchain image
+    /// imageIndex - left in PRESENT_SRC_KHR.
+    void recordUpscale(VkCommandBuffer cmdBuffer, uint32_t imageIndex) const
+    {
+        VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+        renderPassBeginInfo.renderPass = this->renderPass;
+        renderPassBeginInfo.framebuffer = this->framebuffers[imageIndex];
+        renderPassBeginInfo.renderArea.extent.width = this->width;
+        renderPassBeginInfo.renderArea.extent.height = this->height;
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        VkViewport viewport = vks::initializers::viewport((float)this->width, (float)this->height, 0.0f, 1.0f);
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+        VkRect2D scissor = vks::initializers::rect2D(this->width, this->height, 0, 0);
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+        PushConsts pushConsts;
+        pushConsts.uvMaxX       = static_cast<float>(this->renderWidth)  / this->width;
+        pushConsts.uvMaxY       = static_cast<float>(this->renderHeight) / this->height;
+        pushConsts.texelSizeX   = 1.0f / this->width;
+        pushConsts.texelSizeY   = 1.0f / this->height;
+        pushConsts.outputWidth  = static_cast<float>(this->width);
+        pushConsts.outputHeight = static_cast<float>(this->height);
+        pushConsts.sharpness    = this->sharpness;
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &this->descriptorSet, 0, NULL);
+        vkCmdPushConstants(cmdBuffer, this->pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConsts), &pushConsts);
+        vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+
+        vkCmdEndRenderPass(cmdBuffer);
+    }
+
+    /// Reads GPU time of the frame just done by command buffer bufferIndex - the queue must be idle. Once HISTORY_SIZE frames
+    /// were measured at the current scale, adapts it. Returns true if the render size changed - command buffers must be recorded again.
+    bool onFrameDone(uint32_t bufferIndex)
+    {
+        uint64_t timestamps[2];
+        if (!this->isMeasured || vkGetQueryPoolResults(this->device, this->queryPool, 2 * bufferIndex, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+        {
+            return false;
+        }
+        this->lastFrameTime = static_cast<float>(static_cast<double>((timestamps[1] - timestamps[0]) & this->timestampMask) * this->timestampPeriod * 1e-6);
+        this->history[this->historyCount++] = this->lastFrameTime;
+        if (this->historyCount < HISTORY_SIZE)
+        {
+            return false;
+        }
+        this->historyCount = 0;
+
+        // Median - single hitches don't move the scale
+        std::array<float, HISTORY_SIZE> sorted = this->history;
+        std::nth_element(sorted.begin(), sorted.begin() + HISTORY_SIZE / 2, sorted.end());
+        const float frameTime = std::max(sorted[HISTORY_SIZE / 2], 1e-3f);
+        if (frameTime <= this->targetFrameTime && frameTime >= this->targetFrameTime * RAISE_BELOW)
+        {
+            return false;
+        }
+
+        // Pixel count is the square of the scale
+        float newScale = this->scale * std::sqrt(this->targetFrameTime * AIM / frameTime);
+        newScale = std::round(newScale / SCALE_STEP) * SCALE_STEP;
+        newScale = std::min(std::max(newScale, this->minScale), 1.0f);
+        if (newScale == this->scale)
+        {
+            return false;
+        }
+        this->scale = newScale;
+        this->updateRenderSize();
+        return true;
+    }
+
+// } // RUNTIME
+
+// DESTROY {
+
+    void destroy()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        this->destroySizeDependent();
+        vkDestroyPipeline(this->device, this->pipeline, nullptr);
+        vkDestroyPipelineLayout(this->device, this->pipelineLayout, nullptr);
+        vkDestroyRenderPass(this->device, this->renderPass, nullptr);
+        vkDestroyDescriptorPool(this->device, this->descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(this->device, this->descriptorSetLayout, nullptr);
+        vkDestroySampler(this->device, this->sampler, nullptr);
+        if (this->isMeasured)
+        {
+            vkDestroyQueryPool(this->device, this->queryPool, nullptr);
+        }
+        this->device = VK_NULL_HANDLE;
+    }
+
+// } // DESTROY
+
+private:
+    void updateRenderSize()
+    {
+        this->renderWidth  = std::max(1u, static_cast<uint32_t>(std::lround(this->width  * this->scale)));
+        this->renderHeight = std::max(1u, static_cast<uint32_t>(std::lround(this->height * this->scale)));
+    }
+
+    /// Swapchain image is overwritten - whatever was presented in it before doesn't matter.
+    void createRenderPass()
+    {
+        VkAttachmentDescription attachment = {};
+        attachment.format = this->colorFormat;
+        attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+        VkSubpassDescription subpassDescription = {};
+        subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDescription.colorAttachmentCount = 1;
+        subpassDescription.pColorAttachments = &colorReference;
+
+        std::array<VkSubpassDependency, 2> dependencies;
+
+        // Previous presentation of the image
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = 0;
+
+        // Presentation (and text overlay) next
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[1].dependencyFlags = 0;
+
+        VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &attachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpassDescription;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+        VK_CHECK_RESULT(vkCreateRenderPass(this->device, &renderPassInfo, nullptr, &this->renderPass));
+    }
+
+    /// Full-screen triangle, no vertex input, no depth, no blending.
+    void createPipeline(VkPipelineCache pipelineCache, const VkPipelineShaderStageCreateInfo& vertexStage, const VkPipelineShaderStageCreateInfo& fragmentStage)
+    {
+        VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
+            vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+        VkPipelineRasterizationStateCreateInfo rasterizationState =
+            vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE, 0);
+        VkPipelineColorBlendAttachmentState blendAttachmentState =
+            vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+        VkPipelineColorBlendStateCreateInfo colorBlendState =
+            vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
+        VkPipelineDepthStencilStateCreateInfo depthStencilState =
+            vks::initializers::pipelineDepthStencilStateCreateInfo(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+        VkPipelineViewportStateCreateInfo viewportState =
+            vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+        VkPipelineMultisampleStateCreateInfo multisampleState =
+            vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+        std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState =
+            vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables.data(), static_cast<uint32_t>(dynamicStateEnables.size()), 0);
+        VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = { vertexStage, fragmentStage };
+
+        VkGraphicsPipelineCreateInfo pipelineCreateInfo = vks::initializers::pipelineCreateInfo(this->pipelineLayout, this->renderPass, 0);
+        pipelineCreateInfo.pVertexInputState = &vertexInputState;
+        pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+        pipelineCreateInfo.pRasterizationState = &rasterizationState;
+        pipelineCreateInfo.pColorBlendState = &colorBlendState;
+        pipelineCreateInfo.pMultisampleState = &multisampleState;
+        pipelineCreateInfo.pViewportState = &viewportState;
+        pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+        pipelineCreateInfo.pDynamicState = &dynamicState;
+        pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        pipelineCreateInfo.pStages = shaderStages.data();
+        VK_CHECK_RESULT(vkCreateGraphicsPipelines(this->device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &this->pipeline));
+    }
+
+    void destroySizeDependent()
+    {
+        for (VkFramebuffer fb : this->framebuffers)
+        {
+            vkDestroyFramebuffer(this->device, fb, nullptr);
+        }
+        this->framebuffers.clear();
+        if (this->framebuffer != VK_NULL_HANDLE)
+        {
+            vkDestroyFramebuffer(this->device, this->framebuffer, nullptr);
+            vkDestroyImageView(this->device, this->view, nullptr);
+            vkDestroyImage(this->device, this->image, nullptr);
+            vkFreeMemory(this->device, this->memory, nullptr);
+            this->framebuffer = VK_NULL_HANDLE;
+        }
+    }
+};
+
+} // namespace vk229
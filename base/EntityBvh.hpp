@@ -0,0 +1,645 @@
+#pragma once
+
+#include <assert.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ParallelFor.hpp"
+#include "FrustumCulling.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Bounding volume hierarchy over entity boxes (AabbSoA), for frustum culling, box queries (probe assignment)
+/// and ray queries (picking).
+/// * build()      - binned SAH, top of the tree is split serially until there is a subtree for every thread,
+///                  subtrees are then built in parallel and stitched together,
+/// * refit()      - boxes changed, topology kept - bottom-up over all nodes,
+/// * markDirty() + refitDirty() - only ancestors of changed entities are refitted, O(changed * depth).
+/// Parents always have lower indices than their children, so a reverse pass over nodes is bottom-up.
+/// Refitting doesn't improve the tree - rebuild it when entities moved far. Depth is measured by build() (refits keep it),
+/// traversal stacks are sized from it - on the stack up to STACK_SIZE entries, on the heap for degenerate trees.
+struct EntityBvh
+{
+    struct Node
+    {
+        glm::vec3 boxMin;
+        uint32_t  left;   // Inner node - left child, leaf - first entity in entityIndices.
+        glm::vec3 boxMax;
+        uint32_t  right;  // Inner node - right child.
+        uint32_t  count;  // Entities in leaf, 0 for inner node.
+        uint32_t  parent; // INVALID for root.
+
+        bool isLeaf() const
+        {
+            return this->count > 0;
+        }
+    };
+
+    static constexpr uint32_t INVALID       = 0xFFFFFFFFu;
+    static constexpr uint32_t BIN_COUNT     = 16;
+    static constexpr uint32_t MAX_LEAF_SIZE = 8;
+    static constexpr uint32_t PARALLEL_MIN  = 4096; // Smaller ranges are not worth a task.
+
+    std::vector<Node>     nodes;          // nodes[0] is the root.
+    std::vector<uint32_t> entityIndices;  // Entities of leaves, leaf by leaf.
+    std::vector<uint32_t> leafOf;         // Leaf node of every entity.
+    uint32_t              maxDepth = 0;   // Edges from the root to the deepest leaf.
+
+// BUILD {
+
+    void build(const AabbSoA& boxes, vks::ThreadPool* pool = nullptr)
+    {
+        const uint32_t count = boxes.size();
+        this->nodes.clear();
+        this->entityIndices.resize(count);
+        this->leafOf.assign(count, INVALID);
+        this->dirty.clear();
+        this->maxDepth = 0;
+        if (count == 0)
+        {
+            return;
+        }
+
+        this->centroids.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            this->centroids[i] = 0.5f * (boxes.getMin(i) + boxes.getMax(i));
+            this->entityIndices[i] = i;
+        }
+
+        // Top of the tree, until there is enough subtrees for all threads
+        struct Task { uint32_t node, begin, end; };
+        std::vector<Task> tasks;
+        this->nodes.push_back(makeNode(boxes, 0, count, INVALID));
+        tasks.push_back({ 0, 0, count });
+
+        const size_t threadCount = pool ? pool->threads.size() : 1;
+        while (tasks.size() < 2 * threadCount)
+        {
+            auto largest = std::max_element(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) { return (a.end - a.begin) < (b.end - b.begin); });
+            if (largest->end - largest->begin < PARALLEL_MIN)
+            {
+                break;
+            }
+            const Task task = *largest;
+            const uint32_t mid = this->split(boxes, task.begin, task.end);
+            if (mid == task.begin)
+            {
+                break; // Stays a leaf - nothing to parallelize.
+            }
+            const uint32_t left = this->nodes.size();
+            this->nodes.push_back(makeNode(boxes, task.begin, mid, task.node));
+            this->nodes.push_back(makeNode(boxes, mid, task.end, task.node));
+            this->nodes[task.node].left  = left;
+            this->nodes[task.node].right = left + 1;
+            this->nodes[task.node].count = 0;
+
+            *largest = { left, task.begin, mid };
+            tasks.push_back({ left + 1, mid, task.end });
+        }
+
+        // Subtrees, every one into its own array - its root is local node 0
+        std::vector<std::vector<Node>> subtrees(tasks.size());
+        auto buildSubtrees = [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t t = begin; t < end; t++)
+            {
+                subtrees[t].push_back(makeNode(boxes, tasks[t].begin, tasks[t].end, INVALID));
+                this->buildRecursive(boxes, subtrees[t], 0);
+            }
+        };
+        if (pool)
+        {
+            parallelFor(*pool, tasks.size(), buildSubtrees);
+        }
+        else
+        {
+            buildSubtrees(0, tasks.size(), 0);
+        }
+
+        // Stitching - local root replaces task's node, the rest is appended
+        for (size_t t = 0; t < tasks.size(); t++)
+        {
+            const uint32_t offset = this->nodes.size() - 1;
+            auto global = [&](uint32_t local) { return local == 0 ? tasks[t].node : local + offset; };
+            for (uint32_t local = 0; local < subtrees[t].size(); local++)
+            {
+                Node node = subtrees[t][local];
+                if (!node.isLeaf())
+                {
+                    node.left  = global(node.left);
+                    node.right = global(node.right);
+                }
+                if (local == 0)
+                {
+                    node.parent = this->nodes[tasks[t].node].parent;
+                    this->nodes[tasks[t].node] = node;
+                }
+                else
+                {
+                    node.parent = global(node.parent);
+                    this->nodes.push_back(node);
+                }
+            }
+        }
+
+        // Parents come first - their depth is known
+        std::vector<uint32_t> depths(this->nodes.size(), 0);
+        for (uint32_t n = 0; n < this->nodes.size(); n++)
+        {
+            const Node& node = this->nodes[n];
+            if (node.parent != INVALID)
+            {
+                depths[n]      = depths[node.parent] + 1;
+                this->maxDepth = std::max(this->maxDepth, depths[n]);
+            }
+            for (uint32_t i = 0; node.isLeaf() && i < node.count; i++)
+            {
+                this->leafOf[this->entityIndices[node.left + i]] = n;
+            }
+        }
+        this->dirty.assign(this->nodes.size(), false);
+        this->centroids.clear();
+    }
+
+// } // BUILD
+
+// REFIT {
+
+    /// All boxes changed.
+    void refit(const AabbSoA& boxes)
+    {
+        for (size_t n = this->nodes.size(); n-- > 0;)
+        {
+            this->refitNode(boxes, n);
+        }
+        std::fill(this->dirty.begin(), this->dirty.end(), false);
+        this->dirtyNodes.clear();
+    }
+
+    /// Box of entity changed - it and its ancestors are refitted by refitDirty().
+    void markDirty(uint32_t entity)
+    {
+        for (uint32_t n = this->leafOf[entity]; n != INVALID && !this->dirty[n]; n = this->nodes[n].parent)
+        {
+            this->dirty[n] = true;
+            this->dirtyNodes.push_back(n);
+        }
+    }
+
+    void refitDirty(const AabbSoA& boxes)
+    {
+        // Children before parents
+        std::sort(this->dirtyNodes.begin(), this->dirtyNodes.end(), std::greater<uint32_t>());
+        for (uint32_t n : this->dirtyNodes)
+        {
+            this->refitNode(boxes, n);
+            this->dirty[n] = false;
+        }
+        this->dirtyNodes.clear();
+    }
+
+// } // REFIT
+
+// QUERIES {
+
+    /// Calls visit(entity) for every entity whose box is not fully outside of the frustum.
+    /// Entities of nodes fully inside are visited without tests.
+    template <typename Visit>
+    void queryFrustum(const Frustum& frustum, const AabbSoA& boxes, Visit visit) const
+    {
+        if (this->nodes.empty())
+        {
+            return;
+        }
+
+        struct Entry { uint32_t node; uint32_t planeMask; }; // Planes which still can cut the node.
+        TraversalStack<Entry> stack(this->getStackCapacity());
+        stack.push({ 0, 0x3F });
+        while (!stack.isEmpty())
+        {
+            const Entry entry = stack.pop();
+            const Node& node  = this->nodes[entry.node];
+
+            uint32_t planeMask = entry.planeMask;
+            if (!testPlanes(frustum, node.boxMin, node.boxMax, planeMask))
+            {
+                continue;
+            }
+
+            if (!node.isLeaf())
+            {
+                stack.push({ node.right, planeMask });
+                stack.push({ node.left,  planeMask });
+                continue;
+            }
+
+            for (uint32_t i = 0; i < node.count; i++)
+            {
+                const uint32_t entity = this->entityIndices[node.left + i];
+                uint32_t entityMask = planeMask;
+                if (entityMask == 0 || testPlanes(frustum, boxes.getMin(entity), boxes.getMax(entity), entityMask))
+                {
+                    visit(entity);
+                }
+            }
+        }
+    }
+
+    /// Same output as Frustum::writeVisibility(), but only visible entities are tested and written
+    /// after everything is cleared.
+    uint32_t writeVisibility(const Frustum& frustum, const AabbSoA& boxes, void* dst, size_t stride) const
+    {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        const uint32_t zero = 0;
+        const uint32_t one  = 1;
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            memcpy(out + i * stride, &zero, sizeof(uint32_t));
+        }
+
+        uint32_t visible = 0;
+        this->queryFrustum(frustum, boxes, [&](uint32_t entity)
+        {
+            memcpy(out + entity * stride, &one, sizeof(uint32_t));
+            visible++;
+        });
+        return visible;
+    }
+
+    /// Calls visit(entity) for every entity whose box overlaps given box - e.g. entities affected by a probe.
+    template <typename Visit>
+    void queryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const AabbSoA& boxes, Visit visit) const
+    {
+        if (this->nodes.empty())
+        {
+            return;
+        }
+
+        TraversalStack<uint32_t> stack(this->getStackCapacity());
+        stack.push(0);
+        while (!stack.isEmpty())
+        {
+            const Node& node = this->nodes[stack.pop()];
+            if (!overlaps(node.boxMin, node.boxMax, boxMin, boxMax))
+            {
+                continue;
+            }
+            if (!node.isLeaf())
+            {
+                stack.push(node.right);
+                stack.push(node.left);
+                continue;
+            }
+            for (uint32_t i = 0; i < node.count; i++)
+            {
+                const uint32_t entity = this->entityIndices[node.left + i];
+                if (overlaps(boxes.getMin(entity), boxes.getMax(entity), boxMin, boxMax))
+                {
+                    visit(entity);
+                }
+            }
+        }
+    }
+
+    /// Nearest entity box hit by the ray, closer than tMax (picking). Returns INVALID when nothing is hit,
+    /// otherwise entity index, and distance along dir in outT.
+    uint32_t raycast(const glm::vec3& origin, const glm::vec3& dir, const AabbSoA& boxes, float tMax, float& outT) const
+    {
+        uint32_t hit = INVALID;
+        outT = tMax;
+        if (this->nodes.empty())
+        {
+            return hit;
+        }
+
+        const glm::vec3 invDir = 1.0f / dir;
+
+        TraversalStack<uint32_t> stack(this->getStackCapacity());
+        stack.push(0);
+        while (!stack.isEmpty())
+        {
+            const Node& node = this->nodes[stack.pop()];
+            float tNode;
+            if (!intersectRay(origin, invDir, node.boxMin, node.boxMax, outT, tNode))
+            {
+                continue;
+            }
+            if (node.isLeaf())
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                {
+                    const uint32_t entity = this->entityIndices[node.left + i];
+                    float tEntity;
+                    if (intersectRay(origin, invDir, boxes.getMin(entity), boxes.getMax(entity), outT, tEntity))
+                    {
+                        outT = tEntity;
+                        hit  = entity;
+                    }
+                }
+                continue;
+            }
+
+            // Nearer child is popped first
+            float tLeft, tRight;
+            const Node& left    = this->nodes[node.left];
+            const Node& right   = this->nodes[node.right];
+            const bool  isLeft  = intersectRay(origin, invDir, left.boxMin,  left.boxMax,  outT, tLeft);
+            const bool  isRight = intersectRay(origin, invDir, right.boxMin, right.boxMax, outT, tRight);
+            if (isLeft && isRight)
+            {
+                stack.push(tLeft < tRight ? node.right : node.left);
+                stack.push(tLeft < tRight ? node.left  : node.right);
+            }
+            else if (isLeft)
+            {
+                stack.push(node.left);
+            }
+            else if (isRight)
+            {
+                stack.push(node.right);
+            }
+        }
+        return hit;
+    }
+
+// } // QUERIES
+
+private:
+    static constexpr uint32_t STACK_SIZE = 64; // Entries on the stack - SAH trees are far shallower.
+
+    /// Depth first traversal pops a node and pushes its two children - what stays on the stack is at most one sibling
+    /// per level above, and the two children.
+    uint32_t getStackCapacity() const
+    {
+        return this->maxDepth + 2;
+    }
+
+    /// Stack of traversals - on the stack for trees of usual depth, on the heap beyond STACK_SIZE.
+    template <typename T>
+    struct TraversalStack
+    {
+        T              local[STACK_SIZE];
+        std::vector<T> heap;
+        T*             items    = local;
+        uint32_t       size     = 0;
+        uint32_t       capacity = STACK_SIZE;
+
+        explicit TraversalStack(uint32_t requiredCapacity)
+        {
+            if (requiredCapacity > STACK_SIZE)
+            {
+                this->heap.resize(requiredCapacity);
+                this->items    = this->heap.data();
+                this->capacity = requiredCapacity;
+            }
+        }
+
+        void push(const T& item)
+        {
+            assert(this->size < this->capacity);
+            this->items[this->size++] = item;
+        }
+
+        T pop()
+        {
+            return this->items[--this->size];
+        }
+
+        bool isEmpty() const
+        {
+            return this->size == 0;
+        }
+    };
+
+    std::vector<glm::vec3> centroids; // Only during build.
+    std::vector<bool>      dirty;
+    std::vector<uint32_t>  dirtyNodes;
+
+    struct Bin
+    {
+        glm::vec3 boxMin = glm::vec3( std::numeric_limits<float>::max());
+        glm::vec3 boxMax = glm::vec3(-std::numeric_limits<float>::max());
+        uint32_t  count  = 0;
+    };
+
+    static float area(const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        const glm::vec3 d = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static bool overlaps(const glm::vec3& aMin, const glm::vec3& aMax, const glm::vec3& bMin, const glm::vec3& bMax)
+    {
+        return aMin.x <= bMax.x && aMax.x >= bMin.x &&
+               aMin.y <= bMax.y && aMax.y >= bMin.y &&
+               aMin.z <= bMax.z && aMax.z >= bMin.z;
+    }
+
+    /// Slab test, outT - entry distance (0 when origin is inside).
+    static bool intersectRay(const glm::vec3& origin, const glm::vec3& invDir, const glm::vec3& boxMin, const glm::vec3& boxMax, float tMax, float& outT)
+    {
+        const glm::vec3 t0    = (boxMin - origin) * invDir;
+        const glm::vec3 t1    = (boxMax - origin) * invDir;
+        const glm::vec3 tNear = glm::min(t0, t1);
+        const glm::vec3 tFar  = glm::max(t0, t1);
+        const float     enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        const float     exit  = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+        outT = enter;
+        return enter <= exit;
+    }
+
+    /// Tests box against planes in planeMask, planes the box is fully inside of are removed from the mask.
+    static bool testPlanes(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t& planeMask)
+    {
+        for (uint32_t p = 0; p < 6; p++)
+        {
+            if (!(planeMask & (1u << p)))
+            {
+                continue;
+            }
+            const glm::vec4& plane = frustum.planes[p];
+            const glm::vec3  pos(plane.x > 0.0f ? boxMax.x : boxMin.x, plane.y > 0.0f ? boxMax.y : boxMin.y, plane.z > 0.0f ? boxMax.z : boxMin.z);
+            const glm::vec3  neg(plane.x > 0.0f ? boxMin.x : boxMax.x, plane.y > 0.0f ? boxMin.y : boxMax.y, plane.z > 0.0f ? boxMin.z : boxMax.z);
+            if (((plane.x * pos.x + plane.y * pos.y) + plane.z * pos.z) + plane.w < 0.0f)
+            {
+                return false;
+            }
+            if (((plane.x * neg.x + plane.y * neg.y) + plane.z * neg.z) + plane.w >= 0.0f)
+            {
+                planeMask &= ~(1u << p);
+            }
+        }
+        return true;
+    }
+
+    Node makeNode(const AabbSoA& boxes, uint32_t begin, uint32_t end, uint32_t parent) const
+    {
+        Node node;
+        node.boxMin = glm::vec3( std::numeric_limits<float>::max());
+        node.boxMax = glm::vec3(-std::numeric_limits<float>::max());
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const uint32_t entity = this->entityIndices[i];
+            node.boxMin = glm::min(node.boxMin, boxes.getMin(entity));
+            node.boxMax = glm::max(node.boxMax, boxes.getMax(entity));
+        }
+        node.left   = begin;
+        node.right  = INVALID;
+        node.count  = end - begin;
+        node.parent = parent;
+        return node;
+    }
+
+    void refitNode(const AabbSoA& boxes, size_t n)
+    {
+        Node& node = this->nodes[n];
+        if (node.isLeaf())
+        {
+            const Node fresh = this->makeNode(boxes, node.left, node.left + node.count, node.parent);
+            node.boxMin = fresh.boxMin;
+            node.boxMax = fresh.boxMax;
+            return;
+        }
+        node.boxMin = glm::min(this->nodes[node.left].boxMin, this->nodes[node.right].boxMin);
+        node.boxMax = glm::max(this->nodes[node.left].boxMax, this->nodes[node.right].boxMax);
+    }
+
+    /// Best binned SAH split of entities [begin, end) - partitions them and returns the first one of the right part,
+    /// or begin if they should stay a leaf.
+    uint32_t split(const AabbSoA& boxes, uint32_t begin, uint32_t end)
+    {
+        const uint32_t count = end - begin;
+        if (count <= 2)
+        {
+            return begin;
+        }
+
+        glm::vec3 centroidMin( std::numeric_limits<float>::max());
+        glm::vec3 centroidMax(-std::numeric_limits<float>::max());
+        glm::vec3 boxMin( std::numeric_limits<float>::max());
+        glm::vec3 boxMax(-std::numeric_limits<float>::max());
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const uint32_t entity = this->entityIndices[i];
+            centroidMin = glm::min(centroidMin, this->centroids[entity]);
+            centroidMax = glm::max(centroidMax, this->centroids[entity]);
+            boxMin      = glm::min(boxMin, boxes.getMin(entity));
+            boxMax      = glm::max(boxMax, boxes.getMax(entity));
+        }
+
+        float    bestCost = static_cast<float>(count); // Leaf, intersection cost 1 per entity.
+        int      bestAxis = -1;
+        uint32_t bestBin  = 0;
+        const float invArea = 1.0f / std::max(area(boxMin, boxMax), std::numeric_limits<float>::min());
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float extent = centroidMax[axis] - centroidMin[axis];
+            if (!(extent > 0.0f))
+            {
+                continue;
+            }
+
+            Bin bins[BIN_COUNT];
+            const float scale = BIN_COUNT / extent;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const uint32_t entity = this->entityIndices[i];
+                const uint32_t b = std::min(static_cast<uint32_t>((this->centroids[entity][axis] - centroidMin[axis]) * scale), BIN_COUNT - 1);
+                bins[b].boxMin = glm::min(bins[b].boxMin, boxes.getMin(entity));
+                bins[b].boxMax = glm::max(bins[b].boxMax, boxes.getMax(entity));
+                bins[b].count++;
+            }
+
+            // Right sweep, then left sweep evaluating split after every bin
+            float    rightArea[BIN_COUNT];
+            uint32_t rightCount[BIN_COUNT];
+            Bin right;
+            for (uint32_t b = BIN_COUNT - 1; b > 0; b--)
+            {
+                right.boxMin = glm::min(right.boxMin, bins[b].boxMin);
+                right.boxMax = glm::max(right.boxMax, bins[b].boxMax);
+                right.count += bins[b].count;
+                rightArea[b]  = area(right.boxMin, right.boxMax);
+                rightCount[b] = right.count;
+            }
+            Bin left;
+            for (uint32_t b = 0; b < BIN_COUNT - 1; b++)
+            {
+                left.boxMin = glm::min(left.boxMin, bins[b].boxMin);
+                left.boxMax = glm::max(left.boxMax, bins[b].boxMax);
+                left.count += bins[b].count;
+                if (left.count == 0 || rightCount[b + 1] == 0)
+                {
+                    continue;
+                }
+                const float cost = 1.0f + (area(left.boxMin, left.boxMax) * left.count + rightArea[b + 1] * rightCount[b + 1]) * invArea;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin  = b;
+                }
+            }
+        }
+
+        if (bestAxis < 0)
+        {
+            if (count <= MAX_LEAF_SIZE)
+            {
+                return begin;
+            }
+            // Too many to be a leaf, nothing better - median along the largest axis
+            const glm::vec3 extent = centroidMax - centroidMin;
+            const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            const uint32_t mid = begin + count / 2;
+            std::nth_element(this->entityIndices.begin() + begin, this->entityIndices.begin() + mid, this->entityIndices.begin() + end,
+                             [&](uint32_t a, uint32_t b) { return this->centroids[a][axis] < this->centroids[b][axis]; });
+            return mid;
+        }
+
+        const float scale = BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        auto isLeft = [&](uint32_t entity)
+        {
+            return std::min(static_cast<uint32_t>((this->centroids[entity][bestAxis] - centroidMin[bestAxis]) * scale), BIN_COUNT - 1) <= bestBin;
+        };
+        return std::partition(this->entityIndices.begin() + begin, this->entityIndices.begin() + end, isLeft) - this->entityIndices.begin();
+    }
+
+    /// Splits local node n of a subtree until leaves - explicit stack, so deep trees are fine.
+    void buildRecursive(const AabbSoA& boxes, std::vector<Node>& local, uint32_t root)
+    {
+        std::vector<uint32_t> stack = { root };
+        while (!stack.empty())
+        {
+            const uint32_t n = stack.back();
+            stack.pop_back();
+
+            const uint32_t begin = local[n].left;
+            const uint32_t end   = begin + local[n].count;
+            const uint32_t mid   = this->split(boxes, begin, end);
+            if (mid == begin)
+            {
+                continue;
+            }
+
+            const uint32_t left = local.size();
+            local.push_back(makeNode(boxes, begin, mid, n));
+            local.push_back(makeNode(boxes, mid, end, n));
+            local[n].left  = left;
+            local[n].right = left + 1;
+            local[n].count = 0;
+            stack.push_back(left + 1);
+            stack.push_back(left);
+        }
+    }
+};
+
+} // namespace vk229
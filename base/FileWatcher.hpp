@@ -0,0 +1,117 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Watches files for changes with inotify, polled once per frame - never blocks.
+/// Directories of the files are watched rather than files themselves, because editors and exporters
+/// usually save by writing a new file and renaming it over the old one, which ends watches of files.
+/// A file is reported when it is closed after writing or renamed in - never on creation, when it may still be empty.
+/// Elsewhere than on Linux nothing is ever reported.
+struct FileWatcher
+{
+    FileWatcher()
+    {
+#if defined(__linux__)
+        this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    ~FileWatcher()
+    {
+#if defined(__linux__)
+        if (this->fd >= 0)
+        {
+            close(this->fd);
+        }
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    bool isAvailable() const
+    {
+        return this->fd >= 0;
+    }
+
+    void addFile(const std::string& path)
+    {
+        const size_t slash = path.find_last_of('/');
+        const std::string dir  = slash == std::string::npos ? "." : path.substr(0, slash);
+        const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+#if defined(__linux__)
+        if (this->fd < 0)
+        {
+            return;
+        }
+        auto it = this->dirByPath.find(dir);
+        if (it == this->dirByPath.end())
+        {
+            const int wd = inotify_add_watch(this->fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0)
+            {
+                return;
+            }
+            it = this->dirByPath.emplace(dir, wd).first;
+            this->dirs[wd].path = dir;
+        }
+        this->dirs[it->second].names.insert(name);
+#endif
+    }
+
+    /// Paths (as added) of watched files changed since the last poll, each reported once.
+    std::vector<std::string> poll()
+    {
+        std::set<std::string> changed;
+#if defined(__linux__)
+        alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+        for (;;)
+        {
+            const ssize_t size = this->fd >= 0 ? read(this->fd, buffer, sizeof(buffer)) : -1;
+            if (size <= 0)
+            {
+                break; // EAGAIN - nothing more.
+            }
+            for (ssize_t offset = 0; offset < size;)
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+
+                auto dir = this->dirs.find(event->wd);
+                if (dir == this->dirs.end() || event->len == 0 || dir->second.names.count(event->name) == 0)
+                {
+                    continue;
+                }
+                changed.insert(dir->second.path + "/" + event->name);
+            }
+        }
+#endif
+        return std::vector<std::string>(changed.begin(), changed.end());
+    }
+
+private:
+    struct WatchedDir
+    {
+        std::string           path;
+        std::set<std::string> names;
+    };
+
+    int                        fd = -1;
+    std::map<int, WatchedDir>  dirs;      // By watch descriptor.
+    std::map<std::string, int> dirByPath;
+};
+
+} // namespace vk229
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Axis aligned boxes kept as flat arrays, one per coordinate - the layout the SIMD test loads from.
+struct AabbSoA
+{
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    size_t size() const
+    {
+        return this->minX.size();
+    }
+
+    void clear()
+    {
+        this->minX.clear(); this->minY.clear(); this->minZ.clear();
+        this->maxX.clear(); this->maxY.clear(); this->maxZ.clear();
+    }
+
+    void push(const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        this->minX.push_back(boxMin.x); this->minY.push_back(boxMin.y); this->minZ.push_back(boxMin.z);
+        this->maxX.push_back(boxMax.x); this->maxY.push_back(boxMax.y); this->maxZ.push_back(boxMax.z);
+    }
+
+    void set(size_t i, const glm::vec3& boxMin, const glm::vec3& boxMax)
+    {
+        this->minX[i] = boxMin.x; this->minY[i] = boxMin.y; this->minZ[i] = boxMin.z;
+        this->maxX[i] = boxMax.x; this->maxY[i] = boxMax.y; this->maxZ[i] = boxMax.z;
+    }
+
+    glm::vec3 getMin(size_t i) const
+    {
+        return glm::vec3(this->minX[i], this->minY[i], this->minZ[i]);
+    }
+
+    glm::vec3 getMax(size_t i) const
+    {
+        return glm::vec3(this->maxX[i], this->maxY[i], this->maxZ[i]);
+    }
+
+    /// Box of a box transformed by an affine matrix (Arvo) - no corners needed.
+    static void transform(const glm::mat4& m, const glm::vec3& boxMin, const glm::vec3& boxMax, glm::vec3& outMin, glm::vec3& outMax)
+    {
+        outMin = glm::vec3(m[3]);
+        outMax = glm::vec3(m[3]);
+        for (int col = 0; col < 3; col++)
+        {
+            for (int row = 0; row < 3; row++)
+            {
+                const float a = m[col][row] * boxMin[col];
+                const float b = m[col][row] * boxMax[col];
+                outMin[row] += std::min(a, b);
+                outMax[row] += std::max(a, b);
+            }
+        }
+    }
+};
+
+//////////////////////////////////////
+/// View frustum as six planes (xyz - inward normal, w - distance), taken from view-projection matrix
+/// with [0, 1] depth range (GLM_FORCE_DEPTH_ZERO_TO_ONE).
+/// Box test checks the corner furthest along each plane's normal - a box is culled when it is fully outside
+/// of any plane. Boxes crossing two planes near a frustum corner can pass, that only costs a draw.
+/// Normal signs are the same for all boxes, so per plane the corner is chosen once, and 8 boxes (AVX)
+/// or 4 boxes (NEON) are tested at a time with no blends.
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    void update(const glm::mat4& viewProj)
+    {
+        const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+        const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+        const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+        const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+        this->planes[0] = row3 + row0; // Left
+        this->planes[1] = row3 - row0; // Right
+        this->planes[2] = row3 + row1; // Bottom (top, if projection flips y)
+        this->planes[3] = row3 - row1;
+        this->planes[4] = row2;        // Near
+        this->planes[5] = row3 - row2; // Far
+    }
+
+    bool isBoxVisible(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        for (const glm::vec4& plane : this->planes)
+        {
+            const float x = plane.x > 0.0f ? boxMax.x : boxMin.x;
+            const float y = plane.y > 0.0f ? boxMax.y : boxMin.y;
+            const float z = plane.z > 0.0f ? boxMax.z : boxMin.z;
+            if (((plane.x * x + plane.y * y) + plane.z * z) + plane.w < 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Writes visibility of boxes [0, count) as uint32_t 0 or 1 into interleaved data - e.g. instance counts of
+    /// indirect draw commands. dst points to the value of first element, stride is size of the whole element.
+    /// Returns number of visible boxes.
+    uint32_t writeVisibility(const AabbSoA& boxes, void* dst, size_t stride) const
+    {
+        uint8_t*     out     = static_cast<uint8_t*>(dst);
+        const size_t count   = boxes.size();
+        uint32_t     visible = 0;
+        size_t       i       = 0;
+
+        // Corner furthest along the normal, per plane
+        const float* cornerX[6];
+        const float* cornerY[6];
+        const float* cornerZ[6];
+        for (int p = 0; p < 6; p++)
+        {
+            cornerX[p] = this->planes[p].x > 0.0f ? boxes.maxX.data() : boxes.minX.data();
+            cornerY[p] = this->planes[p].y > 0.0f ? boxes.maxY.data() : boxes.minY.data();
+            cornerZ[p] = this->planes[p].z > 0.0f ? boxes.maxZ.data() : boxes.minZ.data();
+        }
+
+#if defined(__AVX2__)
+        uint32_t flags[8];
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++)
+            {
+                const __m256 dist = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(this->planes[p].x), _mm256_loadu_ps(cornerX[p] + i)),
+                                                _mm256_mul_ps(_mm256_set1_ps(this->planes[p].y), _mm256_loadu_ps(cornerY[p] + i))),
+                                  _mm256_mul_ps(_mm256_set1_ps(this->planes[p].z), _mm256_loadu_ps(cornerZ[p] + i))),
+                    _mm256_set1_ps(this->planes[p].w));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            const int outsideMask = _mm256_movemask_ps(outside);
+            for (size_t k = 0; k < 8; k++)
+            {
+                flags[k] = (outsideMask >> k) & 1 ? 0u : 1u;
+                memcpy(out + (i + k) * stride, &flags[k], sizeof(uint32_t));
+                visible += flags[k];
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint32_t flags[4];
+        for (; i + 4 <= count; i += 4)
+        {
+            uint32x4_t outside = vdupq_n_u32(0);
+            for (int p = 0; p < 6; p++)
+            {
+                const float32x4_t dist = vaddq_f32(
+                    vaddq_f32(vaddq_f32(vmulq_f32(vdupq_n_f32(this->planes[p].x), vld1q_f32(cornerX[p] + i)),
+                                        vmulq_f32(vdupq_n_f32(this->planes[p].y), vld1q_f32(cornerY[p] + i))),
+                              vmulq_f32(vdupq_n_f32(this->planes[p].z), vld1q_f32(cornerZ[p] + i))),
+                    vdupq_n_f32(this->planes[p].w));
+                outside = vorrq_u32(outside, vcltq_f32(dist, vdupq_n_f32(0.0f)));
+            }
+            vst1q_u32(flags, vshrq_n_u32(outside, 31));
+            for (size_t k = 0; k < 4; k++)
+            {
+                flags[k] ^= 1u; // Outside -> 0.
+                memcpy(out + (i + k) * stride, &flags[k], sizeof(uint32_t));
+                visible += flags[k];
+            }
+        }
+#endif
+
+        // Remainder, or everything without SIMD.
+        for (; i < count; i++)
+        {
+            const uint32_t flag = this->isBoxVisible(boxes.getMin(i), boxes.getMax(i)) ? 1u : 0u;
+            memcpy(out + i * stride, &flag, sizeof(uint32_t));
+            visible += flag;
+        }
+
+        return visible;
+    }
+};
+
+} // namespace vk229
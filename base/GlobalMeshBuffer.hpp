@@ -0,0 +1,176 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <VulkanBuffer.hpp>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+
+#include "MeshCooker.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Many meshes in one device local buffer, for vertex pulling - there is no vertex input, vertex shaders read vertices
+/// as a storage buffer. The buffer holds four sections:
+/// * vertices  - floats of all meshes, each mesh with its own components,
+/// * positions - the same vertices, position only (tightly packed xyz) - for depth only passes, which read 12 bytes per vertex,
+/// * indices   - bound once as index buffer, a mesh is drawn with its firstIndex; indices are local to the mesh,
+///               so gl_VertexIndex is the vertex of the mesh - the vertex cache still works,
+/// * formats   - MeshFormat per mesh, where its vertices are and which components they have,
+/// * sequential indices (optional) - 0..N-1 for the N indices; drawn with them, gl_VertexIndex is the position in the index
+///               section, which the shader reads as a storage buffer - so it knows the triangle (visibility buffer).
+///               Vertices are not reused then, every index is a vertex shader invocation.
+/// So one pipeline draws any mesh, and nothing is bound between draws.
+struct GlobalMeshBuffer
+{
+    static constexpr uint32_t MAX_COMPONENTS = 6;
+    static constexpr uint32_t ABSENT         = 0xFFFFFFFFu; // Component the mesh doesn't store.
+
+    /// std430, as declared by vertex shaders: vertex v of the mesh starts at float vertexBase + v * stride,
+    /// component at layout location l at float offsets[l] of the vertex. Its position alone is at float positionBase + v * 3.
+    struct MeshFormat
+    {
+        uint32_t vertexBase;
+        uint32_t positionBase;
+        uint32_t stride;
+        uint32_t offsets[MAX_COMPONENTS];
+    };
+
+    struct MeshRange
+    {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    std::vector<MeshFormat> formats; // Per mesh, in order of add().
+    std::vector<MeshRange>  ranges;
+
+    vks::Buffer            buffer;
+    VkDeviceSize           indicesOffset    = 0;
+    VkDeviceSize           sequentialOffset = 0; // Of sequential indices, 0 when there are none.
+    VkDescriptorBufferInfo verticesDescriptor  = {};
+    VkDescriptorBufferInfo positionsDescriptor = {};
+    VkDescriptorBufferInfo indicesDescriptor   = {};
+    VkDescriptorBufferInfo formatsDescriptor   = {};
+
+    /// Appends a mesh. Locations of its components are their indices in layoutComponents (the scene vertex layout).
+    /// Returns index of the mesh - of its format and range.
+    uint32_t add(const CookedMesh& mesh, const std::vector<vks::Component>& layoutComponents)
+    {
+        assert(layoutComponents.size() <= MAX_COMPONENTS);
+
+        MeshFormat format;
+        format.vertexBase   = static_cast<uint32_t>(this->vertices.size());
+        format.positionBase = static_cast<uint32_t>(this->positions.size());
+        format.stride       = mesh.stride;
+        std::fill(std::begin(format.offsets), std::end(format.offsets), ABSENT);
+
+        uint32_t offset = 0;
+        for (vks::Component component : mesh.components)
+        {
+            auto location = std::find(layoutComponents.begin(), layoutComponents.end(), component);
+            assert(location != layoutComponents.end());
+            format.offsets[location - layoutComponents.begin()] = offset;
+            offset += MeshCooker::getComponentSize(component) / sizeof(float);
+        }
+
+        this->formats.push_back(format);
+        this->ranges.push_back({ static_cast<uint32_t>(this->indices.size()), static_cast<uint32_t>(mesh.indices.size()) });
+        this->vertices.insert(this->vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        this->positions.insert(this->positions.end(), mesh.positions.begin(), mesh.positions.end());
+        this->indices.insert(this->indices.end(), mesh.indices.begin(), mesh.indices.end());
+        return static_cast<uint32_t>(this->formats.size() - 1);
+    }
+
+    /// Creates the buffer from added meshes, through a staging buffer. Host copies of vertices, positions and indices are freed.
+    /// withSequentialIndices - the buffer also holds sequential indices (see bindSequentialIndexBuffer()).
+    void upload(vks::VulkanDevice* dev, VkQueue queue, bool withSequentialIndices = false)
+    {
+        assert(!this->formats.empty() && this->buffer.buffer == VK_NULL_HANDLE);
+
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(dev->properties.limits.minStorageBufferOffsetAlignment, sizeof(uint32_t));
+        auto align = [&](VkDeviceSize size) { return (size + alignment - 1) / alignment * alignment; };
+
+        const VkDeviceSize verticesSize  = this->vertices.size() * sizeof(float);
+        const VkDeviceSize positionsSize = this->positions.size() * sizeof(float);
+        const VkDeviceSize indicesSize   = this->indices.size() * sizeof(uint32_t);
+        const VkDeviceSize formatsSize   = this->formats.size() * sizeof(MeshFormat);
+        const VkDeviceSize positionsOffset = align(verticesSize);
+        this->indicesOffset = align(positionsOffset + positionsSize);
+        const VkDeviceSize formatsOffset = align(this->indicesOffset + indicesSize);
+        this->sequentialOffset = withSequentialIndices ? align(formatsOffset + formatsSize) : 0;
+        const VkDeviceSize size = withSequentialIndices ? this->sequentialOffset + indicesSize : formatsOffset + formatsSize;
+
+        vks::Buffer staging;
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &staging,
+            size));
+        VK_CHECK_RESULT(staging.map());
+        uint8_t* mapped = static_cast<uint8_t*>(staging.mapped);
+        memcpy(mapped,                       this->vertices.data(),  verticesSize);
+        memcpy(mapped + positionsOffset,     this->positions.data(), positionsSize);
+        memcpy(mapped + this->indicesOffset, this->indices.data(),   indicesSize);
+        memcpy(mapped + formatsOffset,       this->formats.data(),   formatsSize);
+        if (withSequentialIndices)
+        {
+            uint32_t* sequential = reinterpret_cast<uint32_t*>(mapped + this->sequentialOffset);
+            for (uint32_t i = 0; i < this->indices.size(); i++)
+            {
+                sequential[i] = i;
+            }
+        }
+        staging.unmap();
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &this->buffer,
+            size));
+        dev->copyBuffer(&staging, &this->buffer, queue);
+        staging.destroy();
+
+        this->verticesDescriptor  = { this->buffer.buffer, 0, verticesSize };
+        this->positionsDescriptor = { this->buffer.buffer, positionsOffset, positionsSize };
+        this->indicesDescriptor   = { this->buffer.buffer, this->indicesOffset, indicesSize };
+        this->formatsDescriptor   = { this->buffer.buffer, formatsOffset, formatsSize };
+
+        this->vertices  = std::vector<float>();
+        this->positions = std::vector<float>();
+        this->indices   = std::vector<uint32_t>();
+    }
+
+    /// Binds the index section - once for all meshes.
+    void bindIndexBuffer(VkCommandBuffer cmdBuffer) const
+    {
+        vkCmdBindIndexBuffer(cmdBuffer, this->buffer.buffer, this->indicesOffset, VK_INDEX_TYPE_UINT32);
+    }
+
+    /// Binds sequential indices instead - meshes are drawn with the same firstIndex and indexCount, gl_VertexIndex is then
+    /// firstIndex + i, the position of the index in the index section (indicesDescriptor).
+    void bindSequentialIndexBuffer(VkCommandBuffer cmdBuffer) const
+    {
+        assert(this->sequentialOffset != 0);
+        vkCmdBindIndexBuffer(cmdBuffer, this->buffer.buffer, this->sequentialOffset, VK_INDEX_TYPE_UINT32);
+    }
+
+    void destroy()
+    {
+        this->buffer.destroy();
+        *this = GlobalMeshBuffer();
+    }
+
+private:
+    std::vector<float>    vertices; // Until upload().
+    std::vector<float>    positions;
+    std::vector<uint32_t> indices;
+};
+
+} // namespace vk229
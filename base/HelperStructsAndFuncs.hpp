@@ -1,11 +1,31 @@
 #pragma once
 
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <set>
 #include <vulkan/vulkan.h>
 #include <iostream>
 #include <map>
 #include <VulkanTexture.hpp>
 #include <VulkanModel.hpp>
+#include "DepthPyramid.hpp"
+#include "DynamicInstanceBuffer.hpp"
+#include "FrustumCulling.hpp"
+#include "EntityBvh.hpp"
+#include "TransformHierarchy.hpp"
+#include "SceneFile.hpp"
+#include "FileWatcher.hpp"
+#include "ShaderModuleCache.hpp"
+#include "MaterialVariant.hpp"
+#include "SpirvReflection.hpp"
+#include "PipelineCompiler.hpp"
+#include "MeshCooker.hpp"
+#include "GlobalMeshBuffer.hpp"
+#include "OverdrawMeter.hpp"
+#include "RenderGraph.hpp"
+#include "ClusteredLights.hpp"
 
 namespace vk229
 {
@@ -70,23 +90,43 @@ using shaders_set_name_t  = std::string;
 
 using entity_name_t   = std::string;
 
+/// Pass a scene pipeline draws in - it defines depth and color state of the pipeline (see SceneData::prepareSinglePipeline()).
+enum class PipelinePass
+{
+    SHADING,               // Depth test LESS_OR_EQUAL, depth writes.
+    SHADING_AFTER_PREPASS, // Depth test EQUAL against depth laid by the pre-pass, no depth writes.
+    DEPTH_PREPASS,         // Depth only, no color writes.
+    OVERDRAW,              // Like SHADING, fragments are counted by additive blending (OverdrawMeter).
+    OVERDRAW_HEATMAP,      // Like OVERDRAW, in the main pass - every fragment adds the blend constants to the frame.
+    SURFACE_ID,            // Surfaces pass of OverdrawMeter - depth test EQUAL, no depth writes, no blending.
+    VISIBILITY_IDS,        // Ids into the visibility buffer - like SHADING, no blending.
+    VISIBILITY_CLASSIFY,   // Full-screen triangle writing batch depths of the visibility buffer - depth test ALWAYS, no color writes, no culling.
+    VISIBILITY_SHADING,    // Full-screen triangle shading a batch of the visibility buffer - depth test EQUAL against batch depths, no depth writes, no culling.
+    MOTION_VECTORS         // Motion vectors of temporal upscaling - like SURFACE_ID.
+};
 
-VkPipelineShaderStageCreateInfo loadShader(VkDevice& dev, std::string fileName, VkShaderStageFlagBits stage, std::vector<VkShaderModule>& shaderModules)
+/// Entities with equal keys share a pipeline.
+struct PipelineKey
 {
-        VkPipelineShaderStageCreateInfo shaderStage = {};
-        shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        shaderStage.stage = stage;
-#if defined(__ANDROID__)
-        shaderStage.module = vks::tools::loadShader(androidApp->activity->assetManager, fileName.c_str(), device);
-#else
-        shaderStage.module = vks::tools::loadShader(fileName.c_str(), dev);
-#endif
-        shaderStage.pName = "main"; // todo : make param
-        assert(shaderStage.module != VK_NULL_HANDLE);
-        shaderModules.push_back(shaderStage.module);
-
-        return shaderStage;
-}
+    std::vector<shader_name_t>  shadersNames;
+    MaterialVariant             variant;
+    std::vector<vks::Component> vertexComponents; // Stored by entity's mesh - they define pipeline's vertex input.
+    PipelinePass                pass = PipelinePass::SHADING;
+
+    bool operator<(const PipelineKey& other) const
+    {
+        return std::tie(this->shadersNames, this->variant, this->vertexComponents, this->pass) < std::tie(other.shadersNames, other.variant, other.vertexComponents, other.pass);
+    }
+
+    bool operator==(const PipelineKey& other) const
+    {
+        return this->shadersNames == other.shadersNames && this->variant == other.variant && this->vertexComponents == other.vertexComponents &&
+               this->pass == other.pass;
+    }
+};
+
+using pipeline_key_t  = PipelineKey;
+
 
 struct UniformBufferVS {
     glm::mat4 view;
@@ -95,7 +135,9 @@ struct UniformBufferVS {
 };
 
 struct DeviceSideBuffers {
-    vks::Buffer scene; // Scene buffer - device's side mapped memory.
+    vks::Buffer scene;      // Scene buffer - device's side mapped memory.
+    vks::Buffer transforms; // World matrix per entity, in entities3dInfoMap order - mapped, written by TransformHierarchy.
+    vks::Buffer zeroVertex; // One vertex of zeros, read with stride 0 by vertex inputs which the mesh doesn't store.
 };
 
 //////////////////////////////////////
@@ -165,10 +207,12 @@ struct MatrixInfo
 /// Properties:
 /// * shaders_set_name
 /// * shaders_names_vector
+/// * material variant - specialization constants of the shaders
 struct ShaderSetInfo
 {
     shaders_set_name_t         shadersSetName;
     std::vector<shader_name_t> shadersNames;
+    MaterialVariant            variant;
 };
 
 //////////////////////////////////////
@@ -178,8 +222,8 @@ struct ShaderSetInfo
 /// * mesh_name
 /// * textures_set_name
 /// * shaders_set_name
-/// * model_matrix_name
-/// * parent_model_name - TODO
+/// * model_matrix_name  - relative to the parent
+/// * parent_entity_name - empty for entities placed directly in the world
 struct Entity3dInfo
 {
     entity_name_t       entityName;
@@ -187,14 +231,14 @@ struct Entity3dInfo
     matrix_name_t       matrixName;
     textures_set_name_t texturesSetName;
     shaders_set_name_t  shadersSetName;
-    // TODO: transform matrix - part of one big dynamic UBO (or not).
-    // TODO: parent/child ptr - to apply parent's transforms to a child.
+    entity_name_t       parentName;
 };
 
 // Used for init.
 struct SceneInfo
 {
-    // Vertex layout for the models.
+    // Vertex layout of the scene - location i of vertex shader inputs is component i.
+    // Meshes store only components which vertex shaders of their entities read, see updateMeshComponents().
     vks::VertexLayout vertexLayout;
 
     std::map<mesh_name_t,       MeshInfo>       meshesInfoMap;
@@ -207,6 +251,8 @@ struct SceneInfo
 
     std::map<entity_name_t, Entity3dInfo>   entities3dInfoMap;
 
+    SceneFile::Settings settings; // Rendering settings of the scene, e.g. depth pre-pass.
+
 
     SceneInfo() :
         vertexLayout({
@@ -283,6 +329,55 @@ struct SceneInfo
         }
     }
 
+    /// Everything from a loaded scene file (see SceneFile).
+    void fillFromSceneFile(const SceneFile& sceneFile)
+    {
+        auto str = [&](const SceneFile::StringRef& ref) { return std::string(sceneFile.getString(ref)); };
+
+        for (const SceneFile::MeshRecord& mesh : sceneFile.getMeshes())
+        {
+            this->meshesInfoMap[str(mesh.name)] = { str(mesh.name), str(mesh.filename) };
+        }
+        for (const SceneFile::ShaderRecord& shader : sceneFile.getShaders())
+        {
+            this->shadersInfoMap[str(shader.name)] = { str(shader.name), static_cast<shader_stage_t>(shader.stage), str(shader.filename) };
+        }
+        for (const SceneFile::TextureRecord& texture : sceneFile.getTextures())
+        {
+            this->texturesInfoMap[str(texture.name)] = { str(texture.name), static_cast<texture_form_t>(texture.format), static_cast<texture_type_t>(texture.type), str(texture.filename) };
+        }
+        for (const SceneFile::MatrixRecord& matrix : sceneFile.getMatrices())
+        {
+            MatrixInfo& matrixInfo = this->matriciesInfoMap[str(matrix.name)];
+            matrixInfo.matrixName = str(matrix.name);
+            memcpy(&matrixInfo.matrix, matrix.matrix, sizeof(matrix.matrix));
+        }
+        for (const SceneFile::SetRecord& set : sceneFile.getTextureSets())
+        {
+            TextureSetInfo& setInfo = this->texturesSetInfoMap[str(set.name)];
+            setInfo.texturesSetName = str(set.name);
+            for (const SceneFile::StringRef& member : sceneFile.getSetMembers(set))
+            {
+                setInfo.texturesNames.push_back(str(member));
+            }
+        }
+        for (const SceneFile::ShaderSetRecord& set : sceneFile.getShaderSets())
+        {
+            ShaderSetInfo& setInfo = this->shadersSetInfoMap[str(set.name)];
+            setInfo.shadersSetName = str(set.name);
+            setInfo.variant        = set.variant;
+            for (const SceneFile::StringRef& member : sceneFile.getSetMembers(set))
+            {
+                setInfo.shadersNames.push_back(str(member));
+            }
+        }
+        for (const SceneFile::EntityRecord& entity : sceneFile.getEntities())
+        {
+            this->entities3dInfoMap[str(entity.name)] = { str(entity.name), str(entity.mesh), str(entity.matrix), str(entity.texturesSet), str(entity.shadersSet), str(entity.parent) };
+        }
+        this->settings = sceneFile.getSettings();
+    }
+
     uint32_t getTextureSetSize() const
     {
         return this->texturesSetInfoMap.begin()->second.texturesNames.size();
@@ -294,6 +389,209 @@ struct SceneInfo
     }
 };
 
+// Entities are drawn in two phases, when occlusion culling is enabled (see DepthPyramid).
+enum class DrawPhase
+{
+    EARLY,
+    LATE
+};
+
+// GPU occlusion culling of entities (cull.comp) - one indirect draw per entity and phase,
+// with instance count 0 or 1. Entities are indexed in entities3dInfoMap order.
+struct SceneCulling
+{
+    bool isEnabled = false;
+
+    DepthPyramid depthPyramid;
+
+    vks::Buffer bounds;     // Bounding sphere per entity, world space.
+    vks::Buffer visibility; // Per entity, was it visible in the last frame.
+    vks::Buffer commands;   // VkDrawIndexedIndirectCommand per entity, early ones followed by late ones.
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorSet       descriptorSet;
+    VkPipelineLayout      pipelineLayout;
+    VkPipeline            earlyPipeline;
+    VkPipeline            latePipeline;
+};
+
+// CPU frustum culling of entities - used when GPU culling is not available.
+// Every frame the SIMD box test writes instance counts of indirect draws (one per entity) straight
+// into the slice of a persistently mapped buffer, read by that frame's command buffer.
+// Large scenes are traversed through the entity BVH instead, skipping whole groups outside of the frustum.
+struct SceneFrustumCulling
+{
+    static constexpr uint32_t BVH_MIN_ENTITIES = 1024; // Below that, testing all boxes is faster.
+
+    bool isEnabled = false;
+
+    Frustum               frustum;
+    DynamicInstanceBuffer commands;         // VkDrawIndexedIndirectCommand per entity, one slice per draw command buffer.
+    uint32_t              visibleCount = 0; // In the last frame.
+};
+
+// Hot reload of the scene file and assets it uses (see SceneData::reloadChangedFiles()).
+// Replaced GPU resources are retired - destroyed once no frame in flight can use them.
+struct SceneHotReload
+{
+    bool isEnabled = false;
+
+    FileWatcher watcher;
+    std::string assetsPath;
+    std::string scenePath;
+
+    uint64_t frameIndex = 0;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired; // Frame of retirement, destruction.
+};
+
+// Pipelines created on pipeline compiler threads (see SceneData::preparePipelines() and updatePipelines()).
+// Until its pipeline is ready, an entity is drawn with a fallback pipeline of its vertex shader and fallback.frag, or not drawn.
+struct SceneAsyncPipelines
+{
+    bool isEnabled   = false;
+    bool useFallback = true;
+
+    struct Job
+    {
+        pipeline_key_t              key;
+        PipelineFuture              future;
+        std::vector<VkShaderModule> modules; // Retained in the shader cache until the pipeline is created.
+        bool                        isStale; // Its shaders were reloaded - the pipeline is destroyed when ready.
+        bool                        isFallback; // Goes to fallbackPipelinesMap when ready.
+    };
+
+    PipelineCompiler                     compiler;
+    std::vector<Job>                     pending;
+    std::map<pipeline_key_t, VkPipeline> fallbackPipelinesMap;
+};
+
+// Vertex pulling (see SceneData::enableVertexPulling()) - meshes live in one global buffer and vertex shaders read their vertices
+// by gl_VertexIndex - every vertex shader has a pulling permutation (<name>.pulling.vert.spv), which pipelines are created with.
+// Pipelines have no vertex input, so entities of meshes with different components share them.
+// Meshes stay in host memory, the global buffer is built again when some of them are reloaded.
+struct SceneVertexPulling
+{
+    bool isEnabled = false;
+
+    std::map<mesh_name_t, CookedMesh> cookedMeshes;
+    std::map<mesh_name_t, uint32_t>   meshIndices; // Into formats and ranges of the global buffer.
+    GlobalMeshBuffer                  meshes;
+};
+
+// Depth pre-pass (see SceneData::updateDepthPrepass()) - entities are drawn depth only first, from position streams of their meshes
+// (depth permutations of vertex shaders, <name>.depth.vert.spv), then shaded with depth test EQUAL and no depth writes - every pixel
+// is shaded once. It costs another geometry pass, so the scene file turns it on, off, or auto - on when overdraw measured at startup
+// (shaded fragments per covered pixel) reaches its threshold.
+struct SceneDepthPrepass
+{
+    bool  isActive         = false; // Entity pipelines are created for the main pass after pre-pass.
+    float measuredOverdraw = 0.0f;  // Without pre-pass, 0 until measured.
+
+    OverdrawMeter                        meter;
+    std::map<shader_name_t, VkPipeline>  pipelinesMap;         // Depth only, per vertex shader.
+    std::map<shader_name_t, VkPipeline>  overdrawPipelinesMap; // Drawing into the meter, per vertex shader.
+    std::map<mesh_name_t,   vks::Buffer> positionBuffers;      // Position streams of meshes - in the global buffer with vertex pulling.
+};
+
+// Overdraw diagnostics (see SceneData::measureOverdrawDiagnostics()) - the frame can be drawn as a heatmap of shaded fragments
+// per pixel (black, red, yellow, white), and overdraw is measured per entity: for pixels where the entity is finally seen,
+// how many fragments were shaded there, with histograms. Uses depth permutations of vertex shaders, as the pre-pass does.
+struct SceneOverdrawDiagnostics
+{
+    // Per fragment added to the frame - red saturates at 4 fragments, green at 16, blue at 64.
+    static constexpr float HEATMAP_BLEND_CONSTANTS[4] = { 0.25f, 0.0625f, 0.015625f, 0.0f };
+
+    bool isEnabled      = false;
+    bool isHeatmapShown = false; // Entities are drawn by heatmapPipelinesMap, without pre-pass.
+
+    std::map<shader_name_t, VkPipeline> heatmapPipelinesMap; // Per vertex shader.
+    std::map<shader_name_t, VkPipeline> surfacePipelinesMap; // Drawing entity ids into the meter, per vertex shader.
+    OverdrawMeter::Result               result;              // Of the last measurement, surfaces by entity index.
+};
+
+// Visibility buffer (see SceneData::prepareVisibilityBuffer()) - frames can be drawn by a RenderGraph of two passes: entities
+// write their index and triangle into the ids image (visibility permutations of vertex shaders - position only, drawn with
+// sequential indices), then a full-screen triangle classifies pixels - writes the depth of their material batch, entities
+// of one shader set and texture set (visibility_classify.frag) - and every batch shades the pixels it owns with a full-screen
+// triangle at its depth, tested for EQUAL (visibility permutations of fragment shaders) - pixels of other batches are rejected
+// by the early depth test. Geometry is rasterized once and every pixel is shaded once, whatever the overdraw. Needs vertex pulling.
+struct SceneVisibilityBuffer
+{
+    static constexpr VkFormat IDS_FORMAT   = VK_FORMAT_R32G32_UINT; // Entity index + 1 (0 is background), triangle.
+    static constexpr VkFormat BATCH_FORMAT = VK_FORMAT_D16_UNORM;   // First entity of the batch + 1 (0 is background) / 65535.
+
+    /// Per entity, as visibility permutations of fragment shaders read it.
+    struct EntityVisibility
+    {
+        uint32_t meshIndex; // Into mesh formats of the global buffer.
+        uint32_t batch;     // Index of the first entity of its batch.
+    };
+
+    bool isEnabled = false;
+    bool isActive  = false; // Frames are drawn through the visibility buffer.
+
+    RenderGraph                graph;
+    RenderGraph::resource_id_t idsImage;
+    RenderGraph::resource_id_t depthImage;
+    RenderGraph::resource_id_t batchImage;   // Depth of the shading pass - batch of every pixel.
+    RenderGraph::resource_id_t frameImage;   // Imported - swapchain image of the recorded frame.
+    RenderGraph::pass_id_t     geometryPass;
+    RenderGraph::pass_id_t     shadingPass;
+    VkSampler                  idsSampler    = VK_NULL_HANDLE;
+    VkDescriptorImageInfo      idsDescriptor = {};
+
+    vks::Buffer           entities;        // EntityVisibility per entity, mapped.
+    std::vector<uint32_t> batches;         // First entity of every batch.
+    uint32_t              bufferIndex = 0; // Of the command buffer being recorded - its frustum culling slice.
+
+    std::map<shader_name_t,      VkPipeline> geometryPipelinesMap; // Per vertex shader.
+    std::map<shaders_set_name_t, VkPipeline> shadingPipelinesMap;  // Per shader set.
+    VkPipeline                               classifyPipeline = VK_NULL_HANDLE;
+};
+
+// Dynamic lights (see SceneData::addLight()) - point and spot lights, binned into clusters of the view every frame (ClusteredLights),
+// so a pixel shades only the lights near it. A light can be attached to an entity, it moves with it - e.g. a lamp prop.
+// Material shaders always read the cluster lists - without binning (see SceneData::enableClusteredLights()) they are empty.
+struct SceneLights
+{
+    bool isEnabled = false; // Lights are binned - needs compute in the graphics queue.
+
+    std::vector<ClusteredLights::Light> locals;   // In space of their entity, or world.
+    std::vector<uint32_t>               entities; // Entity a light is attached to, TransformHierarchy::ROOT for none.
+    std::vector<ClusteredLights::Light> worlds;   // Of the next frame, see SceneData::updateLights().
+    ClusteredLights                     clusters;
+};
+
+// Motion vectors of temporal upscaling (TemporalUpscaler) - drawn over the scene's depth by motion permutations of vertex shaders,
+// which project every vertex with the world matrix and view of the previous frame too. Previous world matrices are written
+// only for entities which moved in the last two frames (see SceneData::updateTransforms()) - a still scene costs nothing.
+struct SceneMotionVectors
+{
+    /// As motion permutations read it (binding 18), both without jitter.
+    struct Params
+    {
+        glm::mat4 viewProjection;
+        glm::mat4 previousViewProjection;
+    };
+
+    bool isEnabled = false; // Needs vertex pulling.
+
+    vks::Buffer            previousTransforms; // World matrix per entity, of the previous frame, mapped.
+    vks::Buffer            params;             // Params, mapped.
+    std::vector<glm::mat4> worlds;             // Of the current frame - previous ones of the next.
+    std::vector<uint32_t>  moved;              // Entities moved by the last updateTransforms().
+
+    VkRenderPass                        renderPass = VK_NULL_HANDLE; // Of TemporalUpscaler, not owned.
+    std::map<shader_name_t, VkPipeline> pipelinesMap;                // Per vertex shader.
+};
+
+// Push constants of an entity's draw, as declared by vertex shaders - only the part within the reflected range is pushed.
+struct EntityPushConstants
+{
+    uint32_t entityIndex; // Into world matrices.
+    uint32_t meshIndex;   // Into mesh formats of the global buffer, with vertex pulling.
+};
+
 // Used to store assets data.
 struct SceneData
 {
@@ -301,19 +599,49 @@ struct SceneData
     VkDescriptorSetLayout descriptorSetLayout;
     SceneInfo sceneInfo;
 
+    // Reflected from shaders of the scene - see setupDescriptorSetLayout() and setupPipelineLayout().
+    std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings;
+    VkPushConstantRange                       pushConstantRange = {};
+
     UniformBufferVS uboVS;
 
     DeviceSideBuffers uniformBuffers;
 
     std::map<mesh_name_t,    mesh_objtype_t>                    meshesMap;
-    std::map<shader_name_t,  VkPipelineShaderStageCreateInfo>   shadersMap;
+    std::map<mesh_name_t,    std::vector<vks::Component>>       meshComponentsMap; // Vertex components stored by the mesh.
+    std::map<shader_name_t,  VkPipelineShaderStageCreateInfo>   shadersMap; // Only while pipelines are created - modules are released after.
     std::map<texture_name_t, texture_objtype_t>                 texturesMap;
 //    std::map<matrix_name_t,  matrix_content_t>                  matriciesMap;
-    std::map<entity_name_t,  VkPipeline>                        pipelinesMap;
+    std::map<entity_name_t,  VkPipeline>                        pipelinesMap;        // Shared, owned by uniquePipelinesMap.
+    std::map<pipeline_key_t, VkPipeline>                        uniquePipelinesMap;
     std::map<entity_name_t,  VkDescriptorSet>                   descriptorSetsMap;
 
+    TransformHierarchy transformHierarchy; // Entities' model matrices - world ones go to uniformBuffers.transforms.
+
+    AabbSoA   meshBounds;   // Model space box of entity's mesh, in entities3dInfoMap order.
+    AabbSoA   entityBounds; // World space box per entity, in entities3dInfoMap order.
+    EntityBvh entityBvh;    // Over entityBounds - frustum, box (probe) and ray (picking) queries.
+
+    SceneCulling        culling;
+    SceneFrustumCulling frustumCulling;
+    SceneHotReload      hotReload;
+    SceneAsyncPipelines asyncPipelines;
+    SceneVertexPulling  vertexPulling;
+    SceneDepthPrepass   depthPrepass;
+    SceneOverdrawDiagnostics overdraw;
+    SceneVisibilityBuffer    visibilityBuffer;
+    SceneLights              lights;
+    SceneMotionVectors       motionVectors;
+
+    ShaderModuleCache shaderCache;
+
+    vks::ThreadPool threadPool;
+
+    bool isDrawRecordingLogged = true; // Every entity recorded by recordEntityDraws() - off for frequent rebuilds (dynamic resolution).
+
     SceneData()
     {
+        this->threadPool.setThreadCount(std::max(1u, std::thread::hardware_concurrency()));
     }
 
     ~SceneData()
@@ -342,6 +670,126 @@ struct SceneData
         return this->pipelinesMap.find(_ent) != this->pipelinesMap.end();
     }
 
+    pipeline_key_t getPipelineKey(const Entity3dInfo& entity3dInfo) const
+    {
+        const ShaderSetInfo& shadSetInfo = this->sceneInfo.shadersSetInfoMap.at(entity3dInfo.shadersSetName);
+        const PipelinePass   pass = this->depthPrepass.isActive ? PipelinePass::SHADING_AFTER_PREPASS : PipelinePass::SHADING;
+        if (this->vertexPulling.isEnabled) // No vertex input - any mesh.
+        {
+            return { shadSetInfo.shadersNames, shadSetInfo.variant, {}, pass };
+        }
+        return { shadSetInfo.shadersNames, shadSetInfo.variant, this->meshComponentsMap.at(entity3dInfo.meshName), pass };
+    }
+
+    /// Vertex shader of the entity's shader set.
+    shader_name_t getVertexShaderName(const Entity3dInfo& entity3dInfo) const
+    {
+        for (const shader_name_t& shadName : this->sceneInfo.shadersSetInfoMap.at(entity3dInfo.shadersSetName).shadersNames)
+        {
+            if (this->sceneInfo.shadersInfoMap.at(shadName).shaderStage == VK_SHADER_STAGE_VERTEX_BIT)
+            {
+                return shadName;
+            }
+        }
+        assert(false && "Shader set without vertex shader.");
+        return shader_name_t();
+    }
+
+    /// Name under which a permutation of a shader is loaded - default_transforms + pulling -> default_transforms.pulling.
+    static shader_name_t getPermutationShaderName(const shader_name_t& shadName, const std::string& variant)
+    {
+        return shadName + "." + variant;
+    }
+
+    /// Permutation of vertex shaders which depth pre-pass and overdraw pipelines are created with.
+    std::string getDepthVariant() const
+    {
+        return this->vertexPulling.isEnabled ? "depth_pulling" : "depth";
+    }
+
+    /// Depth permutations of vertex shaders are loaded - for the pre-pass or overdraw diagnostics.
+    bool isDepthPermutationNeeded(const SceneFile::Settings& settings) const
+    {
+        return settings.depthPrepass != SceneFile::DEPTH_PREPASS_OFF || this->overdraw.isEnabled;
+    }
+
+    /// Permutations loaded besides the shader itself - of vertex shaders, with vertex pulling, depth pre-pass or overdraw diagnostics,
+    /// and of vertex and fragment shaders with the visibility buffer.
+    std::vector<std::string> getShaderVariants(const ShaderInfo& shadInfo, const SceneFile::Settings& settings) const
+    {
+        std::vector<std::string> variants;
+        if (shadInfo.shaderStage == VK_SHADER_STAGE_FRAGMENT_BIT && this->visibilityBuffer.isEnabled)
+        {
+            variants.push_back("visibility");
+        }
+        if (shadInfo.shaderStage != VK_SHADER_STAGE_VERTEX_BIT)
+        {
+            return variants;
+        }
+        if (this->vertexPulling.isEnabled)
+        {
+            variants.push_back("pulling");
+        }
+        if (this->isDepthPermutationNeeded(settings))
+        {
+            variants.push_back(this->getDepthVariant());
+        }
+        if (this->visibilityBuffer.isEnabled)
+        {
+            variants.push_back("visibility");
+        }
+        if (this->motionVectors.isEnabled)
+        {
+            variants.push_back("motion");
+        }
+        return variants;
+    }
+
+    /// File of a shader permutation, named as CMake compiles them: default_transforms.vert.spv + pulling -> default_transforms.pulling.vert.spv.
+    static shader_filename_t getPermutationFilename(const shader_filename_t& filename, const std::string& variant)
+    {
+        const size_t dot = filename.find('.', filename.find_last_of('/') + 1);
+        assert(dot != shader_filename_t::npos);
+        return filename.substr(0, dot) + "." + variant + filename.substr(dot);
+    }
+
+    /// SPIR-V files of a shader - the shader itself, then its permutations (see getShaderVariants()).
+    std::vector<shader_filename_t> getShaderFilenames(const ShaderInfo& shadInfo, const SceneFile::Settings& settings) const
+    {
+        std::vector<shader_filename_t> filenames = { shadInfo.shaderFilename };
+        for (const std::string& variant : this->getShaderVariants(shadInfo, settings))
+        {
+            filenames.push_back(getPermutationFilename(shadInfo.shaderFilename, variant));
+        }
+        return filenames;
+    }
+
+    std::vector<shader_filename_t> getShaderFilenames(const ShaderInfo& shadInfo) const
+    {
+        return this->getShaderFilenames(shadInfo, this->sceneInfo.settings);
+    }
+
+    /// Reflection of the shader of given stage in the set - its module must be loaded.
+    const SpirvReflection* findShaderReflection(const std::vector<shader_name_t>& shadNames, VkShaderStageFlagBits stage) const
+    {
+        for (const shader_name_t& shadName : shadNames)
+        {
+            auto shader = this->shadersMap.find(shadName);
+            if (shader != this->shadersMap.end() && shader->second.stage == stage)
+            {
+                return &this->shaderCache.getReflection(shader->second.module);
+            }
+        }
+        return nullptr;
+    }
+
+    const VkDescriptorSetLayoutBinding* findSetLayoutBinding(uint32_t binding) const
+    {
+        auto layoutBinding = std::find_if(this->setLayoutBindings.begin(), this->setLayoutBindings.end(),
+                                          [&](const VkDescriptorSetLayoutBinding& b) { return b.binding == binding; });
+        return layoutBinding == this->setLayoutBindings.end() ? nullptr : &*layoutBinding;
+    }
+
     bool isDescriptorSetAlreadyCreated(entity_name_t _ds) const
     {
         return this->descriptorSetsMap.find(_ds) != this->descriptorSetsMap.end();
@@ -389,8 +837,13 @@ struct SceneData
 
     /// Loading meshes from file.
     /// It requires model filename, vertex layout, model scale, vks::VulkanDevice and queue.
+    /// Every mesh stores only vertex components read by its shaders - they must be loaded before, by loadShaders().
+    /// With vertex pulling meshes are cooked in host memory and put together into the global buffer - models keep only counts and dimensions.
     void loadModels(vks::VulkanDevice* dev, VkQueue& queue, std::string assetsPath)
     {
+        this->updateMeshComponents();
+
+        bool isCooked = false;
         auto& entities3dInfo = this->sceneInfo.entities3dInfoMap;
         for (auto& ent3dCreInf : entities3dInfo)
         {
@@ -404,20 +857,226 @@ struct SceneData
 
             assert(meshName == modelInfo.meshName);
 
-            if (false == this->isMeshAlreadyCreated(meshName))
+            if (false == this->isMeshAlreadyCreated(meshName) && this->vertexPulling.isEnabled)
+            {
+                CookedMesh cookedMesh;
+                std::string error;
+                if (!MeshCooker::cook(assetsPath + "models/my_new_scene1/"+modelFName, this->meshComponentsMap.at(meshName), 1.0f, cookedMesh, error))
+                {
+                    vks::tools::exitFatal(error, "Error");
+                }
+                this->meshesMap[meshName] = cookedMesh.toModel(dev->logicalDevice);
+                this->vertexPulling.cookedMeshes[meshName] = std::move(cookedMesh);
+                isCooked = true;
+            }
+            else
             {
-                vks::Model model;
-                model.loadFromFile(assetsPath + "models/my_new_scene1/"+modelFName, this->sceneInfo.vertexLayout, 1.0f, dev, queue);
-                this->meshesMap[meshName] = std::move(model);
+                // Depth permutations read the position stream, indices are model's - both come from one import when both are missing
+                const bool isModelNeeded     = false == this->isMeshAlreadyCreated(meshName);
+                const bool isPositionsNeeded = this->isDepthPermutationNeeded(this->sceneInfo.settings) &&
+                                               this->depthPrepass.positionBuffers.count(meshName) == 0;
+                if (isModelNeeded || isPositionsNeeded)
+                {
+                    CookedMesh cookedMesh;
+                    std::string error;
+                    const std::vector<vks::Component> components = isModelNeeded ? this->meshComponentsMap.at(meshName)
+                                                                                  : std::vector<vks::Component>{ vks::VERTEX_COMPONENT_POSITION };
+                    if (!MeshCooker::cook(assetsPath + "models/my_new_scene1/"+modelFName, components, 1.0f, cookedMesh, error))
+                    {
+                        vks::tools::exitFatal(error, "Error");
+                    }
+                    if (isModelNeeded)
+                    {
+                        this->meshesMap[meshName] = this->uploadModel(dev, queue, cookedMesh);
+                    }
+                    if (isPositionsNeeded)
+                    {
+                        this->uploadPositionStream(dev, queue, cookedMesh, meshName);
+                    }
+                }
             }
         }
 
+        if (isCooked)
+        {
+            this->buildGlobalMeshBuffer(dev, queue);
+        }
+
+        this->buildTransformHierarchy();
+        this->computeEntityBounds();
+    }
+
+    /// Data in a new device local buffer, through a staging one.
+    static void uploadBuffer(vks::VulkanDevice* dev, VkQueue& queue, VkBufferUsageFlags usage, void* data, VkDeviceSize size, vks::Buffer& outBuffer)
+    {
+        vks::Buffer staging;
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &staging,
+            size,
+            data));
+        VK_CHECK_RESULT(dev->createBuffer(
+            usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &outBuffer,
+            size));
+        dev->copyBuffer(&staging, &outBuffer, queue);
+        staging.destroy();
+    }
+
+    /// Model with vertex and index buffers of the cooked mesh - what vks::Model::loadFromFile() would have loaded (see MeshCooker).
+    static vks::Model uploadModel(vks::VulkanDevice* dev, VkQueue& queue, CookedMesh& cookedMesh)
+    {
+        vks::Model model = cookedMesh.toModel(dev->logicalDevice);
+        uploadBuffer(dev, queue, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cookedMesh.vertices.data(), cookedMesh.vertices.size() * sizeof(float), model.vertices);
+        uploadBuffer(dev, queue, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,  cookedMesh.indices.data(),  cookedMesh.indices.size() * sizeof(uint32_t), model.indices);
+        return model;
+    }
+
+    /// Positions of the mesh alone (xyz per vertex, same vertices as its model) in a device local vertex buffer.
+    void uploadPositionStream(vks::VulkanDevice* dev, VkQueue& queue, CookedMesh& cookedMesh, const mesh_name_t& meshName)
+    {
+        uploadBuffer(dev, queue, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, cookedMesh.positions.data(), cookedMesh.positions.size() * sizeof(float),
+                     this->depthPrepass.positionBuffers[meshName]);
+    }
+
+    /// Mesh is retired - it is loaded again by loadModels().
+    void unloadMesh(const mesh_name_t& meshName)
+    {
+        this->retire([model = this->meshesMap[meshName]]() mutable { model.destroy(); });
+        this->meshesMap.erase(meshName);
+        this->vertexPulling.cookedMeshes.erase(meshName);
+
+        auto positions = this->depthPrepass.positionBuffers.find(meshName);
+        if (positions != this->depthPrepass.positionBuffers.end())
+        {
+            this->retire([buffer = positions->second]() mutable { buffer.destroy(); });
+            this->depthPrepass.positionBuffers.erase(positions);
+        }
+    }
+
+    /// Vertices are read by vertex shaders from the global buffer (pulling permutations), not by vertex input - see loadModels().
+    void enableVertexPulling()
+    {
+        this->vertexPulling.isEnabled = true;
+    }
+
+    /// Heatmap and per entity overdraw - depth permutations and position streams are loaded even with the pre-pass off.
+    /// Must be called before assets are loaded.
+    void enableOverdrawDiagnostics()
+    {
+        this->overdraw.isEnabled = true;
+    }
+
+    /// Frames can be drawn through the visibility buffer (see prepareVisibilityBuffer()) - visibility permutations are loaded
+    /// and the global buffer gets sequential indices. Needs vertex pulling, must be called before assets are loaded.
+    void enableVisibilityBuffer()
+    {
+        assert(this->vertexPulling.isEnabled);
+        this->visibilityBuffer.isEnabled = true;
+    }
+
+    /// Dynamic lights are binned by a compute pass every frame (see prepareClusteredLights()). Needs compute in the graphics queue.
+    void enableClusteredLights()
+    {
+        this->lights.isEnabled = true;
+    }
+
+    /// Motion permutations of vertex shaders are loaded, motion vectors are drawn for temporal upscaling (see prepareMotionVectors()).
+    void enableMotionVectors()
+    {
+        assert(this->vertexPulling.isEnabled);
+        this->motionVectors.isEnabled = true;
+    }
+
+    /// Puts all cooked meshes into a new global buffer, the old one is retired. Existing descriptor sets are rewritten.
+    void buildGlobalMeshBuffer(vks::VulkanDevice* dev, VkQueue& queue)
+    {
+        SceneVertexPulling& pulling = this->vertexPulling;
+        if (pulling.meshes.buffer.buffer != VK_NULL_HANDLE)
+        {
+            this->retire([meshes = pulling.meshes]() mutable { meshes.destroy(); });
+            pulling.meshes = GlobalMeshBuffer();
+        }
+
+        pulling.meshIndices.clear();
+        for (auto& [meshName, cookedMesh] : pulling.cookedMeshes)
+        {
+            pulling.meshIndices[meshName] = pulling.meshes.add(cookedMesh, this->sceneInfo.vertexLayout.components);
+        }
+        pulling.meshes.upload(dev, queue, this->visibilityBuffer.isEnabled);
+
+        for (auto& [entityName, descSet] : this->descriptorSetsMap)
+        {
+            this->writeDescriptorSet(dev, this->sceneInfo.entities3dInfoMap[entityName], descSet);
+        }
+    }
+
+    /// Index of entity - of its draw, transform, bounds etc.
+    uint32_t getEntityIndex(const entity_name_t& entityName) const
+    {
+        auto it = this->sceneInfo.entities3dInfoMap.find(entityName);
+        assert(it != this->sceneInfo.entities3dInfoMap.end());
+        return std::distance(this->sceneInfo.entities3dInfoMap.begin(), it);
+    }
+
+    /// Entity's model matrix is relative to its parent entity.
+    void buildTransformHierarchy()
+    {
+        std::vector<uint32_t>  parents;
+        std::vector<glm::mat4> locals;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            parents.push_back(entity3dInfo.parentName.empty() ? TransformHierarchy::ROOT : this->getEntityIndex(entity3dInfo.parentName));
+            locals.push_back(this->sceneInfo.matriciesInfoMap[entity3dInfo.matrixName].matrix);
+        }
+        if (!this->transformHierarchy.build(parents, locals))
+        {
+            vks::tools::exitFatal("Parents of scene entities form a cycle.", "Error");
+        }
+    }
+
+    /// Bounding box of every entity - its mesh box (from loading) transformed by its world matrix.
+    void computeEntityBounds()
+    {
+        this->meshBounds.clear();
+        this->entityBounds.clear();
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const vks::Model& model = this->meshesMap[entity3dInfo.meshName];
+            this->meshBounds.push(model.dim.min, model.dim.max);
+
+            glm::vec3 boxMin, boxMax;
+            AabbSoA::transform(this->transformHierarchy.getWorld(this->entityBounds.size()), model.dim.min, model.dim.max, boxMin, boxMax);
+            this->entityBounds.push(boxMin, boxMax);
+        }
+        this->entityBvh.build(this->entityBounds, &this->threadPool);
+    }
+
+    /// Sphere around entity's box - what GPU culling tests.
+    glm::vec4 getBoundingSphere(uint32_t entity) const
+    {
+        const glm::vec3 boxMin = this->entityBounds.getMin(entity);
+        const glm::vec3 boxMax = this->entityBounds.getMax(entity);
+        return glm::vec4(0.5f * (boxMin + boxMax), 0.5f * glm::length(boxMax - boxMin));
+    }
+
+    /// Nearest entity whose box is hit by the ray, e.g. through the cursor. Returns entity name, empty if none.
+    entity_name_t pickEntity(const glm::vec3& origin, const glm::vec3& dir, float tMax = std::numeric_limits<float>::max())
+    {
+        float t;
+        const uint32_t entity = this->entityBvh.raycast(origin, dir, this->entityBounds, tMax, t);
+        if (entity == EntityBvh::INVALID)
+        {
+            return entity_name_t();
+        }
+        return std::next(this->sceneInfo.entities3dInfoMap.begin(), entity)->first;
     }
 
     void loadSingleShader(vks::VulkanDevice* dev,
                        VkQueue& queue,
                        std::string assetsPath,
-                       std::vector<VkShaderModule> shaderModules,
                        shader_name_t shadName,
                        VkPipelineShaderStageCreateInfo& outShaderSCI)
     {
@@ -428,14 +1087,15 @@ struct SceneData
         shader_filename_t shadFName = shaderInfo.shaderFilename;
         shader_stage_t shadStage = shaderInfo.shaderStage;
 
-        outShaderSCI = loadShader(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/" + shadFName, shadStage, shaderModules);
+        outShaderSCI = this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/" + shadFName, shadStage);
 
     }
 
+    /// Acquires modules of shaders used by entities from the shader cache - identical SPIR-V is one module.
+    /// They are released by preparePipelines().
     void loadShaders(vks::VulkanDevice* dev,
                      VkQueue& queue,
-                     std::string assetsPath,
-                     std::vector<VkShaderModule>& shaderModules)
+                     std::string assetsPath)
     {
         auto& entities3dInfo = this->sceneInfo.entities3dInfoMap;
         for (auto& [entityName, entity3dInfo] : entities3dInfo) // <entity_name, Entity3dInfo>
@@ -447,8 +1107,16 @@ struct SceneData
                 if (false == this->isShaderAlreadyCreated(shadName))
                 {
                     VkPipelineShaderStageCreateInfo shaderStageCreateInfo;
-                    this->loadSingleShader(dev, queue, assetsPath, shaderModules, shadName, shaderStageCreateInfo);
+                    this->loadSingleShader(dev, queue, assetsPath, shadName, shaderStageCreateInfo);
                     this->shadersMap[shadName] = shaderStageCreateInfo;
+
+                    // Pipelines are created with permutations, the shader itself is reflected for vertex components of meshes
+                    const ShaderInfo& shadInfo = this->sceneInfo.shadersInfoMap[shadName];
+                    for (const std::string& variant : this->getShaderVariants(shadInfo, this->sceneInfo.settings))
+                    {
+                        this->shadersMap[getPermutationShaderName(shadName, variant)] = this->shaderCache.acquire(
+                            dev->logicalDevice, assetsPath + "shaders/my_new_scene1/" + getPermutationFilename(shadInfo.shaderFilename, variant), shaderStageCreateInfo.stage);
+                    }
                 }
                 else
                 {
@@ -458,6 +1126,50 @@ struct SceneData
         }
     }
 
+    /// Vertex components every mesh has to store - components of the scene vertex layout at locations which vertex shaders
+    /// of entities using the mesh read. Inputs only forwarded to fragment shader inputs which are never read don't count (e.g. color).
+    /// Shaders must be loaded. Returns meshes whose components changed - loaded ones have to be loaded again.
+    std::set<mesh_name_t> updateMeshComponents()
+    {
+        std::map<mesh_name_t, std::set<uint32_t>> meshLocations;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const std::vector<shader_name_t>& shadNames = this->sceneInfo.shadersSetInfoMap.at(entity3dInfo.shadersSetName).shadersNames;
+            const SpirvReflection* vertex   = this->findShaderReflection(shadNames, VK_SHADER_STAGE_VERTEX_BIT);
+            const SpirvReflection* fragment = this->findShaderReflection(shadNames, VK_SHADER_STAGE_FRAGMENT_BIT);
+            assert(vertex && "Shaders of the entity must be loaded.");
+
+            std::set<uint32_t>& locations = meshLocations[entity3dInfo.meshName];
+            for (uint32_t location : getLiveVertexInputs(*vertex, fragment))
+            {
+                locations.insert(location);
+            }
+        }
+
+        std::set<mesh_name_t> changedMeshes;
+        const std::vector<vks::Component>& sceneComponents = this->sceneInfo.vertexLayout.components;
+        for (auto& [meshName, locations] : meshLocations)
+        {
+            std::vector<vks::Component> components;
+            for (uint32_t location : locations)
+            {
+                if (location >= sceneComponents.size())
+                {
+                    vks::tools::exitFatal("Vertex shader input at location " + std::to_string(location) + " is not in the scene vertex layout", "Error");
+                }
+                components.push_back(sceneComponents[location]);
+            }
+
+            auto old = this->meshComponentsMap.find(meshName);
+            if (old != this->meshComponentsMap.end() && old->second != components)
+            {
+                changedMeshes.insert(meshName);
+            }
+            this->meshComponentsMap[meshName] = std::move(components);
+        }
+        return changedMeshes;
+    }
+
     /// It requires:
     /// * vks::VulkanDevice*
     /// * VkBufferUsageFlags,    // = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
@@ -476,88 +1188,157 @@ struct SceneData
         // Map persistent
         VK_CHECK_RESULT(this->uniformBuffers.scene.map());
 
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->uniformBuffers.transforms,
+            this->transformHierarchy.size() * sizeof(glm::mat4)));
+        VK_CHECK_RESULT(this->uniformBuffers.transforms.map());
+
+        // Widest vertex input is 4 components of 32 bits
+        float zeros[4] = {};
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->uniformBuffers.zeroVertex,
+            sizeof(zeros),
+            zeros));
+
+        // Later only changed ones are written, by updateTransforms()
+        this->writeWorldMatrices();
+
         this->updateUniformBuffers(true, viewMat, perspMat);
     }
 
+    void writeWorldMatrices()
+    {
+        glm::mat4* worlds = static_cast<glm::mat4*>(this->uniformBuffers.transforms.mapped);
+        for (uint32_t i = 0; i < this->transformHierarchy.size(); i++)
+        {
+            worlds[i] = this->transformHierarchy.getWorld(i);
+        }
+    }
+
     // PREPARING_DESCRIPTOR_SETS {
 
     /// We describe here the bindings given to shaders. It can be for example an UBO or a texture sampler.
     /// We must provide information in which stage this binding will be used and what type is it.
     /// We assign a binding id to it.
+    /// Bindings are reflected from SPIR-V of all shaders of the scene (loaded by loadShaders()) - a binding used
+    /// by several stages is one binding visible to all of them, so the layout always matches the shaders.
     /// It requires:
     /// * vks::VulkanDevice*
-    /// * VkDescriptorType    // in { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER }
-    /// * VkShaderStageFlags  // in { VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT }
-    /// * bind id 0...N
     /// * a relation between: { VkDescriptorType , VkShaderStageFlags , bind_id } // this is basically a descriptor (VkDescriptorSetLayoutBinding)
     void setupDescriptorSetLayout(vks::VulkanDevice* dev)
     {
-        uint32_t bindId = 0u;
-
-    // SCENE_SPECIFIC {
-        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings;
-        std::cout << " >>> setupDescriptorSetLayout: adding bind of id: " << bindId << " - VertS UBO\n";
-        setLayoutBindings.push_back(
-            // Binding 0 : Vertex shader uniform buffer
-            vks::initializers::descriptorSetLayoutBinding( VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                                                           VK_SHADER_STAGE_VERTEX_BIT,
-                                                           bindId++) );
-
-        // Putting samplers for all types of textures used in this scene
-        for (int i = 0; i < this->sceneInfo.getTextureSetSize(); i++)
-        {
-            std::cout << " >>> setupDescriptorSetLayout: adding bind of id: " << bindId << " - FragS samplers - one for every texture in TexSet\n";
-            setLayoutBindings.push_back(
-                // Binding: Fragment shader combined sampler
-                vks::initializers::descriptorSetLayoutBinding( VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                                                               VK_SHADER_STAGE_FRAGMENT_BIT,
-                                                               bindId++) );
+        this->setLayoutBindings = this->getReflectedSetLayoutBindings();
+        for (const VkDescriptorSetLayoutBinding& binding : this->setLayoutBindings)
+        {
+            std::cout << " >>> setupDescriptorSetLayout: adding bind of id: " << binding.binding << " - type " << binding.descriptorType
+                      << ", count " << binding.descriptorCount << ", stages " << binding.stageFlags << "\n";
         }
-    // } // SCENE_SPECIFIC
 
         VkDescriptorSetLayoutCreateInfo descriptorLayout =
-            vks::initializers::descriptorSetLayoutCreateInfo( setLayoutBindings.data(), setLayoutBindings.size());
+            vks::initializers::descriptorSetLayoutCreateInfo( this->setLayoutBindings.data(), this->setLayoutBindings.size());
 
         VkDescriptorSetLayout descSetLayout;
         VK_CHECK_RESULT(vkCreateDescriptorSetLayout(dev->logicalDevice, &descriptorLayout, nullptr, &descSetLayout));
         this->descriptorSetLayout = descSetLayout;
     }
 
+    /// Union of descriptor bindings of loaded shaders, sorted by binding. Entities share one layout, so shaders must agree
+    /// on type and size of every binding they declare - and use set 0 only.
+    std::vector<VkDescriptorSetLayoutBinding> getReflectedSetLayoutBindings() const
+    {
+        std::map<uint32_t, VkDescriptorSetLayoutBinding> bindings;
+        for (auto& [shadName, shaderStageCreateInfo] : this->shadersMap)
+        {
+            const SpirvReflection& reflection = this->shaderCache.getReflection(shaderStageCreateInfo.module);
+            for (const SpirvReflection::DescriptorBinding& reflected : reflection.bindings)
+            {
+                if (reflected.set != 0)
+                {
+                    vks::tools::exitFatal("Shader " + shadName + " uses descriptor set " + std::to_string(reflected.set) + ", only set 0 is supported", "Error");
+                }
+                auto known = bindings.find(reflected.binding);
+                if (known == bindings.end())
+                {
+                    VkDescriptorSetLayoutBinding binding =
+                        vks::initializers::descriptorSetLayoutBinding(reflected.type, reflection.stage, reflected.binding, reflected.count);
+                    bindings.emplace(reflected.binding, binding);
+                }
+                else if (known->second.descriptorType != reflected.type || known->second.descriptorCount != reflected.count)
+                {
+                    vks::tools::exitFatal("Shader " + shadName + " declares binding " + std::to_string(reflected.binding) + " differently than other shaders", "Error");
+                }
+                else
+                {
+                    known->second.stageFlags |= reflection.stage;
+                }
+            }
+        }
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings;
+        for (auto& [bindId, binding] : bindings)
+        {
+            setLayoutBindings.push_back(binding);
+        }
+        return setLayoutBindings;
+    }
+
+    /// Whether a (reloaded) shader still fits the descriptor set layout and push constant range - pipelines of it can be created.
+    bool fitsPipelineLayout(const SpirvReflection& reflection) const
+    {
+        for (const SpirvReflection::DescriptorBinding& reflected : reflection.bindings)
+        {
+            const VkDescriptorSetLayoutBinding* binding = this->findSetLayoutBinding(reflected.binding);
+            if (reflected.set != 0 || binding == nullptr || binding->descriptorType != reflected.type ||
+                binding->descriptorCount != reflected.count || (binding->stageFlags & reflection.stage) == 0)
+            {
+                return false;
+            }
+        }
+        return reflection.pushConstantSize == 0 ||
+               (reflection.pushConstantSize <= this->pushConstantRange.size && (this->pushConstantRange.stageFlags & reflection.stage));
+    }
+
     /// In this method we setup a pool for allocating shaders bindings.
-    /// We must specify here how much bindings there will be of any VkDescriptorType.
+    /// We must specify here how much bindings there will be of any VkDescriptorType - as many as the set layout has, per entity.
     /// It requires:
     /// * vks::VulkanDevice*
     /// * descriptorCount   // how much descriptors do we need = no more than number of distinct entities
-    /// * VkDescriptorType  // just as in descriptor set layout = in { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER }
     /// * relation between: VkDescriptorType and number of descriptors of this type.
     void setupDescriptorPool(vks::VulkanDevice* dev, VkDescriptorPool& descPool)
     { // This is fully scene specific.
         // One descriptor set per drawable object.
         const uint32_t descriptorCount = this->sceneInfo.getNeededDescriptorCount(); // Max number of sets - one for each distinct drawable entity.
 
-        // Example uses one ubo
-        std::vector<VkDescriptorPoolSize> poolSizes =
+        std::map<VkDescriptorType, uint32_t> typeCounts;
+        for (const VkDescriptorSetLayoutBinding& binding : this->setLayoutBindings)
         {
-            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, descriptorCount),
-        };
+            typeCounts[binding.descriptorType] += binding.descriptorCount * descriptorCount;
+        }
 
-///        THIS WORKS AS WELL
-//        poolSizes.push_back(
-//            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptorCount*this->sceneInfo.getTextureSetSize())
-//        );
+        std::vector<VkDescriptorPoolSize> poolSizes;
+        for (auto& [type, count] : typeCounts)
+        {
+            poolSizes.push_back(vks::initializers::descriptorPoolSize(type, count));
+        }
 
-        for (int i = 0; i < this->sceneInfo.getTextureSetSize(); i++)
+        // Culling uses one more set: ubo, three storage buffers and depth pyramid
+        const uint32_t cullingSetCount = this->culling.isEnabled ? 1 : 0;
+        if (this->culling.isEnabled)
         {
-            poolSizes.push_back(
-                vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, descriptorCount)
-            );
+            poolSizes.push_back(vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1));
+            poolSizes.push_back(vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         3));
+            poolSizes.push_back(vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1));
         }
 
         VkDescriptorPoolCreateInfo descriptorPoolInfo =
             vks::initializers::descriptorPoolCreateInfo(
-                poolSizes.size(), // uint32_t poolSizeCount
-                poolSizes.data(), // VkDescriptorPoolSize* pPoolSizes
-                descriptorCount); // uint32_t maxSets
+                poolSizes.size(),                   // uint32_t poolSizeCount
+                poolSizes.data(),                   // VkDescriptorPoolSize* pPoolSizes
+                descriptorCount + cullingSetCount); // uint32_t maxSets
 
         VK_CHECK_RESULT(vkCreateDescriptorPool(dev->logicalDevice, &descriptorPoolInfo, nullptr, &descPool));
     }
@@ -574,7 +1355,6 @@ struct SceneData
     void setupDescriptorSets(vks::VulkanDevice* dev, VkDescriptorPool& descPool)
     { // This is fully scene specific.
         VkDescriptorSetAllocateInfo descripotrSetAllocInfo;
-        std::vector<VkWriteDescriptorSet> writeDescriptorSets;
 
         descripotrSetAllocInfo = vks::initializers::descriptorSetAllocateInfo(descPool, &this->descriptorSetLayout, 1);
 
@@ -590,31 +1370,95 @@ struct SceneData
 
                 VkDescriptorSet descSet;
                 VK_CHECK_RESULT(vkAllocateDescriptorSets(dev->logicalDevice, &descripotrSetAllocInfo, &descSet));
-                std::cout << "  >>> setupDescriptorSet: adding write descriptor set for UBO " << writeDescriptorSets.size() << "\n";
-                writeDescriptorSets = {
-                    // Binding 0 - unifirm buffer.
-                    vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,	0, &this->uniformBuffers.scene.descriptor), // Binding 0 : Vertex shader uniform buffer
-                };
+                this->writeDescriptorSet(dev, entity3dInfo, descSet);
 
-                textures_set_name_t& texSetName = entity3dInfo.texturesSetName;
-                TextureSetInfo& texSetInfo = this->sceneInfo.texturesSetInfoMap[texSetName];
-                auto& texturesNames = texSetInfo.texturesNames;
+                this->descriptorSetsMap[entityName] = std::move(descSet);
+            }
+        }
+    }
 
-                for (texture_name_t& texName : texturesNames)
-                {
-                    auto& textureDescriptor = this->texturesMap[texName].descriptor;
-                    std::cout << "  >>> setupDescriptorSet: adding write descriptor set for sampler " << writeDescriptorSets.size() << ": " << texSetName << "/" << texName << "\n";
-                    writeDescriptorSets.push_back(
-                        // Binding i : Fragment shader combined sampler - for every texture
-                        vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, writeDescriptorSets.size(), &textureDescriptor)
-                    );
-                }
+    /// Fills entity's descriptor set - ubo, its textures and world matrices. Used again when its textures are reloaded.
+    void writeDescriptorSet(vks::VulkanDevice* dev, Entity3dInfo& entity3dInfo, VkDescriptorSet descSet)
+    {
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+
+        std::cout << "  >>> setupDescriptorSet: adding write descriptor set for UBO " << writeDescriptorSets.size() << "\n";
+        writeDescriptorSets = {
+            // Binding 0 - unifirm buffer.
+            vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,	0, &this->uniformBuffers.scene.descriptor), // Binding 0 : Vertex shader uniform buffer
+        };
 
-                vkUpdateDescriptorSets(dev->logicalDevice, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+        textures_set_name_t& texSetName = entity3dInfo.texturesSetName;
+        TextureSetInfo& texSetInfo = this->sceneInfo.texturesSetInfoMap[texSetName];
+        auto& texturesNames = texSetInfo.texturesNames;
 
-                this->descriptorSetsMap[entityName] = std::move(descSet);
-            }
+        assert(texturesNames.size() <= 6 && "Texture set has more textures than material shaders have samplers (bindings 1-6).");
+        for (uint32_t i = 0; i < texturesNames.size(); i++)
+        {
+            auto& textureDescriptor = this->texturesMap[texturesNames[i]].descriptor;
+            std::cout << "  >>> setupDescriptorSet: adding write descriptor set for sampler " << 1 + i << ": " << texSetName << "/" << texturesNames[i] << "\n";
+            writeDescriptorSets.push_back(
+                // Binding 1 + i : Fragment shader combined sampler - for every texture
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 + i, &textureDescriptor)
+            );
+        }
+
+        writeDescriptorSets.push_back(
+            // Binding 7 : Vertex shader storage buffer with world matrices, indexed by push constant - whatever the texture count
+            vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &this->uniformBuffers.transforms.descriptor)
+        );
+
+        if (this->vertexPulling.isEnabled)
+        {
+            // Binding 8 : Vertices of all meshes, binding 9 : Mesh formats - read by pulling permutations of vertex shaders
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8, &this->vertexPulling.meshes.verticesDescriptor));
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &this->vertexPulling.meshes.formatsDescriptor));
+            // Binding 10 : Position streams - read by depth permutations
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10, &this->vertexPulling.meshes.positionsDescriptor));
+            // Binding 11 : Indices of all meshes - read by visibility permutations
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 11, &this->vertexPulling.meshes.indicesDescriptor));
+        }
+
+        if (this->visibilityBuffer.isEnabled)
+        {
+            // Binding 12 : Visibility ids, binding 13 : Mesh and batch per entity - read by visibility permutations of fragment shaders
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 12, &this->visibilityBuffer.idsDescriptor));
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 13, &this->visibilityBuffer.entities.descriptor));
         }
+
+        // Binding 14 : Lights, binding 15 : Light lists of clusters, binding 16 : Cluster params - read by material shaders
+        writeDescriptorSets.push_back(
+            vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 14, &this->lights.clusters.lights.descriptor));
+        writeDescriptorSets.push_back(
+            vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 15, &this->lights.clusters.clusters.descriptor));
+        writeDescriptorSets.push_back(
+            vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 16, &this->lights.clusters.params.descriptor));
+
+        if (this->motionVectors.isEnabled)
+        {
+            // Binding 17 : Previous world matrices, binding 18 : Motion params - read by motion permutations
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 17, &this->motionVectors.previousTransforms.descriptor));
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(descSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 18, &this->motionVectors.params.descriptor));
+        }
+
+        // Resources which no shader declares aren't in the layout (reflected) - they are not written
+        auto isNotInLayout = [&](const VkWriteDescriptorSet& write)
+        {
+            const VkDescriptorSetLayoutBinding* binding = this->findSetLayoutBinding(write.dstBinding);
+            assert(binding == nullptr || binding->descriptorType == write.descriptorType);
+            return binding == nullptr;
+        };
+        writeDescriptorSets.erase(std::remove_if(writeDescriptorSets.begin(), writeDescriptorSets.end(), isNotInLayout), writeDescriptorSets.end());
+
+        vkUpdateDescriptorSets(dev->logicalDevice, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
     }
 
     // } // PREPARING_DESCRIPTOR_SETS
@@ -623,6 +1467,7 @@ struct SceneData
 
     /// In this method we describe pipeline layout.
     /// It bases on VkDescriptorSetLayout created before.
+    /// Entity index (into world matrices) is a push constant - its range covers push constant blocks of all loaded shaders (reflected).
     /// It requires:
     /// * vks::VulkanDevice*
     /// * VkDescriptorSetLayout
@@ -631,8 +1476,22 @@ struct SceneData
     {
         VkPipelineLayout pipLayout;
 
+        this->pushConstantRange = {};
+        for (auto& [shadName, shaderStageCreateInfo] : this->shadersMap)
+        {
+            const SpirvReflection& reflection = this->shaderCache.getReflection(shaderStageCreateInfo.module);
+            if (reflection.pushConstantSize > 0)
+            {
+                this->pushConstantRange.stageFlags |= reflection.stage;
+                this->pushConstantRange.size        = std::max(this->pushConstantRange.size, reflection.pushConstantSize);
+            }
+        }
+        assert(this->pushConstantRange.size == 0 || this->pushConstantRange.size >= sizeof(uint32_t)); // Entity index.
+
         VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
             vks::initializers::pipelineLayoutCreateInfo( &this->descriptorSetLayout, 1); // 1 -> layout count.
+        pPipelineLayoutCreateInfo.pushConstantRangeCount = this->pushConstantRange.size > 0 ? 1 : 0;
+        pPipelineLayoutCreateInfo.pPushConstantRanges = &this->pushConstantRange;
 
         VK_CHECK_RESULT(vkCreatePipelineLayout(dev->logicalDevice, &pPipelineLayoutCreateInfo, nullptr, &pipLayout));
 
@@ -651,13 +1510,18 @@ struct SceneData
     /// * VkRenderPass       // for VkPipelineCreateInfo
     /// * VkPipelineCache    // for vkCreateGraphicsPipelines
     /// * vertex bind id
+    /// * PipelinePass       // depth test and writes, color writes and blending
+    /// Reads nothing but its arguments, the pipeline layout and reflection of the stages' modules (ShaderModuleCache is locked) -
+    /// it may run on a pipeline compiler thread.
     void prepareSinglePipeline(vks::VulkanDevice* dev,
                          VkRenderPass renderPass,
                          VkPipelineCache pipelineCache,
-                         std::vector<shader_name_t>& shaderNamesVec,
-                         std::vector<VkVertexInputBindingDescription>&   bindingDescriptions,
-                         std::vector<VkVertexInputAttributeDescription>& attributeDescriptions,
-                         VkPipeline& pipelineToPrep)
+                         std::vector<VkPipelineShaderStageCreateInfo> shaderStages,
+                         const MaterialVariant& variant,
+                         PipelinePass pass,
+                         const std::vector<VkVertexInputBindingDescription>&   bindingDescriptions,
+                         const std::vector<VkVertexInputAttributeDescription>& attributeDescriptions,
+                         VkPipeline& pipelineToPrep) const
     {
         VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
             vks::initializers::pipelineInputAssemblyStateCreateInfo(
@@ -665,28 +1529,49 @@ struct SceneData
                 0,
                 VK_FALSE);
 
+        const bool isFullScreen = pass == PipelinePass::VISIBILITY_CLASSIFY || pass == PipelinePass::VISIBILITY_SHADING;
         VkPipelineRasterizationStateCreateInfo rasterizationState =
             vks::initializers::pipelineRasterizationStateCreateInfo(
                 VK_POLYGON_MODE_FILL,
-                VK_CULL_MODE_BACK_BIT,
+                isFullScreen ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT,
                 VK_FRONT_FACE_CLOCKWISE,
                 0);
 
+        const bool isCounting = pass == PipelinePass::OVERDRAW || pass == PipelinePass::OVERDRAW_HEATMAP;
         VkPipelineColorBlendAttachmentState blendAttachmentState =
             vks::initializers::pipelineColorBlendAttachmentState(
-                0xf,
-                VK_FALSE);
+                pass == PipelinePass::DEPTH_PREPASS || pass == PipelinePass::VISIBILITY_CLASSIFY ? 0x0 : 0xf,
+                isCounting ? VK_TRUE : VK_FALSE);
+        if (isCounting) // Fragment count - in the heatmap scaled by blend constants.
+        {
+            const VkBlendFactor srcFactor = pass == PipelinePass::OVERDRAW_HEATMAP ? VK_BLEND_FACTOR_CONSTANT_COLOR : VK_BLEND_FACTOR_ONE;
+            blendAttachmentState.srcColorBlendFactor = srcFactor;
+            blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            blendAttachmentState.colorBlendOp        = VK_BLEND_OP_ADD;
+            blendAttachmentState.srcAlphaBlendFactor = srcFactor;
+            blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            blendAttachmentState.alphaBlendOp        = VK_BLEND_OP_ADD;
+        }
 
         VkPipelineColorBlendStateCreateInfo colorBlendState =
             vks::initializers::pipelineColorBlendStateCreateInfo(
                 1,
                 &blendAttachmentState);
+        if (pass == PipelinePass::OVERDRAW_HEATMAP)
+        {
+            std::copy(std::begin(SceneOverdrawDiagnostics::HEATMAP_BLEND_CONSTANTS), std::end(SceneOverdrawDiagnostics::HEATMAP_BLEND_CONSTANTS),
+                      colorBlendState.blendConstants);
+        }
 
+        // After the pre-pass (or the counts pass of the meter) depth is final - only the nearest fragment passes, and depth isn't written again.
+        // A visibility buffer batch passes where the classification wrote its depth
+        const bool isAfterPrepass = pass == PipelinePass::SHADING_AFTER_PREPASS || pass == PipelinePass::SURFACE_ID || pass == PipelinePass::MOTION_VECTORS ||
+                                    pass == PipelinePass::VISIBILITY_SHADING;
         VkPipelineDepthStencilStateCreateInfo depthStencilState =
             vks::initializers::pipelineDepthStencilStateCreateInfo(
                 VK_TRUE,
-                VK_TRUE,
-                VK_COMPARE_OP_LESS_OR_EQUAL);
+                isAfterPrepass ? VK_FALSE : VK_TRUE,
+                isAfterPrepass ? VK_COMPARE_OP_EQUAL : pass == PipelinePass::VISIBILITY_CLASSIFY ? VK_COMPARE_OP_ALWAYS : VK_COMPARE_OP_LESS_OR_EQUAL);
 
         VkPipelineViewportStateCreateInfo viewportState =
             vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
@@ -706,9 +1591,6 @@ struct SceneData
                 dynamicStateEnables.size(),
                 0);
 
-        // Load shaders
-        std::vector<VkPipelineShaderStageCreateInfo> shaderStages(shaderNamesVec.size());
-
         VkGraphicsPipelineCreateInfo pipelineCreateInfo =
             vks::initializers::pipelineCreateInfo(
                 this->pipelineLayout,
@@ -738,10 +1620,24 @@ struct SceneData
 
         // SCENE_SPECIFIC {
 
-        uint8_t shadStCounter = 0u;
-        for (const shader_name_t& shadName : shaderNamesVec) // Order is not relevant.
+        // Material variant - every stage gets only the constants it declares (reflected), a constant id of another shader
+        // (e.g. a vertex shader's own constant 0) is never fed with the variant
+        const std::vector<VkSpecializationMapEntry> variantMapEntries = MaterialVariant::getMapEntries();
+        std::vector<std::vector<VkSpecializationMapEntry>> specializationMapEntries(shaderStages.size());
+        std::vector<VkSpecializationInfo>                  specializationInfos(shaderStages.size());
+        for (size_t s = 0; s < shaderStages.size(); s++)
         {
-            shaderStages[shadStCounter++] = this->shadersMap[shadName];
+            const SpirvReflection& reflection = this->shaderCache.getReflection(shaderStages[s].module);
+            for (const VkSpecializationMapEntry& entry : variantMapEntries)
+            {
+                if (reflection.hasSpecializationConstant(entry.constantID))
+                {
+                    specializationMapEntries[s].push_back(entry);
+                }
+            }
+            specializationInfos[s] =
+                vks::initializers::specializationInfo(specializationMapEntries[s].size(), specializationMapEntries[s].data(), sizeof(MaterialVariant), &variant);
+            shaderStages[s].pSpecializationInfo = specializationMapEntries[s].empty() ? nullptr : &specializationInfos[s];
         }
 
         VK_CHECK_RESULT(vkCreateGraphicsPipelines(dev->logicalDevice, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelineToPrep));
@@ -749,136 +1645,1844 @@ struct SceneData
         // } // SCENE_SPECIFIC
     }
 
-    void preparePipelines(vks::VulkanDevice* dev, VkRenderPass renderPass, VkPipelineCache pipelineCache, uint32_t vertedBindId, std::string assetsPath, std::vector<VkShaderModule> shaderModules)
+    /// Vertex input of a pipeline - one binding with components stored by the mesh, attributes at locations the vertex shader declares
+    /// (reflected). Inputs which the mesh doesn't store are never read for real (forwarded to unused fragment inputs, see updateMeshComponents()),
+    /// they are fed from binding vertexBindId + 1 - the zero vertex with stride 0 (see bindEntityMesh()), never from the mesh's own data.
+    /// With vertex pulling there is no vertex input.
+    void getVertexInputDescriptions(const pipeline_key_t& key,
+                                    uint32_t vertexBindId,
+                                    std::vector<VkVertexInputBindingDescription>&   bindingDescriptions,
+                                    std::vector<VkVertexInputAttributeDescription>& attributeDescriptions) const
     {
-    // SCENE_SPECIFIC {
+        bindingDescriptions.clear();
+        attributeDescriptions.clear();
+        if (this->vertexPulling.isEnabled)
+        {
+            return;
+        }
+
+        const std::vector<vks::Component>& sceneComponents = this->sceneInfo.vertexLayout.components;
 
-        std::vector<VkVertexInputBindingDescription> vertInputBindingDescriptions = {
+        std::map<vks::Component, uint32_t> offsets; // Of components stored by the mesh.
+        uint32_t stride = 0;
+        for (vks::Component component : key.vertexComponents)
+        {
+            offsets[component] = stride;
+            stride += MeshCooker::getComponentSize(component);
+        }
+
+        bindingDescriptions = {
             // Binding point: Mesh vertex layout description at per-vertex rate
-            vks::initializers::vertexInputBindingDescription(vertedBindId, this->sceneInfo.vertexLayout.stride(), VK_VERTEX_INPUT_RATE_VERTEX),
+            vks::initializers::vertexInputBindingDescription(vertexBindId, stride, VK_VERTEX_INPUT_RATE_VERTEX),
         };
 
-        std::vector<VkVertexInputAttributeDescription> vertInputAttributeDescriptions = {
-            // Per-vertex attributees
-            // These are advanced for each vertex fetched by the vertex shader
-            vks::initializers::vertexInputAttributeDescription(vertedBindId, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),                     // Location 0: Position
-            vks::initializers::vertexInputAttributeDescription(vertedBindId, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3),     // Location 1: Normal
-            vks::initializers::vertexInputAttributeDescription(vertedBindId, 2, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 6),     // Location 2: Tangent
-            vks::initializers::vertexInputAttributeDescription(vertedBindId, 3, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 9),     // Location 3: Bitangent
-            vks::initializers::vertexInputAttributeDescription(vertedBindId, 4, VK_FORMAT_R32G32_SFLOAT,    sizeof(float) * 12),    // Location 4: Texture coordinates
-            vks::initializers::vertexInputAttributeDescription(vertedBindId, 5, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 14),    // Location 5: Color
-        };
+        attributeDescriptions.clear();
+        const SpirvReflection* vertex = this->findShaderReflection(key.shadersNames, VK_SHADER_STAGE_VERTEX_BIT);
+        for (const SpirvReflection::InterfaceVariable& input : vertex->inputs)
+        {
+            if (input.location >= sceneComponents.size() || input.format == VK_FORMAT_UNDEFINED)
+            {
+                vks::tools::exitFatal("Vertex shader input at location " + std::to_string(input.location) + " doesn't match the scene vertex layout", "Error");
+            }
+            auto offset = offsets.find(sceneComponents[input.location]);
+            if (offset == offsets.end())
+            {
+                if (bindingDescriptions.size() == 1)
+                {
+                    bindingDescriptions.push_back(vks::initializers::vertexInputBindingDescription(vertexBindId + 1, 0, VK_VERTEX_INPUT_RATE_VERTEX));
+                }
+                attributeDescriptions.push_back(vks::initializers::vertexInputAttributeDescription(vertexBindId + 1, input.location, input.format, 0));
+                continue;
+            }
+            attributeDescriptions.push_back(
+                // Per-vertex attributes, advanced for each vertex fetched by the vertex shader
+                vks::initializers::vertexInputAttributeDescription(vertexBindId, input.location, input.format, offset->second));
+        }
+    }
+
+    /// Pipelines are created on threadCount compiler threads from now on - see preparePipelines().
+    /// useFallback - entities waiting for their pipelines are drawn with fallback ones, otherwise they are skipped.
+    void enableAsyncPipelines(uint32_t threadCount, bool useFallback)
+    {
+        this->asyncPipelines.isEnabled   = true;
+        this->asyncPipelines.useFallback = useFallback;
+        this->asyncPipelines.compiler.setThreadCount(threadCount);
+    }
+
+    /// Stages of loaded shaders, for pipeline creation - pulling permutations of vertex shaders with vertex pulling.
+    std::vector<VkPipelineShaderStageCreateInfo> getShaderStages(const std::vector<shader_name_t>& shadNames) const
+    {
+        std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+        for (const shader_name_t& shadName : shadNames)
+        {
+            const VkPipelineShaderStageCreateInfo& shaderStage = this->shadersMap.at(shadName);
+            if (this->vertexPulling.isEnabled && shaderStage.stage == VK_SHADER_STAGE_VERTEX_BIT)
+            {
+                shaderStages.push_back(this->shadersMap.at(getPermutationShaderName(shadName, "pulling")));
+                continue;
+            }
+            shaderStages.push_back(shaderStage);
+        }
+        return shaderStages;
+    }
+
+    /// Creates missing pipelines of entities, one per distinct shaders, material variant and mesh vertex components,
+    /// then releases shader modules loaded by loadShaders() - pipelines don't need them.
+    /// With async pipelines they are only started on pipeline compiler threads - updatePipelines() puts them in place once ready,
+    /// meanwhile entities are drawn with fallback pipelines or not at all. Fallbacks are created here while the scene is loading
+    /// (isLoading - nothing is drawn yet, they are small), later (hot reload, between frames) they are compiled on the threads too.
+    void preparePipelines(vks::VulkanDevice* dev, VkRenderPass renderPass, VkPipelineCache pipelineCache, uint32_t vertedBindId, std::string assetsPath,
+                          bool isLoading = true)
+    {
+    // SCENE_SPECIFIC {
+
+        this->prepareDepthPipelines(dev, renderPass, pipelineCache, vertedBindId, assetsPath);
+        this->prepareVisibilityPipelines(dev, pipelineCache, assetsPath);
+        this->prepareMotionPipelines(dev, pipelineCache, assetsPath);
 
         for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
         {
             if (false == this->isPipelineAlreadyCreated(entityName))
             {
-                std::cout << " >>> preparePipelines: creating pipeline for entity: " << entityName << "\n";
+                pipeline_key_t key = this->getPipelineKey(entity3dInfo);
+                auto unique = this->uniquePipelinesMap.find(key);
+                if (unique != this->uniquePipelinesMap.end())
+                {
+                    this->pipelinesMap[entityName] = unique->second;
+                    continue;
+                }
 
-                shaders_set_name_t& shadSetName = entity3dInfo.shadersSetName;
-                ShaderSetInfo&      shadSetInfo = this->sceneInfo.shadersSetInfoMap[shadSetName];
-                auto& shaderNames = shadSetInfo.shadersNames;
+                std::vector<VkVertexInputBindingDescription>   vertInputBindingDescriptions;
+                std::vector<VkVertexInputAttributeDescription> vertInputAttributeDescriptions;
+                this->getVertexInputDescriptions(key, vertedBindId, vertInputBindingDescriptions, vertInputAttributeDescriptions);
+                std::vector<VkPipelineShaderStageCreateInfo> shaderStages = this->getShaderStages(key.shadersNames);
 
-                VkPipeline pip;
-                this->prepareSinglePipeline(dev, renderPass, pipelineCache, shaderNames, vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
-                this->pipelinesMap[entityName] = std::move(pip);
+                if (false == this->asyncPipelines.isEnabled)
+                {
+                    std::cout << " >>> preparePipelines: creating pipeline for entity: " << entityName << "\n";
+
+                    VkPipeline pip;
+                    this->prepareSinglePipeline(dev, renderPass, pipelineCache, shaderStages, key.variant, key.pass, vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+                    unique = this->uniquePipelinesMap.emplace(std::move(key), pip).first;
+                    this->pipelinesMap[entityName] = unique->second;
+                    continue;
+                }
+
+                if (this->asyncPipelines.useFallback)
+                {
+                    this->prepareFallbackPipeline(dev, renderPass, pipelineCache, vertedBindId, assetsPath, key, isLoading);
+                }
+                if (this->findPendingPipeline(key, false) == nullptr)
+                {
+                    std::cout << " >>> preparePipelines: starting pipeline for entity: " << entityName << "\n";
+                    this->startPipeline(dev, renderPass, pipelineCache, std::move(key), shaderStages, vertInputBindingDescriptions, vertInputAttributeDescriptions, false);
+                }
             }
         }
 
+        for (auto& [shadName, shaderStageCreateInfo] : this->shadersMap)
+        {
+            this->shaderCache.release(shaderStageCreateInfo.module);
+        }
+        this->shadersMap.clear();
+
     // } // SCENE_SPECIFIC
     }
 
+    /// Fallback pipeline key of a pipeline - its vertex shader with fallback.frag, same vertex input and pass.
+    pipeline_key_t getFallbackPipelineKey(const pipeline_key_t& key) const
+    {
+        pipeline_key_t fallbackKey;
+        fallbackKey.vertexComponents = key.vertexComponents;
+        fallbackKey.pass             = key.pass;
+        for (const shader_name_t& shadName : key.shadersNames)
+        {
+            if (this->sceneInfo.shadersInfoMap.at(shadName).shaderStage == VK_SHADER_STAGE_VERTEX_BIT)
+            {
+                fallbackKey.shadersNames.push_back(shadName);
+            }
+        }
+        return fallbackKey;
+    }
 
-    // } // PREPARING_PIPELINES
-
-    /// In this method we fill command buffer with draw commands.
-    /// First we bind needed handles:
-    /// * DescriptorSets
-    /// * Pipeline
-    /// * VertexBuffers
-    /// * IndexBuffer
-    /// Then we insert draw command with: vkCmdDrawIndexed.
-    /// It requires:
-    /// * VkCommandBuffer
-    /// * VkPipelineBindPoint
-    /// * VkPipelineLayout
-    /// * VkPipeline
-    /// * vertex buffer bind id
-    /// * VkBuffer*              // buffer with vertex data
-    /// * VkDeviceSize*          // offsets for binding vertex buffer
-    /// * VkBuffer*              // buffer with index data
-    /// * VkIndexType
-    /// * index count
-    void recordDrawCommandsForEntities(VkCommandBuffer& drawCmdBuffer, uint32_t vertexBufferBindId, const VkDeviceSize* offsets)
-    { // This is fully scene specific.
-        for (auto& entCreInfMap : this->sceneInfo.entities3dInfoMap)
+    /// Starts creation of a pipeline on a compiler thread - updatePipelines() puts it in place once ready.
+    void startPipeline(vks::VulkanDevice* dev,
+                       VkRenderPass renderPass,
+                       VkPipelineCache pipelineCache,
+                       pipeline_key_t key,
+                       const std::vector<VkPipelineShaderStageCreateInfo>&   shaderStages,
+                       const std::vector<VkVertexInputBindingDescription>&   vertInputBindingDescriptions,
+                       const std::vector<VkVertexInputAttributeDescription>& vertInputAttributeDescriptions,
+                       bool isFallback)
+    {
+        // Modules stay alive until the pipeline is created
+        std::vector<VkShaderModule> modules;
+        for (const VkPipelineShaderStageCreateInfo& shaderStage : shaderStages)
         {
-            entity_name_t entName   = entCreInfMap.first;
-            Entity3dInfo& entCreInf = entCreInfMap.second;
+            this->shaderCache.retain(shaderStage.module);
+            modules.push_back(shaderStage.module);
+        }
+        PipelineFuture future = this->asyncPipelines.compiler.compile(
+            [this, dev, renderPass, pipelineCache, shaderStages, variant = key.variant, pass = key.pass, vertInputBindingDescriptions, vertInputAttributeDescriptions]()
+            {
+                VkPipeline pip;
+                this->prepareSinglePipeline(dev, renderPass, pipelineCache, shaderStages, variant, pass, vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+                return pip;
+            });
+        this->asyncPipelines.pending.push_back({ std::move(key), std::move(future), std::move(modules), false, isFallback });
+    }
 
-            mesh_name_t& modelName = entCreInf.meshName;
+    /// Generic pipeline drawing entities whose own pipeline is not ready yet - untextured, lit by normals only.
+    /// One per vertex shader and vertex components. Created synchronously while loading, on a compiler thread otherwise -
+    /// a frame never waits for one.
+    void prepareFallbackPipeline(vks::VulkanDevice* dev, VkRenderPass renderPass, VkPipelineCache pipelineCache, uint32_t vertedBindId, const std::string& assetsPath,
+                                 const pipeline_key_t& key, bool isLoading)
+    {
+        pipeline_key_t fallbackKey = this->getFallbackPipelineKey(key);
+        if (this->asyncPipelines.fallbackPipelinesMap.count(fallbackKey) > 0 || this->findPendingPipeline(fallbackKey, true) != nullptr)
+        {
+            return;
+        }
 
-            auto& descrSet = this->descriptorSetsMap[entName];
-            auto& pipeline = this->pipelinesMap[entName];
-            auto& model    = this->meshesMap[modelName];
+        std::vector<VkVertexInputBindingDescription>   vertInputBindingDescriptions;
+        std::vector<VkVertexInputAttributeDescription> vertInputAttributeDescriptions;
+        this->getVertexInputDescriptions(fallbackKey, vertedBindId, vertInputBindingDescriptions, vertInputAttributeDescriptions);
 
-            std::cout << " >>> buildCommandBuffer: building draw command buffer for entity: " << entName << "\n";
+        std::vector<VkPipelineShaderStageCreateInfo> shaderStages = this->getShaderStages(fallbackKey.shadersNames);
+        shaderStages.push_back(this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/fallback.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT));
 
-            vkCmdBindDescriptorSets(drawCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &descrSet, 0, NULL);
-            vkCmdBindPipeline(drawCmdBuffer,       VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-            vkCmdBindVertexBuffers(drawCmdBuffer,  vertexBufferBindId, 1, &(model.vertices.buffer), offsets);
-            vkCmdBindIndexBuffer(drawCmdBuffer,    model.indices.buffer,  0, VK_INDEX_TYPE_UINT32);
-            vkCmdDrawIndexed(drawCmdBuffer,        model.indexCount,      1, 0, 0, 0);
+        if (isLoading)
+        {
+            VkPipeline pip;
+            this->prepareSinglePipeline(dev, renderPass, pipelineCache, shaderStages, fallbackKey.variant, fallbackKey.pass, vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+            this->asyncPipelines.fallbackPipelinesMap.emplace(std::move(fallbackKey), pip);
         }
+        else
+        {
+            this->startPipeline(dev, renderPass, pipelineCache, std::move(fallbackKey), shaderStages, vertInputBindingDescriptions, vertInputAttributeDescriptions, true);
+        }
+        this->shaderCache.release(shaderStages.back().module);
     }
 
-// } // PREPARE
-
-// RUNTIME {
+    SceneAsyncPipelines::Job* findPendingPipeline(const pipeline_key_t& key, bool isFallback)
+    {
+        for (SceneAsyncPipelines::Job& job : this->asyncPipelines.pending)
+        {
+            if (!job.isStale && job.isFallback == isFallback && job.key == key)
+            {
+                return &job;
+            }
+        }
+        return nullptr;
+    }
 
-    void updateUniformBuffers(bool viewChanged, glm::mat4& viewMat, glm::mat4& perspMat)
+    /// Puts pipelines created on compiler threads in place of fallbacks. Called once per frame, never blocks.
+    /// Returns true if draw command buffers must be recorded again.
+    bool updatePipelines(vks::VulkanDevice* dev)
     {
-        if (viewChanged)
+        bool isChanged = false;
+        auto& pending = this->asyncPipelines.pending;
+        for (auto it = pending.begin(); it != pending.end();)
         {
-            this->uboVS.view       = viewMat;
-            this->uboVS.projection = perspMat;
+            if (!it->future.isReady())
+            {
+                it++;
+                continue;
+            }
+
+            const VkPipeline pipeline = it->future.get();
+            for (VkShaderModule module : it->modules)
+            {
+                this->shaderCache.release(module);
+            }
+            if (it->isStale) // Its shaders were reloaded meanwhile.
+            {
+                vkDestroyPipeline(dev->logicalDevice, pipeline, nullptr);
+                it = pending.erase(it);
+                continue;
+            }
+            if (it->isFallback) // Entities waiting for their own pipelines are drawn with it from now on.
+            {
+                this->asyncPipelines.fallbackPipelinesMap.emplace(std::move(it->key), pipeline);
+                it = pending.erase(it);
+                isChanged = true;
+                continue;
+            }
+
+            for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+            {
+                const pipeline_key_t key = this->getPipelineKey(entity3dInfo);
+                if (false == this->isPipelineAlreadyCreated(entityName) && key == it->key)
+                {
+                    this->pipelinesMap[entityName] = pipeline;
+                }
+            }
+            this->uniquePipelinesMap.emplace(std::move(it->key), pipeline);
+            it = pending.erase(it);
+            isChanged = true;
         }
 
-        // Copy to device memory.
-        this->copyDataToDeviceMemory();
+        if (isChanged)
+        {
+            this->retireUnusedPipelines(dev); // Entities which changed their key meanwhile.
+        }
+        return isChanged;
     }
 
-    void copyDataToDeviceMemory()
+    /// Pipeline entity is drawn with - its own, fallback one, or VK_NULL_HANDLE (skipped) until its own one is ready.
+    VkPipeline getDrawPipeline(const entity_name_t& entityName, const Entity3dInfo& entity3dInfo) const
     {
-        memcpy(this->uniformBuffers.scene.mapped, &this->uboVS, sizeof(this->uboVS));
+        auto pipeline = this->pipelinesMap.find(entityName);
+        if (pipeline != this->pipelinesMap.end())
+        {
+            return pipeline->second;
+        }
+        auto fallback = this->asyncPipelines.fallbackPipelinesMap.find(this->getFallbackPipelineKey(this->getPipelineKey(entity3dInfo)));
+        return fallback != this->asyncPipelines.fallbackPipelinesMap.end() ? fallback->second : VK_NULL_HANDLE;
     }
 
-// } // RUNTIME
+    // } // PREPARING_PIPELINES
 
-// DESTROY {
+    // PREPARING_DEPTH_PREPASS {
+
+    /// Meter of overdraw, then depth pre-pass pipelines and decision whether the pre-pass is used (see updateDepthPrepass()).
+    /// Must be called before preparePipelines() - entity pipelines depend on the decision - with shaders loaded, descriptor sets
+    /// and uniform buffers ready (the scene is drawn to measure overdraw). Width and height are of measured frames.
+    void prepareDepthPrepass(vks::VulkanDevice* dev,
+                             VkQueue& queue,
+                             VkRenderPass renderPass,
+                             VkPipelineCache pipelineCache,
+                             uint32_t vertedBindId,
+                             std::string assetsPath,
+                             VkFormat depthFormat,
+                             uint32_t width,
+                             uint32_t height)
+    {
+        this->depthPrepass.meter.prepare(dev, depthFormat, width, height);
+        this->prepareDepthPipelines(dev, renderPass, pipelineCache, vertedBindId, assetsPath);
+        this->updateDepthPrepass(dev, queue, vertedBindId);
+    }
 
-    void destroy(VkDevice& dev)
+    /// Missing depth only and overdraw pipelines of vertex shaders of entities - created synchronously, they are small.
+    /// With overdraw diagnostics also heatmap and surface id pipelines. Nothing when no depth permutations are loaded.
+    void prepareDepthPipelines(vks::VulkanDevice* dev, VkRenderPass renderPass, VkPipelineCache pipelineCache, uint32_t vertedBindId, const std::string& assetsPath)
     {
-        for (auto& pipM : this->pipelinesMap)
+        if (false == this->isDepthPermutationNeeded(this->sceneInfo.settings))
         {
-            vkDestroyPipeline(dev, pipM.second, nullptr); // Here we have segfault when validation layers are active, probably driver bug.
+            return;
         }
 
-        vkDestroyPipelineLayout(dev, this->pipelineLayout, nullptr);
-
-        vkDestroyDescriptorSetLayout(dev, this->descriptorSetLayout, nullptr);
+        // Position stream - one vec3 at location 0
+        std::vector<VkVertexInputBindingDescription>   vertInputBindingDescriptions;
+        std::vector<VkVertexInputAttributeDescription> vertInputAttributeDescriptions;
+        if (false == this->vertexPulling.isEnabled)
+        {
+            vertInputBindingDescriptions   = { vks::initializers::vertexInputBindingDescription(vertedBindId, 3 * sizeof(float), VK_VERTEX_INPUT_RATE_VERTEX) };
+            vertInputAttributeDescriptions = { vks::initializers::vertexInputAttributeDescription(vertedBindId, 0, VK_FORMAT_R32G32B32_SFLOAT, 0) };
+        }
 
-        for (auto& modM : this->meshesMap)
+        const VkPipelineShaderStageCreateInfo overdrawStage =
+            this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/overdraw.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        const VkPipelineShaderStageCreateInfo entityIdStage =
+            this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/entity_id.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
         {
-            modM.second.destroy();
+            const shader_name_t shadName = this->getVertexShaderName(entity3dInfo);
+            if (this->depthPrepass.pipelinesMap.count(shadName) > 0)
+            {
+                continue;
+            }
+
+            std::cout << " >>> prepareDepthPipelines: creating depth pipelines of vertex shader: " << shadName << "\n";
+
+            const VkPipelineShaderStageCreateInfo depthStage = this->shadersMap.at(getPermutationShaderName(shadName, this->getDepthVariant()));
+            VkPipeline pip;
+            this->prepareSinglePipeline(dev, renderPass, pipelineCache, { depthStage }, MaterialVariant(), PipelinePass::DEPTH_PREPASS,
+                                        vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+            this->depthPrepass.pipelinesMap[shadName] = pip;
+            this->prepareSinglePipeline(dev, this->depthPrepass.meter.renderPass, pipelineCache, { depthStage, overdrawStage }, MaterialVariant(), PipelinePass::OVERDRAW,
+                                        vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+            this->depthPrepass.overdrawPipelinesMap[shadName] = pip;
+            if (this->overdraw.isEnabled)
+            {
+                this->prepareSinglePipeline(dev, renderPass, pipelineCache, { depthStage, overdrawStage }, MaterialVariant(), PipelinePass::OVERDRAW_HEATMAP,
+                                            vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+                this->overdraw.heatmapPipelinesMap[shadName] = pip;
+                this->prepareSinglePipeline(dev, this->depthPrepass.meter.surfacesRenderPass, pipelineCache, { depthStage, entityIdStage }, MaterialVariant(), PipelinePass::SURFACE_ID,
+                                            vertInputBindingDescriptions, vertInputAttributeDescriptions, pip);
+                this->overdraw.surfacePipelinesMap[shadName] = pip;
+            }
         }
+        this->shaderCache.release(overdrawStage.module);
+        this->shaderCache.release(entityIdStage.module);
+    }
 
-        for (auto& texM : this->texturesMap)
+    /// Draws all entities, position only, with pipelines of their vertex shaders - all of them, not culled.
+    void recordPositionOnlyDraws(VkCommandBuffer cmdBuffer, const std::map<shader_name_t, VkPipeline>& pipelines, uint32_t vertexBindId)
+    {
+        if (this->vertexPulling.isEnabled)
         {
-            texM.second.destroy();
+            this->vertexPulling.meshes.bindIndexBuffer(cmdBuffer);
+        }
+        const VkDeviceSize offsets[1] = { 0 };
+        uint32_t entityIndex = 0;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const VkPipeline pipeline = pipelines.at(this->getVertexShaderName(entity3dInfo));
+            vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &this->descriptorSetsMap.at(entityName), 0, NULL);
+            vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            const uint32_t firstIndex = this->bindEntityMesh(cmdBuffer, entityIndex++, entity3dInfo.meshName, vertexBindId, offsets, true);
+            vkCmdDrawIndexed(cmdBuffer, this->meshesMap.at(entity3dInfo.meshName).indexCount, 1, firstIndex, 0, 0);
         }
+    }
 
-        this->uniformBuffers.scene.destroy();
+    /// Draws all entities into the meter, as the main pass without pre-pass would, and counts shaded fragments. Waits for the queue.
+    OverdrawMeter::Result measureOverdraw(VkQueue& queue, uint32_t vertexBindId)
+    {
+        return this->depthPrepass.meter.measure(queue, [this, vertexBindId](VkCommandBuffer cmdBuffer)
+        {
+            this->recordPositionOnlyDraws(cmdBuffer, this->depthPrepass.overdrawPipelinesMap, vertexBindId);
+        });
+    }
+
+    /// Decides whether the pre-pass is used, from the scene settings - with auto, overdraw is measured (once).
+    /// When the decision changes, entity pipelines are dropped - preparePipelines() creates them for the other pass.
+    /// Returns true if it changed.
+    bool updateDepthPrepass(vks::VulkanDevice* dev, VkQueue& queue, uint32_t vertexBindId)
+    {
+        const SceneFile::Settings& settings = this->sceneInfo.settings;
+        bool isActive = settings.depthPrepass == SceneFile::DEPTH_PREPASS_ON;
+        if (settings.depthPrepass == SceneFile::DEPTH_PREPASS_AUTO)
+        {
+            if (this->depthPrepass.measuredOverdraw == 0.0f)
+            {
+                const OverdrawMeter::Result result = this->measureOverdraw(queue, vertexBindId);
+                this->depthPrepass.measuredOverdraw = result.getOverdraw();
+                std::cout << " >>> updateDepthPrepass: overdraw " << this->depthPrepass.measuredOverdraw << " (max " << result.maxCount
+                          << "), threshold " << settings.prepassMinOverdraw << "\n";
+            }
+            isActive = this->depthPrepass.measuredOverdraw >= settings.prepassMinOverdraw;
+        }
+        if (isActive == this->depthPrepass.isActive)
+        {
+            return false;
+        }
+
+        this->depthPrepass.isActive = isActive;
+        this->pipelinesMap.clear(); // Pipelines of the other pass are retired by retireUnusedPipelines().
+        auto& fallbacks = this->asyncPipelines.fallbackPipelinesMap;
+        for (auto it = fallbacks.begin(); it != fallbacks.end();)
+        {
+            this->retire([device = dev->logicalDevice, pipeline = it->second]() { vkDestroyPipeline(device, pipeline, nullptr); });
+            it = fallbacks.erase(it);
+        }
+        return true;
+    }
+
+    // } // PREPARING_DEPTH_PREPASS
+
+    // OVERDRAW_DIAGNOSTICS {
+
+    /// Measures overdraw of the current view, per entity too (surfaces of the result by entity index), and prints a report.
+    /// Waits for the queue. Needs overdraw diagnostics enabled.
+    const OverdrawMeter::Result& measureOverdrawDiagnostics(VkQueue& queue, uint32_t vertexBindId)
+    {
+        assert(this->overdraw.isEnabled);
+
+        this->overdraw.result = this->depthPrepass.meter.measure(queue,
+            [this, vertexBindId](VkCommandBuffer cmdBuffer)
+            {
+                this->recordPositionOnlyDraws(cmdBuffer, this->depthPrepass.overdrawPipelinesMap, vertexBindId);
+            },
+            [this, vertexBindId](VkCommandBuffer cmdBuffer)
+            {
+                this->recordPositionOnlyDraws(cmdBuffer, this->overdraw.surfacePipelinesMap, vertexBindId);
+            },
+            static_cast<uint32_t>(this->sceneInfo.entities3dInfoMap.size()));
+        this->printOverdrawReport(this->overdraw.result);
+        return this->overdraw.result;
+    }
+
+    /// Totals and histogram, then per entity - pixels where it is seen, average and max fragments shaded there, and its histogram.
+    void printOverdrawReport(const OverdrawMeter::Result& result) const
+    {
+        auto printHistogram = [](const OverdrawMeter::Stats& stats)
+        {
+            for (uint32_t i = 0; i < OverdrawMeter::HISTOGRAM_SIZE; i++)
+            {
+                std::cout << " " << stats.histogram[i];
+            }
+        };
+
+        std::cout << " >>> overdraw: " << result.getOverdraw() << " fragments per pixel, max " << result.maxCount << ", " << result.coveredCount
+                  << " pixels covered\n";
+        std::cout << " >>> overdraw: pixels by fragments 1.." << OverdrawMeter::HISTOGRAM_SIZE << "+:";
+        printHistogram(result);
+        std::cout << "\n";
+
+        uint32_t entityIndex = 0;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const OverdrawMeter::Stats& stats = result.surfaces.at(entityIndex++);
+            if (stats.coveredCount == 0)
+            {
+                continue;
+            }
+            std::cout << " >>> overdraw: " << entityName << ": " << stats.coveredCount << " pixels, " << stats.getOverdraw() << " per pixel, max "
+                      << stats.maxCount << ":";
+            printHistogram(stats);
+            std::cout << "\n";
+        }
+    }
+
+    // } // OVERDRAW_DIAGNOSTICS
+
+    // PREPARING_VISIBILITY_BUFFER {
+
+    /// Render graph of visibility buffer frames - ids and depth are transient, the frame is the imported swapchain image
+    /// (cleared to clearColor, left in PRESENT_SRC_KHR) - the sampler of ids and the entity buffer. Must be called after assets
+    /// are loaded and before descriptor sets are set up - they reference the ids image. Pipelines are created by preparePipelines().
+    void prepareVisibilityBuffer(vks::VulkanDevice* dev, VkFormat colorFormat, VkFormat depthFormat, uint32_t width, uint32_t height, VkClearColorValue clearColor)
+    {
+        SceneVisibilityBuffer& vis   = this->visibilityBuffer;
+        RenderGraph&           graph = vis.graph;
+
+        vis.idsImage   = graph.createImage("visibility ids", SceneVisibilityBuffer::IDS_FORMAT, width, height);
+        vis.depthImage = graph.createImage("visibility depth", depthFormat, width, height);
+        vis.batchImage = graph.createImage("visibility batches", SceneVisibilityBuffer::BATCH_FORMAT, width, height);
+        vis.frameImage = graph.importImage("frame", colorFormat, width, height, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+        vis.geometryPass = graph.addPass("visibility", [this](VkCommandBuffer cmdBuffer) { this->recordVisibilityDraws(cmdBuffer); });
+        graph.writeColor(vis.geometryPass, vis.idsImage, VK_ATTACHMENT_LOAD_OP_CLEAR); // Background is 0.
+        graph.writeDepth(vis.geometryPass, vis.depthImage, VK_ATTACHMENT_LOAD_OP_CLEAR);
+
+        vis.shadingPass = graph.addPass("shading", [this](VkCommandBuffer cmdBuffer) { this->recordVisibilityShading(cmdBuffer); });
+        graph.writeColor(vis.shadingPass, vis.frameImage, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor);
+        graph.writeDepth(vis.shadingPass, vis.batchImage, VK_ATTACHMENT_LOAD_OP_CLEAR, { 0.0f, 0 }); // Background matches no batch.
+        graph.readSampled(vis.shadingPass, vis.idsImage);
+
+        graph.compile(dev);
+
+        // Ids are fetched, never filtered
+        VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
+        samplerCreateInfo.magFilter     = VK_FILTER_NEAREST;
+        samplerCreateInfo.minFilter     = VK_FILTER_NEAREST;
+        samplerCreateInfo.mipmapMode    = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCreateInfo.addressModeU  = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV  = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW  = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.maxAnisotropy = 1.0f;
+        VK_CHECK_RESULT(vkCreateSampler(dev->logicalDevice, &samplerCreateInfo, nullptr, &vis.idsSampler));
+        vis.idsDescriptor = { vis.idsSampler, graph.getView(vis.idsImage), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &vis.entities,
+            this->sceneInfo.entities3dInfoMap.size() * sizeof(SceneVisibilityBuffer::EntityVisibility)));
+        VK_CHECK_RESULT(vis.entities.map());
+        this->writeVisibilityEntities();
+    }
+
+    /// Mesh and batch of every entity - a batch is entities of one shader set and texture set, shaded by one full-screen draw
+    /// with the descriptor set of its first entity. Written again after hot reload - meshes and sets of entities may change.
+    void writeVisibilityEntities()
+    {
+        SceneVisibilityBuffer& vis = this->visibilityBuffer;
+        assert(this->sceneInfo.entities3dInfoMap.size() < 0xFFFF); // Batch depths are D16.
+        auto* entities = static_cast<SceneVisibilityBuffer::EntityVisibility*>(vis.entities.mapped);
+
+        std::map<std::pair<shaders_set_name_t, textures_set_name_t>, uint32_t> batchesMap; // First entity of the batch.
+        vis.batches.clear();
+        uint32_t entityIndex = 0;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            auto batch = batchesMap.emplace(std::make_pair(entity3dInfo.shadersSetName, entity3dInfo.texturesSetName), entityIndex);
+            if (batch.second)
+            {
+                vis.batches.push_back(entityIndex);
+            }
+            entities[entityIndex++] = { this->vertexPulling.meshIndices.at(entity3dInfo.meshName), batch.first->second };
+        }
+    }
+
+    /// Missing visibility pipelines - ids ones per vertex shader, shading ones per shader set. Created synchronously, with shaders loaded.
+    void prepareVisibilityPipelines(vks::VulkanDevice* dev, VkPipelineCache pipelineCache, const std::string& assetsPath)
+    {
+        SceneVisibilityBuffer& vis = this->visibilityBuffer;
+        if (false == vis.isEnabled)
+        {
+            return;
+        }
+
+        const VkPipelineShaderStageCreateInfo idsStage =
+            this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/visibility.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        const VkPipelineShaderStageCreateInfo fullscreenStage =
+            this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/base/fullscreen.batch.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        if (vis.classifyPipeline == VK_NULL_HANDLE)
+        {
+            const VkPipelineShaderStageCreateInfo classifyStages[] = {
+                this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/base/fullscreen.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
+                this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/visibility_classify.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
+            };
+            this->prepareSinglePipeline(dev, vis.graph.getRenderPass(vis.shadingPass), pipelineCache, { classifyStages[0], classifyStages[1] },
+                                        MaterialVariant(), PipelinePass::VISIBILITY_CLASSIFY, {}, {}, vis.classifyPipeline);
+            for (const VkPipelineShaderStageCreateInfo& stage : classifyStages)
+            {
+                this->shaderCache.release(stage.module);
+            }
+        }
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const shader_name_t vertName = this->getVertexShaderName(entity3dInfo);
+            if (vis.geometryPipelinesMap.count(vertName) == 0)
+            {
+                std::cout << " >>> prepareVisibilityPipelines: creating ids pipeline of vertex shader: " << vertName << "\n";
+
+                VkPipeline pip;
+                this->prepareSinglePipeline(dev, vis.graph.getRenderPass(vis.geometryPass), pipelineCache,
+                                            { this->shadersMap.at(getPermutationShaderName(vertName, "visibility")), idsStage },
+                                            MaterialVariant(), PipelinePass::VISIBILITY_IDS, {}, {}, pip);
+                vis.geometryPipelinesMap[vertName] = pip;
+            }
+
+            if (vis.shadingPipelinesMap.count(entity3dInfo.shadersSetName) == 0)
+            {
+                std::cout << " >>> prepareVisibilityPipelines: creating shading pipeline of shader set: " << entity3dInfo.shadersSetName << "\n";
+
+                const ShaderSetInfo& shadSetInfo = this->sceneInfo.shadersSetInfoMap.at(entity3dInfo.shadersSetName);
+                std::vector<VkPipelineShaderStageCreateInfo> shaderStages = { fullscreenStage };
+                for (const shader_name_t& shadName : shadSetInfo.shadersNames)
+                {
+                    if (this->sceneInfo.shadersInfoMap.at(shadName).shaderStage == VK_SHADER_STAGE_FRAGMENT_BIT)
+                    {
+                        shaderStages.push_back(this->shadersMap.at(getPermutationShaderName(shadName, "visibility")));
+                    }
+                }
+
+                VkPipeline pip;
+                this->prepareSinglePipeline(dev, vis.graph.getRenderPass(vis.shadingPass), pipelineCache, shaderStages,
+                                            shadSetInfo.variant, PipelinePass::VISIBILITY_SHADING, {}, {}, pip);
+                vis.shadingPipelinesMap[entity3dInfo.shadersSetName] = pip;
+            }
+        }
+        this->shaderCache.release(idsStage.module);
+        this->shaderCache.release(fullscreenStage.module);
+    }
+
+    /// Ids pass - all entities, culled by CPU frustum culling when it is enabled (GPU occlusion culling isn't used here).
+    /// Drawn with sequential indices, same index ranges - gl_VertexIndex is the position in the global index buffer.
+    void recordVisibilityDraws(VkCommandBuffer cmdBuffer)
+    {
+        SceneVisibilityBuffer& vis = this->visibilityBuffer;
+        this->vertexPulling.meshes.bindSequentialIndexBuffer(cmdBuffer);
+
+        const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+        uint32_t   entityIndex   = 0;
+        VkPipeline boundPipeline = VK_NULL_HANDLE;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const VkPipeline pipeline = vis.geometryPipelinesMap.at(this->getVertexShaderName(entity3dInfo));
+            vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &this->descriptorSetsMap.at(entityName), 0, NULL);
+            if (pipeline != boundPipeline)
+            {
+                vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                boundPipeline = pipeline;
+            }
+            const uint32_t firstIndex = this->bindEntityMesh(cmdBuffer, entityIndex, entity3dInfo.meshName, 0, nullptr, true); // Nothing bound with pulling.
+            if (this->frustumCulling.isEnabled)
+            {
+                const VkDeviceSize sliceOffset = this->frustumCulling.commands.getSliceOffset(vis.bufferIndex);
+                vkCmdDrawIndexedIndirect(cmdBuffer, this->frustumCulling.commands.buffer, sliceOffset + entityIndex * stride, 1, stride);
+            }
+            else
+            {
+                vkCmdDrawIndexed(cmdBuffer, this->meshesMap.at(entity3dInfo.meshName).indexCount, 1, firstIndex, 0, 0);
+            }
+            entityIndex++;
+        }
+    }
+
+    /// Shading pass - a full-screen triangle classifying pixels by batch, then one per batch, with the descriptor set (textures)
+    /// of its first entity, whose index is pushed - its depth is the batch's, pixels of other batches fail the depth test.
+    void recordVisibilityShading(VkCommandBuffer cmdBuffer)
+    {
+        SceneVisibilityBuffer& vis = this->visibilityBuffer;
+        if (vis.batches.empty())
+        {
+            return;
+        }
+        // Any descriptor set - all have the ids and entities
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &this->descriptorSetsMap.begin()->second, 0, NULL);
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vis.classifyPipeline);
+        vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+
+        for (uint32_t first : vis.batches)
+        {
+            auto entity = std::next(this->sceneInfo.entities3dInfoMap.begin(), first);
+            vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &this->descriptorSetsMap.at(entity->first), 0, NULL);
+            vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vis.shadingPipelinesMap.at(entity->second.shadersSetName));
+            const EntityPushConstants pushConstants = { first, 0 };
+            vkCmdPushConstants(cmdBuffer, this->pipelineLayout, this->pushConstantRange.stageFlags, 0, this->pushConstantRange.size, &pushConstants);
+            vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+        }
+    }
+
+    /// Ids and depth follow the frame size - the graph is compiled again, descriptor sets get the new ids image.
+    /// The device must be idle, as on resize.
+    void updateVisibilityBuffer(vks::VulkanDevice* dev, uint32_t width, uint32_t height)
+    {
+        SceneVisibilityBuffer& vis = this->visibilityBuffer;
+        const RenderGraph::Resource& ids = vis.graph.resources[vis.idsImage];
+        if (ids.width == width && ids.height == height)
+        {
+            return;
+        }
+
+        for (RenderGraph::resource_id_t res : { vis.idsImage, vis.depthImage, vis.batchImage, vis.frameImage })
+        {
+            vis.graph.setExtent(res, width, height);
+        }
+        vis.graph.compile(dev); // Pipelines stay - formats of the passes are the same.
+        vis.idsDescriptor.imageView = vis.graph.getView(vis.idsImage);
+        for (auto& [entityName, descSet] : this->descriptorSetsMap)
+        {
+            this->writeDescriptorSet(dev, this->sceneInfo.entities3dInfoMap[entityName], descSet);
+        }
+    }
+
+    /// Records a frame drawn through the visibility buffer into the swapchain image. bufferIndex - of the draw command buffer.
+    void recordVisibilityFrame(VkCommandBuffer cmdBuffer, uint32_t bufferIndex, VkImage frameImage, VkImageView frameView)
+    {
+        SceneVisibilityBuffer& vis = this->visibilityBuffer;
+        vis.bufferIndex = bufferIndex;
+        vis.graph.setImportedImage(vis.frameImage, frameImage, frameView);
+        vis.graph.execute(cmdBuffer);
+    }
+
+    // } // PREPARING_VISIBILITY_BUFFER
+
+    // PREPARING_CLUSTERED_LIGHTS {
+
+    /// Buffers of lights and cluster lists - material shaders read them, so they are created even without binning, with no lights.
+    /// Binning pipeline (cluster_lights.comp) is created if clustered lights are enabled.
+    /// Must be called before descriptor sets are set up.
+    void prepareClusteredLights(vks::VulkanDevice* dev, VkQueue& queue, VkPipelineCache pipelineCache, const std::string& assetsPath)
+    {
+        VkPipelineShaderStageCreateInfo binningShaderStage = {};
+        if (this->lights.isEnabled)
+        {
+            binningShaderStage = this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/cluster_lights.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        }
+        this->lights.clusters.prepare(dev, queue, pipelineCache, binningShaderStage);
+        if (this->lights.isEnabled)
+        {
+            this->shaderCache.release(binningShaderStage.module);
+        }
+    }
+
+    /// Adds a light - in space of the entity it is attached to (it follows its world matrix, range is not scaled), or in world space.
+    /// Returns its index, for setLight().
+    uint32_t addLight(const ClusteredLights::Light& light, const entity_name_t& entityName = entity_name_t())
+    {
+        this->lights.locals.push_back(light);
+        this->lights.entities.push_back(entityName.empty() ? TransformHierarchy::ROOT : this->getEntityIndex(entityName));
+        return this->lights.locals.size() - 1;
+    }
+
+    /// Moves or changes a light - from the next updateLights().
+    void setLight(uint32_t lightIndex, const ClusteredLights::Light& light)
+    {
+        this->lights.locals[lightIndex] = light;
+    }
+
+    /// Records binning of lights of this frame, before render passes which shade with them.
+    void recordLightBinning(VkCommandBuffer cmdBuffer)
+    {
+        this->lights.clusters.record(cmdBuffer);
+    }
+
+    // } // PREPARING_CLUSTERED_LIGHTS
+
+    // PREPARING_MOTION_VECTORS {
+
+    /// Previous world matrices and params of motion permutations - renderPass is the motion vectors pass of TemporalUpscaler,
+    /// pipelines are created with it by preparePipelines(). Must be called after uniform buffers are prepared, before descriptor
+    /// sets are set up.
+    void prepareMotionVectors(vks::VulkanDevice* dev, VkRenderPass renderPass)
+    {
+        SceneMotionVectors& motion = this->motionVectors;
+        motion.renderPass = renderPass;
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &motion.previousTransforms,
+            this->transformHierarchy.size() * sizeof(glm::mat4)));
+        VK_CHECK_RESULT(motion.previousTransforms.map());
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &motion.params,
+            sizeof(SceneMotionVectors::Params)));
+        VK_CHECK_RESULT(motion.params.map());
+
+        this->resetPreviousWorldMatrices();
+    }
+
+    /// Previous world matrices are the current ones - nothing moved.
+    void resetPreviousWorldMatrices()
+    {
+        SceneMotionVectors& motion = this->motionVectors;
+        motion.worlds.resize(this->transformHierarchy.size());
+        motion.moved.clear();
+        glm::mat4* previous = static_cast<glm::mat4*>(motion.previousTransforms.mapped);
+        for (uint32_t i = 0; i < this->transformHierarchy.size(); i++)
+        {
+            motion.worlds[i] = this->transformHierarchy.getWorld(i);
+            previous[i]      = motion.worlds[i];
+        }
+    }
+
+    /// Missing motion pipelines, per vertex shader - with its motion permutation and motion.frag. Created synchronously, with shaders loaded.
+    void prepareMotionPipelines(vks::VulkanDevice* dev, VkPipelineCache pipelineCache, const std::string& assetsPath)
+    {
+        SceneMotionVectors& motion = this->motionVectors;
+        if (false == motion.isEnabled)
+        {
+            return;
+        }
+
+        const VkPipelineShaderStageCreateInfo motionStage =
+            this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/base/motion.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            const shader_name_t vertName = this->getVertexShaderName(entity3dInfo);
+            if (motion.pipelinesMap.count(vertName) > 0)
+            {
+                continue;
+            }
+
+            std::cout << " >>> prepareMotionPipelines: creating motion pipeline of vertex shader: " << vertName << "\n";
+
+            VkPipeline pip;
+            this->prepareSinglePipeline(dev, motion.renderPass, pipelineCache,
+                                        { this->shadersMap.at(getPermutationShaderName(vertName, "motion")), motionStage },
+                                        MaterialVariant(), PipelinePass::MOTION_VECTORS, {}, {}, pip);
+            motion.pipelinesMap[vertName] = pip;
+        }
+        this->shaderCache.release(motionStage.module);
+    }
+
+    /// Records motion vectors of the entities drawn by this command buffer (both phases of culling), inside the motion vectors
+    /// pass - over the scene's depth, which they test for EQUAL.
+    void recordMotionVectors(VkCommandBuffer cmdBuffer, uint32_t vertexBufferBindId, const VkDeviceSize* offsets, uint32_t bufferIndex)
+    {
+        this->recordEntityDraws(cmdBuffer, vertexBufferBindId, offsets, DrawPhase::EARLY, bufferIndex, &this->motionVectors.pipelinesMap);
+        if (this->culling.isEnabled)
+        {
+            this->recordEntityDraws(cmdBuffer, vertexBufferBindId, offsets, DrawPhase::LATE, bufferIndex, &this->motionVectors.pipelinesMap);
+        }
+    }
+
+    // } // PREPARING_MOTION_VECTORS
+
+    // PREPARING_CULLING {
+
+    /// In this method we create everything needed by occlusion culling:
+    /// * bounding sphere of every entity, around its box - mapped, moving entities update them,
+    /// * visibility - everything is visible in the first frame,
+    /// * indirect draw commands - only their instance counts are written by culling,
+    /// * descriptor set, early and late culling pipelines (cull.comp specialized by phase),
+    /// * depth pyramid, which is sized later, in updateDepthPyramid().
+    /// Descriptor pool must be set up with culling enabled.
+    /// It requires:
+    /// * vks::VulkanDevice*
+    /// * VkQueue            // for uploading initial buffers contents
+    /// * VkDescriptorPool
+    /// * VkPipelineCache
+    void prepareCulling(vks::VulkanDevice* dev,
+                        VkQueue& queue,
+                        VkDescriptorPool& descPool,
+                        VkPipelineCache pipelineCache,
+                        std::string assetsPath)
+    {
+        const uint32_t entityCount = this->sceneInfo.entities3dInfoMap.size();
+
+        std::vector<VkDrawIndexedIndirectCommand> commands = this->getDrawCommands();
+        commands.insert(commands.end(), commands.begin(), commands.end()); // Late draws.
+
+        // Spheres follow moving entities - written by updateTransforms()
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->culling.bounds,
+            entityCount * sizeof(glm::vec4)));
+        VK_CHECK_RESULT(this->culling.bounds.map());
+        glm::vec4* spheres = static_cast<glm::vec4*>(this->culling.bounds.mapped);
+        for (uint32_t i = 0; i < entityCount; i++)
+        {
+            spheres[i] = this->getBoundingSphere(i);
+        }
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &this->culling.visibility,
+            entityCount * sizeof(uint32_t)));
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &this->culling.commands,
+            commands.size() * sizeof(VkDrawIndexedIndirectCommand)));
+
+        // Small enough for inline updates
+        assert(this->culling.commands.size <= 65536);
+        VkCommandBuffer copyCmd = dev->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vkCmdUpdateBuffer(copyCmd, this->culling.commands.buffer, 0, this->culling.commands.size, commands.data());
+        vkCmdFillBuffer(copyCmd,   this->culling.visibility.buffer, 0, VK_WHOLE_SIZE, 1);
+        dev->flushCommandBuffer(copyCmd, queue, true);
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         VK_SHADER_STAGE_COMPUTE_BIT, 0), // Binding 0 : View and projection
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         VK_SHADER_STAGE_COMPUTE_BIT, 1), // Binding 1 : Bounding spheres
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         VK_SHADER_STAGE_COMPUTE_BIT, 2), // Binding 2 : Visibility
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         VK_SHADER_STAGE_COMPUTE_BIT, 3), // Binding 3 : Draw commands
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 4), // Binding 4 : Depth pyramid
+        };
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo( setLayoutBindings.data(), setLayoutBindings.size());
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(dev->logicalDevice, &descriptorLayout, nullptr, &this->culling.descriptorSetLayout));
+
+        VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo( &this->culling.descriptorSetLayout, 1);
+        VkPushConstantRange pushConstantRange =
+            vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t), 0); // Entity count.
+        pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(dev->logicalDevice, &pPipelineLayoutCreateInfo, nullptr, &this->culling.pipelineLayout));
+
+        VkDescriptorSetAllocateInfo descripotrSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(descPool, &this->culling.descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(dev->logicalDevice, &descripotrSetAllocInfo, &this->culling.descriptorSet));
+
+        // Binding 4 is written once the pyramid exists, in updateDepthPyramid()
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(this->culling.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &this->uniformBuffers.scene.descriptor),
+            vks::initializers::writeDescriptorSet(this->culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &this->culling.bounds.descriptor),
+            vks::initializers::writeDescriptorSet(this->culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &this->culling.visibility.descriptor),
+            vks::initializers::writeDescriptorSet(this->culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &this->culling.commands.descriptor),
+        };
+        vkUpdateDescriptorSets(dev->logicalDevice, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+
+        // Phase is a specialization constant
+        int32_t phase = 0;
+        VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(int32_t));
+        VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(phase), &phase);
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo =
+            vks::initializers::computePipelineCreateInfo(this->culling.pipelineLayout, 0);
+        computePipelineCreateInfo.stage = this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+
+        phase = static_cast<int32_t>(DrawPhase::EARLY);
+        VK_CHECK_RESULT(vkCreateComputePipelines(dev->logicalDevice, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &this->culling.earlyPipeline));
+        phase = static_cast<int32_t>(DrawPhase::LATE);
+        VK_CHECK_RESULT(vkCreateComputePipelines(dev->logicalDevice, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &this->culling.latePipeline));
+        this->shaderCache.release(computePipelineCreateInfo.stage.module);
+
+        const VkPipelineShaderStageCreateInfo reduceShaderStage =
+            this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/base/hiz.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        this->culling.depthPyramid.prepare(dev, pipelineCache, reduceShaderStage);
+        this->shaderCache.release(reduceShaderStage.module);
+    }
+
+    /// Depth pyramid follows the depth buffer, which is recreated on resize.
+    void updateDepthPyramid(vks::VulkanDevice* dev, VkImage depthImage, VkFormat depthFormat, uint32_t width, uint32_t height)
+    {
+        if (this->culling.depthPyramid.update(depthImage, depthFormat, width, height))
+        {
+            VkWriteDescriptorSet writeDescriptorSet =
+                vks::initializers::writeDescriptorSet(this->culling.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, &this->culling.depthPyramid.descriptor);
+            vkUpdateDescriptorSets(dev->logicalDevice, 1, &writeDescriptorSet, 0, NULL);
+        }
+    }
+
+    /// Indirect draw buffer of CPU frustum culling, slices are written by cullEntities().
+    void prepareFrustumCulling(vks::VulkanDevice* dev, uint32_t sliceCount)
+    {
+        const std::vector<VkDrawIndexedIndirectCommand> commands = this->getDrawCommands();
+        this->frustumCulling.commands.create(dev, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                             commands.size() * sizeof(VkDrawIndexedIndirectCommand), sliceCount, commands.data());
+    }
+
+    /// One draw of every entity's mesh.
+    std::vector<VkDrawIndexedIndirectCommand> getDrawCommands()
+    {
+        std::vector<VkDrawIndexedIndirectCommand> commands;
+        for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+        {
+            VkDrawIndexedIndirectCommand command = {};
+            command.indexCount    = this->meshesMap[entity3dInfo.meshName].indexCount;
+            command.instanceCount = 1;
+            if (this->vertexPulling.isEnabled) // Mesh is a range of the global index buffer.
+            {
+                command.firstIndex = this->vertexPulling.meshes.ranges[this->vertexPulling.meshIndices.at(entity3dInfo.meshName)].firstIndex;
+            }
+            commands.push_back(command);
+        }
+        return commands;
+    }
+
+    // } // PREPARING_CULLING
+
+    /// In this method we record culling of one phase, outside of render pass.
+    /// Early phase must be recorded before the early render pass, late phase after the pyramid is built.
+    /// It requires:
+    /// * VkCommandBuffer
+    /// * DrawPhase
+    void recordCulling(VkCommandBuffer& cmdBuffer, DrawPhase phase)
+    {
+        const uint32_t entityCount = this->sceneInfo.entities3dInfoMap.size();
+
+        // Previous frame must be done with the draw commands and visibility
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        if (phase == DrawPhase::EARLY)
+        {
+            vkCmdPipelineBarrier(
+                cmdBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                1, &memoryBarrier,
+                0, nullptr,
+                0, nullptr);
+        }
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, phase == DrawPhase::EARLY ? this->culling.earlyPipeline : this->culling.latePipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->culling.pipelineLayout, 0, 1, &this->culling.descriptorSet, 0, NULL);
+        vkCmdPushConstants(cmdBuffer, this->culling.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &entityCount);
+        vkCmdDispatch(cmdBuffer, (entityCount + 63) / 64, 1, 1); // Local size of cull.comp.
+
+        // Instance counts are read by indirect draws
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+    }
+
+    /// Binds entity's mesh - vertex buffer (or its position stream) and index buffer - and pushes entity's constants.
+    /// The zero vertex goes to the next binding, for inputs which the mesh doesn't store (see getVertexInputDescriptions()).
+    /// With vertex pulling nothing is bound, the mesh is a range of the global index buffer. Returns first index of the mesh.
+    uint32_t bindEntityMesh(VkCommandBuffer cmdBuffer, uint32_t entityIndex, const mesh_name_t& meshName, uint32_t vertexBufferBindId, const VkDeviceSize* offsets, bool isPositionOnly)
+    {
+        uint32_t firstIndex = 0;
+        EntityPushConstants pushConstants = { entityIndex, 0 };
+        if (this->vertexPulling.isEnabled)
+        {
+            pushConstants.meshIndex = this->vertexPulling.meshIndices.at(meshName);
+            firstIndex = this->vertexPulling.meshes.ranges[pushConstants.meshIndex].firstIndex;
+        }
+        else
+        {
+            const vks::Model& model = this->meshesMap.at(meshName);
+            const VkBuffer     vertices[]      = { isPositionOnly ? this->depthPrepass.positionBuffers.at(meshName).buffer : model.vertices.buffer,
+                                                   this->uniformBuffers.zeroVertex.buffer };
+            const VkDeviceSize bufferOffsets[] = { offsets[0], 0 };
+            vkCmdBindVertexBuffers(cmdBuffer,  vertexBufferBindId, isPositionOnly ? 1 : 2, vertices, bufferOffsets);
+            vkCmdBindIndexBuffer(cmdBuffer,    model.indices.buffer,  0, VK_INDEX_TYPE_UINT32);
+        }
+        if (this->pushConstantRange.size > 0)
+        {
+            vkCmdPushConstants(cmdBuffer,  this->pipelineLayout,  this->pushConstantRange.stageFlags, 0, this->pushConstantRange.size, &pushConstants);
+        }
+        return firstIndex;
+    }
+
+    /// In this method we fill command buffer with draw commands.
+    /// First we bind needed handles:
+    /// * DescriptorSets
+    /// * Pipeline
+    /// * VertexBuffers
+    /// * IndexBuffer
+    /// Then we insert draw command with: vkCmdDrawIndexed.
+    /// With culling enabled draw is indirect - its instance count is 0 when the entity is culled in this phase.
+    /// With CPU frustum culling draw is indirect too, from the slice of the command buffer.
+    /// Without culling everything is drawn in early phase.
+    /// With vertex pulling nothing is bound per entity but the descriptor set and pipeline - the global index buffer is bound once,
+    /// entity's mesh is its index range and mesh index (push constant).
+    /// With depth pre-pass active, entities of the phase are drawn twice in the same render pass - depth only from position streams,
+    /// then shaded (pipelines test depth for EQUAL) - both with the same draw command, so culling applies to both.
+    /// It requires:
+    /// * VkCommandBuffer
+    /// * VkPipelineBindPoint
+    /// * VkPipelineLayout
+    /// * VkPipeline
+    /// * vertex buffer bind id
+    /// * VkBuffer*              // buffer with vertex data
+    /// * VkDeviceSize*          // offsets for binding vertex buffer
+    /// * VkBuffer*              // buffer with index data
+    /// * VkIndexType
+    /// * index count
+    /// * DrawPhase
+    /// * command buffer index
+    void recordDrawCommandsForEntities(VkCommandBuffer& drawCmdBuffer, uint32_t vertexBufferBindId, const VkDeviceSize* offsets, DrawPhase phase = DrawPhase::EARLY, uint32_t bufferIndex = 0)
+    { // This is fully scene specific.
+        if (false == this->culling.isEnabled && phase == DrawPhase::LATE)
+        {
+            return;
+        }
+
+        if (this->overdraw.isHeatmapShown)
+        {
+            this->recordEntityDraws(drawCmdBuffer, vertexBufferBindId, offsets, phase, bufferIndex, &this->overdraw.heatmapPipelinesMap);
+            return;
+        }
+        if (this->depthPrepass.isActive)
+        {
+            this->recordEntityDraws(drawCmdBuffer, vertexBufferBindId, offsets, phase, bufferIndex, &this->depthPrepass.pipelinesMap);
+        }
+        this->recordEntityDraws(drawCmdBuffer, vertexBufferBindId, offsets, phase, bufferIndex, nullptr);
+    }
+
+    /// Draws of entities in the phase, as recordDrawCommandsForEntities() records them. Position only draws (pre-pass, heatmap,
+    /// motion vectors) use given pipelines of entities' vertex shaders - entities without a pipeline ready are skipped by all of them.
+    void recordEntityDraws(VkCommandBuffer drawCmdBuffer, uint32_t vertexBufferBindId, const VkDeviceSize* offsets, DrawPhase phase, uint32_t bufferIndex,
+                           const std::map<shader_name_t, VkPipeline>* positionOnlyPipelines)
+    {
+        if (this->vertexPulling.isEnabled)
+        {
+            this->vertexPulling.meshes.bindIndexBuffer(drawCmdBuffer);
+        }
+        assert(this->pushConstantRange.size <= sizeof(EntityPushConstants));
+
+        const bool isPositionOnly = positionOnlyPipelines != nullptr;
+        const uint32_t entityCount = this->sceneInfo.entities3dInfoMap.size();
+        uint32_t commandIndex = phase == DrawPhase::EARLY ? 0 : entityCount;
+        uint32_t entityIndex  = 0;
+        VkPipeline boundPipeline = VK_NULL_HANDLE;
+
+        for (auto& entCreInfMap : this->sceneInfo.entities3dInfoMap)
+        {
+            entity_name_t entName   = entCreInfMap.first;
+            Entity3dInfo& entCreInf = entCreInfMap.second;
+
+            mesh_name_t& modelName = entCreInf.meshName;
+
+            auto& descrSet = this->descriptorSetsMap[entName];
+            auto  pipeline = this->getDrawPipeline(entName, entCreInf);
+            auto& model    = this->meshesMap[modelName];
+
+            if (pipeline == VK_NULL_HANDLE) // Not ready yet, and no fallback.
+            {
+                entityIndex++;
+                commandIndex++;
+                continue;
+            }
+            if (isPositionOnly)
+            {
+                pipeline = positionOnlyPipelines->at(this->getVertexShaderName(entCreInf));
+            }
+
+            if (this->isDrawRecordingLogged)
+            {
+                std::cout << " >>> buildCommandBuffer: building draw command buffer for entity: " << entName << (isPositionOnly ? " (position only)\n" : "\n");
+            }
+
+            vkCmdBindDescriptorSets(drawCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &descrSet, 0, NULL);
+            if (pipeline != boundPipeline) // Entities share pipelines.
+            {
+                vkCmdBindPipeline(drawCmdBuffer,   VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                boundPipeline = pipeline;
+            }
+            const uint32_t firstIndex = this->bindEntityMesh(drawCmdBuffer, entityIndex++, modelName, vertexBufferBindId, offsets, isPositionOnly);
+            const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+            if (this->culling.isEnabled)
+            {
+                vkCmdDrawIndexedIndirect(drawCmdBuffer, this->culling.commands.buffer, (commandIndex++) * stride, 1, stride);
+            }
+            else if (this->frustumCulling.isEnabled)
+            {
+                const VkDeviceSize sliceOffset = this->frustumCulling.commands.getSliceOffset(bufferIndex);
+                vkCmdDrawIndexedIndirect(drawCmdBuffer, this->frustumCulling.commands.buffer, sliceOffset + (commandIndex++) * stride, 1, stride);
+            }
+            else
+            {
+                vkCmdDrawIndexed(drawCmdBuffer,    model.indexCount,      1, firstIndex, 0, 0);
+            }
+        }
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    void updateUniformBuffers(bool viewChanged, glm::mat4& viewMat, glm::mat4& perspMat)
+    {
+        if (viewChanged)
+        {
+            this->uboVS.view       = viewMat;
+            this->uboVS.projection = perspMat;
+        }
+
+        // Copy to device memory.
+        this->copyDataToDeviceMemory();
+    }
+
+    void copyDataToDeviceMemory()
+    {
+        memcpy(this->uniformBuffers.scene.mapped, &this->uboVS, sizeof(this->uboVS));
+    }
+
+    /// Entity's model matrix, relative to its parent - it and its children are moved by the next updateTransforms().
+    void setEntityMatrix(const entity_name_t& entityName, const glm::mat4& matrix)
+    {
+        this->transformHierarchy.setLocal(this->getEntityIndex(entityName), matrix);
+    }
+
+    /// Propagates changed model matrices down the hierarchy into the transform buffer,
+    /// and moves bounds of the updated entities - boxes, BVH (refit) and spheres of GPU culling.
+    void updateTransforms()
+    {
+        const std::vector<uint32_t>& updated = this->transformHierarchy.update(&this->threadPool, this->uniformBuffers.transforms.mapped, sizeof(glm::mat4));
+        if (this->motionVectors.isEnabled)
+        {
+            this->updatePreviousWorldMatrices(updated);
+        }
+        if (updated.empty())
+        {
+            return;
+        }
+
+        glm::vec4* spheres = this->culling.isEnabled ? static_cast<glm::vec4*>(this->culling.bounds.mapped) : nullptr;
+        for (uint32_t entity : updated)
+        {
+            glm::vec3 boxMin, boxMax;
+            AabbSoA::transform(this->transformHierarchy.getWorld(entity), this->meshBounds.getMin(entity), this->meshBounds.getMax(entity), boxMin, boxMax);
+            this->entityBounds.set(entity, boxMin, boxMax);
+            this->entityBvh.markDirty(entity);
+            if (spheres)
+            {
+                spheres[entity] = this->getBoundingSphere(entity);
+            }
+        }
+        this->entityBvh.refitDirty(this->entityBounds);
+    }
+
+    /// Previous world matrix of an entity moved now is where it was drawn in the last frame. Entities which stopped get
+    /// their current one again - they don't move on screen any more.
+    void updatePreviousWorldMatrices(const std::vector<uint32_t>& updated)
+    {
+        SceneMotionVectors& motion = this->motionVectors;
+        glm::mat4* previous = static_cast<glm::mat4*>(motion.previousTransforms.mapped);
+        for (uint32_t entity : motion.moved)
+        {
+            previous[entity] = motion.worlds[entity];
+        }
+        for (uint32_t entity : updated)
+        {
+            previous[entity]      = motion.worlds[entity];
+            motion.worlds[entity] = this->transformHierarchy.getWorld(entity);
+        }
+        motion.moved = updated;
+    }
+
+    /// Camera of motion vectors of the next frame - view-projection matrices without jitter, of it and the previous frame.
+    void updateMotionVectors(const glm::mat4& viewProjection, const glm::mat4& previousViewProjection)
+    {
+        const SceneMotionVectors::Params params = { viewProjection, previousViewProjection };
+        memcpy(this->motionVectors.params.mapped, &params, sizeof(params));
+    }
+
+    /// Lights of the next frame - attached ones follow world matrices of their entities (after updateTransforms()),
+    /// and the view they are binned for. width, height - of the frame.
+    void updateLights(const glm::mat4& viewMat, const glm::mat4& perspMat, uint32_t width, uint32_t height)
+    {
+        SceneLights& lights = this->lights;
+        lights.worlds.resize(lights.locals.size());
+        for (size_t i = 0; i < lights.locals.size(); i++)
+        {
+            ClusteredLights::Light light = lights.locals[i];
+            if (lights.entities[i] != TransformHierarchy::ROOT)
+            {
+                const glm::mat4& world = this->transformHierarchy.getWorld(lights.entities[i]);
+                light.positionRange = glm::vec4(glm::vec3(world * glm::vec4(glm::vec3(light.positionRange), 1.0f)), light.positionRange.w);
+                if (light.isSpot())
+                {
+                    light.directionCosOuter = glm::vec4(glm::normalize(glm::mat3(world) * glm::vec3(light.directionCosOuter)), light.directionCosOuter.w);
+                }
+            }
+            lights.worlds[i] = light;
+        }
+        lights.clusters.setLights(lights.worlds.data(), lights.worlds.size());
+        lights.clusters.setView(viewMat, perspMat, width, height);
+    }
+
+    /// CPU frustum culling - writes instance counts of the slice read by command buffer of this frame.
+    /// Returns fence, which must be signaled by submission of this command buffer.
+    VkFence cullEntities(uint32_t slice)
+    {
+        this->frustumCulling.frustum.update(this->uboVS.projection * this->uboVS.view);
+
+        uint8_t* commands = static_cast<uint8_t*>(this->frustumCulling.commands.beginWrite(slice));
+        uint8_t* instanceCounts = commands + offsetof(VkDrawIndexedIndirectCommand, instanceCount);
+        if (this->entityBounds.size() >= SceneFrustumCulling::BVH_MIN_ENTITIES)
+        {
+            this->frustumCulling.visibleCount = this->entityBvh.writeVisibility(
+                this->frustumCulling.frustum, this->entityBounds, instanceCounts, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        else
+        {
+            this->frustumCulling.visibleCount = this->frustumCulling.frustum.writeVisibility(
+                this->entityBounds, instanceCounts, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        this->frustumCulling.commands.endWrite(slice);
+
+        return this->frustumCulling.commands.getFence(slice);
+    }
+
+// } // RUNTIME
+
+// HOT_RELOAD {
+
+    /// Starts watching the scene file and every texture, mesh and shader it uses.
+    void enableHotReload(const std::string& assetsPath, const std::string& scenePath)
+    {
+        this->hotReload.isEnabled  = this->hotReload.watcher.isAvailable();
+        this->hotReload.assetsPath = assetsPath;
+        this->hotReload.scenePath  = scenePath;
+        this->watchSceneFiles();
+    }
+
+    void watchSceneFiles()
+    {
+        const std::string& assetsPath = this->hotReload.assetsPath;
+        this->hotReload.watcher.addFile(this->hotReload.scenePath);
+        for (auto& [texName, texInfo] : this->sceneInfo.texturesInfoMap)
+        {
+            this->hotReload.watcher.addFile(assetsPath + "textures/my_new_scene1/" + texInfo.textureFilename);
+        }
+        for (auto& [meshName, meshInfo] : this->sceneInfo.meshesInfoMap)
+        {
+            this->hotReload.watcher.addFile(assetsPath + "models/my_new_scene1/" + meshInfo.meshFilename);
+        }
+        for (auto& [shadName, shadInfo] : this->sceneInfo.shadersInfoMap)
+        {
+            for (const shader_filename_t& filename : this->getShaderFilenames(shadInfo))
+            {
+                this->hotReload.watcher.addFile(assetsPath + "shaders/my_new_scene1/" + filename);
+            }
+        }
+    }
+
+    /// Applies changes of watched files. The new scene definition is compared with the live one and only what differs
+    /// is reloaded - changed textures, meshes and shaders - then only what depends on them is rebuilt:
+    /// * descriptor sets of entities whose textures changed,
+    /// * pipelines of entities whose shaders changed,
+    /// * entity data (transforms, bounds, draw commands), when meshes or matrices changed,
+    /// * depth pre-pass pipelines of changed vertex shaders - and all entity pipelines, when settings switch the pre-pass on or off,
+    /// * visibility buffer pipelines of changed shaders and shader sets, and its batches.
+    /// Adding or removing entities (or changing texture set size) changes descriptor pool and culling buffers - it needs a restart,
+    /// as do shaders whose descriptor bindings or push constants no longer fit the pipeline layout - nothing is reloaded then.
+    /// Meshes are loaded again also when shaders of their entities start or stop reading some vertex component.
+    /// Must be called between frames, when no draw command buffer is pending - descriptor sets are rewritten in place.
+    /// Returns true if draw command buffers must be recorded again.
+    bool reloadChangedFiles(vks::VulkanDevice* dev,
+                            VkQueue& queue,
+                            VkRenderPass renderPass,
+                            VkPipelineCache pipelineCache,
+                            uint32_t vertexBindId,
+                            uint32_t sliceCount)
+    {
+        if (!this->hotReload.isEnabled)
+        {
+            return false;
+        }
+        const std::vector<std::string> changedFiles = this->hotReload.watcher.poll();
+        if (changedFiles.empty())
+        {
+            return false;
+        }
+        const auto timeStart = std::chrono::steady_clock::now();
+        const std::set<std::string> changed(changedFiles.begin(), changedFiles.end());
+        const std::string& assetsPath = this->hotReload.assetsPath;
+
+        SceneInfo newInfo = this->sceneInfo;
+        if (changed.count(this->hotReload.scenePath))
+        {
+            SceneFile sceneFile;
+            std::string error;
+            if (!sceneFile.loadOrCompile(this->hotReload.scenePath, error, true))
+            {
+                std::cout << " >>> reloadChangedFiles: " << error << "\n";
+            }
+            else
+            {
+                newInfo = SceneInfo();
+                newInfo.fillFromSceneFile(sceneFile);
+                if (!this->hasSameLayout(newInfo))
+                {
+                    std::cout << " >>> reloadChangedFiles: entities or texture set size changed - restart needed\n";
+                    newInfo = this->sceneInfo;
+                }
+            }
+        }
+
+        // Assets - changed definition or file
+        std::set<texture_name_t> textures;
+        for (auto& [texName, texInfo] : newInfo.texturesInfoMap)
+        {
+            auto old = this->sceneInfo.texturesInfoMap.find(texName);
+            const bool isRedefined = old == this->sceneInfo.texturesInfoMap.end() ||
+                                     old->second.textureFilename != texInfo.textureFilename || old->second.textureFormat != texInfo.textureFormat;
+            if (this->isTextureAlreadyCreated(texName) && (isRedefined || changed.count(assetsPath + "textures/my_new_scene1/" + texInfo.textureFilename)))
+            {
+                textures.insert(texName);
+            }
+        }
+        std::set<mesh_name_t> meshes;
+        for (auto& [meshName, meshInfo] : newInfo.meshesInfoMap)
+        {
+            auto old = this->sceneInfo.meshesInfoMap.find(meshName);
+            const bool isRedefined = old == this->sceneInfo.meshesInfoMap.end() || old->second.meshFilename != meshInfo.meshFilename;
+            if (this->isMeshAlreadyCreated(meshName) && (isRedefined || changed.count(assetsPath + "models/my_new_scene1/" + meshInfo.meshFilename)))
+            {
+                meshes.insert(meshName);
+            }
+        }
+        std::set<shader_name_t> shaders;
+        for (auto& [shadName, shadInfo] : newInfo.shadersInfoMap)
+        {
+            auto old = this->sceneInfo.shadersInfoMap.find(shadName);
+            const bool isRedefined = old == this->sceneInfo.shadersInfoMap.end() ||
+                                     old->second.shaderFilename != shadInfo.shaderFilename || old->second.shaderStage != shadInfo.shaderStage;
+            const std::vector<shader_filename_t> filenames = this->getShaderFilenames(shadInfo);
+            if (isRedefined || std::any_of(filenames.begin(), filenames.end(), [&](const shader_filename_t& f) { return changed.count(assetsPath + "shaders/my_new_scene1/" + f) > 0; }))
+            {
+                shaders.insert(shadName);
+            }
+        }
+
+        // Changed shaders must fit the pipeline layout, reflected from the shaders at startup - so must depth permutations
+        // of all vertex shaders, when the depth pre-pass is turned on
+        const bool isPrepassChanged = newInfo.settings != this->sceneInfo.settings;
+        std::set<shader_name_t> checkedShaders = shaders;
+        for (auto& [shadName, shadInfo] : newInfo.shadersInfoMap)
+        {
+            if (isPrepassChanged && shadInfo.shaderStage == VK_SHADER_STAGE_VERTEX_BIT)
+            {
+                checkedShaders.insert(shadName);
+            }
+        }
+        for (const shader_name_t& shadName : checkedShaders)
+        {
+            const ShaderInfo& shadInfo = newInfo.shadersInfoMap.at(shadName);
+            for (const shader_filename_t& filename : this->getShaderFilenames(shadInfo, newInfo.settings))
+            {
+                const VkPipelineShaderStageCreateInfo shaderStage =
+                    this->shaderCache.acquire(dev->logicalDevice, assetsPath + "shaders/my_new_scene1/" + filename, shadInfo.shaderStage);
+                const bool isFitting = this->fitsPipelineLayout(this->shaderCache.getReflection(shaderStage.module));
+                this->shaderCache.release(shaderStage.module);
+                if (!isFitting)
+                {
+                    std::cout << " >>> reloadChangedFiles: resources of shader " << filename << " changed - restart needed\n";
+                    return false;
+                }
+            }
+        }
+
+        // Entities - which of their GPU objects depend on what changed
+        std::set<entity_name_t> descriptorEntities;
+        std::set<entity_name_t> pipelineEntities;
+        bool isEntityDataChanged = !meshes.empty();
+        for (auto& [entityName, entity3dInfo] : newInfo.entities3dInfoMap)
+        {
+            const Entity3dInfo& old = this->sceneInfo.entities3dInfoMap.at(entityName);
+
+            const std::vector<texture_name_t>& texNames    = newInfo.texturesSetInfoMap.at(entity3dInfo.texturesSetName).texturesNames;
+            const std::vector<texture_name_t>& oldTexNames = this->sceneInfo.texturesSetInfoMap.at(old.texturesSetName).texturesNames;
+            if (texNames != oldTexNames || std::any_of(texNames.begin(), texNames.end(), [&](const texture_name_t& n) { return textures.count(n) > 0; }))
+            {
+                descriptorEntities.insert(entityName);
+            }
+
+            const ShaderSetInfo& shadSet    = newInfo.shadersSetInfoMap.at(entity3dInfo.shadersSetName);
+            const ShaderSetInfo& oldShadSet = this->sceneInfo.shadersSetInfoMap.at(old.shadersSetName);
+            const std::vector<shader_name_t>& shadNames = shadSet.shadersNames;
+            if (shadNames != oldShadSet.shadersNames || shadSet.variant != oldShadSet.variant || entity3dInfo.meshName != old.meshName ||
+                std::any_of(shadNames.begin(), shadNames.end(), [&](const shader_name_t& n) { return shaders.count(n) > 0; }))
+            {
+                pipelineEntities.insert(entityName);
+            }
+
+            if (entity3dInfo.meshName != old.meshName || entity3dInfo.parentName != old.parentName || entity3dInfo.matrixName != old.matrixName ||
+                newInfo.matriciesInfoMap.at(entity3dInfo.matrixName).matrix != this->sceneInfo.matriciesInfoMap.at(old.matrixName).matrix)
+            {
+                isEntityDataChanged = true;
+            }
+        }
+
+        // Replaced objects are retired, new ones are created by the usual loaders - they create only what is missing
+        for (const texture_name_t& texName : textures)
+        {
+            this->retire([tex = this->texturesMap[texName]]() mutable { tex.destroy(); });
+            this->texturesMap.erase(texName);
+        }
+        for (const mesh_name_t& meshName : meshes)
+        {
+            this->unloadMesh(meshName);
+        }
+        auto isUsingChangedShader = [&](const pipeline_key_t& key)
+        {
+            return std::any_of(key.shadersNames.begin(), key.shadersNames.end(), [&](const shader_name_t& n) { return shaders.count(n) > 0; });
+        };
+        for (auto* pipelines : { &this->uniquePipelinesMap, &this->asyncPipelines.fallbackPipelinesMap })
+        {
+            for (auto it = pipelines->begin(); it != pipelines->end();)
+            {
+                if (isUsingChangedShader(it->first))
+                {
+                    this->retire([device = dev->logicalDevice, pipeline = it->second]() { vkDestroyPipeline(device, pipeline, nullptr); });
+                    it = pipelines->erase(it);
+                }
+                else
+                {
+                    it++;
+                }
+            }
+        }
+        for (SceneAsyncPipelines::Job& job : this->asyncPipelines.pending)
+        {
+            job.isStale = job.isStale || isUsingChangedShader(job.key);
+        }
+        for (const entity_name_t& entityName : pipelineEntities)
+        {
+            this->pipelinesMap.erase(entityName);
+        }
+        const bool isDepthPermutationDropped = false == this->isDepthPermutationNeeded(newInfo.settings);
+        for (auto* pipelines : { &this->depthPrepass.pipelinesMap, &this->depthPrepass.overdrawPipelinesMap,
+                                 &this->overdraw.heatmapPipelinesMap, &this->overdraw.surfacePipelinesMap })
+        {
+            for (auto it = pipelines->begin(); it != pipelines->end();)
+            {
+                if (isDepthPermutationDropped || shaders.count(it->first) > 0)
+                {
+                    this->retire([device = dev->logicalDevice, pipeline = it->second]() { vkDestroyPipeline(device, pipeline, nullptr); });
+                    it = pipelines->erase(it);
+                }
+                else
+                {
+                    it++;
+                }
+            }
+        }
+        // Visibility pipelines - ids ones of changed vertex shaders, shading ones of shader sets which changed or use a changed shader.
+        // Motion pipelines of changed vertex shaders too
+        for (auto* pipelines : { &this->visibilityBuffer.geometryPipelinesMap, &this->motionVectors.pipelinesMap })
+        {
+            for (auto it = pipelines->begin(); it != pipelines->end();)
+            {
+                if (shaders.count(it->first) > 0)
+                {
+                    this->retire([device = dev->logicalDevice, pipeline = it->second]() { vkDestroyPipeline(device, pipeline, nullptr); });
+                    it = pipelines->erase(it);
+                }
+                else
+                {
+                    it++;
+                }
+            }
+        }
+        auto& shadingPipelines = this->visibilityBuffer.shadingPipelinesMap;
+        for (auto it = shadingPipelines.begin(); it != shadingPipelines.end();)
+        {
+            const ShaderSetInfo& oldShadSet = this->sceneInfo.shadersSetInfoMap.at(it->first);
+            const std::vector<shader_name_t>& oldNames = oldShadSet.shadersNames;
+            auto shadSet = newInfo.shadersSetInfoMap.find(it->first);
+            if (shadSet == newInfo.shadersSetInfoMap.end() || shadSet->second.shadersNames != oldNames || shadSet->second.variant != oldShadSet.variant ||
+                std::any_of(oldNames.begin(), oldNames.end(), [&](const shader_name_t& n) { return shaders.count(n) > 0; }))
+            {
+                this->retire([device = dev->logicalDevice, pipeline = it->second]() { vkDestroyPipeline(device, pipeline, nullptr); });
+                it = shadingPipelines.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        if (isDepthPermutationDropped)
+        {
+            for (auto& [meshName, positions] : this->depthPrepass.positionBuffers)
+            {
+                this->retire([buffer = positions]() mutable { buffer.destroy(); });
+            }
+            this->depthPrepass.positionBuffers.clear();
+        }
+
+        this->sceneInfo = std::move(newInfo);
+        this->loadTextures(dev, queue, assetsPath);
+        this->loadShaders(dev, queue, assetsPath); // Shader modules aren't kept - changed files are simply read again.
+
+        // Meshes whose shaders read other vertex components now - loaded again, with pipelines of their entities
+        for (const mesh_name_t& meshName : this->updateMeshComponents())
+        {
+            if (this->isMeshAlreadyCreated(meshName))
+            {
+                this->unloadMesh(meshName);
+                meshes.insert(meshName);
+                isEntityDataChanged = true;
+            }
+            for (auto& [entityName, entity3dInfo] : this->sceneInfo.entities3dInfoMap)
+            {
+                if (entity3dInfo.meshName == meshName)
+                {
+                    this->pipelinesMap.erase(entityName);
+                    pipelineEntities.insert(entityName);
+                }
+            }
+        }
+
+        if (isEntityDataChanged || isPrepassChanged)
+        {
+            this->loadModels(dev, queue, assetsPath); // Also transforms, bounds and position streams.
+        }
+        if (isEntityDataChanged)
+        {
+            this->uploadEntityData(dev, queue, sliceCount);
+        }
+        if (isPrepassChanged)
+        {
+            this->prepareDepthPipelines(dev, renderPass, pipelineCache, vertexBindId, assetsPath);
+            this->updateDepthPrepass(dev, queue, vertexBindId);
+        }
+        this->preparePipelines(dev, renderPass, pipelineCache, vertexBindId, assetsPath, false);
+        this->retireUnusedPipelines(dev);
+        for (const entity_name_t& entityName : descriptorEntities)
+        {
+            this->writeDescriptorSet(dev, this->sceneInfo.entities3dInfoMap[entityName], this->descriptorSetsMap[entityName]);
+        }
+        if (this->visibilityBuffer.isEnabled)
+        {
+            this->writeVisibilityEntities(); // Batches and mesh indices.
+        }
+        this->watchSceneFiles();
+
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timeStart).count();
+        std::cout << " >>> reloadChangedFiles: " << textures.size() << " textures, " << meshes.size() << " meshes, " << shaders.size() << " shaders, "
+                  << descriptorEntities.size() << " descriptor sets, " << pipelineEntities.size() << " entity pipelines in " << ms << " ms\n";
+
+        return isEntityDataChanged || isPrepassChanged || !descriptorEntities.empty() || !pipelineEntities.empty();
+    }
+
+    /// Pipelines of variants which no entity uses anymore.
+    void retireUnusedPipelines(vks::VulkanDevice* dev)
+    {
+        std::set<VkPipeline> used;
+        for (auto& [entityName, pipeline] : this->pipelinesMap)
+        {
+            used.insert(pipeline);
+        }
+        for (auto it = this->uniquePipelinesMap.begin(); it != this->uniquePipelinesMap.end();)
+        {
+            if (used.count(it->second) == 0)
+            {
+                this->retire([device = dev->logicalDevice, pipeline = it->second]() { vkDestroyPipeline(device, pipeline, nullptr); });
+                it = this->uniquePipelinesMap.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+
+    /// Same entities and texture set size - the descriptor pool, descriptor sets and per entity buffers still fit.
+    bool hasSameLayout(const SceneInfo& newInfo) const
+    {
+        auto isSameEntity = [](const auto& a, const auto& b) { return a.first == b.first; };
+        const auto& entities    = this->sceneInfo.entities3dInfoMap;
+        const auto& newEntities = newInfo.entities3dInfoMap;
+        if (entities.size() != newEntities.size() || !std::equal(entities.begin(), entities.end(), newEntities.begin(), isSameEntity))
+        {
+            return false;
+        }
+        const size_t texSetSize = this->sceneInfo.getTextureSetSize();
+        for (auto& [entityName, entity3dInfo] : newEntities)
+        {
+            auto texSet = newInfo.texturesSetInfoMap.find(entity3dInfo.texturesSetName);
+            auto shadSet = newInfo.shadersSetInfoMap.find(entity3dInfo.shadersSetName);
+            if (texSet == newInfo.texturesSetInfoMap.end() || texSet->second.texturesNames.size() != texSetSize || shadSet == newInfo.shadersSetInfoMap.end())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Everything per entity, after meshes or transforms changed - world matrices, culling spheres and draw commands.
+    void uploadEntityData(vks::VulkanDevice* dev, VkQueue& queue, uint32_t sliceCount)
+    {
+        this->writeWorldMatrices();
+        if (this->motionVectors.isEnabled)
+        {
+            this->resetPreviousWorldMatrices();
+        }
+
+        if (this->culling.isEnabled)
+        {
+            glm::vec4* spheres = static_cast<glm::vec4*>(this->culling.bounds.mapped);
+            for (uint32_t i = 0; i < this->entityBounds.size(); i++)
+            {
+                spheres[i] = this->getBoundingSphere(i);
+            }
+
+            std::vector<VkDrawIndexedIndirectCommand> commands = this->getDrawCommands();
+            commands.insert(commands.end(), commands.begin(), commands.end()); // Late draws.
+            VkCommandBuffer copyCmd = dev->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+            vkCmdUpdateBuffer(copyCmd, this->culling.commands.buffer, 0, this->culling.commands.size, commands.data());
+            dev->flushCommandBuffer(copyCmd, queue, true);
+        }
+
+        if (this->frustumCulling.isEnabled)
+        {
+            this->retire([commands = this->frustumCulling.commands]() mutable { commands.destroy(); });
+            this->prepareFrustumCulling(dev, sliceCount);
+        }
+    }
+
+    /// Destruction of a replaced object, once no frame in flight can use it.
+    void retire(std::function<void()> destruction)
+    {
+        this->hotReload.retired.push_back({ this->hotReload.frameIndex, std::move(destruction) });
+    }
+
+    /// Called once per frame, after its submission. framesInFlight - submitted frames which may still be executing.
+    void destroyRetired(uint32_t framesInFlight)
+    {
+        auto& retired = this->hotReload.retired;
+        auto isDone = [&](const std::pair<uint64_t, std::function<void()>>& r) { return r.first + framesInFlight < this->hotReload.frameIndex; };
+        for (auto& r : retired)
+        {
+            if (isDone(r))
+            {
+                r.second();
+            }
+        }
+        retired.erase(std::remove_if(retired.begin(), retired.end(), isDone), retired.end());
+        this->hotReload.frameIndex++;
+    }
+
+// } // HOT_RELOAD
+
+// DESTROY {
+
+    void destroy(VkDevice& dev)
+    {
+        this->asyncPipelines.compiler.wait();
+        for (SceneAsyncPipelines::Job& job : this->asyncPipelines.pending)
+        {
+            vkDestroyPipeline(dev, job.future.get(), nullptr);
+        }
+        this->asyncPipelines.pending.clear();
+        for (auto& [key, pipeline] : this->asyncPipelines.fallbackPipelinesMap)
+        {
+            vkDestroyPipeline(dev, pipeline, nullptr);
+        }
+
+        for (auto& r : this->hotReload.retired)
+        {
+            r.second();
+        }
+        this->hotReload.retired.clear();
+
+        for (auto& pipM : this->uniquePipelinesMap)
+        {
+            vkDestroyPipeline(dev, pipM.second, nullptr); // Here we have segfault when validation layers are active, probably driver bug.
+        }
+        for (auto* pipelines : { &this->depthPrepass.pipelinesMap, &this->depthPrepass.overdrawPipelinesMap,
+                                 &this->overdraw.heatmapPipelinesMap, &this->overdraw.surfacePipelinesMap })
+        {
+            for (auto& [shadName, pipeline] : *pipelines)
+            {
+                vkDestroyPipeline(dev, pipeline, nullptr);
+            }
+        }
+        for (auto& [meshName, positions] : this->depthPrepass.positionBuffers)
+        {
+            positions.destroy();
+        }
+        this->depthPrepass.meter.destroy();
+
+        if (this->visibilityBuffer.isEnabled)
+        {
+            for (auto* pipelines : { &this->visibilityBuffer.geometryPipelinesMap, &this->visibilityBuffer.shadingPipelinesMap })
+            {
+                for (auto& [name, pipeline] : *pipelines)
+                {
+                    vkDestroyPipeline(dev, pipeline, nullptr);
+                }
+            }
+            vkDestroyPipeline(dev, this->visibilityBuffer.classifyPipeline, nullptr);
+            vkDestroySampler(dev, this->visibilityBuffer.idsSampler, nullptr);
+            this->visibilityBuffer.entities.destroy();
+            this->visibilityBuffer.graph.destroy();
+        }
+
+        this->lights.clusters.destroy();
+
+        if (this->motionVectors.isEnabled)
+        {
+            for (auto& [shadName, pipeline] : this->motionVectors.pipelinesMap)
+            {
+                vkDestroyPipeline(dev, pipeline, nullptr);
+            }
+            this->motionVectors.previousTransforms.destroy();
+            this->motionVectors.params.destroy();
+        }
+
+        vkDestroyPipelineLayout(dev, this->pipelineLayout, nullptr);
+
+        vkDestroyDescriptorSetLayout(dev, this->descriptorSetLayout, nullptr);
+
+        this->shaderCache.destroy(); // Only modules of pipelines which were never created.
+
+        for (auto& modM : this->meshesMap)
+        {
+            modM.second.destroy();
+        }
+
+        for (auto& texM : this->texturesMap)
+        {
+            texM.second.destroy();
+        }
+
+        this->vertexPulling.meshes.destroy();
+
+        this->uniformBuffers.scene.destroy();
+        this->uniformBuffers.transforms.destroy();
+        this->uniformBuffers.zeroVertex.destroy();
+
+        if (this->culling.isEnabled)
+        {
+            vkDestroyPipeline(dev, this->culling.earlyPipeline, nullptr);
+            vkDestroyPipeline(dev, this->culling.latePipeline, nullptr);
+            vkDestroyPipelineLayout(dev, this->culling.pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(dev, this->culling.descriptorSetLayout, nullptr);
+            this->culling.bounds.destroy();
+            this->culling.visibility.destroy();
+            this->culling.commands.destroy();
+            this->culling.depthPyramid.destroy();
+        }
+
+        this->frustumCulling.commands.destroy();
     }
 
 // } // DESTROY
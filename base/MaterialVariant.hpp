@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Variant of the material shader (default_material.frag) - texture maps it uses and its coefficients.
+/// It is passed as specialization constants at pipeline creation, so the driver compiles out fetches and math
+/// of maps missing from featureMask - a variant costs only what it uses.
+/// Entities with the same shaders and variant share one pipeline.
+struct MaterialVariant
+{
+    static constexpr uint32_t ALL_FEATURES = 0x3F; // Bit (1 << TexT) per texture map.
+
+    uint32_t featureMask = ALL_FEATURES;
+    float    aoCoeff     = 0.25f;
+    float    emitCoeff   = 1.0f;
+    float    diffDiCoeff = 3.0f;
+    float    reflCoeff   = 2.0f;
+    float    uvScale     = 0.9375f; // Part of the reflection map covered by its content.
+
+    bool hasFeature(uint32_t texType) const
+    {
+        return (this->featureMask >> texType) & 1u;
+    }
+
+    bool operator<(const MaterialVariant& other) const
+    {
+        return this->tie() < other.tie();
+    }
+
+    bool operator==(const MaterialVariant& other) const
+    {
+        return this->tie() == other.tie();
+    }
+
+    bool operator!=(const MaterialVariant& other) const
+    {
+        return !(*this == other);
+    }
+
+    /// Constant ids as declared in default_material.frag, data is the variant itself.
+    static std::vector<VkSpecializationMapEntry> getMapEntries()
+    {
+        return {
+            { 0, offsetof(MaterialVariant, featureMask), sizeof(uint32_t) },
+            { 1, offsetof(MaterialVariant, aoCoeff),     sizeof(float) },
+            { 2, offsetof(MaterialVariant, emitCoeff),   sizeof(float) },
+            { 3, offsetof(MaterialVariant, diffDiCoeff), sizeof(float) },
+            { 4, offsetof(MaterialVariant, reflCoeff),   sizeof(float) },
+            { 5, offsetof(MaterialVariant, uvScale),     sizeof(float) },
+        };
+    }
+
+private:
+    std::tuple<const uint32_t&, const float&, const float&, const float&, const float&, const float&> tie() const
+    {
+        return std::tie(this->featureMask, this->aoCoeff, this->emitCoeff, this->diffDiCoeff, this->reflCoeff, this->uvScale);
+    }
+};
+
+} // namespace vk229
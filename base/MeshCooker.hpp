@@ -0,0 +1,161 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <glm/glm.hpp>
+#include <VulkanTools.h>
+#include <VulkanModel.hpp>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Mesh in host memory - interleaved vertices with given components, triangle list indices into them.
+/// Positions are also kept as a tightly packed stream (xyz per vertex), for passes which need nothing else (depth pre-pass).
+struct CookedMesh
+{
+    std::vector<vks::Component> components; // Of every vertex, in this order.
+    uint32_t                    stride = 0; // Floats per vertex.
+    std::vector<float>          vertices;
+    std::vector<float>          positions;  // Same vertices, position only.
+    std::vector<uint32_t>       indices;
+    uint32_t                    vertexCount = 0;
+
+    // As vks::Model computes its dimensions - of positions in the file, before scale.
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    /// Model without GPU buffers (nothing to destroy), for code which reads only its counts and dimensions.
+    vks::Model toModel(VkDevice device) const
+    {
+        vks::Model model;
+        model.device      = device;
+        model.vertexCount = this->vertexCount;
+        model.indexCount  = static_cast<uint32_t>(this->indices.size());
+        model.dim.min     = this->min;
+        model.dim.max     = this->max;
+        model.dim.size    = this->max - this->min;
+        return model;
+    }
+};
+
+//////////////////////////////////////
+/// Reads meshes into host memory, the way vks::Model::loadFromFile() reads them into GPU buffers (same import flags,
+/// flipped Y, zero where the file has no tangents or UVs) - so both give the same vertices, wherever they are used from.
+struct MeshCooker
+{
+    static constexpr unsigned int IMPORT_FLAGS = aiProcess_FlipWindingOrder | aiProcess_Triangulate | aiProcess_PreTransformVertices |
+                                                 aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals;
+
+    /// Bytes of a component in a vertex - vks::VertexLayout is the one definition, so cooked vertices are laid out as vks::Model's.
+    static uint32_t getComponentSize(vks::Component component)
+    {
+        return vks::VertexLayout({ component }).stride();
+    }
+
+    /// Returns false, with error set, if the file can't be imported.
+    static bool cook(const std::string& filename, const std::vector<vks::Component>& components, float scale, CookedMesh& mesh, std::string& error)
+    {
+        Assimp::Importer importer;
+#if defined(__ANDROID__)
+        const aiScene* scene = nullptr;
+        AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+        if (asset)
+        {
+            std::vector<char> data(AAsset_getLength(asset));
+            AAsset_read(asset, data.data(), data.size());
+            AAsset_close(asset);
+            scene = importer.ReadFileFromMemory(data.data(), data.size(), IMPORT_FLAGS);
+        }
+#else
+        const aiScene* scene = importer.ReadFile(filename.c_str(), IMPORT_FLAGS);
+#endif
+        if (scene == nullptr)
+        {
+            error = "Could not import mesh " + filename + ": " + importer.GetErrorString();
+            return false;
+        }
+
+        mesh = CookedMesh();
+        mesh.components = components;
+        mesh.stride     = vks::VertexLayout(components).stride() / sizeof(float);
+
+        const aiVector3D zero3D(0.0f, 0.0f, 0.0f);
+        for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+        {
+            const aiMesh* part = scene->mMeshes[m];
+
+            aiColor3D color(0.0f, 0.0f, 0.0f);
+            scene->mMaterials[part->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, color);
+
+            for (unsigned int v = 0; v < part->mNumVertices; v++)
+            {
+                const aiVector3D& pos       = part->mVertices[v];
+                const aiVector3D& normal    = part->mNormals[v];
+                const aiVector3D& texCoord  = part->HasTextureCoords(0) ? part->mTextureCoords[0][v] : zero3D;
+                const aiVector3D& tangent   = part->HasTangentsAndBitangents() ? part->mTangents[v] : zero3D;
+                const aiVector3D& bitangent = part->HasTangentsAndBitangents() ? part->mBitangents[v] : zero3D;
+
+                for (vks::Component component : components)
+                {
+                    switch (component)
+                    {
+                    case vks::VERTEX_COMPONENT_POSITION:
+                        mesh.vertices.insert(mesh.vertices.end(), { pos.x * scale, -pos.y * scale, pos.z * scale });
+                        break;
+                    case vks::VERTEX_COMPONENT_NORMAL:
+                        mesh.vertices.insert(mesh.vertices.end(), { normal.x, -normal.y, normal.z });
+                        break;
+                    case vks::VERTEX_COMPONENT_UV:
+                        mesh.vertices.insert(mesh.vertices.end(), { texCoord.x, texCoord.y });
+                        break;
+                    case vks::VERTEX_COMPONENT_COLOR:
+                        mesh.vertices.insert(mesh.vertices.end(), { color.r, color.g, color.b });
+                        break;
+                    case vks::VERTEX_COMPONENT_TANGENT:
+                        mesh.vertices.insert(mesh.vertices.end(), { tangent.x, tangent.y, tangent.z });
+                        break;
+                    case vks::VERTEX_COMPONENT_BITANGENT:
+                        mesh.vertices.insert(mesh.vertices.end(), { bitangent.x, bitangent.y, bitangent.z });
+                        break;
+                    case vks::VERTEX_COMPONENT_DUMMY_FLOAT:
+                        mesh.vertices.push_back(0.0f);
+                        break;
+                    case vks::VERTEX_COMPONENT_DUMMY_VEC4:
+                        mesh.vertices.insert(mesh.vertices.end(), { 0.0f, 0.0f, 0.0f, 0.0f });
+                        break;
+                    }
+                }
+
+                mesh.positions.insert(mesh.positions.end(), { pos.x * scale, -pos.y * scale, pos.z * scale });
+                mesh.min = glm::min(mesh.min, glm::vec3(pos.x, pos.y, pos.z));
+                mesh.max = glm::max(mesh.max, glm::vec3(pos.x, pos.y, pos.z));
+            }
+
+            // Indices of every part are into vertices of the whole mesh
+            for (unsigned int f = 0; f < part->mNumFaces; f++)
+            {
+                const aiFace& face = part->mFaces[f];
+                if (face.mNumIndices != 3)
+                {
+                    continue;
+                }
+                mesh.indices.insert(mesh.indices.end(),
+                                    { mesh.vertexCount + face.mIndices[0], mesh.vertexCount + face.mIndices[1], mesh.vertexCount + face.mIndices[2] });
+            }
+            mesh.vertexCount += part->mNumVertices;
+        }
+
+        assert(mesh.vertices.size() == size_t(mesh.vertexCount) * mesh.stride);
+        assert(mesh.positions.size() == size_t(mesh.vertexCount) * 3);
+        return true;
+    }
+};
+
+} // namespace vk229
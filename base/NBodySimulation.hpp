@@ -0,0 +1,681 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <glm/glm.hpp>
+#include "ParallelFor.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace vk229
+{
+/////////////////////////////////////////
+/// CPU N-body simulation:
+/// * bodies (rocks) in SoA layout, forces from attractors computed with AVX2 / NEON,
+/// * optional body-body gravity through Barnes-Hut octree, built in parallel every step,
+/// * kick-drift-kick leapfrog integrator (symplectic - orbits don't spiral out).
+/////////////////////////////////////////
+
+//////////////////////////////////////
+/// Bodies in structure of arrays layout.
+/// Every component is a separate array, so kernels load 8 (AVX2) or 4 (NEON) bodies at once.
+struct BodiesSoA
+{
+    std::vector<float> px, py, pz; // Position.
+    std::vector<float> vx, vy, vz; // Velocity.
+    std::vector<float> ax, ay, az; // Acceleration from the last evaluation.
+    std::vector<float> m;          // Mass.
+    std::vector<float> r;          // Radius, used only by collisions.
+
+    size_t size() const
+    {
+        return this->px.size();
+    }
+
+    void resize(size_t n)
+    {
+        for (std::vector<float>* v : { &px, &py, &pz, &vx, &vy, &vz, &ax, &ay, &az, &m, &r })
+        {
+            v->resize(n, 0.0f);
+        }
+    }
+};
+
+//////////////////////////////////////
+/// Massive body attracting all others - planet, light.
+/// Attractors attract each other too, bodies' influence on them is ignored.
+struct Attractor
+{
+    glm::vec3 pos;
+    glm::vec3 vel;
+    float     mass;
+    bool      isFixed; // Does not move, ie. planet in the center of the system.
+    glm::vec3 acc = glm::vec3(0.0f);
+};
+
+//////////////////////////////////////
+/// Barnes-Hut octree node.
+/// Children of a node are 8 consecutive nodes, starting at firstChild.
+struct OctreeNode
+{
+    glm::vec3 centerOfMass;
+    float     mass;
+    glm::vec3 center;      // Cell center.
+    float     halfSize;    // Cell half size.
+    int32_t   firstChild;  // -1 for leaf.
+    uint32_t  bodyBegin;   // Range in sorted bodies.
+    uint32_t  bodyEnd;
+};
+
+class NBodySimulation
+{
+public:
+    static const uint32_t LEAF_SIZE       = 8;  // Max bodies in a leaf (unless MAX_DEPTH reached).
+    static const uint32_t MAX_DEPTH       = 24;
+    static const uint32_t TOP_DEPTH       = 2;  // Levels built serially, subtrees below them are built in parallel.
+    static const uint32_t TOP_CELLS_DIM   = 1u << TOP_DEPTH;
+    static const uint32_t TOP_CELLS_COUNT = TOP_CELLS_DIM * TOP_CELLS_DIM * TOP_CELLS_DIM;
+
+    float G                = 1.0f;
+    float softening        = 0.1f;
+    float theta            = 0.5f;  // Barnes-Hut opening angle, 0 -> exact all-pairs.
+    bool  bodyInteractions = false; // Body-body gravity through octree.
+
+    BodiesSoA              bodies;
+    std::vector<Attractor> attractors;
+
+    NBodySimulation()
+    {
+        this->setThreadCount(std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    void setThreadCount(uint32_t count)
+    {
+        this->threadPool.setThreadCount(count);
+    }
+
+    /// Bodies or attractors changed outside of step(), accelerations must be recomputed.
+    void invalidate()
+    {
+        this->accelerationsValid = false;
+    }
+
+    /// One kick-drift-kick leapfrog step.
+    void step(float dt)
+    {
+        if (!this->accelerationsValid)
+        {
+            this->computeAccelerations();
+        }
+
+        this->kick(0.5f * dt);
+        this->drift(dt);
+        this->computeAccelerations();
+        this->kick(0.5f * dt);
+    }
+
+    /// Writes bodies' positions as vec3 into interleaved data - e.g. persistently mapped instance buffer.
+    /// dst points to the position of first element, stride is size of the whole element.
+    void writePositions(void* dst, size_t stride)
+    {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        parallelFor(this->threadPool, this->bodies.size(), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const float pos[3] = { this->bodies.px[i], this->bodies.py[i], this->bodies.pz[i] };
+                memcpy(out + i * stride, pos, sizeof(pos));
+            }
+        });
+    }
+
+    /// For work on bodies between steps, ie. collisions.
+    vks::ThreadPool& getThreadPool()
+    {
+        return this->threadPool;
+    }
+
+    const std::vector<OctreeNode>& getOctree() const
+    {
+        return this->nodes;
+    }
+
+private:
+    vks::ThreadPool threadPool;
+    bool accelerationsValid = false;
+
+    // Octree.
+    std::vector<OctreeNode>               nodes;
+    std::vector<uint32_t>                 sortedIndices;  // Body indices in octree order.
+    std::vector<uint32_t>                 scratchIndices;
+    std::vector<glm::vec4>                sortedBodies;   // xyz - position, w - mass; in octree order.
+    std::vector<std::vector<OctreeNode>>  subtrees;       // One per top cell.
+    std::vector<std::vector<uint32_t>>    threadHistograms;
+
+// INTEGRATOR {
+
+    void kick(float dt)
+    {
+        for (Attractor& a : this->attractors)
+        {
+            if (!a.isFixed)
+            {
+                a.vel += a.acc * dt;
+            }
+        }
+
+        BodiesSoA& b = this->bodies;
+        parallelFor(this->threadPool, b.size(), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                b.vx[i] += b.ax[i] * dt;
+                b.vy[i] += b.ay[i] * dt;
+                b.vz[i] += b.az[i] * dt;
+            }
+        });
+    }
+
+    void drift(float dt)
+    {
+        for (Attractor& a : this->attractors)
+        {
+            if (!a.isFixed)
+            {
+                a.pos += a.vel * dt;
+            }
+        }
+
+        BodiesSoA& b = this->bodies;
+        parallelFor(this->threadPool, b.size(), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                b.px[i] += b.vx[i] * dt;
+                b.py[i] += b.vy[i] * dt;
+                b.pz[i] += b.vz[i] * dt;
+            }
+        });
+    }
+
+// } // INTEGRATOR
+
+// FORCES {
+
+    void computeAccelerations()
+    {
+        const float eps2 = this->softening * this->softening;
+
+        // Attractors - few of them, scalar is enough.
+        for (Attractor& a : this->attractors)
+        {
+            a.acc = glm::vec3(0.0f);
+            for (const Attractor& other : this->attractors)
+            {
+                if (&other == &a)
+                {
+                    continue;
+                }
+                glm::vec3 d  = other.pos - a.pos;
+                float     r2 = glm::dot(d, d) + eps2;
+                a.acc += d * (this->G * other.mass / (r2 * std::sqrt(r2)));
+            }
+        }
+
+        if (this->bodies.size() == 0)
+        {
+            this->accelerationsValid = true;
+            return;
+        }
+
+        if (this->bodyInteractions)
+        {
+            this->buildOctree();
+        }
+
+        parallelFor(this->threadPool, this->bodies.size(), [&](size_t begin, size_t end, size_t)
+        {
+            this->accelerateByAttractors(begin, end);
+        });
+
+        if (this->bodyInteractions)
+        {
+            // Iterating in octree order - neighbouring bodies walk the same nodes, which stay in cache.
+            parallelFor(this->threadPool, this->sortedBodies.size(), [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t s = begin; s < end; s++)
+                {
+                    this->accelerateByOctree(s);
+                }
+            });
+        }
+
+        this->accelerationsValid = true;
+    }
+
+    /// Overwrites accelerations of bodies [begin, end) with gravity of attractors.
+    void accelerateByAttractors(size_t begin, size_t end)
+    {
+        BodiesSoA& b = this->bodies;
+        const float eps2 = this->softening * this->softening;
+        size_t i = begin;
+
+#if defined(__AVX2__)
+        const __m256 eps2V = _mm256_set1_ps(eps2);
+        const __m256 oneV  = _mm256_set1_ps(1.0f);
+        for (; i + 8 <= end; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(&b.px[i]);
+            const __m256 y = _mm256_loadu_ps(&b.py[i]);
+            const __m256 z = _mm256_loadu_ps(&b.pz[i]);
+            __m256 accX = _mm256_setzero_ps();
+            __m256 accY = _mm256_setzero_ps();
+            __m256 accZ = _mm256_setzero_ps();
+
+            for (const Attractor& a : this->attractors)
+            {
+                const __m256 dx   = _mm256_sub_ps(_mm256_set1_ps(a.pos.x), x);
+                const __m256 dy   = _mm256_sub_ps(_mm256_set1_ps(a.pos.y), y);
+                const __m256 dz   = _mm256_sub_ps(_mm256_set1_ps(a.pos.z), z);
+                const __m256 r2   = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                                  _mm256_add_ps(_mm256_mul_ps(dz, dz), eps2V));
+                const __m256 invR = _mm256_div_ps(oneV, _mm256_sqrt_ps(r2));
+                const __m256 s    = _mm256_mul_ps(_mm256_set1_ps(this->G * a.mass), _mm256_mul_ps(invR, _mm256_mul_ps(invR, invR)));
+                accX = _mm256_add_ps(accX, _mm256_mul_ps(dx, s));
+                accY = _mm256_add_ps(accY, _mm256_mul_ps(dy, s));
+                accZ = _mm256_add_ps(accZ, _mm256_mul_ps(dz, s));
+            }
+
+            _mm256_storeu_ps(&b.ax[i], accX);
+            _mm256_storeu_ps(&b.ay[i], accY);
+            _mm256_storeu_ps(&b.az[i], accZ);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t eps2V = vdupq_n_f32(eps2);
+        const float32x4_t oneV  = vdupq_n_f32(1.0f);
+        for (; i + 4 <= end; i += 4)
+        {
+            const float32x4_t x = vld1q_f32(&b.px[i]);
+            const float32x4_t y = vld1q_f32(&b.py[i]);
+            const float32x4_t z = vld1q_f32(&b.pz[i]);
+            float32x4_t accX = vdupq_n_f32(0.0f);
+            float32x4_t accY = vdupq_n_f32(0.0f);
+            float32x4_t accZ = vdupq_n_f32(0.0f);
+
+            for (const Attractor& a : this->attractors)
+            {
+                const float32x4_t dx   = vsubq_f32(vdupq_n_f32(a.pos.x), x);
+                const float32x4_t dy   = vsubq_f32(vdupq_n_f32(a.pos.y), y);
+                const float32x4_t dz   = vsubq_f32(vdupq_n_f32(a.pos.z), z);
+                const float32x4_t r2   = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)),
+                                                   vaddq_f32(vmulq_f32(dz, dz), eps2V));
+                const float32x4_t invR = vdivq_f32(oneV, vsqrtq_f32(r2));
+                const float32x4_t s    = vmulq_f32(vdupq_n_f32(this->G * a.mass), vmulq_f32(invR, vmulq_f32(invR, invR)));
+                accX = vaddq_f32(accX, vmulq_f32(dx, s));
+                accY = vaddq_f32(accY, vmulq_f32(dy, s));
+                accZ = vaddq_f32(accZ, vmulq_f32(dz, s));
+            }
+
+            vst1q_f32(&b.ax[i], accX);
+            vst1q_f32(&b.ay[i], accY);
+            vst1q_f32(&b.az[i], accZ);
+        }
+#endif
+
+        // Remainder, or everything without SIMD. Same operations in the same order as above.
+        for (; i < end; i++)
+        {
+            float accX = 0.0f, accY = 0.0f, accZ = 0.0f;
+            for (const Attractor& a : this->attractors)
+            {
+                const float dx   = a.pos.x - b.px[i];
+                const float dy   = a.pos.y - b.py[i];
+                const float dz   = a.pos.z - b.pz[i];
+                const float r2   = (dx * dx + dy * dy) + (dz * dz + eps2);
+                const float invR = 1.0f / std::sqrt(r2);
+                const float s    = (this->G * a.mass) * (invR * (invR * invR));
+                accX += dx * s;
+                accY += dy * s;
+                accZ += dz * s;
+            }
+            b.ax[i] = accX;
+            b.ay[i] = accY;
+            b.az[i] = accZ;
+        }
+    }
+
+    /// Adds gravity of other bodies to the body at position s in octree order.
+    void accelerateByOctree(size_t s)
+    {
+        const glm::vec3 pos    = glm::vec3(this->sortedBodies[s]);
+        const float     eps2   = this->softening * this->softening;
+        const float     theta2 = this->theta * this->theta;
+        glm::vec3       acc    = glm::vec3(0.0f);
+
+        int32_t  stack[8 * (MAX_DEPTH + 1) + 1];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const OctreeNode& node = this->nodes[stack[--stackSize]];
+            if (node.mass <= 0.0f)
+            {
+                continue;
+            }
+
+            if (node.firstChild < 0)
+            {
+                for (uint32_t j = node.bodyBegin; j < node.bodyEnd; j++)
+                {
+                    if (j == s)
+                    {
+                        continue;
+                    }
+                    const glm::vec3 d  = glm::vec3(this->sortedBodies[j]) - pos;
+                    const float     r2 = glm::dot(d, d) + eps2;
+                    acc += d * (this->G * this->sortedBodies[j].w / (r2 * std::sqrt(r2)));
+                }
+                continue;
+            }
+
+            const glm::vec3 d    = node.centerOfMass - pos;
+            const float     r2   = glm::dot(d, d);
+            const float     size = 2.0f * node.halfSize;
+            if (size * size < theta2 * r2)
+            {
+                // Far enough - whole cell acts as a single body in its center of mass.
+                const float r2s = r2 + eps2;
+                acc += d * (this->G * node.mass / (r2s * std::sqrt(r2s)));
+            }
+            else
+            {
+                for (int32_t c = 0; c < 8; c++)
+                {
+                    stack[stackSize++] = node.firstChild + c;
+                }
+            }
+        }
+
+        const uint32_t i = this->sortedIndices[s];
+        this->bodies.ax[i] += acc.x;
+        this->bodies.ay[i] += acc.y;
+        this->bodies.az[i] += acc.z;
+    }
+
+// } // FORCES
+
+// OCTREE {
+
+    static uint32_t octantOf(const glm::vec3& p, const glm::vec3& center)
+    {
+        return (p.x >= center.x ? 1u : 0u) | (p.y >= center.y ? 2u : 0u) | (p.z >= center.z ? 4u : 0u);
+    }
+
+    static glm::vec3 childCenter(const OctreeNode& parent, uint32_t octant)
+    {
+        const float q = 0.5f * parent.halfSize;
+        return parent.center + glm::vec3((octant & 1u) ? q : -q, (octant & 2u) ? q : -q, (octant & 4u) ? q : -q);
+    }
+
+    static OctreeNode makeChild(const OctreeNode& parent, uint32_t octant, uint32_t begin, uint32_t end)
+    {
+        OctreeNode child;
+        child.centerOfMass = glm::vec3(0.0f);
+        child.mass         = 0.0f;
+        child.center       = childCenter(parent, octant);
+        child.halfSize     = 0.5f * parent.halfSize;
+        child.firstChild   = -1;
+        child.bodyBegin    = begin;
+        child.bodyEnd      = end;
+        return child;
+    }
+
+    void computeLeafMass(OctreeNode& node) const
+    {
+        glm::vec3 weighted = glm::vec3(0.0f);
+        float     mass     = 0.0f;
+        for (uint32_t j = node.bodyBegin; j < node.bodyEnd; j++)
+        {
+            weighted += glm::vec3(this->sortedBodies[j]) * this->sortedBodies[j].w;
+            mass     += this->sortedBodies[j].w;
+        }
+        node.mass         = mass;
+        node.centerOfMass = mass > 0.0f ? weighted / mass : node.center;
+    }
+
+    static void computeInnerMass(OctreeNode& node, const OctreeNode* children)
+    {
+        glm::vec3 weighted = glm::vec3(0.0f);
+        float     mass     = 0.0f;
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            weighted += children[c].centerOfMass * children[c].mass;
+            mass     += children[c].mass;
+        }
+        node.mass         = mass;
+        node.centerOfMass = mass > 0.0f ? weighted / mass : node.center;
+    }
+
+    /// Subdivides node local[nodeId] recursively, children are appended to local.
+    /// Touches only its own range of sorted arrays, so subtrees can be built concurrently.
+    void buildSubtree(std::vector<OctreeNode>& local, uint32_t nodeId, uint32_t depth)
+    {
+        const uint32_t begin = local[nodeId].bodyBegin;
+        const uint32_t end   = local[nodeId].bodyEnd;
+
+        if (end - begin <= LEAF_SIZE || depth >= MAX_DEPTH)
+        {
+            this->computeLeafMass(local[nodeId]);
+            return;
+        }
+
+        // Stable partition into octants, through scratch arrays.
+        const glm::vec3 center = local[nodeId].center;
+        uint32_t counts[8] = {};
+        for (uint32_t j = begin; j < end; j++)
+        {
+            counts[octantOf(glm::vec3(this->sortedBodies[j]), center)]++;
+        }
+        uint32_t offsets[8];
+        offsets[0] = begin;
+        for (uint32_t c = 1; c < 8; c++)
+        {
+            offsets[c] = offsets[c - 1] + counts[c - 1];
+        }
+
+        const OctreeNode parent = local[nodeId];
+        const uint32_t firstChild = local.size();
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            local.push_back(makeChild(parent, c, offsets[c], offsets[c] + counts[c]));
+        }
+        local[nodeId].firstChild = firstChild;
+
+        for (uint32_t j = begin; j < end; j++)
+        {
+            const uint32_t c = octantOf(glm::vec3(this->sortedBodies[j]), center);
+            this->scratchIndices[offsets[c]++] = this->sortedIndices[j];
+        }
+        for (uint32_t j = begin; j < end; j++)
+        {
+            const uint32_t i = this->scratchIndices[j];
+            this->sortedIndices[j] = i;
+            this->sortedBodies[j]  = glm::vec4(this->bodies.px[i], this->bodies.py[i], this->bodies.pz[i], this->bodies.m[i]);
+        }
+
+        for (uint32_t c = 0; c < 8; c++)
+        {
+            this->buildSubtree(local, firstChild + c, depth + 1);
+        }
+
+        computeInnerMass(local[nodeId], &local[firstChild]);
+    }
+
+    /// Top TOP_DEPTH levels come from a parallel counting sort of bodies into top cells (in Morton order),
+    /// then subtrees of all top cells are built in parallel and appended to the node array.
+    void buildOctree()
+    {
+        const BodiesSoA& b = this->bodies;
+        const uint32_t bodyCount   = b.size();
+        const uint32_t threadCount = std::max<size_t>(1, this->threadPool.threads.size());
+
+        // Bounds.
+        std::vector<glm::vec3> threadMin(threadCount, glm::vec3( INFINITY));
+        std::vector<glm::vec3> threadMax(threadCount, glm::vec3(-INFINITY));
+        parallelFor(this->threadPool, bodyCount, [&](size_t begin, size_t end, size_t t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const glm::vec3 p(b.px[i], b.py[i], b.pz[i]);
+                threadMin[t] = glm::min(threadMin[t], p);
+                threadMax[t] = glm::max(threadMax[t], p);
+            }
+        });
+        glm::vec3 boundsMin = threadMin[0], boundsMax = threadMax[0];
+        for (uint32_t t = 1; t < threadCount; t++)
+        {
+            boundsMin = glm::min(boundsMin, threadMin[t]);
+            boundsMax = glm::max(boundsMax, threadMax[t]);
+        }
+
+        OctreeNode root;
+        root.center       = 0.5f * (boundsMin + boundsMax);
+        root.halfSize     = 0.5f * std::max(std::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), boundsMax.z - boundsMin.z) * 1.001f + 1e-6f;
+        root.firstChild   = 1;
+        root.bodyBegin    = 0;
+        root.bodyEnd      = bodyCount;
+
+        // Top cell id of a body - octant at depth 1, then octant at depth 2, ...
+        const glm::vec3 cornerMin = root.center - glm::vec3(root.halfSize);
+        const float     cellScale = TOP_CELLS_DIM / (2.0f * root.halfSize);
+        auto topCellOf = [&](size_t i) -> uint32_t
+        {
+            const glm::ivec3 cell = glm::clamp(glm::ivec3((glm::vec3(b.px[i], b.py[i], b.pz[i]) - cornerMin) * cellScale), glm::ivec3(0), glm::ivec3(TOP_CELLS_DIM - 1));
+            uint32_t id = 0;
+            for (int32_t level = TOP_DEPTH - 1; level >= 0; level--)
+            {
+                id = id * 8 + (((cell.x >> level) & 1) | (((cell.y >> level) & 1) << 1) | (((cell.z >> level) & 1) << 2));
+            }
+            return id;
+        };
+
+        // Parallel counting sort into top cells - stable, so independent of thread count.
+        this->threadHistograms.assign(threadCount, std::vector<uint32_t>(TOP_CELLS_COUNT, 0));
+        parallelFor(this->threadPool, bodyCount, [&](size_t begin, size_t end, size_t t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                this->threadHistograms[t][topCellOf(i)]++;
+            }
+        });
+
+        std::vector<uint32_t> cellBegin(TOP_CELLS_COUNT + 1, 0);
+        uint32_t running = 0;
+        for (uint32_t c = 0; c < TOP_CELLS_COUNT; c++)
+        {
+            cellBegin[c] = running;
+            for (uint32_t t = 0; t < threadCount; t++)
+            {
+                const uint32_t count = this->threadHistograms[t][c];
+                this->threadHistograms[t][c] = running; // Becomes thread's write offset.
+                running += count;
+            }
+        }
+        cellBegin[TOP_CELLS_COUNT] = running;
+
+        this->sortedIndices.resize(bodyCount);
+        this->scratchIndices.resize(bodyCount);
+        this->sortedBodies.resize(bodyCount);
+        parallelFor(this->threadPool, bodyCount, [&](size_t begin, size_t end, size_t t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const uint32_t dst = this->threadHistograms[t][topCellOf(i)]++;
+                this->sortedIndices[dst] = i;
+                this->sortedBodies[dst]  = glm::vec4(b.px[i], b.py[i], b.pz[i], b.m[i]);
+            }
+        });
+
+        // Top levels, breadth first: root, its 8 children, their 64 children, ...
+        this->nodes.clear();
+        this->nodes.push_back(root);
+        uint32_t levelBegin = 0, levelSize = 1;
+        for (uint32_t depth = 0; depth < TOP_DEPTH; depth++)
+        {
+            const uint32_t nextLevelBegin = this->nodes.size();
+            const uint32_t cellsPerChild  = TOP_CELLS_COUNT >> (3 * (depth + 1)); // Top cells under one child.
+            for (uint32_t n = 0; n < levelSize; n++)
+            {
+                const uint32_t parentId = levelBegin + n;
+                this->nodes[parentId].firstChild = this->nodes.size();
+                for (uint32_t c = 0; c < 8; c++)
+                {
+                    const uint32_t firstCell = (n * 8 + c) * cellsPerChild;
+                    const OctreeNode child = makeChild(this->nodes[parentId], c, cellBegin[firstCell], cellBegin[firstCell + cellsPerChild]);
+                    this->nodes.push_back(child);
+                }
+            }
+            levelBegin = nextLevelBegin;
+            levelSize *= 8;
+        }
+
+        // Subtrees of top cells, in parallel.
+        this->subtrees.resize(TOP_CELLS_COUNT);
+        parallelFor(this->threadPool, TOP_CELLS_COUNT, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t c = begin; c < end; c++)
+            {
+                std::vector<OctreeNode>& local = this->subtrees[c];
+                local.clear();
+                local.push_back(this->nodes[levelBegin + c]);
+                this->buildSubtree(local, 0, TOP_DEPTH);
+            }
+        });
+
+        // Appending subtrees - local node 0 is the top cell itself, local index k > 0 goes to base + k - 1.
+        for (uint32_t c = 0; c < TOP_CELLS_COUNT; c++)
+        {
+            const std::vector<OctreeNode>& local = this->subtrees[c];
+            const int32_t base = this->nodes.size();
+            OctreeNode& topCell = this->nodes[levelBegin + c];
+            topCell = local[0];
+            if (topCell.firstChild >= 0)
+            {
+                topCell.firstChild += base - 1;
+            }
+            for (size_t k = 1; k < local.size(); k++)
+            {
+                OctreeNode node = local[k];
+                if (node.firstChild >= 0)
+                {
+                    node.firstChild += base - 1;
+                }
+                this->nodes.push_back(node);
+            }
+        }
+
+        // Masses of top levels, bottom up.
+        for (int32_t depth = TOP_DEPTH - 1; depth >= 0; depth--)
+        {
+            const uint32_t first = ((1u << (3 * depth)) - 1) / 7; // 1 + 8 + ... nodes above this level.
+            const uint32_t count = 1u << (3 * depth);
+            for (uint32_t n = first; n < first + count; n++)
+            {
+                computeInnerMass(this->nodes[n], &this->nodes[this->nodes[n].firstChild]);
+            }
+        }
+    }
+
+// } // OCTREE
+};
+
+} // namespace vk229
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <vector>
+#include <glm/gtc/packing.hpp>
+#include <vulkan/vulkan.h>
+#include <VulkanBuffer.hpp>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+
+#include "RenderGraph.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Measures overdraw - how many fragments are shaded per covered pixel. A render graph of three passes:
+/// * counts - the scene is drawn into a count image with additive blending of 1.0 per fragment (overdraw.frag), with the depth test
+///   and writes of the main pass, in its draw order - so a fragment counts if it passes the depth test when it is drawn,
+///   even if a later one covers it,
+/// * surfaces (optional) - the scene is drawn again with depth test EQUAL and no blending, writing a surface id (e.g. entity index + 1)
+///   into an id image - so every pixel knows what is finally seen there,
+/// * readback - both images are copied into a host buffer.
+/// They are reduced on the CPU - totals, histogram of pixels by fragment count, and the same per surface, of pixels where it is seen.
+/// Needs no device features (blending of R16_SFLOAT is mandatory, it counts exactly up to 2048).
+/// Images stay between measurements (graph transients, about 10 bytes per pixel), the readback buffer exists during measure() only.
+struct OverdrawMeter
+{
+    static constexpr VkFormat COUNT_FORMAT   = VK_FORMAT_R16_SFLOAT;
+    static constexpr VkFormat ID_FORMAT      = VK_FORMAT_R32_UINT;
+    static constexpr uint32_t HISTOGRAM_SIZE = 16; // Bin i - pixels with i + 1 fragments, the last one - with that many or more.
+
+    struct Stats
+    {
+        uint64_t fragmentCount = 0; // Shaded.
+        uint64_t coveredCount  = 0; // Pixels with at least one fragment.
+        uint32_t maxCount      = 0; // Of one pixel.
+        std::array<uint64_t, HISTOGRAM_SIZE> histogram = {};
+
+        float getOverdraw() const
+        {
+            return this->coveredCount > 0 ? float(this->fragmentCount) / float(this->coveredCount) : 0.0f;
+        }
+
+        void add(uint32_t count)
+        {
+            this->fragmentCount += count;
+            this->coveredCount  += 1;
+            this->maxCount       = std::max(this->maxCount, count);
+            this->histogram[std::min(count, HISTOGRAM_SIZE) - 1]++;
+        }
+    };
+
+    struct Result : Stats
+    {
+        std::vector<Stats> surfaces; // By surface id - 1, of pixels where the surface is seen. Empty without the surfaces pass.
+    };
+
+    vks::VulkanDevice* vulkanDevice = nullptr;
+    VkDevice           device       = VK_NULL_HANDLE;
+    VkFormat           depthFormat  = VK_FORMAT_UNDEFINED;
+    uint32_t           width        = 0;              // Of measured frames.
+    uint32_t           height       = 0;
+
+    // Pipelines drawing into the meter are created for these.
+    VkRenderPass renderPass         = VK_NULL_HANDLE; // Counts.
+    VkRenderPass surfacesRenderPass = VK_NULL_HANDLE;
+
+    RenderGraph graph;
+
+// PREPARE {
+
+    void prepare(vks::VulkanDevice* dev, VkFormat depthFormat, uint32_t w, uint32_t h)
+    {
+        this->vulkanDevice = dev;
+        this->device       = dev->logicalDevice;
+        this->depthFormat  = depthFormat;
+        this->width        = w;
+        this->height       = h;
+
+        RenderGraph& graph = this->graph;
+        this->countImage = graph.createImage("overdraw counts", COUNT_FORMAT, w, h);
+        this->idImage    = graph.createImage("overdraw surface ids", ID_FORMAT, w, h);
+        const RenderGraph::resource_id_t depth = graph.createImage("overdraw depth", depthFormat, w, h);
+
+        const RenderGraph::pass_id_t counts = graph.addPass("overdraw counts", [this](VkCommandBuffer cmdBuffer) { this->drawCounts(cmdBuffer); });
+        graph.writeColor(counts, this->countImage, VK_ATTACHMENT_LOAD_OP_CLEAR);
+        graph.writeDepth(counts, depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+
+        // Surfaces are tested against final depth of counts
+        const RenderGraph::pass_id_t surfaces = graph.addPass("overdraw surfaces", [this](VkCommandBuffer cmdBuffer)
+        {
+            if (this->drawSurfaces)
+            {
+                this->drawSurfaces(cmdBuffer);
+            }
+        });
+        graph.writeColor(surfaces, this->idImage, VK_ATTACHMENT_LOAD_OP_CLEAR);
+        graph.readDepth(surfaces, depth);
+
+        const RenderGraph::pass_id_t readback = graph.addPass("overdraw readback", [this](VkCommandBuffer cmdBuffer) { this->recordReadback(cmdBuffer); });
+        graph.readTransfer(readback, this->countImage);
+        graph.readTransfer(readback, this->idImage);
+        graph.setSideEffects(readback);
+
+        graph.compile(dev);
+        this->renderPass         = graph.getRenderPass(counts);
+        this->surfacesRenderPass = graph.getRenderPass(surfaces);
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    /// Records drawCounts() into the counts pass and drawSurfaces(), if given, into the surfaces pass (viewport and scissor
+    /// are set for both), submits it, waits for the queue and reduces the images. Surface ids drawn must be 1..surfaceCount,
+    /// 0 is background. Slow - for startup and diagnostics, not for every frame.
+    Result measure(VkQueue queue, const std::function<void(VkCommandBuffer)>& drawCounts,
+                   const std::function<void(VkCommandBuffer)>& drawSurfaces = nullptr, uint32_t surfaceCount = 0)
+    {
+        assert(this->renderPass != VK_NULL_HANDLE);
+
+        // Counts, then ids
+        const size_t pixelCount = size_t(this->width) * this->height;
+        this->idsOffset = pixelCount * sizeof(uint32_t); // Counts take half of it, ids stay 4 byte aligned.
+        VK_CHECK_RESULT(this->vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->readback,
+            this->idsOffset + pixelCount * sizeof(uint32_t)));
+
+        this->drawCounts   = drawCounts;
+        this->drawSurfaces = drawSurfaces;
+        VkCommandBuffer cmdBuffer = this->vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        this->graph.execute(cmdBuffer);
+        this->vulkanDevice->flushCommandBuffer(cmdBuffer, queue, true);
+        this->drawCounts   = nullptr;
+        this->drawSurfaces = nullptr;
+
+        Result result;
+        if (drawSurfaces)
+        {
+            result.surfaces.resize(surfaceCount);
+        }
+        VK_CHECK_RESULT(this->readback.map());
+        const uint16_t* counts = static_cast<const uint16_t*>(this->readback.mapped);
+        const uint32_t* ids    = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(this->readback.mapped) + this->idsOffset);
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            const uint32_t count = static_cast<uint32_t>(glm::unpackHalf1x16(counts[i]));
+            if (count == 0)
+            {
+                continue;
+            }
+            result.add(count);
+            if (ids[i] > 0 && ids[i] <= result.surfaces.size())
+            {
+                result.surfaces[ids[i] - 1].add(count);
+            }
+        }
+        this->readback.unmap();
+        this->readback.destroy();
+        return result;
+    }
+
+// } // RUNTIME
+
+// DESTROY {
+
+    void destroy()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        this->graph.destroy();
+        this->renderPass         = VK_NULL_HANDLE;
+        this->surfacesRenderPass = VK_NULL_HANDLE;
+        this->device             = VK_NULL_HANDLE;
+    }
+
+// } // DESTROY
+
+private:
+    RenderGraph::resource_id_t countImage = 0;
+    RenderGraph::resource_id_t idImage    = 0;
+
+    // During measure()
+    std::function<void(VkCommandBuffer)> drawCounts;
+    std::function<void(VkCommandBuffer)> drawSurfaces;
+    vks::Buffer                          readback;
+    VkDeviceSize                         idsOffset = 0;
+
+    void recordReadback(VkCommandBuffer cmdBuffer)
+    {
+        VkBufferImageCopy copyRegion = {};
+        copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        copyRegion.imageExtent = { this->width, this->height, 1 };
+        vkCmdCopyImageToBuffer(cmdBuffer, this->graph.getImage(this->countImage), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, this->readback.buffer, 1, &copyRegion);
+        copyRegion.bufferOffset = this->idsOffset;
+        vkCmdCopyImageToBuffer(cmdBuffer, this->graph.getImage(this->idImage), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, this->readback.buffer, 1, &copyRegion);
+
+        VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = this->readback.buffer;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+};
+
+} // namespace vk229
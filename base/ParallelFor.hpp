@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <threadpool.hpp>
+
+namespace vk229
+{
+
+/// Splits range [0, count) into equal contiguous chunks, one for every thread of the pool,
+/// runs func(begin, end, threadId) on them and waits until all of them are done.
+/// Chunks depend only on count and thread count (not on timing), so results are deterministic.
+template <typename Func>
+void parallelFor(vks::ThreadPool& pool, size_t count, Func func)
+{
+    const size_t threadCount = pool.threads.size();
+    if (threadCount < 2 || count < 2)
+    {
+        func(size_t(0), count, size_t(0));
+        return;
+    }
+
+    const size_t chunkSize = (count + threadCount - 1) / threadCount;
+    for (size_t threadId = 0; threadId < threadCount; threadId++)
+    {
+        const size_t begin = std::min(count, threadId * chunkSize);
+        const size_t end   = std::min(count, begin + chunkSize);
+        if (begin == end)
+        {
+            continue;
+        }
+        pool.threads[threadId]->addJob([begin, end, threadId, &func]() { func(begin, end, threadId); });
+    }
+    pool.wait();
+}
+
+} // namespace vk229
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <threadpool.hpp>
+#include <vulkan/vulkan.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Handle of a pipeline created on a worker thread. Polled without blocking - isReady() - by the frame loop.
+struct PipelineFuture
+{
+    std::shared_future<VkPipeline> future;
+
+    bool isValid() const
+    {
+        return this->future.valid();
+    }
+
+    bool isReady() const
+    {
+        return this->future.valid() && this->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    /// Blocks until the pipeline is created.
+    VkPipeline get() const
+    {
+        return this->future.get();
+    }
+};
+
+//////////////////////////////////////
+/// Creates pipelines on its own worker threads, so long compiles never stall the frame loop
+/// (nor parallelFor() of the scene thread pool, which waits for all jobs of its threads).
+/// Whatever the create function reads must be owned by it - the caller goes on before it runs.
+/// vkCreateGraphicsPipelines with a pipeline cache may be called from many threads, the cache is internally synchronized.
+struct PipelineCompiler
+{
+    void setThreadCount(uint32_t count)
+    {
+        this->pool.setThreadCount(count);
+        this->nextThread = 0;
+    }
+
+    PipelineFuture compile(std::function<VkPipeline()> create)
+    {
+        auto promise = std::make_shared<std::promise<VkPipeline>>();
+        PipelineFuture pipelineFuture = { promise->get_future().share() };
+        if (this->pool.threads.empty())
+        {
+            promise->set_value(create());
+            return pipelineFuture;
+        }
+
+        // Round robin - compiles take similar time
+        this->pool.threads[this->nextThread]->addJob([promise, create]() { promise->set_value(create()); });
+        this->nextThread = (this->nextThread + 1) % this->pool.threads.size();
+        return pipelineFuture;
+    }
+
+    /// Waits for all pipelines being created.
+    void wait()
+    {
+        this->pool.wait();
+    }
+
+private:
+    vks::ThreadPool pool;
+    uint32_t        nextThread = 0;
+};
+
+} // namespace vk229
@@ -0,0 +1,887 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Frame graph - passes declare which images they read and write, in submission order, and compile() derives the rest:
+/// * culling - a pass is recorded only if it has side effects (writes outside the graph, e.g. a readback buffer) or writes
+///   an image which a later recorded pass reads, or an imported image,
+/// * barriers - before every pass, layout transitions and memory dependencies of its images, from their previous uses,
+/// * render passes - a graphics pass (one with attachments) gets its own render pass, initial and final layouts of attachments
+///   are the ones the barriers set, store op is DONT_CARE when nothing reads the attachment later,
+/// * transient images - created by the graph, with usage of all their uses; images whose lifetimes (first to last recorded
+///   pass) don't overlap share memory, contents of an image don't survive to the next execute().
+/// Imported images (swapchain, depth buffer) are owned outside; they start in their given layout, end in their final one,
+/// and can be exchanged between executions (setImportedImage()) - framebuffers are cached per set of views. Dependencies on their
+/// uses outside the graph are the caller's (e.g. the semaphore of an acquired swapchain image, waited for at the stages
+/// of the image's first use in the graph).
+/// A pass declares every image once. Images are single level, single layer, one sample.
+/// Used only by the overdraw meter and visibility buffer frames of my_new_scene1. Main, offscreen (DynamicResolution) and temporal
+/// (TemporalUpscaler) passes of both examples, and the shadow and culling passes of instancing-229, record their own render passes
+/// and barriers.
+struct RenderGraph
+{
+    using resource_id_t = uint32_t;
+    using pass_id_t     = uint32_t;
+
+    enum class Access
+    {
+        COLOR_ATTACHMENT, // Written, blended.
+        DEPTH_ATTACHMENT, // Tested and written.
+        DEPTH_READ_ONLY,  // Tested, not written.
+        SAMPLED,
+        STORAGE_READ,
+        STORAGE_WRITE,
+        TRANSFER_SRC,
+        TRANSFER_DST
+    };
+
+    /// What an access needs from the image.
+    struct AccessInfo
+    {
+        VkImageLayout        layout;
+        VkPipelineStageFlags stages;
+        VkAccessFlags        access;
+        VkImageUsageFlags    usage;
+        bool                 isWrite;
+        bool                 isAttachment;
+    };
+
+    struct Use
+    {
+        resource_id_t        resource;
+        Access               access;
+        VkAttachmentLoadOp   loadOp       = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // Of attachments.
+        VkClearValue         clearValue   = {};
+        VkPipelineStageFlags shaderStages = 0;                                // Of sampled and storage images.
+    };
+
+    struct Resource
+    {
+        std::string   name;
+        VkFormat      format;
+        uint32_t      width;
+        uint32_t      height;
+        bool          isImported;
+        VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Of imported images.
+        VkImageLayout finalLayout   = VK_IMAGE_LAYOUT_UNDEFINED; // Of imported images, UNDEFINED - left as the last use leaves it.
+
+        VkImage     image = VK_NULL_HANDLE;
+        VkImageView view  = VK_NULL_HANDLE;
+
+        // By compile()
+        VkImageUsageFlags          usage     = 0;
+        uint32_t                   firstPass = UINT32_MAX; // Recorded passes using the image.
+        uint32_t                   lastPass  = 0;
+        uint32_t                   heap      = 0;          // Memory of transient images.
+        VkDeviceSize               offset    = 0;
+        VkMemoryRequirements       memReqs   = {};
+    };
+
+    /// Layout transition and memory dependency of one image, before a pass or at the end of the graph.
+    struct Barrier
+    {
+        resource_id_t resource;
+        VkImageLayout oldLayout;
+        VkImageLayout newLayout;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+    };
+
+    struct Pass
+    {
+        std::string                          name;
+        std::vector<Use>                     uses;
+        std::function<void(VkCommandBuffer)> record;
+        bool                                 hasSideEffects = false;
+
+        // By compile()
+        bool                      isRecorded = false;
+        VkRenderPass              renderPass = VK_NULL_HANDLE; // Graphics passes only.
+        std::vector<resource_id_t> attachments;                // In attachment order.
+        std::vector<VkClearValue> clearValues;
+        uint32_t                  width  = 0;
+        uint32_t                  height = 0;
+        std::vector<Barrier>      barriers;
+        VkPipelineStageFlags      srcStages = 0;
+        VkPipelineStageFlags      dstStages = 0;
+    };
+
+    struct Heap
+    {
+        uint32_t       memoryTypeIndex;
+        VkDeviceSize   size   = 0;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+    };
+
+    vks::VulkanDevice* vulkanDevice = nullptr;
+    VkDevice           device       = VK_NULL_HANDLE;
+
+    std::vector<Resource> resources;
+    std::vector<Pass>     passes;   // In submission order.
+    std::vector<Heap>     heaps;    // Of transient images, per memory type.
+
+    std::vector<Barrier>  finalBarriers; // Imported images into their final layouts.
+    VkPipelineStageFlags  finalSrcStages = 0;
+
+    std::map<std::pair<pass_id_t, std::vector<VkImageView>>, VkFramebuffer> framebuffers;
+
+// HELPERS {
+
+    static bool isDepthFormat(VkFormat format)
+    {
+        return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT ||
+               format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+    }
+
+    static VkImageAspectFlags getAspect(VkFormat format)
+    {
+        switch (format)
+        {
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+    }
+
+    static AccessInfo getAccessInfo(const Use& use, VkFormat format)
+    {
+        const VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        switch (use.access)
+        {
+        case Access::COLOR_ATTACHMENT:
+            return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true, true };
+        case Access::DEPTH_ATTACHMENT:
+            return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, fragmentTests,
+                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true, true };
+        case Access::DEPTH_READ_ONLY:
+            return { VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, fragmentTests,
+                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false, true };
+        case Access::SAMPLED:
+            return { isDepthFormat(format) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, use.shaderStages,
+                     VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_SAMPLED_BIT, false, false };
+        case Access::STORAGE_READ:
+            return { VK_IMAGE_LAYOUT_GENERAL, use.shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_STORAGE_BIT, false, false };
+        case Access::STORAGE_WRITE:
+            return { VK_IMAGE_LAYOUT_GENERAL, use.shaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_USAGE_STORAGE_BIT, true, false };
+        case Access::TRANSFER_SRC:
+            return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, false };
+        case Access::TRANSFER_DST:
+            return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true, false };
+        }
+        assert(false);
+        return {};
+    }
+
+    static VkAccessFlags getWriteAccess(VkAccessFlags access)
+    {
+        return access & (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                         VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+    }
+
+    /// The use reads contents written before - a read, or an attachment which is loaded.
+    static bool isReading(const Use& use, const AccessInfo& info)
+    {
+        return !info.isWrite || (info.isAttachment && use.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD);
+    }
+
+    VkImage getImage(resource_id_t res) const
+    {
+        return this->resources[res].image;
+    }
+
+    VkImageView getView(resource_id_t res) const
+    {
+        return this->resources[res].view;
+    }
+
+    /// Pipelines drawing in a graphics pass are created for it (valid after compile(), compatible across compiles
+    /// while formats of the pass's images stay).
+    VkRenderPass getRenderPass(pass_id_t pass) const
+    {
+        assert(this->passes[pass].renderPass != VK_NULL_HANDLE);
+        return this->passes[pass].renderPass;
+    }
+
+    /// Memory of all transient images, aliased.
+    VkDeviceSize getMemorySize() const
+    {
+        VkDeviceSize size = 0;
+        for (const Heap& heap : this->heaps)
+        {
+            size += heap.size;
+        }
+        return size;
+    }
+
+// } // HELPERS
+
+// DECLARING {
+
+    /// Image created by the graph - its contents live from the first write to the last read within one execute().
+    resource_id_t createImage(const std::string& name, VkFormat format, uint32_t width, uint32_t height)
+    {
+        Resource resource;
+        resource.name       = name;
+        resource.format     = format;
+        resource.width      = width;
+        resource.height     = height;
+        resource.isImported = false;
+        this->resources.push_back(resource);
+        return static_cast<resource_id_t>(this->resources.size() - 1);
+    }
+
+    /// Image owned outside the graph, set by setImportedImage() before execute(). Passes writing it are never culled.
+    resource_id_t importImage(const std::string& name, VkFormat format, uint32_t width, uint32_t height,
+                              VkImageLayout initialLayout, VkImageLayout finalLayout)
+    {
+        Resource resource;
+        resource.name          = name;
+        resource.format        = format;
+        resource.width         = width;
+        resource.height        = height;
+        resource.isImported    = true;
+        resource.initialLayout = initialLayout;
+        resource.finalLayout   = finalLayout;
+        this->resources.push_back(resource);
+        return static_cast<resource_id_t>(this->resources.size() - 1);
+    }
+
+    void setImportedImage(resource_id_t res, VkImage image, VkImageView view)
+    {
+        assert(this->resources[res].isImported);
+        this->resources[res].image = image;
+        this->resources[res].view  = view;
+    }
+
+    /// Size of an image - compile() must be called again.
+    void setExtent(resource_id_t res, uint32_t width, uint32_t height)
+    {
+        this->resources[res].width  = width;
+        this->resources[res].height = height;
+    }
+
+    /// Pass recording its commands by record(); a graphics pass records them inside its render pass, with viewport and scissor
+    /// of its attachments set.
+    pass_id_t addPass(const std::string& name, const std::function<void(VkCommandBuffer)>& record)
+    {
+        Pass pass;
+        pass.name   = name;
+        pass.record = record;
+        this->passes.push_back(pass);
+        return static_cast<pass_id_t>(this->passes.size() - 1);
+    }
+
+    /// The pass writes something outside the graph, it is never culled.
+    void setSideEffects(pass_id_t pass)
+    {
+        this->passes[pass].hasSideEffects = true;
+    }
+
+    void writeColor(pass_id_t pass, resource_id_t res, VkAttachmentLoadOp loadOp, VkClearColorValue clearColor = {})
+    {
+        Use use = { res, Access::COLOR_ATTACHMENT, loadOp };
+        use.clearValue.color = clearColor;
+        this->addUse(pass, use);
+    }
+
+    void writeDepth(pass_id_t pass, resource_id_t res, VkAttachmentLoadOp loadOp, VkClearDepthStencilValue clearDepth = { 1.0f, 0 })
+    {
+        Use use = { res, Access::DEPTH_ATTACHMENT, loadOp };
+        use.clearValue.depthStencil = clearDepth;
+        this->addUse(pass, use);
+    }
+
+    /// Depth attachment tested, not written (e.g. depth test EQUAL after a pre-pass).
+    void readDepth(pass_id_t pass, resource_id_t res)
+    {
+        this->addUse(pass, { res, Access::DEPTH_READ_ONLY, VK_ATTACHMENT_LOAD_OP_LOAD });
+    }
+
+    void readSampled(pass_id_t pass, resource_id_t res, VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
+    {
+        Use use = { res, Access::SAMPLED };
+        use.shaderStages = shaderStages;
+        this->addUse(pass, use);
+    }
+
+    void readStorage(pass_id_t pass, resource_id_t res, VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+    {
+        Use use = { res, Access::STORAGE_READ };
+        use.shaderStages = shaderStages;
+        this->addUse(pass, use);
+    }
+
+    void writeStorage(pass_id_t pass, resource_id_t res, VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)
+    {
+        Use use = { res, Access::STORAGE_WRITE };
+        use.shaderStages = shaderStages;
+        this->addUse(pass, use);
+    }
+
+    void readTransfer(pass_id_t pass, resource_id_t res)
+    {
+        this->addUse(pass, { res, Access::TRANSFER_SRC });
+    }
+
+    void writeTransfer(pass_id_t pass, resource_id_t res)
+    {
+        this->addUse(pass, { res, Access::TRANSFER_DST });
+    }
+
+// } // DECLARING
+
+// PREPARE {
+
+    /// Culls passes, creates transient images in aliased memory, render passes, and barriers. Can be called again after
+    /// declarations or extents changed - everything compiled before is destroyed (the device must not use it anymore).
+    void compile(vks::VulkanDevice* dev)
+    {
+        this->destroyCompiled();
+        this->vulkanDevice = dev;
+        this->device       = dev->logicalDevice;
+
+        this->cullPasses();
+        this->createTransientImages();
+        this->createRenderPasses();
+        this->computeBarriers();
+
+        uint32_t recordedCount = 0;
+        for (const Pass& pass : this->passes)
+        {
+            recordedCount += pass.isRecorded ? 1 : 0;
+        }
+        std::cout << " >>> RenderGraph::compile: " << recordedCount << " of " << this->passes.size() << " passes, "
+                  << this->getMemorySize() / 1024 << " KiB of transient images\n";
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    /// Records all passes which weren't culled, with their barriers.
+    void execute(VkCommandBuffer cmdBuffer)
+    {
+        for (pass_id_t p = 0; p < this->passes.size(); p++)
+        {
+            Pass& pass = this->passes[p];
+            if (!pass.isRecorded)
+            {
+                continue;
+            }
+            this->recordBarriers(cmdBuffer, pass.barriers, pass.srcStages, pass.dstStages);
+
+            if (pass.renderPass == VK_NULL_HANDLE)
+            {
+                pass.record(cmdBuffer);
+                continue;
+            }
+
+            VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+            renderPassBeginInfo.renderPass = pass.renderPass;
+            renderPassBeginInfo.framebuffer = this->getFramebuffer(p);
+            renderPassBeginInfo.renderArea.extent.width = pass.width;
+            renderPassBeginInfo.renderArea.extent.height = pass.height;
+            renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+            renderPassBeginInfo.pClearValues = pass.clearValues.data();
+
+            vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            VkViewport viewport = vks::initializers::viewport((float)pass.width, (float)pass.height, 0.0f, 1.0f);
+            vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+            VkRect2D scissor = vks::initializers::rect2D(pass.width, pass.height, 0, 0);
+            vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+            pass.record(cmdBuffer);
+            vkCmdEndRenderPass(cmdBuffer);
+        }
+        this->recordBarriers(cmdBuffer, this->finalBarriers, this->finalSrcStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    }
+
+// } // RUNTIME
+
+// DESTROY {
+
+    /// Compiled objects and declarations.
+    void destroy()
+    {
+        this->destroyCompiled();
+        this->resources.clear();
+        this->passes.clear();
+    }
+
+    /// Compiled objects only - declarations stay, for compile().
+    void destroyCompiled()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        for (auto& [key, framebuffer] : this->framebuffers)
+        {
+            vkDestroyFramebuffer(this->device, framebuffer, nullptr);
+        }
+        this->framebuffers.clear();
+        for (Pass& pass : this->passes)
+        {
+            if (pass.renderPass != VK_NULL_HANDLE)
+            {
+                vkDestroyRenderPass(this->device, pass.renderPass, nullptr);
+            }
+            pass.renderPass = VK_NULL_HANDLE;
+        }
+        for (Resource& resource : this->resources)
+        {
+            if (!resource.isImported && resource.image != VK_NULL_HANDLE)
+            {
+                vkDestroyImageView(this->device, resource.view, nullptr);
+                vkDestroyImage(this->device, resource.image, nullptr);
+                resource.image = VK_NULL_HANDLE;
+                resource.view  = VK_NULL_HANDLE;
+            }
+        }
+        for (Heap& heap : this->heaps)
+        {
+            vkFreeMemory(this->device, heap.memory, nullptr);
+        }
+        this->heaps.clear();
+        this->device = VK_NULL_HANDLE;
+    }
+
+// } // DESTROY
+
+private:
+    void addUse(pass_id_t pass, const Use& use)
+    {
+        for (const Use& other : this->passes[pass].uses)
+        {
+            assert(other.resource != use.resource && "Image declared twice by one pass.");
+        }
+        this->passes[pass].uses.push_back(use);
+    }
+
+    /// Backwards from the last pass - a pass is needed if it has side effects or writes an image needed later,
+    /// then everything it reads is needed.
+    void cullPasses()
+    {
+        std::vector<bool> isNeeded(this->resources.size(), false);
+        for (resource_id_t r = 0; r < this->resources.size(); r++)
+        {
+            isNeeded[r] = this->resources[r].isImported;
+        }
+        for (pass_id_t p = static_cast<pass_id_t>(this->passes.size()); p-- > 0;)
+        {
+            Pass& pass = this->passes[p];
+            pass.isRecorded = pass.hasSideEffects;
+            for (const Use& use : pass.uses)
+            {
+                const AccessInfo info = getAccessInfo(use, this->resources[use.resource].format);
+                pass.isRecorded = pass.isRecorded || (info.isWrite && isNeeded[use.resource]);
+            }
+            if (!pass.isRecorded)
+            {
+                continue;
+            }
+            for (const Use& use : pass.uses)
+            {
+                if (isReading(use, getAccessInfo(use, this->resources[use.resource].format)))
+                {
+                    isNeeded[use.resource] = true;
+                }
+            }
+        }
+    }
+
+    /// Transient images of recorded passes, placed into heaps - largest first, each at the lowest offset where it doesn't overlap
+    /// an already placed image which is alive at the same time.
+    void createTransientImages()
+    {
+        std::vector<resource_id_t> transients;
+        for (Resource& resource : this->resources)
+        {
+            resource.usage     = 0;
+            resource.firstPass = UINT32_MAX;
+            resource.lastPass  = 0;
+        }
+        for (pass_id_t p = 0; p < this->passes.size(); p++)
+        {
+            if (!this->passes[p].isRecorded)
+            {
+                continue;
+            }
+            for (const Use& use : this->passes[p].uses)
+            {
+                Resource& resource = this->resources[use.resource];
+                resource.usage    |= getAccessInfo(use, resource.format).usage;
+                resource.firstPass = std::min(resource.firstPass, p);
+                resource.lastPass  = std::max(resource.lastPass, p);
+            }
+        }
+        for (resource_id_t r = 0; r < this->resources.size(); r++)
+        {
+            Resource& resource = this->resources[r];
+            if (resource.isImported || resource.firstPass == UINT32_MAX)
+            {
+                continue;
+            }
+            VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+            imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageCreateInfo.format = resource.format;
+            imageCreateInfo.extent = { resource.width, resource.height, 1 };
+            imageCreateInfo.mipLevels = 1;
+            imageCreateInfo.arrayLayers = 1;
+            imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageCreateInfo.usage = resource.usage;
+            VK_CHECK_RESULT(vkCreateImage(this->device, &imageCreateInfo, nullptr, &resource.image));
+            vkGetImageMemoryRequirements(this->device, resource.image, &resource.memReqs);
+            transients.push_back(r);
+        }
+
+        std::sort(transients.begin(), transients.end(), [this](resource_id_t a, resource_id_t b)
+        {
+            return this->resources[a].memReqs.size > this->resources[b].memReqs.size;
+        });
+
+        std::vector<resource_id_t> placed;
+        for (resource_id_t r : transients)
+        {
+            Resource& resource = this->resources[r];
+            const uint32_t memoryTypeIndex = this->vulkanDevice->getMemoryType(resource.memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            auto heap = std::find_if(this->heaps.begin(), this->heaps.end(), [&](const Heap& h) { return h.memoryTypeIndex == memoryTypeIndex; });
+            if (heap == this->heaps.end())
+            {
+                this->heaps.push_back({ memoryTypeIndex });
+                heap = this->heaps.end() - 1;
+            }
+            resource.heap = static_cast<uint32_t>(heap - this->heaps.begin());
+
+            // Images of the heap alive at the same time, by offset
+            std::vector<resource_id_t> concurrent;
+            for (resource_id_t other : placed)
+            {
+                const Resource& o = this->resources[other];
+                if (o.heap == resource.heap && o.firstPass <= resource.lastPass && resource.firstPass <= o.lastPass)
+                {
+                    concurrent.push_back(other);
+                }
+            }
+            std::sort(concurrent.begin(), concurrent.end(), [this](resource_id_t a, resource_id_t b)
+            {
+                return this->resources[a].offset < this->resources[b].offset;
+            });
+
+            const VkDeviceSize alignment = resource.memReqs.alignment;
+            VkDeviceSize offset = 0;
+            for (resource_id_t other : concurrent)
+            {
+                const Resource& o = this->resources[other];
+                if (offset + resource.memReqs.size <= o.offset)
+                {
+                    break; // Fits in the gap before it.
+                }
+                offset = std::max(offset, (o.offset + o.memReqs.size + alignment - 1) / alignment * alignment);
+            }
+            resource.offset = offset;
+            heap->size = std::max(heap->size, offset + resource.memReqs.size);
+            placed.push_back(r);
+        }
+
+        for (Heap& heap : this->heaps)
+        {
+            VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+            memAlloc.allocationSize = heap.size;
+            memAlloc.memoryTypeIndex = heap.memoryTypeIndex;
+            VK_CHECK_RESULT(vkAllocateMemory(this->device, &memAlloc, nullptr, &heap.memory));
+        }
+        for (resource_id_t r : transients)
+        {
+            Resource& resource = this->resources[r];
+            VK_CHECK_RESULT(vkBindImageMemory(this->device, resource.image, this->heaps[resource.heap].memory, resource.offset));
+
+            VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+            viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewCreateInfo.format = resource.format;
+            viewCreateInfo.subresourceRange = { getAspect(resource.format), 0, 1, 0, 1 };
+            viewCreateInfo.image = resource.image;
+            VK_CHECK_RESULT(vkCreateImageView(this->device, &viewCreateInfo, nullptr, &resource.view));
+        }
+    }
+
+    /// One subpass with the pass's attachments; layouts are transitioned by barriers outside, so initial and final layouts
+    /// are the ones of the attachments' uses.
+    void createRenderPasses()
+    {
+        for (pass_id_t p = 0; p < this->passes.size(); p++)
+        {
+            Pass& pass = this->passes[p];
+            pass.attachments.clear();
+            pass.clearValues.clear();
+            if (!pass.isRecorded)
+            {
+                continue;
+            }
+
+            std::vector<VkAttachmentDescription> attachments;
+            std::vector<VkAttachmentReference>   colorReferences;
+            VkAttachmentReference                depthReference = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+            for (const Use& use : pass.uses)
+            {
+                const Resource&  resource = this->resources[use.resource];
+                const AccessInfo info     = getAccessInfo(use, resource.format);
+                if (!info.isAttachment)
+                {
+                    continue;
+                }
+                assert(pass.attachments.empty() || (resource.width == pass.width && resource.height == pass.height));
+                pass.width  = resource.width;
+                pass.height = resource.height;
+
+                // Stored when a later pass reads it, or it outlives the graph
+                bool isReadLater = resource.isImported;
+                for (pass_id_t later = p + 1; later < this->passes.size() && !isReadLater; later++)
+                {
+                    if (!this->passes[later].isRecorded)
+                    {
+                        continue;
+                    }
+                    for (const Use& laterUse : this->passes[later].uses)
+                    {
+                        isReadLater = isReadLater || (laterUse.resource == use.resource && isReading(laterUse, getAccessInfo(laterUse, resource.format)));
+                    }
+                }
+
+                VkAttachmentDescription attachment = {};
+                attachment.format = resource.format;
+                attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+                attachment.loadOp = use.loadOp;
+                attachment.storeOp = isReadLater ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                const bool hasStencil = (getAspect(resource.format) & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+                attachment.stencilLoadOp = hasStencil ? use.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                attachment.stencilStoreOp = hasStencil ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                attachment.initialLayout = info.layout;
+                attachment.finalLayout = info.layout;
+
+                const VkAttachmentReference reference = { static_cast<uint32_t>(attachments.size()), info.layout };
+                if (use.access == Access::COLOR_ATTACHMENT)
+                {
+                    colorReferences.push_back(reference);
+                }
+                else
+                {
+                    assert(depthReference.attachment == VK_ATTACHMENT_UNUSED && "One depth attachment per pass.");
+                    depthReference = reference;
+                }
+                attachments.push_back(attachment);
+                pass.attachments.push_back(use.resource);
+                pass.clearValues.push_back(use.clearValue);
+            }
+            if (attachments.empty()) // Compute or transfer.
+            {
+                continue;
+            }
+
+            VkSubpassDescription subpassDescription = {};
+            subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subpassDescription.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+            subpassDescription.pColorAttachments = colorReferences.data();
+            subpassDescription.pDepthStencilAttachment = depthReference.attachment != VK_ATTACHMENT_UNUSED ? &depthReference : nullptr;
+
+            VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+            renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            renderPassInfo.pAttachments = attachments.data();
+            renderPassInfo.subpassCount = 1;
+            renderPassInfo.pSubpasses = &subpassDescription;
+            VK_CHECK_RESULT(vkCreateRenderPass(this->device, &renderPassInfo, nullptr, &pass.renderPass));
+        }
+    }
+
+    /// Uses of every image are replayed in pass order. Before a use, a barrier is needed if the layout changes, if the use reads
+    /// a write which wasn't made visible to its stages yet, or if it writes after earlier reads or writes. Transient images start
+    /// UNDEFINED (contents discarded), after the last uses of all images of their heap - so after images which had their memory
+    /// earlier in the graph, and after the previous execution.
+    void computeBarriers()
+    {
+        std::vector<VkPipelineStageFlags> heapStages(this->heaps.size(), 0);
+        std::vector<VkAccessFlags>        heapAccess(this->heaps.size(), 0);
+        for (pass_id_t p = 0; p < this->passes.size(); p++)
+        {
+            for (const Use& use : this->passes[p].uses)
+            {
+                const Resource& resource = this->resources[use.resource];
+                if (!this->passes[p].isRecorded || resource.isImported || resource.lastPass != p)
+                {
+                    continue;
+                }
+                const AccessInfo info = getAccessInfo(use, resource.format);
+                heapStages[resource.heap] |= info.stages;
+                heapAccess[resource.heap] |= info.isWrite ? getWriteAccess(info.access) : 0;
+            }
+        }
+
+        struct State
+        {
+            VkImageLayout        layout        = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags writeStages   = 0; // Of the last write.
+            VkAccessFlags        writeAccess   = 0;
+            VkPipelineStageFlags readStages    = 0; // Since the last write.
+            VkPipelineStageFlags visibleStages = 0; // The last write is visible to.
+            VkAccessFlags        visibleAccess = 0;
+            bool                 isUsed        = false;
+        };
+        std::vector<State> states(this->resources.size());
+        for (resource_id_t r = 0; r < this->resources.size(); r++)
+        {
+            states[r].layout = this->resources[r].isImported ? this->resources[r].initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        for (Pass& pass : this->passes)
+        {
+            pass.barriers.clear();
+            pass.srcStages = 0;
+            pass.dstStages = 0;
+            if (!pass.isRecorded)
+            {
+                continue;
+            }
+            for (const Use& use : pass.uses)
+            {
+                const Resource&  resource = this->resources[use.resource];
+                const AccessInfo info     = getAccessInfo(use, resource.format);
+                State&           state    = states[use.resource];
+
+                VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+                VkAccessFlags        srcAccess = state.writeAccess;
+                const bool isFirstTransientUse = !resource.isImported && !state.isUsed;
+                if (isFirstTransientUse)
+                {
+                    assert(isReading(use, info) == false && "Transient image read before it is written.");
+                    srcStages |= heapStages[resource.heap];
+                    srcAccess |= heapAccess[resource.heap];
+                }
+
+                const bool isLayoutChange = state.layout != info.layout;
+                const bool isHazard = info.isWrite ? (srcStages != 0)
+                                                   : (state.writeStages != 0 && ((info.stages & ~state.visibleStages) != 0 || (info.access & ~state.visibleAccess) != 0));
+                if (isLayoutChange || isHazard)
+                {
+                    pass.barriers.push_back({ use.resource, isFirstTransientUse ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout, info.layout, srcAccess, info.access });
+                    // Imported image used for the first time waits on the stages of its use - a semaphore wait before
+                    // the graph (acquired swapchain image) is at these stages, so the layout transition comes after it
+                    if (srcStages == 0)
+                    {
+                        srcStages = resource.isImported ? info.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                    }
+                    pass.srcStages |= srcStages;
+                    pass.dstStages |= info.stages;
+                    state.layout        = info.layout;
+                    state.readStages    = 0;
+                    state.visibleStages = info.stages;
+                    state.visibleAccess = info.access;
+                }
+
+                state.isUsed = true;
+                if (info.isWrite)
+                {
+                    state.writeStages   = info.stages;
+                    state.writeAccess   = getWriteAccess(info.access);
+                    state.readStages    = 0;
+                    state.visibleStages = 0;
+                    state.visibleAccess = 0;
+                }
+                else
+                {
+                    state.readStages |= info.stages;
+                }
+            }
+        }
+
+        this->finalBarriers.clear();
+        this->finalSrcStages = 0;
+        for (resource_id_t r = 0; r < this->resources.size(); r++)
+        {
+            const Resource& resource = this->resources[r];
+            const State&    state    = states[r];
+            if (resource.isImported && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && resource.finalLayout != state.layout)
+            {
+                this->finalBarriers.push_back({ r, state.layout, resource.finalLayout, state.writeAccess, 0 });
+                const VkPipelineStageFlags srcStages = state.writeStages | state.readStages;
+                this->finalSrcStages |= srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            }
+        }
+    }
+
+    void recordBarriers(VkCommandBuffer cmdBuffer, const std::vector<Barrier>& barriers, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages) const
+    {
+        if (barriers.empty())
+        {
+            return;
+        }
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+        for (const Barrier& barrier : barriers)
+        {
+            const Resource& resource = this->resources[barrier.resource];
+            assert(resource.image != VK_NULL_HANDLE);
+            VkImageMemoryBarrier imageBarrier = vks::initializers::imageMemoryBarrier();
+            imageBarrier.srcAccessMask = barrier.srcAccess;
+            imageBarrier.dstAccessMask = barrier.dstAccess;
+            imageBarrier.oldLayout = barrier.oldLayout;
+            imageBarrier.newLayout = barrier.newLayout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.image = resource.image;
+            imageBarrier.subresourceRange = { getAspect(resource.format), 0, 1, 0, 1 };
+            imageBarriers.push_back(imageBarrier);
+        }
+        vkCmdPipelineBarrier(cmdBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    /// Framebuffer of the pass with current views of its attachments - imported views change between executions.
+    VkFramebuffer getFramebuffer(pass_id_t p)
+    {
+        const Pass& pass = this->passes[p];
+        std::vector<VkImageView> views;
+        for (resource_id_t res : pass.attachments)
+        {
+            assert(this->resources[res].view != VK_NULL_HANDLE);
+            views.push_back(this->resources[res].view);
+        }
+        auto key = std::make_pair(p, views);
+        auto framebuffer = this->framebuffers.find(key);
+        if (framebuffer != this->framebuffers.end())
+        {
+            return framebuffer->second;
+        }
+
+        VkFramebufferCreateInfo framebufferCreateInfo = vks::initializers::framebufferCreateInfo();
+        framebufferCreateInfo.renderPass = pass.renderPass;
+        framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(views.size());
+        framebufferCreateInfo.pAttachments = views.data();
+        framebufferCreateInfo.width = pass.width;
+        framebufferCreateInfo.height = pass.height;
+        framebufferCreateInfo.layers = 1;
+        VkFramebuffer created;
+        VK_CHECK_RESULT(vkCreateFramebuffer(this->device, &framebufferCreateInfo, nullptr, &created));
+        this->framebuffers[key] = created;
+        return created;
+    }
+};
+
+} // namespace vk229
@@ -0,0 +1,736 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/stat.h>
+#include <vulkan/vulkan.h>
+#include "MaterialVariant.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Scene definition - text form for authoring, compiled binary form for loading.
+///
+/// Text form, one definition per line, '#' starts a comment, names are referenced by later lines:
+///     mesh      <name> <file>
+///     shader    <name> <vert|frag|comp> <file>
+///     texture   <name> <format> <type> <file>          - format as VkFormat without prefix, type as TexT
+///     matrix    <name> identity | <16 floats>          - column major
+///     texset    <name> <texture>...
+///     shaderset <name> <shader>... [features=<type>,...] [ao|emit|diffdi|refl|uvscale=<float>]...
+///     entity    <name> <mesh> <matrix> <texset> <shaderset> [parent entity]
+///     prepass   <off|on|auto> [overdraw]                - depth pre-pass, auto: when measured overdraw is at least given (1.5)
+/// Options of a shader set are its material variant (MaterialVariant) - texture maps it uses (TexT names, all by default)
+/// and its coefficients. Settings of the whole scene (prepass) are in the header.
+///
+/// Binary form is what loading reads - header, arrays of fixed size records and one string table,
+/// which records point to by offset. It is read at once and used in place, nothing is parsed.
+/// loadOrCompile() compiles the text when binary is missing or not newer, so editing the scene needs no rebuild.
+struct SceneFile
+{
+    static constexpr uint32_t MAGIC   = 0x43534B56; // "VKSC"
+    static constexpr uint32_t VERSION = 3;
+
+    enum DepthPrepass : uint32_t
+    {
+        DEPTH_PREPASS_OFF,
+        DEPTH_PREPASS_ON,
+        DEPTH_PREPASS_AUTO
+    };
+
+    /// Scene wide settings, defaults when the scene doesn't set them.
+    struct Settings
+    {
+        uint32_t depthPrepass       = DEPTH_PREPASS_OFF; // DepthPrepass
+        float    prepassMinOverdraw = 1.5f;              // Shaded fragments per covered pixel, for DEPTH_PREPASS_AUTO.
+
+        bool operator==(const Settings& other) const
+        {
+            return this->depthPrepass == other.depthPrepass && this->prepassMinOverdraw == other.prepassMinOverdraw;
+        }
+
+        bool operator!=(const Settings& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    struct StringRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct MeshRecord
+    {
+        StringRef name;
+        StringRef filename;
+    };
+
+    struct ShaderRecord
+    {
+        StringRef name;
+        StringRef filename;
+        uint32_t  stage; // VkShaderStageFlagBits
+    };
+
+    struct TextureRecord
+    {
+        StringRef name;
+        StringRef filename;
+        uint32_t  format; // VkFormat
+        uint32_t  type;   // TexT
+    };
+
+    struct MatrixRecord
+    {
+        StringRef name;
+        float     matrix[16];
+    };
+
+    /// Texture set - its members are [firstMember, firstMember + memberCount) of set members.
+    struct SetRecord
+    {
+        StringRef name;
+        uint32_t  firstMember;
+        uint32_t  memberCount;
+    };
+
+    /// Shader set - members as in SetRecord.
+    struct ShaderSetRecord
+    {
+        StringRef       name;
+        uint32_t        firstMember;
+        uint32_t        memberCount;
+        MaterialVariant variant;
+    };
+
+    struct EntityRecord
+    {
+        StringRef name;
+        StringRef mesh;
+        StringRef matrix;
+        StringRef texturesSet;
+        StringRef shadersSet;
+        StringRef parent; // Empty for roots.
+    };
+
+    enum Section
+    {
+        MESHES,
+        SHADERS,
+        TEXTURES,
+        MATRICES,
+        TEXTURE_SETS,
+        SHADER_SETS,
+        ENTITIES,
+        SET_MEMBERS, // StringRef
+        STRINGS,     // char
+        SECTION_COUNT
+    };
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t fileSize;
+        uint64_t offsets[SECTION_COUNT];
+        uint32_t counts[SECTION_COUNT];
+        Settings settings;
+    };
+
+    /// Records of one section, used in place.
+    template <typename T>
+    struct Records
+    {
+        const T* first;
+        uint32_t count;
+
+        const T* begin() const { return this->first; }
+        const T* end()   const { return this->first + this->count; }
+        const T& operator[](uint32_t i) const { return this->first[i]; }
+    };
+
+    std::vector<uint64_t> data; // Whole file, 8 byte aligned.
+
+// LOADING {
+
+    /// Reads compiled scene. Returns false and error message if it is missing or malformed.
+    bool load(const std::string& binPath, std::string& error)
+    {
+        std::ifstream file(binPath, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            error = "Could not open " + binPath;
+            return false;
+        }
+        const size_t size = file.tellg();
+        if (size < sizeof(Header))
+        {
+            error = binPath + " is too small to be a scene";
+            return false;
+        }
+        this->data.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(this->data.data()), size);
+
+        const Header& header = this->getHeader();
+        if (header.magic != MAGIC || header.version != VERSION || header.fileSize != size)
+        {
+            error = binPath + " is not a scene of version " + std::to_string(VERSION);
+            return false;
+        }
+        for (int s = 0; s < SECTION_COUNT; s++)
+        {
+            if (header.offsets[s] % alignof(uint64_t) != 0 || header.offsets[s] > size ||
+                uint64_t(header.counts[s]) * getRecordSize(Section(s)) > size - header.offsets[s])
+            {
+                error = binPath + " has section out of the file";
+                return false;
+            }
+        }
+        if (!this->areReferencesInFile())
+        {
+            error = binPath + " has string or set member out of its section";
+            return false;
+        }
+        return true;
+    }
+
+    /// Compiles text scene into binary one if binary is missing or older, then loads binary.
+    /// isTextChanged - text is known to be changed (reported by FileWatcher), it is compiled whatever the times say:
+    /// they have a resolution of a second, and an edit within the second of the last compile would look older.
+    bool loadOrCompile(const std::string& textPath, std::string& error, bool isTextChanged = false)
+    {
+        const std::string binPath = textPath + ".bin";
+        struct stat textStat, binStat;
+        const bool isTextPresent = stat(textPath.c_str(), &textStat) == 0;
+        const bool isBinPresent  = stat(binPath.c_str(),  &binStat)  == 0;
+        if (isTextPresent && (isTextChanged || !isBinPresent || binStat.st_mtime <= textStat.st_mtime))
+        {
+            if (!compile(textPath, binPath, error))
+            {
+                return false;
+            }
+        }
+        return this->load(binPath, error);
+    }
+
+    const Header& getHeader() const
+    {
+        return *reinterpret_cast<const Header*>(this->data.data());
+    }
+
+    template <typename T>
+    Records<T> getRecords(Section section) const
+    {
+        const Header& header = this->getHeader();
+        return { reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(this->data.data()) + header.offsets[section]), header.counts[section] };
+    }
+
+    Records<MeshRecord>    getMeshes()      const { return this->getRecords<MeshRecord>(MESHES); }
+    Records<ShaderRecord>  getShaders()     const { return this->getRecords<ShaderRecord>(SHADERS); }
+    Records<TextureRecord> getTextures()    const { return this->getRecords<TextureRecord>(TEXTURES); }
+    Records<MatrixRecord>  getMatrices()    const { return this->getRecords<MatrixRecord>(MATRICES); }
+    Records<SetRecord>     getTextureSets() const { return this->getRecords<SetRecord>(TEXTURE_SETS); }
+    Records<ShaderSetRecord> getShaderSets() const { return this->getRecords<ShaderSetRecord>(SHADER_SETS); }
+    Records<EntityRecord>  getEntities()    const { return this->getRecords<EntityRecord>(ENTITIES); }
+
+    const Settings& getSettings() const
+    {
+        return this->getHeader().settings;
+    }
+
+    template <typename SetRecordT>
+    Records<StringRef> getSetMembers(const SetRecordT& set) const
+    {
+        return { this->getRecords<StringRef>(SET_MEMBERS).first + set.firstMember, set.memberCount };
+    }
+
+    std::string_view getString(const StringRef& ref) const
+    {
+        const Records<char> strings = this->getRecords<char>(STRINGS);
+        return isInRange(ref.offset, ref.length, strings.count) ? std::string_view(strings.first + ref.offset, ref.length) : std::string_view();
+    }
+
+// } // LOADING
+
+// COMPILING {
+
+    /// Text scene -> binary scene. Returns false and error message with line number on syntax errors
+    /// and references to undefined names.
+    static bool compile(const std::string& textPath, const std::string& binPath, std::string& error)
+    {
+        std::ifstream text(textPath);
+        if (!text)
+        {
+            error = "Could not open " + textPath;
+            return false;
+        }
+
+        Compiler compiler;
+        std::string line;
+        for (uint32_t lineNumber = 1; std::getline(text, line); lineNumber++)
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream tokens(line);
+            std::vector<std::string> words;
+            for (std::string word; tokens >> word;)
+            {
+                words.push_back(word);
+            }
+            if (!words.empty() && !compiler.addDefinition(words, error))
+            {
+                error = textPath + ":" + std::to_string(lineNumber) + ": " + error;
+                return false;
+            }
+        }
+
+        std::vector<uint8_t> bin;
+        if (!compiler.write(bin, error))
+        {
+            error = textPath + ": " + error;
+            return false;
+        }
+
+        std::ofstream out(binPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(bin.data()), bin.size());
+        if (!out)
+        {
+            error = "Could not write " + binPath;
+            return false;
+        }
+        return true;
+    }
+
+// } // COMPILING
+
+private:
+    /// [first, first + count) is within [0, total), without overflow.
+    static bool isInRange(uint32_t first, uint32_t count, uint32_t total)
+    {
+        return uint64_t(first) + count <= total;
+    }
+
+    /// Every string of every record is in the string table and members of every set are in the set members,
+    /// so records can be used in place without checks - sections themselves are checked by load().
+    bool areReferencesInFile() const
+    {
+        const uint32_t stringCount = this->getHeader().counts[STRINGS];
+        const uint32_t memberCount = this->getHeader().counts[SET_MEMBERS];
+        auto areStrings = [&](std::initializer_list<StringRef> refs)
+        {
+            for (const StringRef& ref : refs)
+            {
+                if (!isInRange(ref.offset, ref.length, stringCount)) return false;
+            }
+            return true;
+        };
+
+        for (const MeshRecord& mesh : this->getMeshes())
+        {
+            if (!areStrings({ mesh.name, mesh.filename })) return false;
+        }
+        for (const ShaderRecord& shader : this->getShaders())
+        {
+            if (!areStrings({ shader.name, shader.filename })) return false;
+        }
+        for (const TextureRecord& texture : this->getTextures())
+        {
+            if (!areStrings({ texture.name, texture.filename })) return false;
+        }
+        for (const MatrixRecord& matrix : this->getMatrices())
+        {
+            if (!areStrings({ matrix.name })) return false;
+        }
+        for (const SetRecord& set : this->getTextureSets())
+        {
+            if (!areStrings({ set.name }) || !isInRange(set.firstMember, set.memberCount, memberCount)) return false;
+        }
+        for (const ShaderSetRecord& set : this->getShaderSets())
+        {
+            if (!areStrings({ set.name }) || !isInRange(set.firstMember, set.memberCount, memberCount)) return false;
+        }
+        for (const EntityRecord& entity : this->getEntities())
+        {
+            if (!areStrings({ entity.name, entity.mesh, entity.matrix, entity.texturesSet, entity.shadersSet, entity.parent })) return false;
+        }
+        for (const StringRef& member : this->getRecords<StringRef>(SET_MEMBERS))
+        {
+            if (!areStrings({ member })) return false;
+        }
+        return true;
+    }
+
+    static size_t getRecordSize(Section section)
+    {
+        switch (section)
+        {
+        case MESHES:       return sizeof(MeshRecord);
+        case SHADERS:      return sizeof(ShaderRecord);
+        case TEXTURES:     return sizeof(TextureRecord);
+        case MATRICES:     return sizeof(MatrixRecord);
+        case TEXTURE_SETS: return sizeof(SetRecord);
+        case SHADER_SETS:  return sizeof(ShaderSetRecord);
+        case ENTITIES:     return sizeof(EntityRecord);
+        case SET_MEMBERS:  return sizeof(StringRef);
+        default:           return sizeof(char);
+        }
+    }
+
+    struct Compiler
+    {
+        std::vector<MeshRecord>    meshes;
+        std::vector<ShaderRecord>  shaders;
+        std::vector<TextureRecord> textures;
+        std::vector<MatrixRecord>  matrices;
+        std::vector<SetRecord>     textureSets;
+        std::vector<ShaderSetRecord> shaderSets;
+        std::vector<EntityRecord>  entities;
+        std::vector<StringRef>     setMembers;
+        std::string                strings;
+        Settings                   settings;
+
+        std::unordered_map<std::string, StringRef> stringRefs; // Every string is stored once.
+
+        StringRef addString(const std::string& s)
+        {
+            auto it = this->stringRefs.find(s);
+            if (it != this->stringRefs.end())
+            {
+                return it->second;
+            }
+            const StringRef ref = { static_cast<uint32_t>(this->strings.size()), static_cast<uint32_t>(s.size()) };
+            this->strings += s;
+            this->stringRefs[s] = ref;
+            return ref;
+        }
+
+        std::string getString(const StringRef& ref) const
+        {
+            return this->strings.substr(ref.offset, ref.length);
+        }
+
+        bool addDefinition(const std::vector<std::string>& words, std::string& error)
+        {
+            const std::string& kind = words[0];
+            auto expect = [&](size_t minCount, size_t maxCount, const char* syntax)
+            {
+                if (words.size() < minCount || words.size() > maxCount)
+                {
+                    error = std::string("expected: ") + syntax;
+                    return false;
+                }
+                return true;
+            };
+
+            if (kind == "mesh")
+            {
+                if (!expect(3, 3, "mesh <name> <file>")) return false;
+                this->meshes.push_back({ this->addString(words[1]), this->addString(words[2]) });
+            }
+            else if (kind == "shader")
+            {
+                if (!expect(4, 4, "shader <name> <vert|frag|comp> <file>")) return false;
+                uint32_t stage;
+                if (!findName(SHADER_STAGES, words[2], stage, error)) return false;
+                this->shaders.push_back({ this->addString(words[1]), this->addString(words[3]), stage });
+            }
+            else if (kind == "texture")
+            {
+                if (!expect(5, 5, "texture <name> <format> <type> <file>")) return false;
+                uint32_t format, type;
+                if (!findName(TEXTURE_FORMATS, words[2], format, error)) return false;
+                if (!findName(TEXTURE_TYPES, words[3], type, error)) return false;
+                this->textures.push_back({ this->addString(words[1]), this->addString(words[4]), format, type });
+            }
+            else if (kind == "matrix")
+            {
+                if (words.size() != 3 && !expect(18, 18, "matrix <name> identity | <16 floats>")) return false;
+                MatrixRecord record = { this->addString(words[1]), {} };
+                for (int i = 0; i < 16; i++)
+                {
+                    record.matrix[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+                }
+                if (words.size() == 3 && words[2] != "identity")
+                {
+                    error = "expected: matrix <name> identity | <16 floats>";
+                    return false;
+                }
+                for (size_t i = 2; words.size() == 18 && i < 18; i++)
+                {
+                    char* end;
+                    record.matrix[i - 2] = std::strtof(words[i].c_str(), &end);
+                    if (*end != '\0')
+                    {
+                        error = "not a number: " + words[i];
+                        return false;
+                    }
+                }
+                this->matrices.push_back(record);
+            }
+            else if (kind == "texset" || kind == "shaderset")
+            {
+                if (!expect(3, SIZE_MAX, "texset|shaderset <name> <member>... [option=<value>]...")) return false;
+                ShaderSetRecord set = { this->addString(words[1]), static_cast<uint32_t>(this->setMembers.size()), 0, MaterialVariant() };
+                for (size_t i = 2; i < words.size(); i++)
+                {
+                    const size_t equals = words[i].find('=');
+                    if (equals == std::string::npos)
+                    {
+                        this->setMembers.push_back(this->addString(words[i]));
+                        set.memberCount++;
+                    }
+                    else if (kind == "texset" || !parseVariantOption(words[i].substr(0, equals), words[i].substr(equals + 1), set.variant, error))
+                    {
+                        error = error.empty() ? "unknown option: " + words[i] : error;
+                        return false;
+                    }
+                }
+                if (kind == "texset")
+                {
+                    this->textureSets.push_back({ set.name, set.firstMember, set.memberCount });
+                }
+                else
+                {
+                    this->shaderSets.push_back(set);
+                }
+            }
+            else if (kind == "entity")
+            {
+                if (!expect(6, 7, "entity <name> <mesh> <matrix> <texset> <shaderset> [parent]")) return false;
+                this->entities.push_back({ this->addString(words[1]), this->addString(words[2]), this->addString(words[3]),
+                                           this->addString(words[4]), this->addString(words[5]), this->addString(words.size() == 7 ? words[6] : "") });
+            }
+            else if (kind == "prepass")
+            {
+                if (!expect(2, 3, "prepass <off|on|auto> [overdraw]")) return false;
+                if (!findName(DEPTH_PREPASS_MODES, words[1], this->settings.depthPrepass, error)) return false;
+                if (words.size() == 3)
+                {
+                    char* end;
+                    this->settings.prepassMinOverdraw = std::strtof(words[2].c_str(), &end);
+                    if (*end != '\0')
+                    {
+                        error = "not a number: " + words[2];
+                        return false;
+                    }
+                }
+            }
+            else
+            {
+                error = "unknown definition: " + kind;
+                return false;
+            }
+            return true;
+        }
+
+        /// Checks names, references and parents, and lays out the binary scene.
+        bool write(std::vector<uint8_t>& out, std::string& error) const
+        {
+            // Strings are stored once, so a name is identified by its offset. Names of one kind are unique -
+            // loading keys its maps by them, a second definition would silently replace the first.
+            StringRef duplicate = {};
+            auto getNames = [&](const auto& records)
+            {
+                std::unordered_set<uint32_t> names;
+                for (const auto& record : records)
+                {
+                    if (!names.insert(record.name.offset).second && duplicate.length == 0)
+                    {
+                        duplicate = record.name;
+                    }
+                }
+                return names;
+            };
+            const std::unordered_set<uint32_t> names[] = {
+                getNames(this->meshes), getNames(this->shaders), getNames(this->textures), getNames(this->matrices),
+                getNames(this->textureSets), getNames(this->shaderSets), getNames(this->entities)
+            };
+            if (duplicate.length != 0)
+            {
+                error = "defined twice: " + this->getString(duplicate);
+                return false;
+            }
+            auto isDefined = [&](Section section, const StringRef& ref)
+            {
+                return names[section].count(ref.offset) > 0;
+            };
+            auto check = [&](bool isOk, const char* what, const StringRef& ref)
+            {
+                if (!isOk)
+                {
+                    error = std::string("undefined ") + what + ": " + this->getString(ref);
+                }
+                return isOk;
+            };
+            for (const SetRecord& set : this->textureSets)
+            {
+                for (uint32_t i = 0; i < set.memberCount; i++)
+                {
+                    if (!check(isDefined(TEXTURES, this->setMembers[set.firstMember + i]), "texture", this->setMembers[set.firstMember + i])) return false;
+                }
+            }
+            for (const ShaderSetRecord& set : this->shaderSets)
+            {
+                for (uint32_t i = 0; i < set.memberCount; i++)
+                {
+                    if (!check(isDefined(SHADERS, this->setMembers[set.firstMember + i]), "shader", this->setMembers[set.firstMember + i])) return false;
+                }
+            }
+            for (const EntityRecord& entity : this->entities)
+            {
+                if (!check(isDefined(MESHES,       entity.mesh),        "mesh",       entity.mesh))        return false;
+                if (!check(isDefined(MATRICES,     entity.matrix),      "matrix",     entity.matrix))      return false;
+                if (!check(isDefined(TEXTURE_SETS, entity.texturesSet), "texset",     entity.texturesSet)) return false;
+                if (!check(isDefined(SHADER_SETS,  entity.shadersSet),  "shaderset",  entity.shadersSet))  return false;
+                if (!check(entity.parent.length == 0 || isDefined(ENTITIES, entity.parent), "parent entity", entity.parent)) return false;
+            }
+
+            // Walking up from any entity must reach a root within entity count steps
+            std::unordered_map<uint32_t, StringRef> parentOf;
+            for (const EntityRecord& entity : this->entities)
+            {
+                parentOf[entity.name.offset] = entity.parent;
+            }
+            for (const EntityRecord& entity : this->entities)
+            {
+                StringRef ancestor = entity.parent;
+                for (size_t steps = 0; ancestor.length != 0; steps++)
+                {
+                    if (steps == this->entities.size())
+                    {
+                        error = "parents form a cycle: " + this->getString(entity.name);
+                        return false;
+                    }
+                    ancestor = parentOf[ancestor.offset];
+                }
+            }
+
+            Header header = {};
+            header.magic    = MAGIC;
+            header.version  = VERSION;
+            header.settings = this->settings;
+            out.assign(sizeof(Header), 0);
+            auto append = [&](Section section, const void* src, size_t count, size_t recordSize)
+            {
+                out.resize((out.size() + alignof(uint64_t) - 1) / alignof(uint64_t) * alignof(uint64_t), 0);
+                header.offsets[section] = out.size();
+                header.counts[section]  = count;
+                out.insert(out.end(), static_cast<const uint8_t*>(src), static_cast<const uint8_t*>(src) + count * recordSize);
+            };
+            append(MESHES,       this->meshes.data(),      this->meshes.size(),      sizeof(MeshRecord));
+            append(SHADERS,      this->shaders.data(),     this->shaders.size(),     sizeof(ShaderRecord));
+            append(TEXTURES,     this->textures.data(),    this->textures.size(),    sizeof(TextureRecord));
+            append(MATRICES,     this->matrices.data(),    this->matrices.size(),    sizeof(MatrixRecord));
+            append(TEXTURE_SETS, this->textureSets.data(), this->textureSets.size(), sizeof(SetRecord));
+            append(SHADER_SETS,  this->shaderSets.data(),  this->shaderSets.size(),  sizeof(ShaderSetRecord));
+            append(ENTITIES,     this->entities.data(),    this->entities.size(),    sizeof(EntityRecord));
+            append(SET_MEMBERS,  this->setMembers.data(),  this->setMembers.size(),  sizeof(StringRef));
+            append(STRINGS,      this->strings.data(),     this->strings.size(),     sizeof(char));
+            header.fileSize = out.size();
+            memcpy(out.data(), &header, sizeof(Header));
+            return true;
+        }
+
+        /// features=<TexT name>,... - texture maps used by the material, ao|emit|diffdi|refl|uvscale=<float> - its coefficients.
+        static bool parseVariantOption(const std::string& option, const std::string& value, MaterialVariant& variant, std::string& error)
+        {
+            if (option == "features")
+            {
+                variant.featureMask = 0;
+                std::istringstream names(value);
+                for (std::string name; std::getline(names, name, ',');)
+                {
+                    uint32_t type;
+                    if (!findName(TEXTURE_TYPES, name, type, error)) return false;
+                    variant.featureMask |= 1u << type;
+                }
+                return true;
+            }
+
+            float* coefficient = option == "ao"      ? &variant.aoCoeff
+                               : option == "emit"    ? &variant.emitCoeff
+                               : option == "diffdi"  ? &variant.diffDiCoeff
+                               : option == "refl"    ? &variant.reflCoeff
+                               : option == "uvscale" ? &variant.uvScale
+                               : nullptr;
+            if (coefficient == nullptr)
+            {
+                return false;
+            }
+            char* end;
+            *coefficient = std::strtof(value.c_str(), &end);
+            if (value.empty() || *end != '\0')
+            {
+                error = "not a number: " + value;
+                return false;
+            }
+            return true;
+        }
+    };
+
+    struct NamedValue
+    {
+        const char* name;
+        uint32_t    value;
+    };
+
+    static constexpr NamedValue SHADER_STAGES[] = {
+        {"vert", VK_SHADER_STAGE_VERTEX_BIT},
+        {"frag", VK_SHADER_STAGE_FRAGMENT_BIT},
+        {"comp", VK_SHADER_STAGE_COMPUTE_BIT},
+    };
+
+    static constexpr NamedValue TEXTURE_FORMATS[] = {
+        {"BC3_UNORM_BLOCK",    VK_FORMAT_BC3_UNORM_BLOCK},
+        {"BC4_UNORM_BLOCK",    VK_FORMAT_BC4_UNORM_BLOCK},
+        {"B8G8R8A8_UNORM",     VK_FORMAT_B8G8R8A8_UNORM},
+        {"R8G8B8A8_UNORM",     VK_FORMAT_R8G8B8A8_UNORM},
+        {"ASTC_8x8_UNORM_BLOCK", VK_FORMAT_ASTC_8x8_UNORM_BLOCK},
+        {"ETC2_R8G8B8A8_UNORM_BLOCK", VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK},
+    };
+
+    static constexpr NamedValue DEPTH_PREPASS_MODES[] = {
+        {"off",  DEPTH_PREPASS_OFF},
+        {"on",   DEPTH_PREPASS_ON},
+        {"auto", DEPTH_PREPASS_AUTO},
+    };
+
+    // In TexT order.
+    static constexpr NamedValue TEXTURE_TYPES[] = {
+        {"COLOR",      0},
+        {"DIFFUSE_DI", 1},
+        {"AO",         2},
+        {"EMIT",       3},
+        {"NORMAL",     4},
+        {"REFLECTION", 5},
+    };
+
+    template <size_t N>
+    static bool findName(const NamedValue (&values)[N], const std::string& name, uint32_t& outValue, std::string& error)
+    {
+        for (const NamedValue& value : values)
+        {
+            if (name == value.name)
+            {
+                outValue = value.value;
+                return true;
+            }
+        }
+        error = "unknown value: " + name;
+        return false;
+    }
+};
+
+} // namespace vk229
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include <VulkanTools.h>
+
+#include "SpirvReflection.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Shader modules shared between pipelines, keyed by SPIR-V contents - identical code is one module,
+/// however many files or shader names it comes from, and a file is read once while its module is alive.
+/// Modules are only needed while pipelines are created, so they are reference counted:
+/// * stage = acquire(device, path, stage) - loads (or reuses) the module,
+/// * create pipelines using stage,
+/// * release(stage.module)                - the last release destroys the module.
+/// Nothing is kept between pipeline batches, so changed files (hot reload) are simply read again.
+/// Every module is reflected once, when created - getReflection(module) describes what its pipeline has to provide.
+/// The cache is locked by every call - pipelines created on compiler threads read reflection of retained modules.
+struct ShaderModuleCache
+{
+    VkDevice device = VK_NULL_HANDLE;
+
+    VkPipelineShaderStageCreateInfo acquire(VkDevice dev, const std::string& path, VkShaderStageFlagBits stage, const char* entryPoint = "main")
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        assert(this->device == VK_NULL_HANDLE || this->device == dev);
+        this->device = dev;
+
+        VkPipelineShaderStageCreateInfo shaderStage = {};
+        shaderStage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStage.stage  = stage;
+        shaderStage.pName  = entryPoint;
+        shaderStage.module = this->acquireModule(path);
+        return shaderStage;
+    }
+
+    /// One more reference of an acquired module - e.g. until a pipeline created on another thread is done.
+    void retain(VkShaderModule module)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->entries.at(this->keyOfModule.at(module)).refCount++;
+    }
+
+    void release(VkShaderModule module)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto key = this->keyOfModule.find(module);
+        assert(key != this->keyOfModule.end() && "Shader module not acquired from this cache.");
+        if (key == this->keyOfModule.end())
+        {
+            return;
+        }
+        Entry& entry = this->entries.at(key->second);
+        if (--entry.refCount > 0)
+        {
+            return;
+        }
+
+        vkDestroyShaderModule(this->device, module, nullptr);
+        for (auto it = this->keyOfPath.begin(); it != this->keyOfPath.end();)
+        {
+            it = it->second == key->second ? this->keyOfPath.erase(it) : std::next(it);
+        }
+        this->entries.erase(key->second);
+        this->keyOfModule.erase(key);
+    }
+
+    /// Valid while the module is acquired or retained.
+    const SpirvReflection& getReflection(VkShaderModule module) const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->entries.at(this->keyOfModule.at(module)).reflection;
+    }
+
+    /// Modules still referenced - nonzero after all pipelines are created means a missing release.
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->entries.size();
+    }
+
+    /// Destroys modules which were not released.
+    void destroy()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (auto& [key, entry] : this->entries)
+        {
+            vkDestroyShaderModule(this->device, entry.module, nullptr);
+        }
+        this->entries.clear();
+        this->keyOfModule.clear();
+        this->keyOfPath.clear();
+    }
+
+private:
+    /// Code of the module with its hash - hashes order the keys, equal hashes are told apart by the code itself,
+    /// so a collision never hands out a module of different code.
+    struct Key
+    {
+        uint64_t                                     hash;
+        std::shared_ptr<const std::vector<uint32_t>> code;
+
+        int compare(const Key& other) const
+        {
+            if (this->hash != other.hash)
+            {
+                return this->hash < other.hash ? -1 : 1;
+            }
+            if (this->code->size() != other.code->size())
+            {
+                return this->code->size() < other.code->size() ? -1 : 1;
+            }
+            return this->code == other.code ? 0 : memcmp(this->code->data(), other.code->data(), this->code->size() * sizeof(uint32_t));
+        }
+
+        bool operator<(const Key& other) const
+        {
+            return this->compare(other) < 0;
+        }
+
+        bool operator==(const Key& other) const
+        {
+            return this->compare(other) == 0;
+        }
+    };
+
+    struct Entry
+    {
+        VkShaderModule  module   = VK_NULL_HANDLE;
+        uint32_t        refCount = 0;
+        SpirvReflection reflection;
+    };
+
+    std::map<Key, Entry>            entries;
+    std::map<VkShaderModule, Key>   keyOfModule;
+    std::map<std::string, Key>      keyOfPath;   // Files of alive modules - not read again.
+    mutable std::mutex              mutex;
+
+    VkShaderModule acquireModule(const std::string& path)
+    {
+        auto known = this->keyOfPath.find(path);
+        if (known != this->keyOfPath.end())
+        {
+            Entry& entry = this->entries.at(known->second);
+            entry.refCount++;
+            return entry.module;
+        }
+
+        auto code = std::make_shared<const std::vector<uint32_t>>(readCode(path));
+        const Key key = { hashCode(*code), code };
+
+        // Key of an existing entry is kept - its code, not the one just read, stays alive
+        Entry& entry = this->entries[key];
+        this->keyOfPath[path] = this->entries.find(key)->first;
+        if (entry.module == VK_NULL_HANDLE)
+        {
+            std::string error;
+            if (!entry.reflection.parse(*code, error))
+            {
+                vks::tools::exitFatal("Could not reflect shader file \"" + path + "\": " + error, "Error");
+            }
+
+            VkShaderModuleCreateInfo moduleCreateInfo = {};
+            moduleCreateInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            moduleCreateInfo.codeSize = code->size() * sizeof(uint32_t);
+            moduleCreateInfo.pCode    = code->data();
+            VK_CHECK_RESULT(vkCreateShaderModule(this->device, &moduleCreateInfo, nullptr, &entry.module));
+            this->keyOfModule[entry.module] = key;
+        }
+        entry.refCount++;
+        return entry.module;
+    }
+
+    static std::vector<uint32_t> readCode(const std::string& path)
+    {
+        std::vector<uint32_t> code;
+#if defined(__ANDROID__)
+        AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, path.c_str(), AASSET_MODE_STREAMING);
+        if (asset)
+        {
+            const size_t size = AAsset_getLength(asset);
+            code.resize(size / sizeof(uint32_t));
+            AAsset_read(asset, code.data(), code.size() * sizeof(uint32_t));
+            AAsset_close(asset);
+        }
+#else
+        std::ifstream is(path, std::ios::binary | std::ios::ate);
+        if (is.is_open())
+        {
+            const size_t size = is.tellg();
+            code.resize(size / sizeof(uint32_t));
+            is.seekg(0, std::ios::beg);
+            is.read(reinterpret_cast<char*>(code.data()), code.size() * sizeof(uint32_t));
+        }
+#endif
+        if (code.empty())
+        {
+            vks::tools::exitFatal("Could not read shader file \"" + path + "\"!", "Error");
+        }
+        return code;
+    }
+
+    /// FNV-1a, 64 bit, over the words.
+    static uint64_t hashCode(const std::vector<uint32_t>& code)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t word : code)
+        {
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+} // namespace vk229
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "ParallelFor.hpp"
+#include "NBodySimulation.hpp"
+
+namespace vk229
+{
+/////////////////////////////////////////
+/// Collisions of bodies (rocks) of NBodySimulation, treated as spheres of radius bodies.r:
+/// * broad phase - uniform grid hashed into a table, rebuilt in parallel every step, O(n),
+/// * narrow phase - sphere-sphere tests only against bodies from 8 cells around the body,
+/// * response - impulse along the contact normal and positional correction.
+/// Every body sums up its own response from all its contacts (Jacobi), so bodies are processed
+/// in parallel without locks, and results don't depend on thread count.
+/// Big spheres (planet, light) are obstacles - not hashed, tested against every body.
+/// collide.comp is the GPU variant, with the same hash and response.
+/////////////////////////////////////////
+
+struct CollisionSphere
+{
+    glm::vec3 center;
+    float     radius;
+};
+
+class SpatialHashCollisions
+{
+public:
+    float restitution = 0.5f; // 0 - plastic, 1 - elastic.
+    float correction  = 0.8f; // Part of penetration removed in one step.
+
+    std::vector<CollisionSphere> obstacles;
+
+    /// Power of two, at least count.
+    static uint32_t tableSizeFor(uint32_t count)
+    {
+        uint32_t size = 1;
+        while (size < count)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    static glm::ivec3 cellOf(const glm::vec3& p, float invCellSize)
+    {
+        return glm::ivec3(glm::floor(p * invCellSize));
+    }
+
+    static uint32_t hashCell(const glm::ivec3& c, uint32_t tableSize)
+    {
+        return ((uint32_t(c.x) * 73856093u) ^ (uint32_t(c.y) * 19349663u) ^ (uint32_t(c.z) * 83492791u)) & (tableSize - 1u);
+    }
+
+    /// Finds and resolves all contacts, updates positions and velocities of bodies.
+    void resolve(vks::ThreadPool& pool, BodiesSoA& bodies)
+    {
+        const uint32_t bodyCount   = bodies.size();
+        const uint32_t threadCount = std::max<size_t>(1, pool.threads.size());
+        if (bodyCount == 0)
+        {
+            this->contactCount = 0;
+            return;
+        }
+
+        // Cell size - twice the largest diameter. Center of a touching body is at most half of a cell away,
+        // so on every axis it is in the body's cell or in the neighbour on the side closer to the body.
+        std::vector<float> threadMaxRadius(threadCount, 0.0f);
+        parallelFor(pool, bodyCount, [&](size_t begin, size_t end, size_t t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                threadMaxRadius[t] = std::max(threadMaxRadius[t], bodies.r[i]);
+            }
+        });
+        const float maxRadius = *std::max_element(threadMaxRadius.begin(), threadMaxRadius.end());
+        if (maxRadius <= 0.0f)
+        {
+            this->contactCount = 0;
+            return;
+        }
+        this->invCellSize = 1.0f / (4.0f * maxRadius);
+
+        this->buildTable(pool, bodies);
+        this->collide(pool);
+        this->apply(pool, bodies);
+    }
+
+    /// Number of body-body contacts found in the last resolve().
+    uint32_t getContactCount() const
+    {
+        return this->contactCount;
+    }
+
+private:
+    float    invCellSize  = 1.0f;
+    uint32_t tableSize    = 0;
+    uint32_t contactCount = 0;
+
+    std::vector<uint32_t>                       bodyBuckets;    // Bucket of every body.
+    std::unique_ptr<std::atomic<uint32_t>[]>    bucketCursors;  // Counts, then write offsets.
+    uint32_t                                    bucketCursorsCapacity = 0;
+    std::vector<uint32_t>                       bucketStarts;   // Bodies of bucket b are sorted[bucketStarts[b], bucketStarts[b + 1]).
+    std::vector<uint32_t>                       threadSums;
+    std::vector<uint32_t>                       threadContacts;
+    std::vector<uint32_t>                       sortedIndices;  // Body indices in bucket order.
+    std::vector<glm::vec4>                      sortedPos;      // xyz - position, w - radius; in bucket order.
+    std::vector<glm::vec4>                      sortedVel;      // xyz - velocity, w - inverse mass; in bucket order.
+    std::vector<glm::vec4>                      deltaPos;       // xyz - positional correction, w - contact count; in bucket order.
+    std::vector<glm::vec4>                      deltaVel;       // xyz - velocity change; in bucket order.
+
+// BROAD PHASE {
+
+    /// Parallel counting sort of bodies by bucket.
+    void buildTable(vks::ThreadPool& pool, const BodiesSoA& bodies)
+    {
+        const uint32_t bodyCount = bodies.size();
+        this->tableSize = tableSizeFor(bodyCount);
+
+        if (this->bucketCursorsCapacity < this->tableSize)
+        {
+            this->bucketCursors.reset(new std::atomic<uint32_t>[this->tableSize]);
+            this->bucketCursorsCapacity = this->tableSize;
+        }
+        this->bodyBuckets.resize(bodyCount);
+        this->bucketStarts.resize(this->tableSize + 1);
+        this->sortedIndices.resize(bodyCount);
+        this->sortedPos.resize(bodyCount);
+        this->sortedVel.resize(bodyCount);
+
+        parallelFor(pool, this->tableSize, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t b = begin; b < end; b++)
+            {
+                this->bucketCursors[b].store(0, std::memory_order_relaxed);
+            }
+        });
+
+        // Counting.
+        parallelFor(pool, bodyCount, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const uint32_t b = hashCell(cellOf(glm::vec3(bodies.px[i], bodies.py[i], bodies.pz[i]), this->invCellSize), this->tableSize);
+                this->bodyBuckets[i] = b;
+                this->bucketCursors[b].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        // Exclusive prefix sum - sums of chunks, then chunks offset by sums of previous chunks.
+        // parallelFor splits the same count into the same chunks, so both passes agree on them.
+        this->threadSums.assign(pool.threads.size() + 1, 0);
+        parallelFor(pool, this->tableSize, [&](size_t begin, size_t end, size_t t)
+        {
+            uint32_t sum = 0;
+            for (size_t b = begin; b < end; b++)
+            {
+                sum += this->bucketCursors[b].load(std::memory_order_relaxed);
+            }
+            this->threadSums[t] = sum;
+        });
+        uint32_t running = 0;
+        for (uint32_t& sum : this->threadSums)
+        {
+            const uint32_t count = sum;
+            sum = running;
+            running += count;
+        }
+        parallelFor(pool, this->tableSize, [&](size_t begin, size_t end, size_t t)
+        {
+            uint32_t offset = this->threadSums[t];
+            for (size_t b = begin; b < end; b++)
+            {
+                const uint32_t count = this->bucketCursors[b].load(std::memory_order_relaxed);
+                this->bucketStarts[b] = offset;
+                this->bucketCursors[b].store(offset, std::memory_order_relaxed);
+                offset += count;
+            }
+        });
+        this->bucketStarts[this->tableSize] = bodyCount;
+
+        // Scattering - order inside of a bucket depends on timing, so buckets are sorted afterwards.
+        parallelFor(pool, bodyCount, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const uint32_t s = this->bucketCursors[this->bodyBuckets[i]].fetch_add(1, std::memory_order_relaxed);
+                this->sortedIndices[s] = i;
+            }
+        });
+
+        // Buckets hold a few bodies, insertion sort is enough. Data is gathered in bucket order for the narrow phase.
+        parallelFor(pool, this->tableSize, [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t b = begin; b < end; b++)
+            {
+                uint32_t* first = &this->sortedIndices[0] + this->bucketStarts[b];
+                uint32_t* last  = &this->sortedIndices[0] + this->bucketStarts[b + 1];
+                for (uint32_t* it = first + 1; it < last; it++)
+                {
+                    const uint32_t value = *it;
+                    uint32_t* hole = it;
+                    for (; hole > first && *(hole - 1) > value; hole--)
+                    {
+                        *hole = *(hole - 1);
+                    }
+                    *hole = value;
+                }
+
+                for (uint32_t s = this->bucketStarts[b]; s < this->bucketStarts[b + 1]; s++)
+                {
+                    const uint32_t i = this->sortedIndices[s];
+                    this->sortedPos[s] = glm::vec4(bodies.px[i], bodies.py[i], bodies.pz[i], bodies.r[i]);
+                    this->sortedVel[s] = glm::vec4(bodies.vx[i], bodies.vy[i], bodies.vz[i], bodies.m[i] > 0.0f ? 1.0f / bodies.m[i] : 0.0f);
+                }
+            }
+        });
+    }
+
+// } // BROAD PHASE
+
+// NARROW PHASE {
+
+    /// Response of every body to all of its contacts, bodies are not moved yet.
+    void collide(vks::ThreadPool& pool)
+    {
+        const uint32_t bodyCount = this->sortedPos.size();
+        this->deltaPos.resize(bodyCount);
+        this->deltaVel.resize(bodyCount);
+        this->threadContacts.assign(pool.threads.size() + 1, 0);
+
+        parallelFor(pool, bodyCount, [&](size_t begin, size_t end, size_t t)
+        {
+            for (size_t s = begin; s < end; s++)
+            {
+                const glm::vec4  a    = this->sortedPos[s];
+                const glm::vec4  va   = this->sortedVel[s];
+                const glm::vec3  p    = glm::vec3(a) * this->invCellSize;
+                const glm::ivec3 cell = glm::ivec3(glm::floor(p));
+                const glm::ivec3 side = glm::ivec3(p.x - cell.x < 0.5f ? -1 : 1, p.y - cell.y < 0.5f ? -1 : 1, p.z - cell.z < 0.5f ? -1 : 1);
+
+                glm::vec3 dp       = glm::vec3(0.0f);
+                glm::vec3 dv       = glm::vec3(0.0f);
+                float     contacts = 0.0f;
+
+                // Different cells can share a bucket, every bucket is visited once.
+                uint32_t visited[8];
+                uint32_t visitedCount = 0;
+                for (int32_t n = 0; n < 8; n++)
+                {
+                    const glm::ivec3 offset = glm::ivec3((n & 1) ? side.x : 0, (n & 2) ? side.y : 0, (n & 4) ? side.z : 0);
+                    const uint32_t   b      = hashCell(cell + offset, this->tableSize);
+                    if (std::find(visited, visited + visitedCount, b) != visited + visitedCount)
+                    {
+                        continue;
+                    }
+                    visited[visitedCount++] = b;
+
+                    for (uint32_t o = this->bucketStarts[b]; o < this->bucketStarts[b + 1]; o++)
+                    {
+                        if (o == s)
+                        {
+                            continue;
+                        }
+                        const glm::vec4 other = this->sortedPos[o];
+                        const glm::vec3 d     = glm::vec3(other) - glm::vec3(a);
+                        const float     dist2 = glm::dot(d, d);
+                        const float     rSum  = a.w + other.w;
+                        if (dist2 >= rSum * rSum || dist2 <= 0.0f)
+                        {
+                            continue;
+                        }
+
+                        const float wSum = va.w + this->sortedVel[o].w;
+                        if (wSum <= 0.0f)
+                        {
+                            continue;
+                        }
+
+                        const float     dist = std::sqrt(dist2);
+                        const glm::vec3 n    = d / dist; // From this body to the other one.
+                        const float     vn   = glm::dot(glm::vec3(this->sortedVel[o]) - glm::vec3(va), n);
+                        if (vn < 0.0f)
+                        {
+                            // Approaching - this body's share of the impulse.
+                            dv += n * ((1.0f + this->restitution) * vn * va.w / wSum);
+                        }
+                        dp -= n * ((rSum - dist) * this->correction * va.w / wSum);
+                        contacts += 1.0f;
+
+                        if (o > s)
+                        {
+                            this->threadContacts[t]++;
+                        }
+                    }
+                }
+
+                this->deltaPos[s] = glm::vec4(dp, contacts);
+                this->deltaVel[s] = glm::vec4(dv, 0.0f);
+            }
+        });
+
+        this->contactCount = 0;
+        for (uint32_t count : this->threadContacts)
+        {
+            this->contactCount += count;
+        }
+    }
+
+    /// Moves bodies out of each other and out of obstacles, updates velocities.
+    void apply(vks::ThreadPool& pool, BodiesSoA& bodies)
+    {
+        parallelFor(pool, this->sortedIndices.size(), [&](size_t begin, size_t end, size_t)
+        {
+            for (size_t s = begin; s < end; s++)
+            {
+                const uint32_t  i     = this->sortedIndices[s];
+                const glm::vec4 delta = this->deltaPos[s];
+
+                // Corrections of many contacts overlap, averaging them keeps piles stable.
+                glm::vec3 pos = glm::vec3(this->sortedPos[s]) + glm::vec3(delta) / std::max(delta.w, 1.0f);
+                glm::vec3 vel = glm::vec3(this->sortedVel[s]) + glm::vec3(this->deltaVel[s]);
+
+                for (const CollisionSphere& obstacle : this->obstacles)
+                {
+                    const glm::vec3 d     = pos - obstacle.center;
+                    const float     dist2 = glm::dot(d, d);
+                    const float     rSum  = bodies.r[i] + obstacle.radius;
+                    if (dist2 >= rSum * rSum || dist2 <= 0.0f)
+                    {
+                        continue;
+                    }
+                    const glm::vec3 n  = d / std::sqrt(dist2);
+                    const float     vn = glm::dot(vel, n);
+                    pos = obstacle.center + n * rSum;
+                    if (vn < 0.0f)
+                    {
+                        vel -= n * ((1.0f + this->restitution) * vn);
+                    }
+                }
+
+                bodies.px[i] = pos.x;
+                bodies.py[i] = pos.y;
+                bodies.pz[i] = pos.z;
+                bodies.vx[i] = vel.x;
+                bodies.vy[i] = vel.y;
+                bodies.vz[i] = vel.z;
+            }
+        });
+    }
+
+// } // NARROW PHASE
+};
+
+} // namespace vk229
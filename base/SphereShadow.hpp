@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "ParallelFor.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Soft shadow of a sphere (planet) lit by a spherical light, for points much smaller than the sphere (rocks).
+/// Same model as isFragShadedByObstacle() in construct.frag: caster seen from the light moved towards it
+/// gives penumbra angle, seen from the light moved away gives umbra angle, and shade is interpolated
+/// by angular distance of a point from the caster. Both angles depend only on light and caster,
+/// so per point there is one acos left - approximated by the cubic of Abramowitz & Stegun 4.4.45, times sqrt(1 - |x|)
+/// (|error| <= 6.8e-5 rad over [-1, 1], largest around x = 0, float evaluation included), the same in SIMD and scalar code.
+/// nbody.comp (pass 2) computes the same on GPU, with the exact acos.
+struct SphereShadow
+{
+    glm::vec3 lightPos      = glm::vec3(0.0f);
+    glm::vec3 axis          = glm::vec3(1.0f, 0.0f, 0.0f); // From light to caster, unit.
+    float     lightToCaster = 0.0f;
+    float     penumbraAngle = 0.0f; // Points further from the caster (angularly) are lit.
+    float     invAngleRange = 0.0f; // 1 / (penumbraAngle - umbraAngle)
+
+    void setup(const glm::vec3& light, float lightRadius, const glm::vec3& caster, float casterRadius)
+    {
+        const glm::vec3 d = caster - light;
+        this->lightPos      = light;
+        this->lightToCaster = std::sqrt(glm::dot(d, d));
+        this->axis          = this->lightToCaster > 0.0f ? d / this->lightToCaster : glm::vec3(1.0f, 0.0f, 0.0f);
+
+        const float k          = lightRadius / (lightRadius + casterRadius);
+        const float nearDist   = std::max(this->lightToCaster * (1.0f - k), casterRadius);
+        const float farDist    = std::max(this->lightToCaster * (1.0f + k), casterRadius);
+        const float umbraAngle = std::asin(casterRadius / farDist);
+        this->penumbraAngle    = std::asin(casterRadius / nearDist);
+        this->invAngleRange    = this->penumbraAngle > umbraAngle ? 1.0f / (this->penumbraAngle - umbraAngle) : 0.0f;
+    }
+
+    /// Light factor at point p: 1 - lit, 0 - umbra.
+    float lightFactor(float px, float py, float pz) const
+    {
+        const float dx   = px - this->lightPos.x;
+        const float dy   = py - this->lightPos.y;
+        const float dz   = pz - this->lightPos.z;
+        const float len2 = (dx * dx + dy * dy) + dz * dz;
+        const float len  = std::sqrt(len2);
+        if (!(len > this->lightToCaster))
+        {
+            return 1.0f; // Between light and caster.
+        }
+        const float cosAngle = std::min(std::max(((dx * this->axis.x + dy * this->axis.y) + dz * this->axis.z) / len, -1.0f), 1.0f);
+        const float shade    = std::min(std::max((this->penumbraAngle - acosApprox(cosAngle)) * this->invAngleRange, 0.0f), 1.0f);
+        return 1.0f - shade;
+    }
+
+    /// Writes light factors of points [0, count) as floats into interleaved data - e.g. persistently mapped instance buffer.
+    /// dst points to the factor of first element, stride is size of the whole element.
+    void writeLightFactors(vks::ThreadPool& pool, const float* px, const float* py, const float* pz, size_t count, void* dst, size_t stride) const
+    {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        parallelFor(pool, count, [&](size_t begin, size_t end, size_t)
+        {
+            size_t i = begin;
+
+#if defined(__AVX2__)
+            const __m256 lx       = _mm256_set1_ps(this->lightPos.x);
+            const __m256 ly       = _mm256_set1_ps(this->lightPos.y);
+            const __m256 lz       = _mm256_set1_ps(this->lightPos.z);
+            const __m256 ax       = _mm256_set1_ps(this->axis.x);
+            const __m256 ay       = _mm256_set1_ps(this->axis.y);
+            const __m256 az       = _mm256_set1_ps(this->axis.z);
+            const __m256 distV    = _mm256_set1_ps(this->lightToCaster);
+            const __m256 penumbra = _mm256_set1_ps(this->penumbraAngle);
+            const __m256 invRange = _mm256_set1_ps(this->invAngleRange);
+            const __m256 zero     = _mm256_setzero_ps();
+            const __m256 one      = _mm256_set1_ps(1.0f);
+            const __m256 minusOne = _mm256_set1_ps(-1.0f);
+            float factors[8];
+            for (; i + 8 <= end; i += 8)
+            {
+                const __m256 dx   = _mm256_sub_ps(_mm256_loadu_ps(px + i), lx);
+                const __m256 dy   = _mm256_sub_ps(_mm256_loadu_ps(py + i), ly);
+                const __m256 dz   = _mm256_sub_ps(_mm256_loadu_ps(pz + i), lz);
+                const __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+                const __m256 len  = _mm256_sqrt_ps(len2);
+                const __m256 dotA = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ax), _mm256_mul_ps(dy, ay)), _mm256_mul_ps(dz, az));
+                const __m256 cosA = _mm256_min_ps(_mm256_max_ps(_mm256_div_ps(dotA, len), minusOne), one);
+
+                // acos(|x|) = sqrt(1 - |x|) * poly(|x|), acos(x) = pi - acos(-x) for x < 0.
+                const __m256 absX  = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), cosA);
+                __m256       poly  = _mm256_set1_ps(ACOS_C3);
+                poly               = _mm256_add_ps(_mm256_mul_ps(poly, absX), _mm256_set1_ps(ACOS_C2));
+                poly               = _mm256_add_ps(_mm256_mul_ps(poly, absX), _mm256_set1_ps(ACOS_C1));
+                poly               = _mm256_add_ps(_mm256_mul_ps(poly, absX), _mm256_set1_ps(ACOS_C0));
+                const __m256 acosP = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_sub_ps(one, absX)), poly);
+                const __m256 angle = _mm256_blendv_ps(acosP, _mm256_sub_ps(_mm256_set1_ps(ACOS_PI), acosP), _mm256_cmp_ps(cosA, zero, _CMP_LT_OQ));
+
+                const __m256 shade  = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(penumbra, angle), invRange), zero), one);
+                const __m256 behind = _mm256_cmp_ps(len, distV, _CMP_GT_OQ);
+                _mm256_storeu_ps(factors, _mm256_sub_ps(one, _mm256_and_ps(shade, behind)));
+                for (size_t k = 0; k < 8; k++)
+                {
+                    memcpy(out + (i + k) * stride, &factors[k], sizeof(float));
+                }
+            }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+            const float32x4_t lx       = vdupq_n_f32(this->lightPos.x);
+            const float32x4_t ly       = vdupq_n_f32(this->lightPos.y);
+            const float32x4_t lz       = vdupq_n_f32(this->lightPos.z);
+            const float32x4_t ax       = vdupq_n_f32(this->axis.x);
+            const float32x4_t ay       = vdupq_n_f32(this->axis.y);
+            const float32x4_t az       = vdupq_n_f32(this->axis.z);
+            const float32x4_t distV    = vdupq_n_f32(this->lightToCaster);
+            const float32x4_t penumbra = vdupq_n_f32(this->penumbraAngle);
+            const float32x4_t invRange = vdupq_n_f32(this->invAngleRange);
+            const float32x4_t zero     = vdupq_n_f32(0.0f);
+            const float32x4_t one      = vdupq_n_f32(1.0f);
+            const float32x4_t minusOne = vdupq_n_f32(-1.0f);
+            float factors[4];
+            for (; i + 4 <= end; i += 4)
+            {
+                const float32x4_t dx   = vsubq_f32(vld1q_f32(px + i), lx);
+                const float32x4_t dy   = vsubq_f32(vld1q_f32(py + i), ly);
+                const float32x4_t dz   = vsubq_f32(vld1q_f32(pz + i), lz);
+                const float32x4_t len2 = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)), vmulq_f32(dz, dz));
+                const float32x4_t len  = vsqrtq_f32(len2);
+                const float32x4_t dotA = vaddq_f32(vaddq_f32(vmulq_f32(dx, ax), vmulq_f32(dy, ay)), vmulq_f32(dz, az));
+                const float32x4_t cosA = vminq_f32(vmaxq_f32(vdivq_f32(dotA, len), minusOne), one);
+
+                const float32x4_t absX  = vabsq_f32(cosA);
+                float32x4_t       poly  = vdupq_n_f32(ACOS_C3);
+                poly                    = vaddq_f32(vmulq_f32(poly, absX), vdupq_n_f32(ACOS_C2));
+                poly                    = vaddq_f32(vmulq_f32(poly, absX), vdupq_n_f32(ACOS_C1));
+                poly                    = vaddq_f32(vmulq_f32(poly, absX), vdupq_n_f32(ACOS_C0));
+                const float32x4_t acosP = vmulq_f32(vsqrtq_f32(vsubq_f32(one, absX)), poly);
+                const float32x4_t angle = vbslq_f32(vcltq_f32(cosA, zero), vsubq_f32(vdupq_n_f32(ACOS_PI), acosP), acosP);
+
+                const float32x4_t shade  = vminq_f32(vmaxq_f32(vmulq_f32(vsubq_f32(penumbra, angle), invRange), zero), one);
+                const uint32x4_t  behind = vcgtq_f32(len, distV);
+                vst1q_f32(factors, vsubq_f32(one, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(shade), behind))));
+                for (size_t k = 0; k < 4; k++)
+                {
+                    memcpy(out + (i + k) * stride, &factors[k], sizeof(float));
+                }
+            }
+#endif
+
+            // Remainder, or everything without SIMD.
+            for (; i < end; i++)
+            {
+                const float factor = this->lightFactor(px[i], py[i], pz[i]);
+                memcpy(out + i * stride, &factor, sizeof(float));
+            }
+        });
+    }
+
+private:
+    // Abramowitz & Stegun 4.4.45 - acos(|x|) = sqrt(1 - |x|) * (C0 + C1 |x| + C2 |x|^2 + C3 |x|^3), |error| <= 6.8e-5 rad.
+    static constexpr float ACOS_C0 =  1.5707288f;
+    static constexpr float ACOS_C1 = -0.2121144f;
+    static constexpr float ACOS_C2 =  0.0742610f;
+    static constexpr float ACOS_C3 = -0.0187293f;
+    static constexpr float ACOS_PI =  3.14159265f;
+
+    static float acosApprox(float x)
+    {
+        const float absX = std::fabs(x);
+        const float poly = ((ACOS_C3 * absX + ACOS_C2) * absX + ACOS_C1) * absX + ACOS_C0;
+        const float r    = std::sqrt(1.0f - absX) * poly;
+        return x < 0.0f ? ACOS_PI - r : r;
+    }
+};
+
+} // namespace vk229
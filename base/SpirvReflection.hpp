@@ -0,0 +1,533 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// What a pipeline has to provide to a SPIR-V module, read from the module itself at load time:
+/// * descriptor bindings - set, binding, type, array size,
+/// * push constant block size,
+/// * input and output variables with locations - their format and whether the shader reads them,
+/// * ids (SpecId) of specialization constants.
+/// An input which is only copied to an output is "forwarded" - it is live only when the next stage reads that output
+/// (e.g. vertex color passed to a fragment shader which ignores it), see getLiveVertexInputs().
+/// Only what this project's shaders use is understood - no IO blocks, matrices as inputs or descriptor arrays of runtime size.
+struct SpirvReflection
+{
+    static constexpr uint32_t NONE = ~0u;
+
+    struct DescriptorBinding
+    {
+        uint32_t         set;
+        uint32_t         binding;
+        VkDescriptorType type;
+        uint32_t         count;
+    };
+
+    struct InterfaceVariable
+    {
+        uint32_t location;
+        VkFormat format;
+        bool     isUsed;
+        uint32_t forwardedTo; // Output location, when the only use of the input is copying it there, NONE otherwise.
+    };
+
+    VkShaderStageFlagBits          stage = VK_SHADER_STAGE_ALL_GRAPHICS;
+    std::vector<DescriptorBinding> bindings;
+    std::vector<InterfaceVariable> inputs;
+    std::vector<InterfaceVariable> outputs;
+    uint32_t                       pushConstantSize = 0;
+    std::vector<uint32_t>          specializationConstants; // SpecId, sorted.
+
+    bool parse(const std::vector<uint32_t>& code, std::string& error)
+    {
+        *this = SpirvReflection();
+        if (code.size() < HEADER_SIZE || code[0] != MAGIC)
+        {
+            error = "not a SPIR-V module";
+            return false;
+        }
+
+        // Instructions, ids referenced by them (operands and literals alike - a literal equal to an id only makes the analysis conservative)
+        std::vector<size_t> instructions;
+        for (size_t i = HEADER_SIZE; i < code.size();)
+        {
+            const uint32_t wordCount = code[i] >> 16;
+            if (wordCount == 0 || i + wordCount > code.size())
+            {
+                error = "malformed instruction";
+                return false;
+            }
+            instructions.push_back(i);
+            i += wordCount;
+        }
+
+        std::map<uint32_t, Type>                       types;
+        std::map<uint32_t, uint32_t>                   constants;   // Id, 32 bit value.
+        std::map<uint32_t, std::map<uint32_t, uint32_t>> decorations; // Id, decoration, literal.
+        std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, uint32_t>> memberDecorations; // Struct, member -> decoration, literal.
+        std::map<uint32_t, Variable>                   variables;
+        std::map<uint32_t, std::vector<size_t>>        references;  // Id, instructions using it.
+        bool hasEntryPoint = false;
+
+        for (size_t instruction : instructions)
+        {
+            const uint32_t* op = &code[instruction];
+            const uint32_t wordCount = op[0] >> 16;
+            const uint32_t opcode    = op[0] & 0xFFFF;
+            switch (opcode)
+            {
+            case OP_ENTRY_POINT:
+                if (!hasEntryPoint)
+                {
+                    this->stage = getStage(op[1]);
+                    hasEntryPoint = true;
+                }
+                break;
+            case OP_TYPE_BOOL:
+                types[op[1]] = { op[1], opcode, 0, 0, 0, {} };
+                break;
+            case OP_TYPE_INT:
+            case OP_TYPE_FLOAT:
+                types[op[1]] = { op[1], opcode, 0, op[2], opcode == OP_TYPE_INT ? op[3] : 1u, {} };
+                break;
+            case OP_TYPE_VECTOR:
+            case OP_TYPE_MATRIX:
+                types[op[1]] = { op[1], opcode, op[2], op[3], 0, {} };
+                break;
+            case OP_TYPE_IMAGE:
+                types[op[1]] = { op[1], opcode, op[3], 0, op[7], {} }; // Dim, Sampled.
+                break;
+            case OP_TYPE_SAMPLER:
+            case OP_TYPE_SAMPLED_IMAGE:
+                types[op[1]] = { op[1], opcode, wordCount > 2 ? op[2] : 0u, 0, 0, {} };
+                break;
+            case OP_TYPE_ARRAY:
+            case OP_TYPE_RUNTIME_ARRAY:
+                types[op[1]] = { op[1], opcode, op[2], opcode == OP_TYPE_ARRAY ? op[3] : 0u, 0, {} };
+                break;
+            case OP_TYPE_STRUCT:
+                types[op[1]] = { op[1], opcode, 0, 0, 0, std::vector<uint32_t>(op + 2, op + wordCount) };
+                break;
+            case OP_TYPE_POINTER:
+                types[op[1]] = { op[1], opcode, op[3], op[2], 0, {} }; // Pointee, storage class.
+                break;
+            case OP_CONSTANT:
+                constants[op[2]] = op[3];
+                break;
+            case OP_VARIABLE:
+                variables[op[2]] = { op[1], op[3] };
+                break;
+            case OP_DECORATE:
+                decorations[op[1]][op[2]] = wordCount > 3 ? op[3] : 0u;
+                if (op[2] == DECORATION_SPEC_ID && wordCount > 3)
+                {
+                    this->specializationConstants.push_back(op[3]);
+                }
+                break;
+            case OP_MEMBER_DECORATE:
+                memberDecorations[{ op[1], op[2] }][op[3]] = wordCount > 4 ? op[4] : 0u;
+                break;
+            }
+
+            if (opcode != OP_NAME && opcode != OP_MEMBER_NAME && opcode != OP_ENTRY_POINT && opcode != OP_DECORATE && opcode != OP_MEMBER_DECORATE)
+            {
+                for (uint32_t w = 1; w < wordCount; w++)
+                {
+                    references[op[w]].push_back(instruction);
+                }
+            }
+        }
+        if (!hasEntryPoint)
+        {
+            error = "no entry point";
+            return false;
+        }
+
+        auto getDecoration = [&](uint32_t id, uint32_t decoration) -> uint32_t
+        {
+            auto decorated = decorations.find(id);
+            if (decorated == decorations.end() || decorated->second.count(decoration) == 0)
+            {
+                return NONE;
+            }
+            return decorated->second.at(decoration);
+        };
+        auto getType = [&](uint32_t id) -> const Type*
+        {
+            auto type = types.find(id);
+            return type == types.end() ? nullptr : &type->second;
+        };
+        // References of id, other than its own definition
+        auto getUses = [&](uint32_t id) -> std::vector<size_t>
+        {
+            std::vector<size_t> uses;
+            for (size_t instruction : references[id])
+            {
+                const uint32_t opcode = code[instruction] & 0xFFFF;
+                const bool isDefinition = (opcode == OP_VARIABLE || opcode == OP_LOAD) && code[instruction + 2] == id;
+                if (!isDefinition)
+                {
+                    uses.push_back(instruction);
+                }
+            }
+            return uses;
+        };
+
+        for (auto& [id, variable] : variables)
+        {
+            if (variable.storageClass != STORAGE_CLASS_UNIFORM_CONSTANT && variable.storageClass != STORAGE_CLASS_UNIFORM &&
+                variable.storageClass != STORAGE_CLASS_STORAGE_BUFFER && variable.storageClass != STORAGE_CLASS_PUSH_CONSTANT &&
+                variable.storageClass != STORAGE_CLASS_INPUT && variable.storageClass != STORAGE_CLASS_OUTPUT)
+            {
+                continue; // Private, function, workgroup.
+            }
+            const Type* pointer = getType(variable.pointerType);
+            const Type* type    = pointer ? getType(pointer->element) : nullptr;
+            if (type == nullptr)
+            {
+                error = "variable of unknown type";
+                return false;
+            }
+
+            switch (variable.storageClass)
+            {
+            case STORAGE_CLASS_UNIFORM_CONSTANT:
+            case STORAGE_CLASS_UNIFORM:
+            case STORAGE_CLASS_STORAGE_BUFFER:
+            {
+                DescriptorBinding binding = {};
+                binding.set     = getDecoration(id, DECORATION_DESCRIPTOR_SET) == NONE ? 0u : getDecoration(id, DECORATION_DESCRIPTOR_SET);
+                binding.binding = getDecoration(id, DECORATION_BINDING);
+                binding.count   = 1;
+                if (binding.binding == NONE)
+                {
+                    error = "resource without binding";
+                    return false;
+                }
+                while (type->opcode == OP_TYPE_ARRAY || type->opcode == OP_TYPE_RUNTIME_ARRAY)
+                {
+                    if (type->opcode == OP_TYPE_RUNTIME_ARRAY || constants.count(type->length) == 0)
+                    {
+                        error = "descriptor array of unknown size at binding " + std::to_string(binding.binding);
+                        return false;
+                    }
+                    binding.count *= constants.at(type->length);
+                    type = getType(type->element);
+                    if (type == nullptr)
+                    {
+                        error = "array of unknown type";
+                        return false;
+                    }
+                }
+                if (!getDescriptorType(*type, variable.storageClass, getDecoration(type->id, DECORATION_BUFFER_BLOCK) != NONE, binding.type))
+                {
+                    error = "unsupported resource at binding " + std::to_string(binding.binding);
+                    return false;
+                }
+                this->bindings.push_back(binding);
+                break;
+            }
+            case STORAGE_CLASS_PUSH_CONSTANT:
+                this->pushConstantSize = std::max(this->pushConstantSize, getSize(*type, types, constants, decorations, memberDecorations));
+                break;
+            case STORAGE_CLASS_INPUT:
+            case STORAGE_CLASS_OUTPUT:
+            {
+                const uint32_t location = getDecoration(id, DECORATION_LOCATION);
+                if (location == NONE || getDecoration(id, DECORATION_BUILT_IN) != NONE)
+                {
+                    break; // Built-ins, IO blocks.
+                }
+                InterfaceVariable interfaceVariable = { location, getFormat(*type, types), false, NONE };
+                const std::vector<size_t> uses = getUses(id);
+                interfaceVariable.isUsed = !uses.empty();
+                if (variable.storageClass == STORAGE_CLASS_OUTPUT)
+                {
+                    this->outputs.push_back(interfaceVariable);
+                    break;
+                }
+
+                // Forwarded - only loaded, and every load only stored whole into the same output
+                bool     isForwarded = interfaceVariable.isUsed;
+                uint32_t forwardedTo = NONE;
+                for (size_t use : uses)
+                {
+                    const uint32_t* load = &code[use];
+                    if ((load[0] & 0xFFFF) != OP_LOAD || load[3] != id)
+                    {
+                        isForwarded = false;
+                        break;
+                    }
+                    for (size_t loadUse : getUses(load[2]))
+                    {
+                        const uint32_t* store = &code[loadUse];
+                        const auto output = variables.find(store[1]);
+                        const bool isStoreToOutput = (store[0] & 0xFFFF) == OP_STORE && store[2] == load[2] &&
+                                                     output != variables.end() && output->second.storageClass == STORAGE_CLASS_OUTPUT;
+                        const uint32_t outputLocation = isStoreToOutput ? getDecoration(store[1], DECORATION_LOCATION) : NONE;
+                        if (outputLocation == NONE || (forwardedTo != NONE && forwardedTo != outputLocation))
+                        {
+                            isForwarded = false;
+                            break;
+                        }
+                        forwardedTo = outputLocation;
+                    }
+                    if (!isForwarded)
+                    {
+                        break;
+                    }
+                }
+                interfaceVariable.forwardedTo = isForwarded ? forwardedTo : NONE;
+                this->inputs.push_back(interfaceVariable);
+                break;
+            }
+            }
+        }
+
+        auto byLocation = [](const InterfaceVariable& a, const InterfaceVariable& b) { return a.location < b.location; };
+        std::sort(this->inputs.begin(),  this->inputs.end(),  byLocation);
+        std::sort(this->outputs.begin(), this->outputs.end(), byLocation);
+        std::sort(this->specializationConstants.begin(), this->specializationConstants.end());
+        std::sort(this->bindings.begin(), this->bindings.end(), [](const DescriptorBinding& a, const DescriptorBinding& b)
+        {
+            return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+        });
+        return true;
+    }
+
+    const InterfaceVariable* findInput(uint32_t location) const
+    {
+        auto input = std::find_if(this->inputs.begin(), this->inputs.end(), [&](const InterfaceVariable& v) { return v.location == location; });
+        return input == this->inputs.end() ? nullptr : &*input;
+    }
+
+    bool hasSpecializationConstant(uint32_t constantId) const
+    {
+        return std::binary_search(this->specializationConstants.begin(), this->specializationConstants.end(), constantId);
+    }
+
+private:
+    static constexpr uint32_t MAGIC       = 0x07230203;
+    static constexpr size_t   HEADER_SIZE = 5;
+
+    enum : uint32_t
+    {
+        OP_NAME = 5, OP_MEMBER_NAME = 6, OP_ENTRY_POINT = 15, OP_TYPE_BOOL = 20,
+        OP_TYPE_INT = 21, OP_TYPE_FLOAT = 22, OP_TYPE_VECTOR = 23, OP_TYPE_MATRIX = 24, OP_TYPE_IMAGE = 25, OP_TYPE_SAMPLER = 26,
+        OP_TYPE_SAMPLED_IMAGE = 27, OP_TYPE_ARRAY = 28, OP_TYPE_RUNTIME_ARRAY = 29, OP_TYPE_STRUCT = 30, OP_TYPE_POINTER = 32,
+        OP_CONSTANT = 43, OP_VARIABLE = 59, OP_LOAD = 61, OP_STORE = 62, OP_DECORATE = 71, OP_MEMBER_DECORATE = 72,
+    };
+    enum : uint32_t
+    {
+        DECORATION_SPEC_ID = 1, DECORATION_BLOCK = 2, DECORATION_BUFFER_BLOCK = 3, DECORATION_ARRAY_STRIDE = 6, DECORATION_MATRIX_STRIDE = 7,
+        DECORATION_BUILT_IN = 11, DECORATION_LOCATION = 30, DECORATION_BINDING = 33, DECORATION_DESCRIPTOR_SET = 34, DECORATION_OFFSET = 35,
+    };
+    enum : uint32_t
+    {
+        STORAGE_CLASS_UNIFORM_CONSTANT = 0, STORAGE_CLASS_INPUT = 1, STORAGE_CLASS_UNIFORM = 2, STORAGE_CLASS_OUTPUT = 3,
+        STORAGE_CLASS_PUSH_CONSTANT = 9, STORAGE_CLASS_STORAGE_BUFFER = 12,
+    };
+    enum : uint32_t
+    {
+        DIM_BUFFER = 5, DIM_SUBPASS_DATA = 6,
+    };
+
+    /// Meaning of the fields depends on opcode:
+    /// * int, float       - width, signedness,
+    /// * vector, matrix   - element (component, column), count,
+    /// * image            - dim, sampled (1 - sampled, 2 - storage),
+    /// * array            - element, length (constant id),
+    /// * pointer          - element (pointee), storage class,
+    /// * struct           - members.
+    struct Type
+    {
+        uint32_t              id;
+        uint32_t              opcode;
+        uint32_t              element;
+        uint32_t              length;
+        uint32_t              flags;
+        std::vector<uint32_t> members;
+    };
+
+    struct Variable
+    {
+        uint32_t pointerType;
+        uint32_t storageClass;
+    };
+
+    static VkShaderStageFlagBits getStage(uint32_t executionModel)
+    {
+        switch (executionModel)
+        {
+        case 0:  return VK_SHADER_STAGE_VERTEX_BIT;
+        case 1:  return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+        case 2:  return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+        case 3:  return VK_SHADER_STAGE_GEOMETRY_BIT;
+        case 4:  return VK_SHADER_STAGE_FRAGMENT_BIT;
+        case 5:  return VK_SHADER_STAGE_COMPUTE_BIT;
+        default: return VK_SHADER_STAGE_ALL;
+        }
+    }
+
+    static bool getDescriptorType(const Type& type, uint32_t storageClass, bool isBufferBlock, VkDescriptorType& outType)
+    {
+        switch (type.opcode)
+        {
+        case OP_TYPE_SAMPLED_IMAGE:
+            outType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            return true;
+        case OP_TYPE_SAMPLER:
+            outType = VK_DESCRIPTOR_TYPE_SAMPLER;
+            return true;
+        case OP_TYPE_IMAGE:
+            if (type.element == DIM_BUFFER)
+            {
+                outType = type.flags == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+            }
+            else if (type.element == DIM_SUBPASS_DATA)
+            {
+                outType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            }
+            else
+            {
+                outType = type.flags == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+            }
+            return true;
+        case OP_TYPE_STRUCT:
+            if (storageClass == STORAGE_CLASS_STORAGE_BUFFER || (storageClass == STORAGE_CLASS_UNIFORM && isBufferBlock))
+            {
+                outType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                return true;
+            }
+            if (storageClass == STORAGE_CLASS_UNIFORM)
+            {
+                outType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    /// Format of a 32 bit scalar or vector, VK_FORMAT_UNDEFINED for anything else.
+    static VkFormat getFormat(const Type& type, const std::map<uint32_t, Type>& types)
+    {
+        const Type* component = &type;
+        uint32_t count = 1;
+        if (type.opcode == OP_TYPE_VECTOR)
+        {
+            auto element = types.find(type.element);
+            if (element == types.end())
+            {
+                return VK_FORMAT_UNDEFINED;
+            }
+            component = &element->second;
+            count     = type.length;
+        }
+        if ((component->opcode != OP_TYPE_FLOAT && component->opcode != OP_TYPE_INT) || component->length != 32 || count < 1 || count > 4)
+        {
+            return VK_FORMAT_UNDEFINED;
+        }
+
+        static const VkFormat floats[]    = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+        static const VkFormat signeds[]   = { VK_FORMAT_R32_SINT,   VK_FORMAT_R32G32_SINT,   VK_FORMAT_R32G32B32_SINT,   VK_FORMAT_R32G32B32A32_SINT };
+        static const VkFormat unsigneds[] = { VK_FORMAT_R32_UINT,   VK_FORMAT_R32G32_UINT,   VK_FORMAT_R32G32B32_UINT,   VK_FORMAT_R32G32B32A32_UINT };
+        if (component->opcode == OP_TYPE_FLOAT)
+        {
+            return floats[count - 1];
+        }
+        return component->flags ? signeds[count - 1] : unsigneds[count - 1];
+    }
+
+    /// Size of a type in a block - scalars, vectors, matrices, arrays and structs, as laid out by Offset and stride decorations.
+    static uint32_t getSize(const Type& type,
+                            const std::map<uint32_t, Type>& types,
+                            const std::map<uint32_t, uint32_t>& constants,
+                            const std::map<uint32_t, std::map<uint32_t, uint32_t>>& decorations,
+                            const std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, uint32_t>>& memberDecorations)
+    {
+        auto getElementSize = [&](uint32_t element) -> uint32_t
+        {
+            auto elementType = types.find(element);
+            return elementType == types.end() ? 0u : getSize(elementType->second, types, constants, decorations, memberDecorations);
+        };
+
+        switch (type.opcode)
+        {
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+            return type.length / 8;
+        case OP_TYPE_VECTOR:
+        case OP_TYPE_MATRIX: // Columns tightly packed - a matrix member of a block is sized by its MatrixStride instead, see below.
+            return type.length * getElementSize(type.element);
+        case OP_TYPE_ARRAY:
+        {
+            auto decorated = decorations.find(type.id);
+            const uint32_t stride = decorated != decorations.end() && decorated->second.count(DECORATION_ARRAY_STRIDE) ?
+                                    decorated->second.at(DECORATION_ARRAY_STRIDE) : getElementSize(type.element);
+            auto length = constants.find(type.length);
+            return length == constants.end() ? 0u : length->second * stride;
+        }
+        case OP_TYPE_STRUCT:
+        {
+            uint32_t size = 0;
+            for (uint32_t m = 0; m < type.members.size(); m++)
+            {
+                auto decorated = memberDecorations.find({ type.id, m });
+                auto getMemberDecoration = [&](uint32_t decoration)
+                {
+                    return decorated == memberDecorations.end() || decorated->second.count(decoration) == 0 ? NONE : decorated->second.at(decoration);
+                };
+                const uint32_t offset       = getMemberDecoration(DECORATION_OFFSET);
+                const uint32_t matrixStride = getMemberDecoration(DECORATION_MATRIX_STRIDE);
+
+                // Columns of a matrix member are MatrixStride apart - e.g. 16 bytes for vec3 columns of std140 mat3
+                auto member = types.find(type.members[m]);
+                const uint32_t memberSize = member != types.end() && member->second.opcode == OP_TYPE_MATRIX && matrixStride != NONE ?
+                                            member->second.length * matrixStride : getElementSize(type.members[m]);
+                size = std::max(size, (offset == NONE ? size : offset) + memberSize);
+            }
+            return size;
+        }
+        default:
+            return 0;
+        }
+    }
+};
+
+/// Locations of vertex shader inputs which have to be fed by vertex buffers - the ones it reads for anything else
+/// than forwarding them to a fragment shader input, which the fragment shader (if any) never reads.
+inline std::set<uint32_t> getLiveVertexInputs(const SpirvReflection& vertex, const SpirvReflection* fragment)
+{
+    std::set<uint32_t> live;
+    for (const SpirvReflection::InterfaceVariable& input : vertex.inputs)
+    {
+        if (!input.isUsed)
+        {
+            continue;
+        }
+        if (input.forwardedTo == SpirvReflection::NONE)
+        {
+            live.insert(input.location);
+            continue;
+        }
+        const SpirvReflection::InterfaceVariable* next = fragment ? fragment->findInput(input.forwardedTo) : nullptr;
+        if (next && next->isUsed)
+        {
+            live.insert(input.location);
+        }
+    }
+    return live;
+}
+
+} // namespace vk229
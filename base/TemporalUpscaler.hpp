@@ -0,0 +1,592 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+#include <VulkanBuffer.hpp>
+#include <VulkanDevice.hpp>
+#include <VulkanTools.h>
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Temporal upscaling and anti-aliasing - the scene is rendered at a lower resolution, its projection jittered within the rendered
+/// pixel differently every frame, and accumulated into a history at the output resolution (temporal_upscale.frag):
+/// * the jitter is a Halton (2, 3) sequence of JITTER_PHASES offsets (beginFrame()),
+/// * motion vectors - where the surface of a pixel was in the previous frame - are drawn over the scene's depth, by draws of
+///   the scene (recordMotionPass()), pixels without a surface are reprojected by the camera,
+/// * history is reprojected by them, clamped to the neighbourhood of the pixel in the current frame, so disoccluded or changed
+///   pixels don't ghost, and blended with current samples weighted by their distance to the pixel,
+/// * output is up to MAX_UPSCALE times the rendered size, on every axis.
+/// The resolve writes the new history and the swapchain image at once, the new history is then copied over the one which is read -
+/// command buffers are recorded once, for any order of swapchain images. Images have the window size, the scene is rendered into
+/// their top left corner, as with DynamicResolution. Frames must not overlap (submitFrame() waits for the queue).
+/// Resolve shader: binding 0 - frame, 1 - motion vectors, 2 - history (sampler2D), 3 - Params.
+struct TemporalUpscaler
+{
+    static constexpr uint32_t JITTER_PHASES  = 16;
+    static constexpr float    MAX_UPSCALE    = 2.0f;   // Output to rendered size.
+    static constexpr float    NO_MOTION      = 1.0e4f; // Motion vectors are cleared to it - pixels without a surface.
+    static constexpr VkFormat MOTION_FORMAT  = VK_FORMAT_R16G16_SFLOAT;       // Current uv minus previous uv.
+    static constexpr VkFormat HISTORY_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+    /// As the resolve shader reads it - written every frame, by beginFrame().
+    struct Params
+    {
+        glm::mat4 reprojection; // Current clip space to previous one, without jitter - for pixels without motion vectors.
+        glm::vec4 jitter;       // xy - offset of this frame's samples, in rendered pixels.
+        glm::vec4 renderSize;   // Pixels, then their reciprocal.
+        glm::vec4 outputSize;   // Pixels, then their reciprocal.
+        glm::vec4 blend;        // x - currentWeight, y - 1 if history is valid.
+    };
+
+    struct Image
+    {
+        VkImage        image  = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkImageView    view   = VK_NULL_HANDLE;
+    };
+
+    vks::VulkanDevice* vulkanDevice = nullptr;
+    VkDevice           device       = VK_NULL_HANDLE;
+
+    bool  isEnabled     = false;
+    float currentWeight = 0.1f; // Of current samples at the pixel centre, against history - farther ones weigh less.
+
+    uint32_t  width                  = 0; // Of the window - output, and images the scene is rendered into.
+    uint32_t  height                 = 0;
+    uint32_t  frameIndex             = 0;
+    bool      isHistoryValid         = false;
+    glm::mat4 viewProjection         = glm::mat4(1.0f); // Of the frame begun last, without jitter.
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+    VkFormat    colorFormat = VK_FORMAT_UNDEFINED; // Of swapchain images.
+    VkFormat    depthFormat = VK_FORMAT_UNDEFINED;
+    VkImageView frameView   = VK_NULL_HANDLE;      // Offscreen frame the scene is rendered into, not owned.
+    VkImageView depthView   = VK_NULL_HANDLE;      // Not owned.
+
+    // Motion vectors
+    Image         motion;
+    VkRenderPass  motionRenderPass  = VK_NULL_HANDLE; // Motion vectors and the scene's depth.
+    VkFramebuffer motionFramebuffer = VK_NULL_HANDLE;
+
+    // Resolve
+    Image                      history;             // Read by the resolve.
+    Image                      resolved;            // Written by the resolve, copied into history.
+    VkRenderPass               renderPass          = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers;        // Per swapchain image.
+    std::vector<VkImageView>   swapchainViews;      // Not owned.
+    vks::Buffer                params;              // Params, mapped.
+    VkSampler                  sampler             = VK_NULL_HANDLE;
+    VkDescriptorSetLayout      descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool           descriptorPool      = VK_NULL_HANDLE;
+    VkDescriptorSet            descriptorSet       = VK_NULL_HANDLE;
+    VkPipelineLayout           pipelineLayout      = VK_NULL_HANDLE;
+    VkPipeline                 pipeline            = VK_NULL_HANDLE;
+
+// PREPARE {
+
+    /// Creates everything that doesn't depend on the window size - motion vectors pass too, scene's motion pipelines are created
+    /// with it. Stages - fullscreen.vert and temporal_upscale.frag.
+    void prepare(vks::VulkanDevice* dev, VkPipelineCache pipelineCache, VkFormat swapchainFormat, VkFormat sceneDepthFormat,
+                 const VkPipelineShaderStageCreateInfo& vertexStage, const VkPipelineShaderStageCreateInfo& fragmentStage)
+    {
+        this->vulkanDevice = dev;
+        this->device       = dev->logicalDevice;
+        this->colorFormat  = swapchainFormat;
+        this->depthFormat  = sceneDepthFormat;
+
+        VK_CHECK_RESULT(dev->createBuffer(
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &this->params,
+            sizeof(Params)));
+        VK_CHECK_RESULT(this->params.map());
+
+        // Bilinear for history taps - the frame and motion vectors are fetched
+        VkSamplerCreateInfo samplerCreateInfo = vks::initializers::samplerCreateInfo();
+        samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+        samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.maxAnisotropy = 1.0f;
+        samplerCreateInfo.minLod = 0.0f;
+        samplerCreateInfo.maxLod = 0.0f;
+        samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+        VK_CHECK_RESULT(vkCreateSampler(this->device, &samplerCreateInfo, nullptr, &this->sampler));
+
+        std::array<VkDescriptorSetLayoutBinding, 4> setLayoutBindings = {
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0), // Binding 0 : Frame
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1), // Binding 1 : Motion vectors
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2), // Binding 2 : History
+            vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         VK_SHADER_STAGE_FRAGMENT_BIT, 3)  // Binding 3 : Params
+        };
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(this->device, &descriptorLayout, nullptr, &this->descriptorSetLayout));
+
+        std::array<VkDescriptorPoolSize, 2> poolSizes = {
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1)
+        };
+        VkDescriptorPoolCreateInfo descriptorPoolInfo =
+            vks::initializers::descriptorPoolCreateInfo(static_cast<uint32_t>(poolSizes.size()), poolSizes.data(), 1);
+        VK_CHECK_RESULT(vkCreateDescriptorPool(this->device, &descriptorPoolInfo, nullptr, &this->descriptorPool));
+
+        VkDescriptorSetAllocateInfo descriptorSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(this->descriptorPool, &this->descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(this->device, &descriptorSetAllocInfo, &this->descriptorSet));
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(&this->descriptorSetLayout, 1);
+        VK_CHECK_RESULT(vkCreatePipelineLayout(this->device, &pipelineLayoutCreateInfo, nullptr, &this->pipelineLayout));
+
+        this->createMotionRenderPass();
+        this->createRenderPass();
+        this->createPipeline(pipelineCache, vertexStage, fragmentStage);
+    }
+
+    /// Images and framebuffers follow the window - they are (re)created when its size, depth buffer, offscreen frame or swapchain
+    /// images changed, history is cleared. The device must be idle, as on resize. Returns true if they were recreated.
+    bool resize(VkQueue queue, VkImageView windowDepthView, VkImageView offscreenFrameView, const std::vector<VkImageView>& windowSwapchainViews,
+                uint32_t windowWidth, uint32_t windowHeight)
+    {
+        if (windowWidth == this->width && windowHeight == this->height && windowDepthView == this->depthView &&
+            offscreenFrameView == this->frameView && windowSwapchainViews == this->swapchainViews)
+        {
+            return false;
+        }
+
+        this->destroySizeDependent();
+
+        this->width          = windowWidth;
+        this->height         = windowHeight;
+        this->depthView      = windowDepthView;
+        this->frameView      = offscreenFrameView;
+        this->swapchainViews = windowSwapchainViews;
+        this->isHistoryValid = false;
+
+        this->createImage(MOTION_FORMAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, this->motion);
+        this->createImage(HISTORY_FORMAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, this->history);
+        this->createImage(HISTORY_FORMAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, this->resolved);
+
+        std::array<VkImageView, 2> motionAttachments = { this->motion.view, this->depthView };
+        VkFramebufferCreateInfo framebufferCreateInfo = vks::initializers::framebufferCreateInfo();
+        framebufferCreateInfo.renderPass = this->motionRenderPass;
+        framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(motionAttachments.size());
+        framebufferCreateInfo.pAttachments = motionAttachments.data();
+        framebufferCreateInfo.width = this->width;
+        framebufferCreateInfo.height = this->height;
+        framebufferCreateInfo.layers = 1;
+        VK_CHECK_RESULT(vkCreateFramebuffer(this->device, &framebufferCreateInfo, nullptr, &this->motionFramebuffer));
+
+        framebufferCreateInfo.renderPass = this->renderPass;
+        this->framebuffers.resize(this->swapchainViews.size());
+        for (size_t i = 0; i < this->swapchainViews.size(); i++)
+        {
+            std::array<VkImageView, 2> attachments = { this->resolved.view, this->swapchainViews[i] };
+            framebufferCreateInfo.pAttachments = attachments.data();
+            VK_CHECK_RESULT(vkCreateFramebuffer(this->device, &framebufferCreateInfo, nullptr, &this->framebuffers[i]));
+        }
+
+        VkDescriptorImageInfo frameDescriptor   = vks::initializers::descriptorImageInfo(this->sampler, this->frameView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        VkDescriptorImageInfo motionDescriptor  = vks::initializers::descriptorImageInfo(this->sampler, this->motion.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        VkDescriptorImageInfo historyDescriptor = vks::initializers::descriptorImageInfo(this->sampler, this->history.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        std::array<VkWriteDescriptorSet, 4> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &frameDescriptor),   // Binding 0 : Frame
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &motionDescriptor),  // Binding 1 : Motion vectors
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &historyDescriptor), // Binding 2 : History
+            vks::initializers::writeDescriptorSet(this->descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         3, &this->params.descriptor) // Binding 3 : Params
+        };
+        vkUpdateDescriptorSets(this->device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+
+        // Every frame starts with history readable - it is not valid until the first resolve
+        VkCommandBuffer cmdBuffer = this->vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.image = this->history.image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        this->vulkanDevice->flushCommandBuffer(cmdBuffer, queue, true);
+
+        return true;
+    }
+
+// } // PREPARE
+
+// RUNTIME {
+
+    /// History isn't blended into the next frame - e.g. after frames drawn without temporal upscaling.
+    void invalidateHistory()
+    {
+        this->isHistoryValid = false;
+    }
+
+    /// Starts a frame rendered at renderWidth x renderHeight with the camera's view and projection - writes its params.
+    /// Returns the projection to render it with, jittered by a fraction of the rendered pixel.
+    glm::mat4 beginFrame(const glm::mat4& view, const glm::mat4& projection, uint32_t renderWidth, uint32_t renderHeight)
+    {
+        const uint32_t  phase = this->frameIndex++ % JITTER_PHASES;
+        const glm::vec2 jitter(halton(phase + 1, 2) - 0.5f, halton(phase + 1, 3) - 0.5f);
+
+        this->previousViewProjection = this->isHistoryValid ? this->viewProjection : projection * view;
+        this->viewProjection         = projection * view;
+
+        Params params;
+        params.reprojection = this->previousViewProjection * glm::inverse(this->viewProjection);
+        params.jitter       = glm::vec4(jitter, 0.0f, 0.0f);
+        params.renderSize   = glm::vec4(renderWidth, renderHeight, 1.0f / renderWidth, 1.0f / renderHeight);
+        params.outputSize   = glm::vec4(this->width, this->height, 1.0f / this->width, 1.0f / this->height);
+        params.blend        = glm::vec4(this->currentWeight, this->isHistoryValid ? 1.0f : 0.0f, 0.0f, 0.0f);
+        memcpy(this->params.mapped, &params, sizeof(params));
+        this->isHistoryValid = true;
+
+        // Offset in NDC, 2 / size per pixel - samples move by the jitter
+        glm::mat4 offset(1.0f);
+        offset[3][0] = 2.0f * jitter.x / renderWidth;
+        offset[3][1] = 2.0f * jitter.y / renderHeight;
+        return offset * projection;
+    }
+
+    /// Motion vectors pass, after the scene's late render pass (the frame in SHADER_READ_ONLY_OPTIMAL, depth kept) - records
+    /// draws of the scene with motion pipelines (motion.frag, depth test EQUAL). Pixels they don't cover get NO_MOTION.
+    void recordMotionPass(VkCommandBuffer cmdBuffer, uint32_t renderWidth, uint32_t renderHeight, const std::function<void(VkCommandBuffer)>& recordDraws) const
+    {
+        VkClearValue clearValue;
+        clearValue.color = { { NO_MOTION, NO_MOTION, 0.0f, 0.0f } };
+
+        VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+        renderPassBeginInfo.renderPass = this->motionRenderPass;
+        renderPassBeginInfo.framebuffer = this->motionFramebuffer;
+        renderPassBeginInfo.renderArea.extent.width = renderWidth;
+        renderPassBeginInfo.renderArea.extent.height = renderHeight;
+        renderPassBeginInfo.clearValueCount = 1;
+        renderPassBeginInfo.pClearValues = &clearValue;
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        VkViewport viewport = vks::initializers::viewport((float)renderWidth, (float)renderHeight, 0.0f, 1.0f);
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+        VkRect2D scissor = vks::initializers::rect2D(renderWidth, renderHeight, 0, 0);
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+        recordDraws(cmdBuffer);
+
+        vkCmdEndRenderPass(cmdBuffer);
+    }
+
+    /// Resolves the frame into the new history and swapchain image imageIndex - left in PRESENT_SRC_KHR - then copies the new
+    /// history over the one read next frame.
+    void recordResolve(VkCommandBuffer cmdBuffer, uint32_t imageIndex) const
+    {
+        VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+        renderPassBeginInfo.renderPass = this->renderPass;
+        renderPassBeginInfo.framebuffer = this->framebuffers[imageIndex];
+        renderPassBeginInfo.renderArea.extent.width = this->width;
+        renderPassBeginInfo.renderArea.extent.height = this->height;
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        VkViewport viewport = vks::initializers::viewport((float)this->width, (float)this->height, 0.0f, 1.0f);
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+        VkRect2D scissor = vks::initializers::rect2D(this->width, this->height, 0, 0);
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipelineLayout, 0, 1, &this->descriptorSet, 0, NULL);
+        vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+
+        vkCmdEndRenderPass(cmdBuffer);
+
+        // Resolved is in TRANSFER_SRC_OPTIMAL (render pass), history is done being read
+        VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.image = this->history.image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkImageCopy copyRegion = {};
+        copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        copyRegion.extent = { this->width, this->height, 1 };
+        vkCmdCopyImage(cmdBuffer, this->resolved.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, this->history.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+        // Read by the next frame's resolve
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+// } // RUNTIME
+
+// DESTROY {
+
+    void destroy()
+    {
+        if (this->device == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        this->destroySizeDependent();
+        vkDestroyPipeline(this->device, this->pipeline, nullptr);
+        vkDestroyPipelineLayout(this->device, this->pipelineLayout, nullptr);
+        vkDestroyRenderPass(this->device, this->renderPass, nullptr);
+        vkDestroyRenderPass(this->device, this->motionRenderPass, nullptr);
+        vkDestroyDescriptorPool(this->device, this->descriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(this->device, this->descriptorSetLayout, nullptr);
+        vkDestroySampler(this->device, this->sampler, nullptr);
+        this->params.destroy();
+        this->device = VK_NULL_HANDLE;
+    }
+
+// } // DESTROY
+
+private:
+    /// Radical inverse of index in base - low discrepancy, consecutive offsets cover the pixel evenly.
+    static float halton(uint32_t index, uint32_t base)
+    {
+        float result   = 0.0f;
+        float fraction = 1.0f;
+        for (; index > 0; index /= base)
+        {
+            fraction /= base;
+            result   += fraction * (index % base);
+        }
+        return result;
+    }
+
+    /// Window sized, device local, single mip level.
+    void createImage(VkFormat format, VkImageUsageFlags usage, Image& outImage)
+    {
+        VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = format;
+        imageCreateInfo.extent = { this->width, this->height, 1 };
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = usage;
+        VK_CHECK_RESULT(vkCreateImage(this->device, &imageCreateInfo, nullptr, &outImage.image));
+
+        VkMemoryRequirements memReqs;
+        vkGetImageMemoryRequirements(this->device, outImage.image, &memReqs);
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = memReqs.size;
+        memAlloc.memoryTypeIndex = this->vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkAllocateMemory(this->device, &memAlloc, nullptr, &outImage.memory));
+        VK_CHECK_RESULT(vkBindImageMemory(this->device, outImage.image, outImage.memory, 0));
+
+        VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewCreateInfo.format = format;
+        viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        viewCreateInfo.image = outImage.image;
+        VK_CHECK_RESULT(vkCreateImageView(this->device, &viewCreateInfo, nullptr, &outImage.view));
+    }
+
+    void destroyImage(Image& image)
+    {
+        if (image.image == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        vkDestroyImageView(this->device, image.view, nullptr);
+        vkDestroyImage(this->device, image.image, nullptr);
+        vkFreeMemory(this->device, image.memory, nullptr);
+        image = Image();
+    }
+
+    /// Motion vectors are cleared, depth left by the scene's late pass is tested, not written - nor kept after.
+    void createMotionRenderPass()
+    {
+        std::array<VkAttachmentDescription, 2> attachments = {};
+        // Motion vectors
+        attachments[0].format = MOTION_FORMAT;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        // Depth of the scene
+        attachments[1].format = this->depthFormat;
+        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+        VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+        VkSubpassDescription subpassDescription = {};
+        subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDescription.colorAttachmentCount = 1;
+        subpassDescription.pColorAttachments = &colorReference;
+        subpassDescription.pDepthStencilAttachment = &depthReference;
+
+        std::array<VkSubpassDependency, 2> dependencies;
+
+        // Depth written by the scene, motion vectors read by the last frame's resolve
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = 0;
+
+        // Any pixel may be read by the resolve - not by region
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[1].dependencyFlags = 0;
+
+        VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpassDescription;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+        VK_CHECK_RESULT(vkCreateRenderPass(this->device, &renderPassInfo, nullptr, &this->motionRenderPass));
+    }
+
+    /// New history, then copied (left in TRANSFER_SRC_OPTIMAL), and the swapchain image - both overwritten.
+    void createRenderPass()
+    {
+        std::array<VkAttachmentDescription, 2> attachments = {};
+        // Resolved history
+        attachments[0].format = HISTORY_FORMAT;
+        attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        // Swapchain image
+        attachments[1] = attachments[0];
+        attachments[1].format = this->colorFormat;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        std::array<VkAttachmentReference, 2> colorReferences = {
+            VkAttachmentReference{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+            VkAttachmentReference{ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }
+        };
+
+        VkSubpassDescription subpassDescription = {};
+        subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpassDescription.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+        subpassDescription.pColorAttachments = colorReferences.data();
+
+        std::array<VkSubpassDependency, 2> dependencies;
+
+        // Previous presentation of the image, last frame's copy of the resolved history
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = 0;
+
+        // Copy of the history, presentation (and text overlay) next
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_MEMORY_READ_BIT;
+        dependencies[1].dependencyFlags = 0;
+
+        VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpassDescription;
+        renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassInfo.pDependencies = dependencies.data();
+        VK_CHECK_RESULT(vkCreateRenderPass(this->device, &renderPassInfo, nullptr, &this->renderPass));
+    }
+
+    /// Full-screen triangle, no vertex input, no depth, no blending - two color attachments.
+    void createPipeline(VkPipelineCache pipelineCache, const VkPipelineShaderStageCreateInfo& vertexStage, const VkPipelineShaderStageCreateInfo& fragmentStage)
+    {
+        VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
+            vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+        VkPipelineRasterizationStateCreateInfo rasterizationState =
+            vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE, 0);
+        std::array<VkPipelineColorBlendAttachmentState, 2> blendAttachmentStates = {
+            vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE),
+            vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE)
+        };
+        VkPipelineColorBlendStateCreateInfo colorBlendState =
+            vks::initializers::pipelineColorBlendStateCreateInfo(static_cast<uint32_t>(blendAttachmentStates.size()), blendAttachmentStates.data());
+        VkPipelineDepthStencilStateCreateInfo depthStencilState =
+            vks::initializers::pipelineDepthStencilStateCreateInfo(VK_FALSE, VK_FALSE, VK_COMPARE_OP_ALWAYS);
+        VkPipelineViewportStateCreateInfo viewportState =
+            vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+        VkPipelineMultisampleStateCreateInfo multisampleState =
+            vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+        std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState =
+            vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables.data(), static_cast<uint32_t>(dynamicStateEnables.size()), 0);
+        VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = { vertexStage, fragmentStage };
+
+        VkGraphicsPipelineCreateInfo pipelineCreateInfo = vks::initializers::pipelineCreateInfo(this->pipelineLayout, this->renderPass, 0);
+        pipelineCreateInfo.pVertexInputState = &vertexInputState;
+        pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+        pipelineCreateInfo.pRasterizationState = &rasterizationState;
+        pipelineCreateInfo.pColorBlendState = &colorBlendState;
+        pipelineCreateInfo.pMultisampleState = &multisampleState;
+        pipelineCreateInfo.pViewportState = &viewportState;
+        pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+        pipelineCreateInfo.pDynamicState = &dynamicState;
+        pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+        pipelineCreateInfo.pStages = shaderStages.data();
+        VK_CHECK_RESULT(vkCreateGraphicsPipelines(this->device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &this->pipeline));
+    }
+
+    void destroySizeDependent()
+    {
+        for (VkFramebuffer fb : this->framebuffers)
+        {
+            vkDestroyFramebuffer(this->device, fb, nullptr);
+        }
+        this->framebuffers.clear();
+        if (this->motionFramebuffer != VK_NULL_HANDLE)
+        {
+            vkDestroyFramebuffer(this->device, this->motionFramebuffer, nullptr);
+            this->motionFramebuffer = VK_NULL_HANDLE;
+        }
+        this->destroyImage(this->motion);
+        this->destroyImage(this->history);
+        this->destroyImage(this->resolved);
+    }
+};
+
+} // namespace vk229
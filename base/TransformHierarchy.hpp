@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ParallelFor.hpp"
+
+namespace vk229
+{
+
+//////////////////////////////////////
+/// Parent/child transforms of entities - world matrix of a node is world matrix of its parent times its local matrix.
+/// Nodes are kept as flat arrays sorted by depth (breadth first), so every level is contiguous and depends only
+/// on the previous one, and children of a node are contiguous too.
+/// Changed nodes are listed per level. update() walks the levels from the top, computes world matrices
+/// of the listed nodes only (in parallel when there are many of them) and lists their children in the next level,
+/// so the cost follows the changed subtrees, not the whole scene.
+/// World matrices are written straight into the per entity transform buffer.
+struct TransformHierarchy
+{
+    static constexpr uint32_t ROOT         = 0xFFFFFFFFu;
+    static constexpr size_t   PARALLEL_MIN = 256; // Changed nodes in a level, worth splitting between threads.
+
+    std::vector<uint32_t>  parents;      // Node of parent, ROOT for roots.
+    std::vector<uint32_t>  firstChild;   // Children of node n are [firstChild[n], firstChild[n] + childCount[n]).
+    std::vector<uint32_t>  childCount;
+    std::vector<uint32_t>  levels;       // Depth of node.
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t>   dirty;        // Node is listed in dirtyLevels.
+    std::vector<uint32_t>  entityOf;     // Node -> entity, i.e. index in the transform buffer.
+    std::vector<uint32_t>  nodeOf;       // Entity -> node.
+
+    /// parentOfEntity[i] - parent entity of entity i, or ROOT.
+    /// localOfEntity[i]  - transform of entity i relative to its parent (to the world for roots).
+    /// Returns false, leaving the hierarchy as it was, when parents form a cycle - entities of a cycle are never reached from a root.
+    bool build(const std::vector<uint32_t>& parentOfEntity, const std::vector<glm::mat4>& localOfEntity)
+    {
+        const uint32_t count = parentOfEntity.size();
+        assert(localOfEntity.size() == count);
+
+        std::vector<std::vector<uint32_t>> childrenOfEntity(count);
+        std::vector<uint32_t> order; // Entities breadth first.
+        for (uint32_t e = 0; e < count; e++)
+        {
+            if (parentOfEntity[e] == ROOT)
+            {
+                order.push_back(e);
+            }
+            else
+            {
+                childrenOfEntity[parentOfEntity[e]].push_back(e);
+            }
+        }
+
+        std::vector<uint32_t> nodeOfEntity(count, ROOT);
+        std::vector<uint32_t> levelOfNode(count, 0);
+        for (uint32_t n = 0; n < order.size(); n++)
+        {
+            nodeOfEntity[order[n]] = n;
+            for (uint32_t child : childrenOfEntity[order[n]])
+            {
+                levelOfNode[order.size()] = levelOfNode[n] + 1;
+                order.push_back(child);
+            }
+        }
+        if (order.size() != count)
+        {
+            return false;
+        }
+
+        this->nodeOf   = std::move(nodeOfEntity);
+        this->levels   = std::move(levelOfNode);
+        this->entityOf = order;
+        this->parents.resize(count);
+        this->firstChild.assign(count, count);
+        this->childCount.assign(count, 0);
+        this->locals.resize(count);
+        this->worlds.resize(count);
+        for (uint32_t n = 0; n < count; n++)
+        {
+            const uint32_t entity = this->entityOf[n];
+            this->parents[n] = parentOfEntity[entity] == ROOT ? ROOT : this->nodeOf[parentOfEntity[entity]];
+            this->locals[n]  = localOfEntity[entity];
+            if (this->parents[n] != ROOT)
+            {
+                this->firstChild[this->parents[n]] = std::min(this->firstChild[this->parents[n]], n);
+                this->childCount[this->parents[n]]++;
+            }
+        }
+
+        // Everything starts dirty
+        const uint32_t levelCount = count > 0 ? this->levels[count - 1] + 1 : 0;
+        this->dirtyLevels.assign(levelCount + 1, {}); // One more, always empty, for children of the last level.
+        this->dirty.assign(count, 0);
+        for (uint32_t n = 0; n < count && this->parents[n] == ROOT; n++)
+        {
+            this->markDirty(n);
+        }
+        this->update(nullptr, nullptr, 0);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return this->entityOf.size();
+    }
+
+    const glm::mat4& getWorld(uint32_t entity) const
+    {
+        return this->worlds[this->nodeOf[entity]];
+    }
+
+    /// Entity and its whole subtree are updated by the next update().
+    void setLocal(uint32_t entity, const glm::mat4& local)
+    {
+        const uint32_t node = this->nodeOf[entity];
+        this->locals[node] = local;
+        this->markDirty(node);
+    }
+
+    /// Propagates changes down the changed subtrees, level by level. World matrix of every updated node is written
+    /// into dst (may be null) at its entity's index times stride.
+    /// Returns entities which were updated, valid until the next update().
+    const std::vector<uint32_t>& update(vks::ThreadPool* pool, void* dst, size_t stride)
+    {
+        this->updated.clear();
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        for (size_t level = 0; level + 1 < this->dirtyLevels.size(); level++)
+        {
+            std::vector<uint32_t>& nodes = this->dirtyLevels[level];
+            if (nodes.empty())
+            {
+                continue;
+            }
+
+            // Parents are done - nodes of one level are independent
+            auto computeWorlds = [&](size_t begin, size_t end, size_t)
+            {
+                for (size_t k = begin; k < end; k++)
+                {
+                    const uint32_t n = nodes[k];
+                    const uint32_t p = this->parents[n];
+                    this->worlds[n] = p == ROOT ? this->locals[n] : this->worlds[p] * this->locals[n];
+                    if (out)
+                    {
+                        memcpy(out + this->entityOf[n] * stride, &this->worlds[n], sizeof(glm::mat4));
+                    }
+                }
+            };
+            if (pool && nodes.size() >= PARALLEL_MIN)
+            {
+                parallelFor(*pool, nodes.size(), computeWorlds);
+            }
+            else
+            {
+                computeWorlds(0, nodes.size(), 0);
+            }
+
+            for (uint32_t n : nodes)
+            {
+                this->dirty[n] = 0;
+                this->updated.push_back(this->entityOf[n]);
+                for (uint32_t c = this->firstChild[n]; c < this->firstChild[n] + this->childCount[n]; c++)
+                {
+                    this->markDirty(c);
+                }
+            }
+            nodes.clear();
+        }
+        return this->updated;
+    }
+
+private:
+    std::vector<std::vector<uint32_t>> dirtyLevels; // Dirty nodes of every level.
+    std::vector<uint32_t>              updated;
+
+    void markDirty(uint32_t node)
+    {
+        if (!this->dirty[node])
+        {
+            this->dirty[node] = 1;
+            this->dirtyLevels[this->levels[node]].push_back(node);
+        }
+    }
+};
+
+} // namespace vk229
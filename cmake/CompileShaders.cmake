@@ -0,0 +1,119 @@
+# Build time shader compilation.
+#
+# Every GLSL shader of an example is compiled into SPIR-V next to its source (where examples load it from):
+# * glslc -O0 - naive compile, kept in the build tree for the size report,
+# * spirv-opt -O - optimized for performance (glslc -O when spirv-opt is missing).
+# Neither step emits debug info, so output depends only on sources and tool versions - builds are reproducible.
+#
+# Permutations are declared per example as SHADER_PERMUTATIONS_<example>, entries <shader>:<variant>:<DEFINE[=VALUE]>[,...],
+# e.g. "default_material.frag:unlit:UNLIT" compiles default_material.frag with -DUNLIT into default_material.unlit.frag.spv.
+#
+# Target <example>-shaders builds all of them, target shaders-size-report compares size of naive and optimized SPIR-V of all examples.
+#
+# Shaders of examples using compileShaders() are not in the repository, so glslc is required.
+
+find_program(GLSLC_EXECUTABLE NAMES glslc HINTS "$ENV{VULKAN_SDK}/bin" "$ENV{VULKAN_SDK}/Bin")
+find_program(SPIRV_OPT_EXECUTABLE NAMES spirv-opt HINTS "$ENV{VULKAN_SDK}/bin" "$ENV{VULKAN_SDK}/Bin")
+find_program(SPIRV_DIS_EXECUTABLE NAMES spirv-dis HINTS "$ENV{VULKAN_SDK}/bin" "$ENV{VULKAN_SDK}/Bin")
+
+set(SHADER_TARGET_ENV "vulkan1.0")
+
+# Adds commands compiling one shader (with given defines) into OUTPUT.
+function(compileShader SOURCE OUTPUT NAIVE_OUTPUT DEFINES)
+    set(DEFINE_FLAGS "")
+    foreach(DEFINE ${DEFINES})
+        list(APPEND DEFINE_FLAGS "-D${DEFINE}")
+    endforeach()
+    set(GLSLC_FLAGS --target-env=${SHADER_TARGET_ENV} ${DEFINE_FLAGS})
+
+    # Includes are tracked by depfiles where the generator supports them
+    set(DEPFILE_ARGS "")
+    IF(NOT CMAKE_VERSION VERSION_LESS 3.20.0)
+        set(DEPFILE_ARGS DEPFILE ${NAIVE_OUTPUT}.d)
+        list(APPEND GLSLC_FLAGS -MD -MF ${NAIVE_OUTPUT}.d)
+    ENDIF()
+
+    IF(SPIRV_OPT_EXECUTABLE)
+        add_custom_command(
+            OUTPUT ${NAIVE_OUTPUT} ${OUTPUT}
+            COMMAND ${GLSLC_EXECUTABLE} ${GLSLC_FLAGS} -O0 ${SOURCE} -o ${NAIVE_OUTPUT}
+            COMMAND ${SPIRV_OPT_EXECUTABLE} --target-env=${SHADER_TARGET_ENV} -O ${NAIVE_OUTPUT} -o ${OUTPUT}
+            MAIN_DEPENDENCY ${SOURCE}
+            ${DEPFILE_ARGS}
+            COMMENT "Compiling shader ${OUTPUT}"
+            VERBATIM)
+    ELSE()
+        add_custom_command(
+            OUTPUT ${NAIVE_OUTPUT} ${OUTPUT}
+            COMMAND ${GLSLC_EXECUTABLE} ${GLSLC_FLAGS} -O0 ${SOURCE} -o ${NAIVE_OUTPUT}
+            COMMAND ${GLSLC_EXECUTABLE} --target-env=${SHADER_TARGET_ENV} ${DEFINE_FLAGS} -O ${SOURCE} -o ${OUTPUT}
+            MAIN_DEPENDENCY ${SOURCE}
+            ${DEPFILE_ARGS}
+            COMMENT "Compiling shader ${OUTPUT}"
+            VERBATIM)
+    ENDIF()
+endfunction(compileShader)
+
+# Adds target <EXAMPLE_NAME>-shaders, compiling SHADERS (sources) and declared permutations, returns its name in OUT_TARGET.
+function(compileShaders EXAMPLE_NAME SHADERS OUT_TARGET)
+    IF(NOT GLSLC_EXECUTABLE)
+        MESSAGE(FATAL_ERROR "glslc not found - it is needed to compile shaders of ${EXAMPLE_NAME}, install the Vulkan SDK or set VULKAN_SDK")
+    ENDIF()
+
+    set(NAIVE_DIR ${CMAKE_BINARY_DIR}/shaders/${EXAMPLE_NAME})
+    file(MAKE_DIRECTORY ${NAIVE_DIR})
+
+    set(OUTPUTS "")
+    set(REPORT_FILES "") # <naive>|<optimized>
+    foreach(SHADER ${SHADERS})
+        get_filename_component(SHADER_FILENAME ${SHADER} NAME)
+        compileShader(${SHADER} ${SHADER}.spv ${NAIVE_DIR}/${SHADER_FILENAME}.spv "")
+        list(APPEND OUTPUTS ${SHADER}.spv)
+        list(APPEND REPORT_FILES "${NAIVE_DIR}/${SHADER_FILENAME}.spv|${SHADER}.spv")
+    endforeach()
+
+    foreach(PERMUTATION ${SHADER_PERMUTATIONS_${EXAMPLE_NAME}})
+        string(REPLACE ":" ";" PERMUTATION_PARTS ${PERMUTATION})
+        list(LENGTH PERMUTATION_PARTS PERMUTATION_PARTS_COUNT)
+        IF(NOT PERMUTATION_PARTS_COUNT EQUAL 3)
+            MESSAGE(FATAL_ERROR "Shader permutation \"${PERMUTATION}\" of ${EXAMPLE_NAME} is not <shader>:<variant>:<defines>")
+        ENDIF()
+        list(GET PERMUTATION_PARTS 0 SHADER_FILENAME)
+        list(GET PERMUTATION_PARTS 1 VARIANT)
+        list(GET PERMUTATION_PARTS 2 DEFINES)
+        string(REPLACE "," ";" DEFINES ${DEFINES})
+
+        set(SHADER ${CMAKE_SHADERS_INPUT_DIRECTORY}/${EXAMPLE_NAME}/${SHADER_FILENAME})
+        IF(NOT EXISTS ${SHADER})
+            MESSAGE(FATAL_ERROR "Shader permutation \"${PERMUTATION}\" of ${EXAMPLE_NAME} - no such shader")
+        ENDIF()
+        # default_material.frag + unlit -> default_material.unlit.frag.spv
+        get_filename_component(SHADER_NAME ${SHADER_FILENAME} NAME_WE)
+        get_filename_component(SHADER_EXT  ${SHADER_FILENAME} EXT)
+        set(VARIANT_FILENAME ${SHADER_NAME}.${VARIANT}${SHADER_EXT}.spv)
+        set(OUTPUT ${CMAKE_SHADERS_INPUT_DIRECTORY}/${EXAMPLE_NAME}/${VARIANT_FILENAME})
+
+        compileShader(${SHADER} ${OUTPUT} ${NAIVE_DIR}/${VARIANT_FILENAME} "${DEFINES}")
+        list(APPEND OUTPUTS ${OUTPUT})
+        list(APPEND REPORT_FILES "${NAIVE_DIR}/${VARIANT_FILENAME}|${OUTPUT}")
+    endforeach()
+
+    add_custom_target(${EXAMPLE_NAME}-shaders DEPENDS ${OUTPUTS})
+    set_property(GLOBAL APPEND PROPERTY SHADER_TARGETS ${EXAMPLE_NAME}-shaders)
+    set_property(GLOBAL APPEND PROPERTY SHADER_REPORT_FILES ${REPORT_FILES})
+    set(${OUT_TARGET} ${EXAMPLE_NAME}-shaders PARENT_SCOPE)
+endfunction(compileShaders)
+
+# Adds target shaders-size-report - size (and instruction count, with spirv-dis) of every shader, naive vs optimized.
+function(addShaderSizeReport)
+    get_property(SHADER_TARGETS GLOBAL PROPERTY SHADER_TARGETS)
+    get_property(REPORT_FILES GLOBAL PROPERTY SHADER_REPORT_FILES)
+    IF(NOT SHADER_TARGETS)
+        return()
+    ENDIF()
+    string(REPLACE ";" "," REPORT_FILES "${REPORT_FILES}")
+    add_custom_target(shaders-size-report
+        COMMAND ${CMAKE_COMMAND} -DFILES=${REPORT_FILES} -DSPIRV_DIS=${SPIRV_DIS_EXECUTABLE} -P ${CMAKE_SOURCE_DIR}/cmake/ShaderSizeReport.cmake
+        VERBATIM)
+    add_dependencies(shaders-size-report ${SHADER_TARGETS})
+endfunction(addShaderSizeReport)
@@ -0,0 +1,60 @@
+# Run by target shaders-size-report (cmake -DFILES=<naive>|<optimized>,... -DSPIRV_DIS=<path> -P ShaderSizeReport.cmake).
+# Prints size and, when spirv-dis is available, instruction count of naive and optimized SPIR-V of every shader.
+# Static counts only - nothing is run, GPU time of the shaders is not measured.
+
+function(countInstructions FILE OUT_COUNT)
+    IF(NOT SPIRV_DIS)
+        set(${OUT_COUNT} "-" PARENT_SCOPE)
+        return()
+    ENDIF()
+    execute_process(COMMAND ${SPIRV_DIS} --no-header --raw-id ${FILE} OUTPUT_VARIABLE DISASSEMBLY RESULT_VARIABLE RESULT)
+    IF(NOT RESULT EQUAL 0)
+        set(${OUT_COUNT} "?" PARENT_SCOPE)
+        return()
+    ENDIF()
+    string(REGEX MATCHALL "\n" LINES "${DISASSEMBLY}")
+    list(LENGTH LINES COUNT)
+    set(${OUT_COUNT} ${COUNT} PARENT_SCOPE)
+endfunction()
+
+function(padLeft TEXT WIDTH OUT_TEXT)
+    string(LENGTH "${TEXT}" LENGTH)
+    while(LENGTH LESS WIDTH)
+        set(TEXT " ${TEXT}")
+        math(EXPR LENGTH "${LENGTH} + 1")
+    endwhile()
+    set(${OUT_TEXT} "${TEXT}" PARENT_SCOPE)
+endfunction()
+
+string(REPLACE "," ";" FILES "${FILES}")
+set(NAIVE_TOTAL 0)
+set(OPTIMIZED_TOTAL 0)
+message("                                   naive bytes  optimized bytes  naive instr.  optimized instr.")
+foreach(PAIR ${FILES})
+    string(REPLACE "|" ";" PAIR ${PAIR})
+    list(GET PAIR 0 NAIVE)
+    list(GET PAIR 1 OPTIMIZED)
+    IF(NOT EXISTS ${NAIVE} OR NOT EXISTS ${OPTIMIZED})
+        continue()
+    ENDIF()
+
+    file(SIZE ${NAIVE} NAIVE_SIZE)
+    file(SIZE ${OPTIMIZED} OPTIMIZED_SIZE)
+    math(EXPR NAIVE_TOTAL "${NAIVE_TOTAL} + ${NAIVE_SIZE}")
+    math(EXPR OPTIMIZED_TOTAL "${OPTIMIZED_TOTAL} + ${OPTIMIZED_SIZE}")
+    countInstructions(${NAIVE} NAIVE_COUNT)
+    countInstructions(${OPTIMIZED} OPTIMIZED_COUNT)
+
+    get_filename_component(NAME ${OPTIMIZED} NAME)
+    get_filename_component(EXAMPLE ${OPTIMIZED} DIRECTORY)
+    get_filename_component(EXAMPLE ${EXAMPLE} NAME)
+    padLeft("${EXAMPLE}/${NAME}" 34 NAME)
+    padLeft(${NAIVE_SIZE} 13 NAIVE_SIZE)
+    padLeft(${OPTIMIZED_SIZE} 17 OPTIMIZED_SIZE)
+    padLeft(${NAIVE_COUNT} 14 NAIVE_COUNT)
+    padLeft(${OPTIMIZED_COUNT} 18 OPTIMIZED_COUNT)
+    message("${NAME}${NAIVE_SIZE}${OPTIMIZED_SIZE}${NAIVE_COUNT}${OPTIMIZED_COUNT}")
+endforeach()
+padLeft(${NAIVE_TOTAL} 13 NAIVE_TOTAL)
+padLeft(${OPTIMIZED_TOTAL} 17 OPTIMIZED_TOTAL)
+message("                             total${NAIVE_TOTAL}${OPTIMIZED_TOTAL}")
@@ -0,0 +1,30 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Triangle covering the screen, drawn with 3 vertices and no vertex input - visibility buffer shading runs
+// the fragment shader once per pixel of the batch, upscaling of dynamic resolution and temporal resolve once per pixel.
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+#if defined(BATCH_DEPTH)
+// Visibility buffer shading (fullscreen.batch.vert) - the triangle is at the depth visibility_classify.frag wrote
+// for pixels of the pushed batch, tested for EQUAL.
+layout (push_constant) uniform PushConsts
+{
+    uint entityIndex; // First entity of the shaded batch.
+} pushConsts;
+#endif
+
+void main() 
+{
+    const vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+#if defined(BATCH_DEPTH)
+    gl_Position = vec4(uv * 2.0f - 1.0f, float(pushConsts.entityIndex + 1u) / 65535.0f, 1.0f);
+#else
+    gl_Position = vec4(uv * 2.0f - 1.0f, 0.0f, 1.0f);
+#endif
+}
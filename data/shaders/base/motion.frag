@@ -0,0 +1,22 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Motion vectors of temporal upscaling (vk229::TemporalUpscaler), drawn with motion permutations of vertex shaders over the
+// scene's depth - where the surface of the pixel was in the previous frame, as current uv minus previous uv.
+layout (location = 1) in vec4 inClip;         // Without jitter.
+layout (location = 2) in vec4 inPreviousClip; // Without jitter, of the previous frame.
+
+layout (location = 0) out vec2 outMotion;
+
+void main()
+{
+    // Behind the camera in the previous frame - off screen, its history is not used
+    vec2 motion = vec2(2.0f);
+    if (inPreviousClip.w > 0.0f)
+    {
+        motion = clamp((inClip.xy / inClip.w - inPreviousClip.xy / inPreviousClip.w) * 0.5f, -2.0f, 2.0f);
+    }
+    outMotion = motion;
+}
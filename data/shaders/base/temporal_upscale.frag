@@ -0,0 +1,130 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Temporal upscaling and anti-aliasing (vk229::TemporalUpscaler), drawn with fullscreen.vert at the output resolution - writes
+// the new history and the swapchain image. The scene is rendered at a lower resolution, its samples jittered within the
+// rendered pixel, differently every frame:
+// * current samples are the 3x3 rendered pixels around the output pixel, weighted by their distance to its centre (Gaussian
+//   fit of Blackman-Harris, in output pixels) - with upscaling, most output pixels have no sample close to them,
+// * history is fetched where the surface was in the previous frame - motion vectors, or the camera for pixels without a
+//   surface - by Catmull-Rom from 5 bilinear taps, bilinear alone would blur it more every frame,
+// * it is clamped to mean +- standard deviation of the 3x3 samples in YCoCg, so disoccluded or changed pixels don't ghost,
+// * then blended with the current samples by the weight of the nearest of them - where no sample landed, history stays.
+// Samples are weighted by 1 / (1 + luma) as well, so a single bright one doesn't flicker.
+layout (binding = 0) uniform sampler2D frame;   // Rendered part is in its top left corner.
+layout (binding = 1) uniform sampler2D motion;  // Current uv minus previous uv, NO_MOTION without a surface - as the frame.
+layout (binding = 2) uniform sampler2D history; // Output size.
+
+layout (binding = 3) uniform Params
+{
+    mat4 reprojection; // Current clip space to previous one, without jitter.
+    vec4 jitter;       // xy - offset of this frame's samples, in rendered pixels.
+    vec4 renderSize;   // Pixels, then their reciprocal.
+    vec4 outputSize;   // Pixels, then their reciprocal.
+    vec4 blend;        // x - weight of a current sample at the pixel centre, y - 1 if history is valid.
+} params;
+
+layout (location = 0) out vec4 outHistory;
+layout (location = 1) out vec4 outFragColor;
+
+const float NO_MOTION_MIN      = 1000.0f; // Cleared motion vectors are NO_MOTION (1e4), real ones within [-2, 2].
+const float CLAMP_SIGMAS       = 1.25f;
+const float MIN_CURRENT_WEIGHT = 0.02f;   // Of current samples, however far they are - history can't stay forever.
+
+vec3 toYCoCg(vec3 rgb)
+{
+    return vec3(dot(rgb, vec3(0.25f, 0.5f, 0.25f)), dot(rgb, vec3(0.5f, 0.0f, -0.5f)), dot(rgb, vec3(-0.25f, 0.5f, -0.25f)));
+}
+
+vec3 toRgb(vec3 yCoCg)
+{
+    return vec3(yCoCg.x + yCoCg.y - yCoCg.z, yCoCg.x + yCoCg.z, yCoCg.x - yCoCg.y - yCoCg.z);
+}
+
+// Catmull-Rom of 4x4 texels, from 5 bilinear taps - the corners weigh little and are left out.
+vec3 sampleHistory(vec2 uv)
+{
+    const vec2 position = uv * params.outputSize.xy;
+    const vec2 center   = floor(position - 0.5f) + 0.5f;
+    const vec2 f        = position - center;
+
+    const vec2 w0  = f * (-0.5f + f * (1.0f - 0.5f * f));
+    const vec2 w1  = 1.0f + f * f * (-2.5f + 1.5f * f);
+    const vec2 w2  = f * (0.5f + f * (2.0f - 1.5f * f));
+    const vec2 w3  = f * f * (-0.5f + 0.5f * f);
+    const vec2 w12 = w1 + w2;
+
+    const vec2 texel = params.outputSize.zw;
+    const vec2 uv0   = (center - 1.0f) * texel;
+    const vec2 uv3   = (center + 2.0f) * texel;
+    const vec2 uv12  = (center + w2 / w12) * texel;
+
+    vec3 result = texture(history, vec2(uv12.x, uv0.y)).rgb * (w12.x * w0.y)
+                + texture(history, vec2(uv0.x, uv12.y)).rgb * (w0.x * w12.y)
+                + texture(history, uv12).rgb                * (w12.x * w12.y)
+                + texture(history, vec2(uv3.x, uv12.y)).rgb * (w3.x * w12.y)
+                + texture(history, vec2(uv12.x, uv3.y)).rgb * (w12.x * w3.y);
+    const float weight = w12.x * w0.y + w0.x * w12.y + w12.x * w12.y + w3.x * w12.y + w12.x * w3.y;
+    return max(result / weight, 0.0f); // Catmull-Rom overshoots.
+}
+
+void main()
+{
+    const vec2 uv    = gl_FragCoord.xy * params.outputSize.zw;
+    const vec2 scale = params.outputSize.xy * params.renderSize.zw; // Output pixels per rendered one.
+
+    // Centre of the output pixel in the rendered frame - its samples are moved by the jitter
+    const vec2  renderPosition = uv * params.renderSize.xy + params.jitter.xy;
+    const ivec2 nearest        = ivec2(floor(renderPosition));
+    const ivec2 maxPixel       = ivec2(params.renderSize.xy) - 1;
+
+    vec3  sum           = vec3(0.0f);
+    float sumWeight     = 0.0f;
+    float nearestWeight = 0.0f;
+    vec3  moment1       = vec3(0.0f);
+    vec3  moment2       = vec3(0.0f);
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            const ivec2 pixel  = clamp(nearest + ivec2(x, y), ivec2(0), maxPixel);
+            const vec3  color  = toYCoCg(texelFetch(frame, pixel, 0).rgb);
+            const vec2  d      = (vec2(pixel) + 0.5f - renderPosition) * scale;
+            const float weight = exp(-2.29f * dot(d, d));
+
+            sum           += color * (weight / (1.0f + color.x));
+            sumWeight     += weight / (1.0f + color.x);
+            nearestWeight  = max(nearestWeight, weight);
+            moment1       += color;
+            moment2       += color * color;
+        }
+    }
+    const vec3 current = sum / max(sumWeight, 1e-6f);
+
+    // Where the pixel was in the previous frame
+    const vec2 pixelMotion = texelFetch(motion, clamp(nearest, ivec2(0), maxPixel), 0).xy;
+    vec2 previousUv = uv - pixelMotion;
+    if (pixelMotion.x >= NO_MOTION_MIN) // Background - as far as it gets.
+    {
+        const vec4 previousClip = params.reprojection * vec4(uv * 2.0f - 1.0f, 1.0f, 1.0f);
+        previousUv = previousClip.xy / previousClip.w * 0.5f + 0.5f;
+    }
+    const bool isHistory = params.blend.y > 0.0f && all(greaterThanEqual(previousUv, vec2(0.0f))) && all(lessThanEqual(previousUv, vec2(1.0f)));
+
+    vec3 result = current;
+    if (isHistory)
+    {
+        const vec3 mean  = moment1 / 9.0f;
+        const vec3 sigma = sqrt(max(moment2 / 9.0f - mean * mean, 0.0f));
+        const vec3 previous = clamp(toYCoCg(sampleHistory(previousUv)), mean - CLAMP_SIGMAS * sigma, mean + CLAMP_SIGMAS * sigma);
+
+        const float currentWeight = max(params.blend.x * nearestWeight, MIN_CURRENT_WEIGHT);
+        result = mix(previous, current, currentWeight);
+    }
+
+    const vec3 rgb = toRgb(result);
+    outHistory   = vec4(rgb, 1.0f);
+    outFragColor = vec4(rgb, 1.0f);
+}
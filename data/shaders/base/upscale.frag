@@ -0,0 +1,45 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Upscaling of the frame rendered at dynamic resolution (vk229::DynamicResolution) into the swapchain image, drawn with fullscreen.vert.
+// Bilinear, then sharpened as contrast adaptive sharpening (AMD FidelityFX CAS) does: the cross of neighbours, one rendered texel
+// away, is subtracted with a weight which falls where the local contrast is already high - edges don't ring, flat areas don't get noisy.
+layout (binding = 0) uniform sampler2D frame; // Rendered part is [0, uvMax).
+
+layout (push_constant) uniform PushConsts
+{
+    vec2  uvMax;
+    vec2  texelSize;  // Of the frame, in uv.
+    vec2  outputSize; // Pixels.
+    float sharpness;  // 0 .. 1.
+} pushConsts;
+
+layout (location = 0) out vec4 outFragColor;
+
+// Never outside the rendered part - the rest of the frame is stale.
+vec3 fetch(vec2 uv)
+{
+    return texture(frame, clamp(uv, 0.5f * pushConsts.texelSize, pushConsts.uvMax - 0.5f * pushConsts.texelSize)).rgb;
+}
+
+void main()
+{
+    const vec2 uv = gl_FragCoord.xy / pushConsts.outputSize * pushConsts.uvMax;
+    const vec2 t  = pushConsts.texelSize;
+
+    const vec3 c = fetch(uv);
+    const vec3 n = fetch(uv + vec2(0.0f, -t.y));
+    const vec3 s = fetch(uv + vec2(0.0f,  t.y));
+    const vec3 w = fetch(uv + vec2(-t.x, 0.0f));
+    const vec3 e = fetch(uv + vec2( t.x, 0.0f));
+
+    // Headroom to black and white, relative to the brightest neighbour - small across edges
+    const vec3 minRgb = min(c, min(min(n, s), min(w, e)));
+    const vec3 maxRgb = max(c, max(max(n, s), max(w, e)));
+    const vec3 amp    = sqrt(clamp(min(minRgb, 1.0f - maxRgb) / max(maxRgb, vec3(1e-4f)), 0.0f, 1.0f));
+
+    const vec3 weight = -amp / mix(8.0f, 5.0f, pushConsts.sharpness);
+    outFragColor = vec4((c + (n + s + w + e) * weight) / (1.0f + 4.0f * weight), 1.0f);
+}
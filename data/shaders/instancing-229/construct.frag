@@ -5,8 +5,10 @@
 
 #define SOFTEN_AO     25.0f
 #define AMBIENT_COEFF 0.001f
-#define PLANET_RADIUS 2.5f
-#define LIGHT_RADIUS 0.4f
+
+// Set at pipeline creation, the same as the planet shadow of rocks uses.
+layout (constant_id = 0) const float PLANET_RADIUS = 2.5f;
+layout (constant_id = 1) const float LIGHT_RADIUS  = 0.4f;
 
 layout (binding = 1) uniform sampler2D samplerColorMap;
 
@@ -6,10 +6,12 @@
 #define SOFTEN_AO     25.0f
 #define AMBIENT_COEFF 0.0001f
 
-#define LIGHT_RADIUS 0.4f
-#define PLANET_RADIUS 2.5f
-
 layout (binding = 1) uniform sampler2DArray samplerArray;
+layout (binding = 2) uniform samplerCubeShadow shadowCube; // Rocks seen from the light.
+
+// Planes of the shadow map projection, set by instancing-229.cpp - far one is derived from the light orbit and rings.
+layout (constant_id = 0) const float SHADOW_NEAR = 0.1f;
+layout (constant_id = 1) const float SHADOW_FAR  = 128.0f;
 
 layout (location = 0) in vec3  inNormal;
 layout (location = 1) in vec3  inColor;
@@ -18,68 +20,18 @@ layout (location = 3) in vec3  inViewVec;
 layout (location = 4) in vec3  inLightVec;
 layout (location = 5) in float inLightInt;
 layout (location = 6) in vec3  intWorldPos;
+layout (location = 7) in float inShadow;    // Planet shadow, computed once per rock (nbody.comp or vk229::SphereShadow).
 
 layout (location = 0) out vec4 outFragColor;
 
-float fuzzAnd(float f0, float f1)
-{
-    return min(f0, f1);
-}
-
-float fuzzOr(float f0, float f1)
-{
-    return max(f0, f1);
-}
-
-float fuzzNot(float f)
-{
-    return 1.0f - f;
-}
-
-float isFragShadedByObstacle(vec3 obstaclePos, vec3 fragPos, vec3 lightVec)
+// Light factor of rock shadows, lightVec - from the fragment to the light.
+// Depth in the cube face is the one of its perspective projection, with distance along the face's axis.
+float rockShadow(vec3 lightVec)
 {
-    vec3  lightPos = fragPos.xyz + lightVec;
-
-    vec3  vecLiPl = obstaclePos - lightPos;  // vec from light to planet
-    float lenLiPl = length(vecLiPl);
-
-    vec3  vecLiRo = -lightVec;  // vec from light to rock
-    float lenLiRo = length(vecLiRo);
-
-    float k = LIGHT_RADIUS/(LIGHT_RADIUS + PLANET_RADIUS);
-    vec3  lightPosNearF = lightPos + k*normalize(vec3(0.0f) - lightPos)*lenLiPl;
-    vec3  lightPosFarF  = lightPos - k*normalize(vec3(0.0f) - lightPos)*lenLiPl;
-
-    // Light pos near.
-    vec3  vecLiPlNear = obstaclePos - lightPosNearF;  // vec from light to planet
-    float lenLiPlNear = length(vecLiPlNear);
-
-    vec3  vecLiRoNear = fragPos-lightPosNearF;  // vec from light to rock
-    float lenLiRoNear = length(vecLiRoNear);
-
-    float cosFiRoPlNear = dot(vecLiPlNear, vecLiRoNear) / (lenLiPlNear * lenLiRoNear);
-    float fiRoPlNear = acos(cosFiRoPlNear);             // rock-planet angular distance from light point of view
-    float fiPlRadNear = asin(PLANET_RADIUS/lenLiPlNear); // angular size of planet from light point of view
-
-
-    // Light pos near.
-    vec3  vecLiPlFar = obstaclePos - lightPosFarF;  // vec from light to planet
-    float lenLiPlFar = length(vecLiPlFar);
-
-    vec3  vecLiRoFar = fragPos-lightPosFarF;  // vec from light to rock
-    float lenLiRoFar = length(vecLiRoFar);
-
-    float cosFiRoPlFar = dot(vecLiPlFar, vecLiRoFar) / (lenLiPlFar * lenLiRoFar);
-    float fiRoPlFar = acos(cosFiRoPlFar);             // rock-planet angular distance from light point of view
-    float fiPlRadFar = asin(PLANET_RADIUS/lenLiPlFar); // angular size of planet from light point of view
-
-    // Light pos center of light.
-    float cosFiRoPl = dot(vecLiPl, vecLiRo) / (lenLiPl * lenLiRo);
-    float fiRoPl = acos(cosFiRoPl);             // rock-planet angular distance from light point of view
-    float fiPlRad = asin(PLANET_RADIUS/lenLiPl); // angular size of planet from light point of view
-
-//    return ((fiRoPl < fiPlRad) && (lenLiRo > lenLiPl)) ? 1.0f : 0.0f;
-    return min(max((fiPlRadNear - fiRoPl)/(fiPlRadNear - fiPlRadFar), 0.0f), 1.0f) * float(lenLiRo > lenLiPl);
+	vec3  dir   = -lightVec;
+	float dist  = max(max(abs(dir.x), abs(dir.y)), abs(dir.z));
+	float depth = SHADOW_FAR / (SHADOW_FAR - SHADOW_NEAR) - SHADOW_FAR * SHADOW_NEAR / ((SHADOW_FAR - SHADOW_NEAR) * dist);
+	return texture(shadowCube, vec4(dir, depth));
 }
 
 void main() 
@@ -93,7 +45,7 @@ void main()
     vec3 ambient = inLightInt * AMBIENT_COEFF * vec3(1.0f) / (length(inLightVec) + SOFTEN_AO);
 	vec3 diffuse = max(dot(N, L), 0.0) * inColor;
 	vec3 specular = (dot(N,L) > 0.0) ? pow(max(dot(R, V), 0.0), 16.0) * vec3(1.0) * color.r : vec3(0.0);
-    float shadow = fuzzNot( isFragShadedByObstacle(vec3(0.0f), intWorldPos, inLightVec) );
+    float shadow = min(inShadow, rockShadow(inLightVec));
 	
 	outFragColor = vec4(ambient * color.rgb + diffuse * color.rgb * shadow + specular * shadow, 1.0);
 	outFragColor *= inLightInt;
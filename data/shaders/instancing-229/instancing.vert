@@ -3,6 +3,71 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+// Motion vectors of temporal AA are drawn over the scene's depth with depth test EQUAL - gl_Position must be computed exactly
+// as in the other permutations, it is invariant and its expression below is shared.
+invariant gl_Position;
+
+#if defined(MOTION_VECTORS) && !defined(VERTEX_PULLING)
+#error Motion vectors read instances of the previous frame from storage buffers - they need vertex pulling.
+#endif
+
+#if defined(VERTEX_PULLING)
+// Vertex pulling (instancing.pulling.vert) - no vertex input, the rock vertex (gl_VertexIndex, fetched from the index buffer)
+// and its instance (gl_InstanceIndex) are read from storage buffers of set 1.
+// Vertices have vertexLayout of the example: position, normal, UV, color.
+layout (constant_id = 0) const uint VERTEX_STRIDE = 11; // Floats per vertex.
+
+// InstanceData, std430
+struct Instance
+{
+    vec3 pos;
+    float scale;
+    vec3 rot;
+    int texIndex;
+    vec3 reserved; // x - index of the rock, kept in compacted instances.
+    float shadow;
+};
+
+// Instance buffer in use - simulated, CPU slice (dynamic offset) or instances compacted by culling
+layout (std430, set = 1, binding = 0) readonly buffer Instances
+{
+    Instance data[];
+} instances;
+
+layout (std430, set = 1, binding = 1) readonly buffer Vertices
+{
+    float data[];
+} vertices;
+
+vec3 inPos;
+vec3 inNormal;
+vec2 inUV;
+vec3 inColor;
+
+vec3 instancePos;
+vec3 instanceRot;
+float instanceScale;
+int instanceTexIndex;
+float instanceShadow;
+uint rockIndex;
+
+void pullVertex()
+{
+    const uint v = uint(gl_VertexIndex) * VERTEX_STRIDE;
+    inPos    = vec3(vertices.data[v + 0], vertices.data[v + 1], vertices.data[v + 2]);
+    inNormal = vec3(vertices.data[v + 3], vertices.data[v + 4], vertices.data[v + 5]);
+    inUV     = vec2(vertices.data[v + 6], vertices.data[v + 7]);
+    inColor  = vec3(vertices.data[v + 8], vertices.data[v + 9], vertices.data[v + 10]);
+
+    const Instance instance = instances.data[gl_InstanceIndex];
+    instancePos      = instance.pos;
+    instanceRot      = instance.rot;
+    instanceScale    = instance.scale;
+    instanceTexIndex = instance.texIndex;
+    instanceShadow   = instance.shadow;
+    rockIndex        = uint(instance.reserved.x);
+}
+#else
 // Vertex attributes
 layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec3 inNormal;
@@ -14,6 +79,8 @@ layout (location = 4) in vec3 instancePos;
 layout (location = 5) in vec3 instanceRot;
 layout (location = 6) in float instanceScale;
 layout (location = 7) in int instanceTexIndex;
+layout (location = 8) in float instanceShadow;
+#endif
 
 layout (binding = 0) uniform UBO 
 {
@@ -26,6 +93,26 @@ layout (binding = 0) uniform UBO
     float globSpeed;
 } ubo;
 
+#if defined(MOTION_VECTORS)
+// Motion vectors (instancing.motion.vert) - the rock is placed as it was in the previous frame too, from its instance data of
+// then and the spin of then. Both projections are without the jitter of temporal AA, motion.frag writes their difference -
+// gl_Position stays jittered, as in the scene's passes.
+layout (std430, set = 1, binding = 2) readonly buffer PreviousInstances
+{
+    Instance data[]; // By rock index.
+} previousInstances;
+
+layout (set = 1, binding = 3) uniform MotionUBO
+{
+    mat4  viewProjection;
+    mat4  previousViewProjection;
+    float previousLocSpeed;
+    float previousGlobSpeed;
+} motion;
+
+layout (location = 1) out vec4 outClip;
+layout (location = 2) out vec4 outPreviousClip;
+#else
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec3 outUV;
@@ -33,14 +120,16 @@ layout (location = 3) out vec3 outViewVec;
 layout (location = 4) out vec3 outLightVec;
 layout (location = 5) out float outLightInt;
 layout (location = 6) out vec3 outWorldPos;
+layout (location = 7) out float outShadow;
+#endif
 
-mat4 getLocalRotMat(float loc_speed) 
+mat4 getLocalRotMat(vec3 rot, float loc_speed) 
 {
     mat4 mx, my, mz;
 	
 	// rotate around x
-	float s = sin(instanceRot.x + loc_speed);
-	float c = cos(instanceRot.x + loc_speed);
+	float s = sin(rot.x + loc_speed);
+	float c = cos(rot.x + loc_speed);
 
 	mx[0] = vec4( c,   s,  0.0, 0.0);
 	mx[1] = vec4(-s,   c,  0.0, 0.0);
@@ -48,8 +137,8 @@ mat4 getLocalRotMat(float loc_speed)
 	mx[3] = vec4(0.0, 0.0, 0.0, 1.0);
 	
 	// rotate around y
-	s = sin(instanceRot.y + loc_speed);
-	c = cos(instanceRot.y + loc_speed);
+	s = sin(rot.y + loc_speed);
+	c = cos(rot.y + loc_speed);
 
 	my[0] = vec4( c,  0.0,  s,  0.0);
 	my[1] = vec4(0.0, 1.0, 0.0, 0.0);
@@ -57,8 +146,8 @@ mat4 getLocalRotMat(float loc_speed)
 	my[3] = vec4(0.0, 0.0, 0.0, 1.0);
 	
 	// rot around z
-	s = sin(instanceRot.z + loc_speed);
-	c = cos(instanceRot.z + loc_speed);	
+	s = sin(rot.z + loc_speed);
+	c = cos(rot.z + loc_speed);	
 	
 	mz[0] = vec4(1.0, 0.0, 0.0, 0.0);
 	mz[1] = vec4(0.0,  c,   s,  0.0);
@@ -68,12 +157,14 @@ mat4 getLocalRotMat(float loc_speed)
 	return mz * my * mx;
 }
 
+// Rigid rotation of all rings, used only when rocks are not simulated (globSpeed stays 0 otherwise).
+// instancePos is already in world space.
 mat4 getGlobalRotMat(float glob_speed) 
 {
     mat4 globRotMat;
     
-	float s = sin(instanceRot.y + glob_speed);
-	float c = cos(instanceRot.y + glob_speed);
+	float s = sin(glob_speed);
+	float c = cos(glob_speed);
 	
 	globRotMat[0] = vec4( c,  0.0,  s,  0.0);
 	globRotMat[1] = vec4(0.0, 1.0, 0.0, 0.0);
@@ -85,15 +176,30 @@ mat4 getGlobalRotMat(float glob_speed)
 
 void main() 
 {
-	outColor = inColor;
-	outUV = vec3(inUV, instanceTexIndex);
-	
-	mat4 locRotMat  = getLocalRotMat(ubo.locSpeed);
+#if defined(VERTEX_PULLING)
+	pullVertex();
+#endif
+
+	mat4 locRotMat  = getLocalRotMat(instanceRot, ubo.locSpeed);
 	mat4 globRotMat = getGlobalRotMat(ubo.globSpeed);
 	mat4 allRotMat  = globRotMat * locRotMat;
 	
 	vec4 posWorld = globRotMat * (locRotMat * vec4(inPos.xyz * instanceScale, 1.0) + vec4(instancePos, 0.0f));
 	
+	gl_Position = ubo.projection * ubo.view * posWorld;
+
+#if defined(MOTION_VECTORS)
+	const Instance previous = previousInstances.data[rockIndex];
+	mat4 previousLocRotMat  = getLocalRotMat(previous.rot, motion.previousLocSpeed);
+	mat4 previousGlobRotMat = getGlobalRotMat(motion.previousGlobSpeed);
+	vec4 previousPosWorld   = previousGlobRotMat * (previousLocRotMat * vec4(inPos.xyz * previous.scale, 1.0) + vec4(previous.pos, 0.0f));
+
+	outClip         = motion.viewProjection * posWorld;
+	outPreviousClip = motion.previousViewProjection * previousPosWorld;
+#else
+	outColor = inColor;
+	outUV = vec3(inUV, instanceTexIndex);
+	
 	vec4 cameraPosWorld = (ubo.camPos);
 	vec4 lightPosWorld = (ubo.lightPos);
 
@@ -101,7 +207,8 @@ void main()
 	outViewVec  = (cameraPosWorld - posWorld).xyz;
 	outLightInt = ubo.lightInt;
 	outWorldPos = posWorld.xyz;
+	outShadow   = instanceShadow;
 	
 	outNormal = (allRotMat * vec4(inNormal.xyz, 0.0)).xyz;
-	gl_Position = ubo.projection * ubo.view * posWorld;
+#endif
 }
@@ -7,6 +7,11 @@
 #define AMBIENT_COEFF 0.001f
 
 layout (binding = 1) uniform sampler2D samplerColorMap;
+layout (binding = 2) uniform samplerCubeShadow shadowCube; // Rocks seen from the light.
+
+// Planes of the shadow map projection, set by instancing-229.cpp - far one is derived from the light orbit and rings.
+layout (constant_id = 0) const float SHADOW_NEAR = 0.1f;
+layout (constant_id = 1) const float SHADOW_FAR  = 128.0f;
 
 layout (location = 0) in vec3  inNormal;
 layout (location = 1) in vec3  inColor;
@@ -17,6 +22,16 @@ layout (location = 5) in float inLightInt;
 
 layout (location = 0) out vec4 outFragColor;
 
+// Light factor of rock shadows, lightVec - from the fragment to the light.
+// Depth in the cube face is the one of its perspective projection, with distance along the face's axis.
+float rockShadow(vec3 lightVec)
+{
+	vec3  dir   = -lightVec;
+	float dist  = max(max(abs(dir.x), abs(dir.y)), abs(dir.z));
+	float depth = SHADOW_FAR / (SHADOW_FAR - SHADOW_NEAR) - SHADOW_FAR * SHADOW_NEAR / ((SHADOW_FAR - SHADOW_NEAR) * dist);
+	return texture(shadowCube, vec4(dir, depth));
+}
+
 void main() 
 {
 	vec4 color = texture(samplerColorMap, inUV) * vec4(inColor, 1.0);
@@ -28,8 +43,9 @@ void main()
     vec3 ambient = inLightInt * AMBIENT_COEFF * vec3(1.0f) / (length(inLightVec) + SOFTEN_AO);
 	vec3 diffuse = max(dot(N, L), 0.0) * inColor;
 	vec3 specular = pow(max(dot(R, V), 0.0), 24.0) * vec3(1.0) * color.r;
+	float shadow = rockShadow(inLightVec);
 	
-	outFragColor = vec4((diffuse + ambient) * color.rgb + specular, 1.0);
+	outFragColor = vec4((diffuse * shadow + ambient) * color.rgb + specular * shadow, 1.0);
 	outFragColor *= inLightInt;
     outFragColor /= length(inLightVec);
 }
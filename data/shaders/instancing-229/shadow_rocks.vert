@@ -0,0 +1,108 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Rocks into one face of the light's cube shadow map.
+// Position-only mesh stream, instance buffer is the one used by the main pass (only position, rotation and scale are read),
+// or the face's slice of instances sorted by shadow_cull.comp.
+layout (constant_id = 0) const bool FACE_TEST = true; // Instances are not sorted into faces, drop the ones outside here.
+
+layout (location = 0) in vec3 inPos;
+
+layout (location = 1) in vec3 instancePos;
+layout (location = 2) in vec3 instanceRot;
+layout (location = 3) in float instanceScale;
+
+layout (binding = 0) uniform UBO 
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;
+    vec4 camPos;
+    float lightInt;
+    float locSpeed;
+    float globSpeed;
+    mat4 shadowFaces[6];
+} ubo;
+
+layout (push_constant) uniform PushConsts
+{
+    uint  face;         // +X, -X, +Y, -Y, +Z, -Z
+    float rockRadius;   // Bounding radius of rock with scale 1.
+} pushConsts;
+
+// Same as in instancing.vert.
+mat4 getLocalRotMat(float loc_speed) 
+{
+    mat4 mx, my, mz;
+	
+	// rotate around x
+	float s = sin(instanceRot.x + loc_speed);
+	float c = cos(instanceRot.x + loc_speed);
+
+	mx[0] = vec4( c,   s,  0.0, 0.0);
+	mx[1] = vec4(-s,   c,  0.0, 0.0);
+	mx[2] = vec4(0.0, 0.0, 1.0, 0.0);
+	mx[3] = vec4(0.0, 0.0, 0.0, 1.0);
+	
+	// rotate around y
+	s = sin(instanceRot.y + loc_speed);
+	c = cos(instanceRot.y + loc_speed);
+
+	my[0] = vec4( c,  0.0,  s,  0.0);
+	my[1] = vec4(0.0, 1.0, 0.0, 0.0);
+	my[2] = vec4(-s,  0.0,  c,  0.0);
+	my[3] = vec4(0.0, 0.0, 0.0, 1.0);
+	
+	// rot around z
+	s = sin(instanceRot.z + loc_speed);
+	c = cos(instanceRot.z + loc_speed);	
+	
+	mz[0] = vec4(1.0, 0.0, 0.0, 0.0);
+	mz[1] = vec4(0.0,  c,   s,  0.0);
+	mz[2] = vec4(0.0, -s,   c,  0.0);
+	mz[3] = vec4(0.0, 0.0, 0.0, 1.0);
+	
+	return mz * my * mx;
+}
+
+mat4 getGlobalRotMat(float glob_speed) 
+{
+    mat4 globRotMat;
+    
+	float s = sin(glob_speed);
+	float c = cos(glob_speed);
+	
+	globRotMat[0] = vec4( c,  0.0,  s,  0.0);
+	globRotMat[1] = vec4(0.0, 1.0, 0.0, 0.0);
+	globRotMat[2] = vec4(-s,  0.0,  c,  0.0);
+	globRotMat[3] = vec4(0.0, 0.0, 0.0, 1.0);
+	
+	return globRotMat;
+}
+
+void main() 
+{
+	mat4 globRotMat = getGlobalRotMat(ubo.globSpeed);
+
+	// Without sorting, every rock is drawn into all 6 faces, but it is seen by 1-3 of them.
+	// Rocks outside of this face's 90 degree frustum skip rotations, their triangles collapse into a point.
+	if (FACE_TEST)
+	{
+		vec3  toRock = (globRotMat * vec4(instancePos, 1.0)).xyz - ubo.lightPos.xyz;
+		uint  axis   = pushConsts.face / 2;
+		float along  = ((pushConsts.face & 1u) == 0u ? 1.0f : -1.0f) * toRock[axis];
+		float margin = 1.5f * instanceScale * pushConsts.rockRadius; // > sqrt(2) * radius, same test as in shadow_cull.comp
+		if (along + margin < max(abs(toRock[(axis + 1) % 3]), abs(toRock[(axis + 2) % 3])))
+		{
+			gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+			return;
+		}
+	}
+
+	mat4 locRotMat = getLocalRotMat(ubo.locSpeed);
+	vec4 posWorld  = globRotMat * (locRotMat * vec4(inPos.xyz * instanceScale, 1.0) + vec4(instancePos, 0.0f));
+
+	gl_Position = ubo.shadowFaces[pushConsts.face] * posWorld;
+}
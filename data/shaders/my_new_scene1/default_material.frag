@@ -4,7 +4,7 @@
 #extension GL_ARB_shading_language_420pack : enable
 
 // Starts from 1 because vert shader has binding 0 on uniform buffer.
-// Layout of these bindings is defined in setupDescriptorSetLayout().
+// Descriptor set layout is reflected from these bindings, by setupDescriptorSetLayout().
 // Pool for these bindings is created in setupDescriptorPool().
 // Descriptor sets are created in setupDescriptorSet().
 layout (binding = 1) uniform sampler2D samplerColor;
@@ -14,6 +14,75 @@ layout (binding = 4) uniform sampler2D samplerEmit;
 layout (binding = 5) uniform sampler2D samplerNormal;
 layout (binding = 6) uniform sampler2D samplerReflection;
 
+#if defined(VISIBILITY_BUFFER)
+// Visibility buffer shading (default_material.visibility.frag) - drawn as a full-screen triangle (fullscreen.batch.vert) once per
+// material batch, entities of one shader set and texture set. Only pixels whose entity (visibility ids) is in the batch pass
+// the early depth test against the batch depths written by visibility_classify.frag: vertices of the triangle are read as
+// vertex pulling does, and attributes interpolated by barycentrics computed from the pixel position - perspective correct,
+// with their screen space derivatives, for texture LOD.
+layout (early_fragment_tests) in;
+
+struct MeshFormat
+{
+    uint vertexBase;
+    uint positionBase;
+    uint stride;
+    uint offsets[6];
+};
+
+const uint ABSENT = 0xFFFFFFFFu;
+
+layout (binding = 0) uniform UBO 
+{
+    mat4 view;
+    mat4 projection;
+} ubo;
+
+layout (std430, binding = 7) readonly buffer Transforms
+{
+    mat4 worlds[];
+} transforms;
+
+layout (std430, binding = 8) readonly buffer Vertices
+{
+    float data[];
+} vertices;
+
+layout (std430, binding = 9) readonly buffer MeshFormats
+{
+    MeshFormat formats[];
+} meshFormats;
+
+layout (std430, binding = 11) readonly buffer Indices
+{
+    uint data[];
+} indices;
+
+layout (binding = 12) uniform usampler2D visibilityIds; // Entity index + 1 (0 is background), triangle.
+
+struct EntityVisibility
+{
+    uint meshIndex;
+    uint batch; // Index of the first entity of its batch.
+};
+
+layout (std430, binding = 13) readonly buffer Entities
+{
+    EntityVisibility entities[];
+} entities;
+
+// Inputs of the forward permutation, reconstructed by fetchSurface()
+vec3 inNormal;
+vec3 inTan;
+vec3 inBiTan;
+vec2 inUV;
+vec3 inColor;
+vec3 inViewVec;
+vec2 inUVdx; // Derivatives of inUV.
+vec2 inUVdy;
+
+#define SAMPLE_UV(map) textureGrad(map, inUV, inUVdx, inUVdy)
+#else
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inTan;
 layout (location = 2) in vec3 inBiTan;
@@ -21,30 +90,249 @@ layout (location = 3) in vec2 inUV;
 layout (location = 4) in vec3 inColor;
 layout (location = 5) in vec3 inViewVec;
 
+#define SAMPLE_UV(map) texture(map, inUV)
+#endif
+
 layout (location = 0) out vec4 outFragColor;
 
+// Clustered lights (vk229::ClusteredLights) - lights touching the pixel's cluster are listed by cluster_lights.comp.
+struct Light
+{
+    vec4 positionRange;     // World space, w - range, no light beyond it.
+    vec4 colorCosInner;     // rgb - color times intensity, w - cosine of the inner cone angle.
+    vec4 directionCosOuter; // w - cosine of the outer cone angle, -1 for point lights.
+};
+
+const uint MAX_LIGHTS_PER_CLUSTER = 63; // Lists are MAX_LIGHTS_PER_CLUSTER + 1 uints - count first.
+
+layout (std430, binding = 14) readonly buffer Lights
+{
+    Light lights[];
+} lights;
+
+layout (std430, binding = 15) readonly buffer ClusterLights
+{
+    uint data[];
+} clusterLights;
+
+layout (binding = 16) uniform ClusterParams
+{
+    mat4  view;
+    mat4  inverseProjection;
+    vec4  camPos;
+    vec4  screen; // Width, height, near, far.
+    uvec4 grid;   // Clusters along x, y, z, light count.
+} clusterParams;
+
 #define PI            3.14159265359f
-#define AO_COEFF      0.25f
-#define EMIT_COEFF    1.0f
-#define DIFF_DI_COEFF 3.0f
-#define REFL_COEFF    2.0f
 #define REFL_BIAS     0.0f
-#define UV_SCALE      0.9375f
+
+// Material variant (MaterialVariant) - set per shader set at pipeline creation.
+// Maps missing from FEATURES are neither sampled nor used - the branches are resolved when the pipeline is compiled.
+layout (constant_id = 0) const uint  FEATURES      = 0x3Fu; // Bit (1 << TexT) per map.
+layout (constant_id = 1) const float AO_COEFF      = 0.25f;
+layout (constant_id = 2) const float EMIT_COEFF    = 1.0f;
+layout (constant_id = 3) const float DIFF_DI_COEFF = 3.0f;
+layout (constant_id = 4) const float REFL_COEFF    = 2.0f;
+layout (constant_id = 5) const float UV_SCALE      = 0.9375f;
+
+const bool HAS_COLOR      = (FEATURES & 0x01u) != 0u;
+const bool HAS_DIFFUSE_DI = (FEATURES & 0x02u) != 0u;
+const bool HAS_AO         = (FEATURES & 0x04u) != 0u;
+const bool HAS_EMIT       = (FEATURES & 0x08u) != 0u;
+const bool HAS_NORMAL     = (FEATURES & 0x10u) != 0u;
+const bool HAS_REFLECTION = (FEATURES & 0x20u) != 0u;
+
+#if defined(VISIBILITY_BUFFER)
+// Perspective correct barycentrics of the pixel in the triangle of clip space vertices, and their derivatives along x and y
+// (pixel steps). Vulkan NDC y points down, as window y does - no flip.
+struct Barycentrics
+{
+    vec3 lambda;
+    vec3 ddx;
+    vec3 ddy;
+};
+
+Barycentrics getBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 pixelNdc, vec2 size)
+{
+    Barycentrics bary;
+
+    const vec3 invW = 1.0f / vec3(clip0.w, clip1.w, clip2.w);
+    const vec2 ndc0 = clip0.xy * invW.x;
+    const vec2 ndc1 = clip1.xy * invW.y;
+    const vec2 ndc2 = clip2.xy * invW.z;
+
+    // Screen space (linear in NDC) derivatives of barycentrics divided by w
+    const float invDet = 1.0f / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float ddxSum = dot(ddx, vec3(1.0f));
+    float ddySum = dot(ddy, vec3(1.0f));
+
+    const vec2  delta      = pixelNdc - ndc0;
+    const float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+    const float interpW    = 1.0f / interpInvW;
+    bary.lambda = interpW * (vec3(invW.x, 0.0f, 0.0f) + delta.x * ddx + delta.y * ddy);
+
+    // One pixel is 2 / size in NDC
+    ddx    *= 2.0f / size.x;
+    ddy    *= 2.0f / size.y;
+    ddxSum *= 2.0f / size.x;
+    ddySum *= 2.0f / size.y;
+
+    bary.ddx = (bary.lambda * interpInvW + ddx) / (interpInvW + ddxSum) - bary.lambda;
+    bary.ddy = (bary.lambda * interpInvW + ddy) / (interpInvW + ddySum) - bary.lambda;
+    return bary;
+}
+
+vec3 pullVec3(MeshFormat format, uint component, uint vertexStart)
+{
+    const uint offset = format.offsets[component];
+    if (offset == ABSENT)
+    {
+        return vec3(0.0);
+    }
+    return vec3(vertices.data[vertexStart + offset], vertices.data[vertexStart + offset + 1], vertices.data[vertexStart + offset + 2]);
+}
+
+vec2 pullVec2(MeshFormat format, uint component, uint vertexStart)
+{
+    const uint offset = format.offsets[component];
+    if (offset == ABSENT)
+    {
+        return vec2(0.0);
+    }
+    return vec2(vertices.data[vertexStart + offset], vertices.data[vertexStart + offset + 1]);
+}
+
+vec3 interpolate(Barycentrics bary, vec3 a, vec3 b, vec3 c)
+{
+    return a * bary.lambda.x + b * bary.lambda.y + c * bary.lambda.z;
+}
+
+/// Inputs of the pixel's surface - the depth test let through only pixels of entities of the shaded batch.
+void fetchSurface()
+{
+    const uvec2 ids = texelFetch(visibilityIds, ivec2(gl_FragCoord.xy), 0).xy;
+    const uint       entityIndex = ids.x - 1u;
+    const MeshFormat format      = meshFormats.formats[entities.entities[entityIndex].meshIndex];
+    const mat4       world       = transforms.worlds[entityIndex];
+
+    uint vertexStarts[3];
+    vec3 worldPos[3];
+    vec4 clipPos[3];
+    for (uint i = 0; i < 3; i++)
+    {
+        vertexStarts[i] = format.vertexBase + indices.data[ids.y * 3 + i] * format.stride;
+        worldPos[i]     = (world * vec4(pullVec3(format, 0, vertexStarts[i]), 1.0f)).xyz;
+        clipPos[i]      = ubo.projection * ubo.view * vec4(worldPos[i], 1.0f);
+    }
+
+    const vec2 size = vec2(textureSize(visibilityIds, 0));
+    const Barycentrics bary = getBarycentrics(clipPos[0], clipPos[1], clipPos[2], gl_FragCoord.xy / size * 2.0f - 1.0f, size);
+
+    // As the vertex shader outputs them
+    const vec3 camPos = -transpose(mat3(ubo.view)) * ubo.view[3].xyz; // View is rotation and translation.
+    inNormal  = mat3(world) * interpolate(bary, pullVec3(format, 1, vertexStarts[0]), pullVec3(format, 1, vertexStarts[1]), pullVec3(format, 1, vertexStarts[2]));
+    inTan     = mat3(world) * interpolate(bary, pullVec3(format, 2, vertexStarts[0]), pullVec3(format, 2, vertexStarts[1]), pullVec3(format, 2, vertexStarts[2]));
+    inBiTan   = mat3(world) * interpolate(bary, pullVec3(format, 3, vertexStarts[0]), pullVec3(format, 3, vertexStarts[1]), pullVec3(format, 3, vertexStarts[2]));
+    inColor   = interpolate(bary, pullVec3(format, 5, vertexStarts[0]), pullVec3(format, 5, vertexStarts[1]), pullVec3(format, 5, vertexStarts[2]));
+    inViewVec = camPos - interpolate(bary, worldPos[0], worldPos[1], worldPos[2]);
+
+    const mat3x2 uvs = mat3x2(pullVec2(format, 4, vertexStarts[0]), pullVec2(format, 4, vertexStarts[1]), pullVec2(format, 4, vertexStarts[2]));
+    inUV   = uvs * bary.lambda * vec2(1.0, -1.0);
+    inUVdx = uvs * bary.ddx    * vec2(1.0, -1.0);
+    inUVdy = uvs * bary.ddy    * vec2(1.0, -1.0);
+}
+#endif
+
+// Light of the lights listed in the pixel's cluster - Lambert, with inverse square falloff windowed to the range,
+// and smooth edge of spot cones.
+vec3 getClusteredLighting(vec3 N)
+{
+    if (clusterParams.grid.w == 0u)
+    {
+        return vec3(0.0f);
+    }
+
+    const vec3  worldPos  = clusterParams.camPos.xyz - inViewVec;
+    const float viewDepth = -(clusterParams.view * vec4(worldPos, 1.0f)).z;
+    const float nearPlane = clusterParams.screen.z;
+    const uvec3 grid      = clusterParams.grid.xyz;
+
+    uvec3 id;
+    id.xy = min(uvec2(gl_FragCoord.xy / clusterParams.screen.xy * vec2(grid.xy)), grid.xy - 1u);
+    id.z  = uint(clamp(log(max(viewDepth, nearPlane) / nearPlane) / log(clusterParams.screen.w / nearPlane) * float(grid.z), 0.0f, float(grid.z - 1u)));
+    const uint base  = ((id.z * grid.y + id.y) * grid.x + id.x) * (MAX_LIGHTS_PER_CLUSTER + 1u);
+    const uint count = clusterLights.data[base];
+
+    vec3 lighting = vec3(0.0f);
+    for (uint i = 0; i < count; i++)
+    {
+        const Light light = lights.lights[clusterLights.data[base + 1u + i]];
+
+        vec3        L        = light.positionRange.xyz - worldPos;
+        const float distSq   = max(dot(L, L), 1e-4f);
+        const float rangeSq  = light.positionRange.w * light.positionRange.w;
+        const float window   = clamp(1.0f - (distSq * distSq) / (rangeSq * rangeSq), 0.0f, 1.0f); // 1 - (d / range)^4
+        float       falloff  = window * window / distSq;
+        L *= inversesqrt(distSq);
+
+        const float cosOuter = light.directionCosOuter.w;
+        if (cosOuter > -1.0f)
+        {
+            falloff *= smoothstep(cosOuter, max(light.colorCosInner.w, cosOuter + 1e-4f), dot(-L, light.directionCosOuter.xyz));
+        }
+        lighting += light.colorCosInner.rgb * (max(dot(N, L), 0.0f) * falloff);
+    }
+    return lighting;
+}
 
 void main() 
 {
-    // Computing textures colors {
-        vec4 COL  = texture(samplerColor,     inUV);
-        vec4 DDI  = texture(samplerDiffuseDI, inUV); // This is light received directly or indirectly
-        vec4 AO   = texture(samplerAO,        inUV);
-        vec4 EMIT = texture(samplerEmit,      inUV);
-        vec4 NORM = vec4(texture(samplerNormal, inUV).xyz*2.0f - 1.0f, 1.0f); // Mapping from 0..1 to -1..1; in tangent space.
-        vec4 REFLECT; // COORDS TO COMPUTE, TEXTURE TO SAMPLE.
+#if defined(VISIBILITY_BUFFER)
+    fetchSurface();
+#endif
+
+#if defined(UNLIT)
+    // Variant for checking color maps and UVs - no lighting, emission or reflection.
+    outFragColor = SAMPLE_UV(samplerColor);
+    return;
+#endif
+
+    // Computing textures colors - missing maps are neutral: white, fully lit, unoccluded, not emitting, flat {
+        vec4 COL  = HAS_COLOR      ? SAMPLE_UV(samplerColor)     : vec4(1.0f);
+        vec4 DDI  = HAS_DIFFUSE_DI ? SAMPLE_UV(samplerDiffuseDI) : vec4(1.0f/max(DIFF_DI_COEFF, 1e-6f)); // This is light received directly or indirectly
+        vec4 AO   = HAS_AO         ? SAMPLE_UV(samplerAO)        : vec4(1.0f);
+        vec4 EMIT = HAS_EMIT       ? SAMPLE_UV(samplerEmit)      : vec4(0.0f);
+    // }
+
+    // Computing normal {
+        vec3 N = normalize(inNormal);
+        if (HAS_NORMAL)
+        {
+            vec3 NORM = SAMPLE_UV(samplerNormal).xyz*2.0f - 1.0f; // Mapping from 0..1 to -1..1; in tangent space.
+            N = normalize(inTan*NORM.x - inBiTan*NORM.y + inNormal*NORM.z); // Computing normal in world pos.
+        }
     // }
 
+    // Computing dynamic lights {
+        vec4 DYN = vec4(getClusteredLighting(N), 0.0f);
+    // }
+
+    // Compositing fragment color without reflection {
+        float met = 0.25f; // metalness
+        outFragColor =
+                (1.0f - met) * COL * (DDI*DIFF_DI_COEFF + AO*AO_COEFF + DYN) // COLOR * LIGHT
+                + EMIT*EMIT_COEFF;                                           // EMISSION
+    // }
+
+    if (!HAS_REFLECTION)
+    {
+        return;
+    }
+
     // Computing vectors {
-        // vec3 N = normalize(inNormal);
-        vec3 N = normalize(inTan*NORM.x - inBiTan*NORM.y + inNormal*NORM.z); // Computing normal in world pos.
         vec3 V = normalize(inViewVec);
         vec3 R = reflect(-V, N);
     // }
@@ -59,19 +347,15 @@ void main()
     // }
 
     // Computing textures colors - reflection {
-        REFLECT = texture(samplerReflection, reflUV, REFL_BIAS);
+        vec4 REFLECT = texture(samplerReflection, reflUV, REFL_BIAS);
     // }
 
     // Computing fresnel coefficient {
-        float met = 0.25f; // metalness
         float dot = max( 0.0f, dot( N, V ) );
         float fresnel = min(met*4.0f, met + ( 1.0f - met ) * pow( ( 1.0f - dot ), 5.0f ));
     // }
 
-    // Compositing final fragment color {
-        outFragColor =
-                (1.0f - met) * COL * (DDI*DIFF_DI_COEFF + AO*AO_COEFF) // COLOR * LIGHT
-                + EMIT*EMIT_COEFF                                      // EMISSION
-                + REFLECT*REFL_COEFF*fresnel;                          // REFLECTION
+    // Adding reflection {
+        outFragColor += REFLECT*REFL_COEFF*fresnel; // REFLECTION
     // }
 }
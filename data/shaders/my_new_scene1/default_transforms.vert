@@ -3,15 +3,77 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
-// Layout of these vertex attributes is defined in preparePipelines().
+// Depth pre-pass (default_transforms.depth.vert, default_transforms.depth_pulling.vert) - position only, from the tightly
+// packed position stream of the mesh, only the entity index is passed on (overdraw diagnostics, entity_id.frag). The main pass
+// tests depth for EQUAL, so gl_Position must be computed exactly as in the other permutations - it is invariant and its
+// expression below is shared.
+invariant gl_Position;
+
+#if defined(VERTEX_PULLING)
+// Vertex pulling (default_transforms.pulling.vert) - no vertex input, vertices of all meshes are in one storage buffer
+// (GlobalMeshBuffer). gl_VertexIndex is the vertex of entity's mesh, fetched from the global index buffer;
+// its components are read at offsets given by the mesh format, so one pipeline draws meshes of any layout.
+// Components are numbered as the locations below - a component the mesh doesn't store reads as zero.
+struct MeshFormat
+{
+    uint vertexBase;
+    uint positionBase; // Position stream.
+    uint stride;
+    uint offsets[6];
+};
+
+const uint ABSENT = 0xFFFFFFFFu;
+
+layout (std430, binding = 9) readonly buffer MeshFormats
+{
+    MeshFormat formats[];
+} meshFormats;
+
+#if defined(DEPTH_ONLY)
+layout (std430, binding = 10) readonly buffer Positions
+{
+    float data[];
+} positions;
+
+#if defined(VISIBILITY_IDS)
+// Visibility buffer (default_transforms.visibility.vert) - drawn with sequential indices (GlobalMeshBuffer), so gl_VertexIndex
+// is the position in the global index buffer: the vertex is read from there, and gl_VertexIndex / 3 is the triangle, passed on
+// with the entity index into the ids image (visibility.frag). gl_PrimitiveID would need the geometry shader capability.
+layout (std430, binding = 11) readonly buffer Indices
+{
+    uint data[];
+} indices;
+#endif
+
+vec3 inPos;
+#else
+layout (std430, binding = 8) readonly buffer Vertices
+{
+    float data[];
+} vertices;
+
+vec3 inPos;
+vec3 inNormal;
+vec3 inTan;
+vec3 inBiTan;
+vec2 inUV;
+vec3 inColor;
+#endif
+#elif defined(DEPTH_ONLY)
+// Position stream of the mesh - binding of its own, 12 bytes per vertex.
+layout (location = 0) in vec3 inPos;
+#else
+// Location i is component i of the scene vertex layout (SceneInfo::vertexLayout) - vertex input is reflected from these declarations.
+// Color is only passed to the fragment shader, which ignores it - meshes don't store it.
 layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec3 inTan;
 layout (location = 3) in vec3 inBiTan;
 layout (location = 4) in vec2 inUV;
 layout (location = 5) in vec3 inColor;
+#endif
 
-// Layout of these bindings is defined in setupDescriptorSetLayout().
+// Descriptor set layout is reflected from these bindings, by setupDescriptorSetLayout().
 layout (binding = 0) uniform UBO 
 {
     mat4 view;
@@ -19,24 +81,132 @@ layout (binding = 0) uniform UBO
 //    vec4 camPos;
 } ubo;
 
+// Fixed binding, after fragment shader samplers (1-6) - written at 7 by SceneData::writeDescriptorSet() however many textures
+// the entity has, samplers it doesn't use stay unwritten.
+layout (std430, binding = 7) readonly buffer Transforms
+{
+    mat4 worlds[]; // Per entity, written by TransformHierarchy.
+} transforms;
+
+#if defined(MOTION_VECTORS)
+// Motion vectors (default_transforms.motion.vert) - the vertex is projected as it was in the previous frame too, with its
+// world matrix and the view of then. Both projections are without the jitter of temporal upscaling, motion.frag writes
+// their difference - gl_Position stays jittered, as in the scene's passes, whose depth is tested for EQUAL.
+layout (std430, binding = 17) readonly buffer PreviousTransforms
+{
+    mat4 worlds[]; // Per entity, of the previous frame.
+} previousTransforms;
+
+layout (binding = 18) uniform MotionUBO
+{
+    mat4 viewProjection;
+    mat4 previousViewProjection;
+} motion;
+#endif
+
+layout (push_constant) uniform PushConsts
+{
+    uint entityIndex;
+#if defined(VERTEX_PULLING)
+    uint meshIndex; // Into mesh formats.
+#endif
+} pushConsts;
+
+#if !defined(DEPTH_ONLY)
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outTan;
 layout (location = 2) out vec3 outBiTan;
 layout (location = 3) out vec2 outUV;
 layout (location = 4) out vec3 outColor;
 layout (location = 5) out vec3 outViewVec;
+#else
+layout (location = 0) flat out uint outEntityIndex;
+#if defined(VISIBILITY_IDS)
+layout (location = 1) flat out uint outTriangle; // Of the global index buffer.
+#endif
+#if defined(MOTION_VECTORS)
+layout (location = 1) out vec4 outClip;
+layout (location = 2) out vec4 outPreviousClip;
+#endif
+#endif
+
+#if defined(VERTEX_PULLING) && defined(DEPTH_ONLY)
+void pullVertex()
+{
+    const MeshFormat format = meshFormats.formats[pushConsts.meshIndex];
+#if defined(VISIBILITY_IDS)
+    const uint vertexIndex = indices.data[gl_VertexIndex];
+#else
+    const uint vertexIndex = uint(gl_VertexIndex);
+#endif
+    const uint positionStart = format.positionBase + vertexIndex * 3;
+
+    inPos = vec3(positions.data[positionStart], positions.data[positionStart + 1], positions.data[positionStart + 2]);
+}
+#elif defined(VERTEX_PULLING)
+vec3 pullVec3(MeshFormat format, uint component, uint vertexStart)
+{
+    const uint offset = format.offsets[component];
+    if (offset == ABSENT)
+    {
+        return vec3(0.0);
+    }
+    return vec3(vertices.data[vertexStart + offset], vertices.data[vertexStart + offset + 1], vertices.data[vertexStart + offset + 2]);
+}
+
+vec2 pullVec2(MeshFormat format, uint component, uint vertexStart)
+{
+    const uint offset = format.offsets[component];
+    if (offset == ABSENT)
+    {
+        return vec2(0.0);
+    }
+    return vec2(vertices.data[vertexStart + offset], vertices.data[vertexStart + offset + 1]);
+}
 
+void pullVertex()
+{
+    const MeshFormat format = meshFormats.formats[pushConsts.meshIndex];
+    const uint vertexStart  = format.vertexBase + uint(gl_VertexIndex) * format.stride;
+
+    inPos    = pullVec3(format, 0, vertexStart);
+    inNormal = pullVec3(format, 1, vertexStart);
+    inTan    = pullVec3(format, 2, vertexStart);
+    inBiTan  = pullVec3(format, 3, vertexStart);
+    inUV     = pullVec2(format, 4, vertexStart);
+    inColor  = pullVec3(format, 5, vertexStart);
+}
+#endif
 
 void main() 
 {
+#if defined(VERTEX_PULLING)
+    pullVertex();
+#endif
+
+    mat4 world    = transforms.worlds[pushConsts.entityIndex];
+    vec4 worldPos = world * vec4(inPos, 1.0);
+
+    gl_Position = ubo.projection * ubo.view * worldPos;
+
+#if defined(DEPTH_ONLY)
+    outEntityIndex = pushConsts.entityIndex;
+#if defined(VISIBILITY_IDS)
+    outTriangle    = uint(gl_VertexIndex) / 3;
+#endif
+#if defined(MOTION_VECTORS)
+    outClip         = motion.viewProjection * worldPos;
+    outPreviousClip = motion.previousViewProjection * (previousTransforms.worlds[pushConsts.entityIndex] * vec4(inPos, 1.0));
+#endif
+#else
     vec4 camPos = inverse(ubo.view) * vec4(0.0f, 0.0f, 0.0f, 1.0f);
 
-    gl_Position = ubo.projection * ubo.view * vec4(inPos, 1.0);
-    outNormal   = inNormal;
+    // Model matrices are rotation, translation and uniform scale - no inverse transpose needed
+    outNormal   = mat3(world) * inNormal;
     outColor    = inColor;
     outUV       = inUV * vec2(1.0, -1.0);
-    outViewVec  = camPos.xyz - inPos;
-    outTan      = inTan;
-    outBiTan    = inBiTan;
-
+    outViewVec  = camPos.xyz - worldPos.xyz;
+    outTan      = mat3(world) * inTan;
+    outBiTan    = mat3(world) * inBiTan;
+#endif
 }
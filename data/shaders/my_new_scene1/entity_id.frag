@@ -0,0 +1,15 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Surface id of overdraw diagnostics - entity index + 1 (0 is background), written into the id image of OverdrawMeter
+// where the entity is finally seen. Drawn with depth permutations of vertex shaders.
+layout (location = 0) flat in uint inEntityIndex;
+
+layout (location = 0) out uint outId;
+
+void main() 
+{
+    outId = inEntityIndex + 1;
+}
@@ -0,0 +1,18 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Drawn with while the entity's own pipeline is being created (SceneData::preparePipelines()).
+// Cheap to compile and run - no textures, lit from the camera.
+layout (location = 0) in vec3 inNormal;
+layout (location = 5) in vec3 inViewVec;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main() 
+{
+    vec3 N = normalize(inNormal);
+    vec3 V = normalize(inViewVec);
+    outFragColor = vec4(vec3(0.5f) * (0.25f + 0.75f * max(0.0f, dot(N, V))), 1.0f);
+}
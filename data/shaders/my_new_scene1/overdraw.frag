@@ -0,0 +1,13 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Counts shaded fragments - blended additively into the count image of OverdrawMeter, or scaled by blend constants
+// into the heatmap of overdraw diagnostics. Drawn with depth permutations of vertex shaders.
+layout (location = 0) out vec4 outCount;
+
+void main() 
+{
+    outCount = vec4(1.0f);
+}
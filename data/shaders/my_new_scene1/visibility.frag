@@ -0,0 +1,17 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Visibility buffer ids - entity index + 1 (0 is background) and triangle of the global index buffer, where the entity
+// is nearest. Drawn with visibility permutations of vertex shaders, shaded later by VISIBILITY_BUFFER permutations
+// of fragment shaders.
+layout (location = 0) flat in uint inEntityIndex;
+layout (location = 1) flat in uint inTriangle;
+
+layout (location = 0) out uvec2 outIds;
+
+void main() 
+{
+    outIds = uvec2(inEntityIndex + 1, inTriangle);
+}
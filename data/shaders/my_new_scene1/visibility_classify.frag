@@ -0,0 +1,31 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Classification of visibility buffer pixels by material batch - drawn as a full-screen triangle (fullscreen.vert) before
+// the batches are shaded. Every pixel of an entity writes the depth of its batch (first entity of the batch + 1, in D16 steps),
+// background keeps the cleared 0. Every batch then draws its full-screen triangle at its depth (fullscreen.batch.vert)
+// with depth test EQUAL - pixels of other batches fail it before the fragment shader runs.
+layout (binding = 12) uniform usampler2D visibilityIds; // Entity index + 1 (0 is background), triangle.
+
+struct EntityVisibility
+{
+    uint meshIndex;
+    uint batch; // Index of the first entity of its batch.
+};
+
+layout (std430, binding = 13) readonly buffer Entities
+{
+    EntityVisibility entities[];
+} entities;
+
+void main() 
+{
+    const uint entityIndex = texelFetch(visibilityIds, ivec2(gl_FragCoord.xy), 0).x;
+    if (entityIndex == 0u)
+    {
+        discard;
+    }
+    gl_FragDepth = float(entities.entities[entityIndex - 1u].batch + 1u) / 65535.0f;
+}
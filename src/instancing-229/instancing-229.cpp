@@ -13,6 +13,16 @@
 #include <time.h> 
 #include <vector>
 #include <random>
+#include <utility>
+#include <NBodySimulation.hpp>
+#include <SpatialHashCollisions.hpp>
+#include <SphereShadow.hpp>
+#include <DynamicInstanceBuffer.hpp>
+#include <DepthPyramid.hpp>
+#include <ShaderModuleCache.hpp>
+#include <GlobalMeshBuffer.hpp>
+#include <DynamicResolution.hpp>
+#include <TemporalUpscaler.hpp>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -28,14 +38,57 @@
 #define VERTEX_BUFFER_BIND_ID   0
 #define INSTANCE_BUFFER_BIND_ID 1
 #define DESCRIPTOR_COUNT        4
+#define COMPUTE_DESCRIPTOR_COUNT 1
 #define ENABLE_VALIDATION       false
 #define LIGHT_INTENSITY         100
+#ifndef INSTANCE_COUNT
 #define INSTANCE_COUNT          2048
+#endif
 #define PLANET_SCALE            2.5f
 #define LIGHT_SCALE             0.025f
 #define CONSTRUCT_SCALE         16.0f
 #define INSTANCE_SCALE          0.15f
 
+#define ENABLE_NBODY            true  // Rocks orbit the planet, simulated in a compute shader (or on CPU). Otherwise they spin rigidly (globSpeed).
+#define PREFER_CPU_NBODY        false // Simulate rocks on CPU even if GPU can do it, ie. for deterministic runs. Same as "-cpusim" argument.
+#define ENABLE_ROCK_INTERACTION false // Rock-rock gravity - tiled all-pairs on GPU, Barnes-Hut on CPU. Keep INSTANCE_COUNT low on GPU when enabled.
+#define NBODY_THETA             0.7f  // Barnes-Hut opening angle.
+#define NBODY_WORKGROUP_SIZE    256
+#define GRAVITY_CONST           2.5f
+#define PLANET_MASS             100.0f
+#define LIGHT_MASS              10.0f
+#define ROCK_MASS               0.0001f
+#define GRAVITY_SOFTENING       0.1f
+#define PLANET_ATTRACTOR_ID     0
+#define LIGHT_ATTRACTOR_ID      1
+
+#define ENABLE_COLLISIONS       true  // Rocks bounce off each other, planet and light. Only when rocks are simulated.
+#define COLLISION_RESTITUTION   0.5f
+#define COLLISION_CORRECTION    0.8f  // Part of penetration removed in one step.
+
+#define SHADOW_LIGHT_RADIUS     0.4f  // Soft planet shadow on rocks and construct (specialization constants of construct.frag).
+#define SHADOW_PLANET_RADIUS    PLANET_SCALE
+
+#define ENABLE_ROCK_SHADOWS     true  // Rocks cast shadows on rocks and planet, through a cube shadow map around the light.
+#define SHADOW_MAP_SIZE         1024  // Of one cube face.
+#define SHADOW_NEAR             0.1f  // Far plane is derived from the light's orbit and the outer ring (prepareInstanceData).
+#define SHADOW_FAR_MARGIN       1.1f  // Rocks pushed out of their ring by collisions still cast.
+#define SHADOW_CASTER_MODEL     "models/rock01-verylowpoly-smooth.dae" // Same rock, fewer triangles.
+#define SHADOW_CASTER_SCALE     0.9f  // Caster stays inside the rendered rock, so rocks don't shadow themselves.
+#define SHADOW_DEPTH_BIAS_CONSTANT 1.25f
+#define SHADOW_DEPTH_BIAS_SLOPE    1.75f
+#define SHADOW_CULL_WORKGROUP_SIZE 256
+#define SHADOW_CULL_DESCRIPTOR_COUNT 1
+
+#define ENABLE_OCCLUSION_CULLING true  // Two-phase Hi-Z culling of rocks on GPU, draws are indirect. Needs compute in the graphics queue.
+#define CULL_WORKGROUP_SIZE     256
+#define CULL_DESCRIPTOR_COUNT   1
+
+#define ENABLE_VERTEX_PULLING   true  // Rocks read vertices and instance data from storage buffers (gl_VertexIndex, gl_InstanceIndex), no vertex input.
+#define PULLING_DESCRIPTOR_COUNT 2    // Early and late rocks.
+
+#define ENABLE_TEMPORAL_AA      true  // T toggles temporal anti-aliasing - jittered frames accumulate into a history, rocks get motion vectors. Needs vertex pulling.
+
 /////////////////////////////////////////////////
 /// ADDING AN OBJECT:
 /// * add object's texture to textures struct, then load it from file
@@ -79,19 +132,28 @@ public:
         vks::VERTEX_COMPONENT_COLOR,
     });
 
+    // Shadow casters need only positions
+    vks::VertexLayout shadowVertexLayout = vks::VertexLayout({
+        vks::VERTEX_COMPONENT_POSITION,
+    });
+
     struct {
         vks::Model rockModel;
         vks::Model planetModel;
         vks::Model lightModel;
         vks::Model constructModel;
+        vks::Model rockShadowModel;
     } models;
 
     // Per-instance data block
+    // Layout is std430 compatible, it is also read and written by nbody.comp.
     struct InstanceData {
         glm::vec3 pos;
-        glm::vec3 rot;
         float scale;
+        glm::vec3 rot;
         uint32_t texIndex;
+        glm::vec3 reserved;     // x - index of the rock, kept in instances compacted by culling.
+        float shadow;       // Light factor of planet shadow (1 - lit, 0 - umbra), computed once per frame.
     };
     // Contains the instanced data
     struct InstanceBuffer {
@@ -101,6 +163,27 @@ public:
         VkDescriptorBufferInfo descriptor;
     } instanceBuffer;
 
+    // Instanced data written by CPU every frame - one slice per swapchain image (draw command buffer).
+    vk229::DynamicInstanceBuffer dynamicInstanceBuffer;
+
+    // Shader modules live only while pipelines are created.
+    vk229::ShaderModuleCache shaderCache;
+
+    // Where rocks are moved:
+    // * RIGID - rings spin as a whole in the vertex shader (globSpeed), compute shader only shades them,
+    // * GPU   - N-body compute shader,
+    // * CPU   - vk229::NBodySimulation, streamed into dynamic instance buffer.
+    enum class RocksSim { RIGID, GPU, CPU } rocksSim = RocksSim::RIGID;
+
+    // Planet and light always, rocks only in CPU mode.
+    vk229::NBodySimulation nbody;
+
+    // Rock collisions in CPU mode, obstacles are planet and light.
+    vk229::SpatialHashCollisions collisions;
+
+    // Planet shadow on rocks in CPU mode, nbody.comp computes it otherwise.
+    vk229::SphereShadow planetShadow;
+
     // M V P
     // M - MODEL MAT      - model space -> world space
     // V - VIEW MAT       - world space -> camera space
@@ -116,6 +199,7 @@ public:
         float lightInt  = 0.0f;
         float locSpeed  = 0.0f;
         float globSpeed = 0.0f;
+        alignas(16) glm::mat4 shadowFaces[6]; // Light's view-projection of every cube face.
     } uboVS;
 
     struct {
@@ -138,6 +222,168 @@ public:
         VkDescriptorSet constructVkDescrSet;
     } descriptorSets;
 
+    // Rocks' N-body simulation.
+    // Positions live in the instance buffer, velocities in a separate storage buffer,
+    // both device local - the vertex stage reads what the compute shader wrote, no CPU round trip.
+    struct UBOCS {
+        glm::vec4 lightPos;
+        float deltaT           = 0.0f;
+        float G                = GRAVITY_CONST;
+        float planetMass       = PLANET_MASS;
+        float lightMass        = LIGHT_MASS;
+        float softening        = GRAVITY_SOFTENING;
+        uint32_t instanceCount = INSTANCE_COUNT;
+        // Collisions
+        float cellSize         = 1.0f;  // Twice the largest rock diameter.
+        float rockRadius       = 0.0f;  // Of rock with scale 1.
+        float restitution      = COLLISION_RESTITUTION;
+        float correction       = COLLISION_CORRECTION;
+        float planetRadius     = 0.0f;
+        float lightRadius      = 0.0f;
+        uint32_t tableSize     = 1;     // Spatial hash buckets, power of two.
+        // Planet shadow
+        float shadowLightRadius  = SHADOW_LIGHT_RADIUS;
+        float shadowPlanetRadius = SHADOW_PLANET_RADIUS;
+    };
+
+    struct {
+        VkBuffer velocityBuffer       = VK_NULL_HANDLE; // xyz - velocity, w - mass
+        VkDeviceMemory velocityMemory = VK_NULL_HANDLE;
+        VkDescriptorBufferInfo velocityDescriptor;
+        vks::Buffer uniformBuffer;
+        UBOCS ubo;
+        VkDescriptorSetLayout descriptorSetLayout;
+        VkDescriptorSet descriptorSet;
+        VkPipelineLayout pipelineLayout;
+        VkPipeline calculatePipeline;   // Gravity, updates velocities.
+        VkPipeline integratePipeline;   // Updates positions.
+        VkPipeline shadePipeline;       // Planet shadow of every rock.
+        // Collisions
+        vks::Buffer bucketCounts;       // Rocks in every spatial hash bucket.
+        vks::Buffer bucketStarts;       // Start of every bucket within its workgroup of buckets.
+        vks::Buffer blockSums;          // Rocks in every workgroup of buckets, then start of its first bucket.
+        vks::Buffer rockSlots;          // Slot of every rock within its bucket.
+        vks::Buffer sortedRocks;        // Rock indices, sorted by bucket.
+        vks::Buffer deltas;             // Response of every rock, before it is applied.
+        VkPipeline countPipeline;       // Rocks into bucket counts.
+        VkPipeline scanBucketsPipeline; // Prefix sum of counts within workgroups of buckets.
+        VkPipeline scanBlocksPipeline;  // Prefix sum of workgroup sums.
+        VkPipeline scatterPipeline;     // Rocks sorted by bucket.
+        VkPipeline resolvePipeline;     // Contacts, computes responses.
+        VkPipeline applyPipeline;       // Moves rocks, planet and light collisions.
+    } compute;
+
+    // Rock shadows - depth of rocks seen from the light, one cube face per direction.
+    // The planet is left out, its soft shadow is computed analytically (SphereShadow, construct.frag).
+    // So the map holds only moving casters, and it is re-rendered only while something moves.
+    // Exists even with ENABLE_ROCK_SHADOWS off - it is then only cleared, so everything is lit.
+    struct ShadowPushConsts {
+        uint32_t face;
+        float rockRadius;
+    };
+
+    struct {
+        VkFormat format;
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView cubeView;           // Sampled by rocks and planet.
+        VkImageView faceViews[6];       // Rendered, one by one.
+        VkFramebuffer frameBuffers[6];
+        VkSampler sampler;              // Depth comparison.
+        VkDescriptorImageInfo descriptor;
+        VkRenderPass renderPass;
+        VkPipeline pipeline;
+        float farPlane = 0.0f;
+        bool isValid = false;           // Rendered, and nothing moved since.
+    } shadowMap;
+
+    // Shadow casters sorted into cube faces (shadow_cull.comp), in the update command buffer - every face gets its own slice
+    // of compacted instances and its own indirect draw, so a rock is drawn only into the 1-3 faces which see it.
+    // Needs compute in the graphics queue, otherwise every face draws all rocks and shadow_rocks.vert drops the ones outside.
+    struct {
+        bool isEnabled = false;
+        vks::Buffer instances;          // 6 slices of INSTANCE_COUNT, read as per-instance vertex attributes.
+        vks::Buffer commands;           // VkDrawIndexedIndirectCommand per face.
+        VkDescriptorSetLayout descriptorSetLayout;
+        VkDescriptorSet descriptorSet;
+        VkPipelineLayout pipelineLayout;
+        VkPipeline pipeline;
+    } shadowCulling;
+
+    // Rocks simulation and shadow map, one per swapchain image - submitted before the draw command buffer,
+    // skipped while paused, since then they would produce the same as last time.
+    std::vector<VkCommandBuffer> updateCmdBuffers;
+
+    // Rocks occlusion culling (cull.comp), in the draw command buffer:
+    // * early cull   - rocks visible in the previous frame are compacted into early instances,
+    // * early pass   - planet, light, construct and early rocks, all drawn from indirect command 0,
+    // * depth pyramid of the early pass,
+    // * late cull    - rocks visible now, which were not drawn yet, are compacted into late instances,
+    // * late pass    - late rocks, indirect command 1.
+    // Instance counts never leave the GPU. Render passes are split even when culling is not available,
+    // the late one is then empty.
+    struct CullPushConsts {
+        uint32_t instanceCount;
+        float rockRadius;
+    };
+
+    struct {
+        bool isEnabled = false;
+        float rockRadius = 0.0f;        // Sphere around rock's origin, in any rotation, with scale 1.
+        vk229::DepthPyramid depthPyramid;
+        vks::Buffer visibility;         // Per rock, was it visible in the last frame.
+        vks::Buffer earlyInstances;     // Compacted instance data, read as per-instance vertex attributes.
+        vks::Buffer lateInstances;
+        vks::Buffer commands;           // Early and late VkDrawIndexedIndirectCommand.
+        VkDescriptorSetLayout descriptorSetLayout;
+        VkDescriptorSet descriptorSet;
+        VkPipelineLayout pipelineLayout;
+        VkPipeline earlyPipeline;
+        VkPipeline latePipeline;
+    } culling;
+
+    VkRenderPass lateRenderPass = VK_NULL_HANDLE;
+
+    // Vertex pulling of rocks (instancing.pulling.vert) - the rock mesh is in a global mesh buffer, whose index section is bound
+    // instead of vertex buffers, instance data is read from the instance buffer in use. Both through set 1:
+    // * binding 0 - instances, dynamic offset selects the CPU slice,
+    // * binding 1 - vertices.
+    // Early and late rocks read different compacted instances, so they have their own sets.
+    // Shadow casters and the other objects keep their vertex input.
+    struct {
+        bool isEnabled = ENABLE_VERTEX_PULLING;
+        vk229::GlobalMeshBuffer meshes;
+        VkDescriptorSetLayout descriptorSetLayout;
+        VkDescriptorSet earlyDescriptorSet;
+        VkDescriptorSet lateDescriptorSet;
+    } vertexPulling;
+
+    // Temporal anti-aliasing (vk229::TemporalUpscaler at scale 1) instead of multisampling:
+    // * the scene is drawn with a jittered projection into the offscreen frame of vk229::DynamicResolution - only the frame is
+    //   used, onFrameDone() is never called, so its scale stays 1 - by render passes ending in shader read layout,
+    // * rocks draw motion vectors over the depth of the late pass (instancing.motion.vert), from their instance data of this frame
+    //   and of the previous one - previousInstances, by rock index, copied from the instance buffer in use at the end of the frame,
+    // * planet and construct don't move and the light is small - their pixels are reprojected by the camera.
+    // Motion pipeline reads the previous instances and MotionUBO as bindings 2 and 3 of the vertex pulling sets.
+    struct MotionUBO {
+        glm::mat4 viewProjection;          // Without jitter.
+        glm::mat4 previousViewProjection;
+        float previousLocSpeed  = 0.0f;    // Spin of the rocks, as the previous frame was drawn.
+        float previousGlobSpeed = 0.0f;
+    };
+
+    struct {
+        bool isEnabled = false;                         // Prepared - upscaler.isEnabled toggles it.
+        vk229::DynamicResolution frame;
+        vk229::TemporalUpscaler upscaler;
+        VkRenderPass renderPass     = VK_NULL_HANDLE;   // Early and late pass into the offscreen frame.
+        VkRenderPass lateRenderPass = VK_NULL_HANDLE;
+        InstanceBuffer previousInstances;
+        MotionUBO ubo;
+        vks::Buffer uniformBuffer;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+    } temporalAA;
+
     VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
     {
         title = "Vulkan Example - Instanced mesh rendering - 229";
@@ -148,6 +394,26 @@ public:
         zoom = -48.0f;
         rotationSpeed = 0.25f;
         camera.setPerspective(60.0f, (float)width / (float)height, 0.1f, 1024.0f);
+
+        if (ENABLE_NBODY)
+        {
+            rocksSim = PREFER_CPU_NBODY ? RocksSim::CPU : RocksSim::GPU;
+            for (const char* arg : args)
+            {
+                if (std::string(arg) == "-cpusim")
+                {
+                    rocksSim = RocksSim::CPU;
+                }
+            }
+        }
+
+        nbody.G                = GRAVITY_CONST;
+        nbody.softening        = GRAVITY_SOFTENING;
+        nbody.theta            = NBODY_THETA;
+        nbody.bodyInteractions = ENABLE_ROCK_INTERACTION;
+        nbody.attractors.resize(2);
+        nbody.attractors[PLANET_ATTRACTOR_ID] = { glm::vec3(0.0f),               glm::vec3(0.0f),              PLANET_MASS, true  };
+        nbody.attractors[LIGHT_ATTRACTOR_ID]  = { glm::vec3(45.0f, 0.0f, 10.0f), glm::vec3(-1.0f, -0.3f, 1.0f), LIGHT_MASS, false };
     }
 
     ~VulkanExample()
@@ -161,14 +427,74 @@ public:
 
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
+        vkFreeCommandBuffers(device, cmdPool, updateCmdBuffers.size(), updateCmdBuffers.data());
+
+        if (ENABLE_ROCK_SHADOWS)
+        {
+            vkDestroyPipeline(device, shadowMap.pipeline, nullptr);
+        }
+        vkDestroyRenderPass(device, shadowMap.renderPass, nullptr);
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            vkDestroyFramebuffer(device, shadowMap.frameBuffers[face], nullptr);
+            vkDestroyImageView(device, shadowMap.faceViews[face], nullptr);
+        }
+        vkDestroyImageView(device, shadowMap.cubeView, nullptr);
+        vkDestroySampler(device, shadowMap.sampler, nullptr);
+        vkDestroyImage(device, shadowMap.image, nullptr);
+        vkFreeMemory(device, shadowMap.memory, nullptr);
+
+        if (shadowCulling.isEnabled)
+        {
+            vkDestroyPipeline(device, shadowCulling.pipeline, nullptr);
+            vkDestroyPipelineLayout(device, shadowCulling.pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(device, shadowCulling.descriptorSetLayout, nullptr);
+            shadowCulling.instances.destroy();
+            shadowCulling.commands.destroy();
+        }
+
         vkDestroyBuffer(device, instanceBuffer.buffer, nullptr);
 
         vkFreeMemory(device, instanceBuffer.memory, nullptr);
 
+        dynamicInstanceBuffer.destroy();
+
+        if (rocksSim != RocksSim::CPU)
+        {
+            vkDestroyPipeline(device, compute.calculatePipeline, nullptr);
+            vkDestroyPipeline(device, compute.integratePipeline, nullptr);
+            vkDestroyPipeline(device, compute.shadePipeline, nullptr);
+            vkDestroyPipelineLayout(device, compute.pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
+            compute.uniformBuffer.destroy();
+            compute.bucketCounts.destroy();
+            compute.bucketStarts.destroy();
+            compute.blockSums.destroy();
+            compute.rockSlots.destroy();
+            compute.sortedRocks.destroy();
+            compute.deltas.destroy();
+            if (ENABLE_COLLISIONS)
+            {
+                vkDestroyPipeline(device, compute.countPipeline, nullptr);
+                vkDestroyPipeline(device, compute.scanBucketsPipeline, nullptr);
+                vkDestroyPipeline(device, compute.scanBlocksPipeline, nullptr);
+                vkDestroyPipeline(device, compute.scatterPipeline, nullptr);
+                vkDestroyPipeline(device, compute.resolvePipeline, nullptr);
+                vkDestroyPipeline(device, compute.applyPipeline, nullptr);
+            }
+        }
+
+        vkDestroyBuffer(device, compute.velocityBuffer, nullptr);
+        vkFreeMemory(device, compute.velocityMemory, nullptr);
+
         models.rockModel.destroy();
         models.planetModel.destroy();
         models.lightModel.destroy();
         models.constructModel.destroy();
+        if (ENABLE_ROCK_SHADOWS)
+        {
+            models.rockShadowModel.destroy();
+        }
 
         textures.rocksTex2DArr.destroy();
         textures.planetTex2D.destroy();
@@ -176,6 +502,57 @@ public:
         textures.constructTex2D.destroy();
 
         uniformBuffers.scene.destroy();
+
+        if (culling.isEnabled)
+        {
+            vkDestroyPipeline(device, culling.earlyPipeline, nullptr);
+            vkDestroyPipeline(device, culling.latePipeline, nullptr);
+            vkDestroyPipelineLayout(device, culling.pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(device, culling.descriptorSetLayout, nullptr);
+            culling.visibility.destroy();
+            culling.earlyInstances.destroy();
+            culling.lateInstances.destroy();
+            culling.commands.destroy();
+            culling.depthPyramid.destroy();
+        }
+        vkDestroyRenderPass(device, lateRenderPass, nullptr);
+
+        if (vertexPulling.isEnabled)
+        {
+            vkDestroyDescriptorSetLayout(device, vertexPulling.descriptorSetLayout, nullptr);
+            vertexPulling.meshes.destroy();
+        }
+
+        if (temporalAA.isEnabled)
+        {
+            vkDestroyPipeline(device, temporalAA.pipeline, nullptr);
+            vkDestroyRenderPass(device, temporalAA.renderPass, nullptr);
+            vkDestroyRenderPass(device, temporalAA.lateRenderPass, nullptr);
+            vkDestroyBuffer(device, temporalAA.previousInstances.buffer, nullptr);
+            vkFreeMemory(device, temporalAA.previousInstances.memory, nullptr);
+            temporalAA.uniformBuffer.destroy();
+            temporalAA.frame.destroy();
+            temporalAA.upscaler.destroy();
+        }
+
+        shaderCache.destroy();
+    }
+
+    /// Depth buffer is sampled by the depth pyramid.
+    void setupDepthStencil() override
+    {
+        if (!ENABLE_OCCLUSION_CULLING || !vk229::DepthPyramid::isDepthFormatSupported(physicalDevice, depthFormat))
+        {
+            VulkanExampleBase::setupDepthStencil();
+            return;
+        }
+        vk229::DepthPyramid::createDepthStencil(vulkanDevice, depthFormat, width, height, depthStencil.image, depthStencil.mem, depthStencil.view);
+    }
+
+    /// Early pass (renderPass) and late pass, sharing the framebuffers.
+    void setupRenderPass() override
+    {
+        vk229::DepthPyramid::createRenderPasses(device, swapChain.colorFormat, depthFormat, renderPass, lateRenderPass);
     }
 
     void buildCommandBuffers() override
@@ -186,20 +563,57 @@ public:
         clearValues[0].color = { { 0.005f, 0.005f, 0.005f, 0.0f } };
         clearValues[1].depthStencil = { 1.0f, 0u };
 
+        // With temporal AA the scene is drawn into the offscreen frame, then resolved into the history and the swapchain image
+        const bool isTemporal = isTemporalAA();
+        if (isTemporal)
+        {
+            std::vector<VkImageView> swapchainViews;
+            for (uint32_t i = 0; i < swapChain.imageCount; i++)
+            {
+                swapchainViews.push_back(swapChain.buffers[i].view);
+            }
+            temporalAA.frame.resize(temporalAA.renderPass, depthStencil.view, swapchainViews, width, height);
+            temporalAA.upscaler.resize(queue, depthStencil.view, temporalAA.frame.view, swapchainViews, width, height);
+        }
+        else
+        {
+            temporalAA.upscaler.invalidateHistory();
+        }
+
         VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-        renderPassBeginInfo.renderPass = renderPass;
+        renderPassBeginInfo.renderPass = isTemporal ? temporalAA.renderPass : renderPass;
         renderPassBeginInfo.renderArea.extent.width = width;
         renderPassBeginInfo.renderArea.extent.height = height;
         renderPassBeginInfo.clearValueCount = 2;
         renderPassBeginInfo.pClearValues = clearValues;
 
+        // Late pass loads everything
+        VkRenderPassBeginInfo lateRenderPassBeginInfo = renderPassBeginInfo;
+        lateRenderPassBeginInfo.renderPass = isTemporal ? temporalAA.lateRenderPass : lateRenderPass;
+        lateRenderPassBeginInfo.clearValueCount = 0;
+        lateRenderPassBeginInfo.pClearValues = nullptr;
+
+        // Depth buffer is new after resize
+        if (culling.isEnabled && culling.depthPyramid.update(depthStencil.image, depthFormat, width, height))
+        {
+            VkWriteDescriptorSet writeDescriptorSet =
+                vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &culling.depthPyramid.descriptor);
+            vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
+        }
+
         for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
         {
             // Set target frame buffer
-            renderPassBeginInfo.framebuffer = frameBuffers[i];
+            renderPassBeginInfo.framebuffer = isTemporal ? temporalAA.frame.framebuffer : frameBuffers[i];
+            lateRenderPassBeginInfo.framebuffer = renderPassBeginInfo.framebuffer;
 
             VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+            if (culling.isEnabled)
+            {
+                recordCulling(drawCmdBuffers[i], i, culling.earlyPipeline);
+            }
+
             vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
             VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -210,6 +624,20 @@ public:
 
             VkDeviceSize offsets[1] = { 0 };
 
+            // Command buffer i always reads slice i of dynamic instance buffer
+            VkBuffer     rocksInstanceBuffer     = instanceBuffer.buffer;
+            VkDeviceSize rocksInstanceOffsets[1] = { 0 };
+            if (rocksSim == RocksSim::CPU)
+            {
+                rocksInstanceBuffer     = dynamicInstanceBuffer.buffer;
+                rocksInstanceOffsets[0] = dynamicInstanceBuffer.getSliceOffset(i);
+            }
+            if (culling.isEnabled)
+            {
+                rocksInstanceBuffer     = culling.earlyInstances.buffer;
+                rocksInstanceOffsets[0] = 0;
+            }
+
             // Planet
             vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.planetVkDescrSet, 0, NULL);
             vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.planetVkPipeline);
@@ -234,18 +662,78 @@ public:
             // Instanced rocks
             vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.instancedRocksVkDescrSet, 0, NULL);
             vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.instancedRocksVkPipeline);
-            // Binding point 0 : Mesh vertex buffer
-            vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.rockModel.vertices.buffer, offsets);
-            // Binding point 1 : Instance data buffer
-            vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
+            if (vertexPulling.isEnabled)
+            {
+                // Set 1 : Instances (at the slice of this command buffer) and vertices, read by the vertex shader
+                const uint32_t dynamicOffset = static_cast<uint32_t>(rocksInstanceOffsets[0]);
+                vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &vertexPulling.earlyDescriptorSet, 1, &dynamicOffset);
+                vertexPulling.meshes.bindIndexBuffer(drawCmdBuffers[i]);
+            }
+            else
+            {
+                // Binding point 0 : Mesh vertex buffer
+                vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.rockModel.vertices.buffer, offsets);
+                // Binding point 1 : Instance data buffer
+                vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &rocksInstanceBuffer, rocksInstanceOffsets);
 
-            vkCmdBindIndexBuffer(drawCmdBuffers[i], models.rockModel.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+                vkCmdBindIndexBuffer(drawCmdBuffers[i], models.rockModel.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+            }
 
             // Render instances
-            vkCmdDrawIndexed(drawCmdBuffers[i], models.rockModel.indexCount, INSTANCE_COUNT, 0, 0, 0);
+            if (culling.isEnabled)
+            {
+                vkCmdDrawIndexedIndirect(drawCmdBuffers[i], culling.commands.buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+            }
+            else
+            {
+                vkCmdDrawIndexed(drawCmdBuffers[i], models.rockModel.indexCount, INSTANCE_COUNT, 0, 0, 0);
+            }
+
+            vkCmdEndRenderPass(drawCmdBuffers[i]);
+
+            if (culling.isEnabled)
+            {
+                culling.depthPyramid.record(drawCmdBuffers[i]);
+                recordCulling(drawCmdBuffers[i], i, culling.latePipeline);
+            }
+
+            vkCmdBeginRenderPass(drawCmdBuffers[i], &lateRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+            if (culling.isEnabled)
+            {
+                vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+                vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+
+                // Late rocks
+                vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.instancedRocksVkDescrSet, 0, NULL);
+                vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.instancedRocksVkPipeline);
+                if (vertexPulling.isEnabled)
+                {
+                    const uint32_t dynamicOffset = 0;
+                    vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &vertexPulling.lateDescriptorSet, 1, &dynamicOffset);
+                    vertexPulling.meshes.bindIndexBuffer(drawCmdBuffers[i]);
+                }
+                else
+                {
+                    vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.rockModel.vertices.buffer, offsets);
+                    vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &culling.lateInstances.buffer, offsets);
+                    vkCmdBindIndexBuffer(drawCmdBuffers[i], models.rockModel.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+                }
+                vkCmdDrawIndexedIndirect(drawCmdBuffers[i], culling.commands.buffer, sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+            }
 
             vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+            // Motion vectors of rocks over the scene's depth, then history and the swapchain image
+            if (isTemporal)
+            {
+                temporalAA.upscaler.recordMotionPass(drawCmdBuffers[i], width, height, [&](VkCommandBuffer cmdBuffer) {
+                    recordRocksMotion(cmdBuffer, i);
+                });
+                temporalAA.upscaler.recordResolve(drawCmdBuffers[i], i);
+                recordPreviousInstances(drawCmdBuffers[i], i);
+            }
+
             VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
         }
     }
@@ -256,6 +744,22 @@ public:
         models.planetModel.loadFromFile(getAssetPath() + "models/sphere_nonideal.obj",    vertexLayout, PLANET_SCALE,   vulkanDevice, queue);
         models.lightModel.loadFromFile(getAssetPath()  + "models/sphere.obj",             vertexLayout, LIGHT_SCALE,    vulkanDevice, queue);
         models.constructModel.loadFromFile(getAssetPath()  + "models/cage_construct.obj", vertexLayout, CONSTRUCT_SCALE,    vulkanDevice, queue);
+        if (ENABLE_ROCK_SHADOWS)
+        {
+            models.rockShadowModel.loadFromFile(getAssetPath() + SHADOW_CASTER_MODEL, shadowVertexLayout, INSTANCE_SCALE * SHADOW_CASTER_SCALE, vulkanDevice, queue);
+        }
+        if (vertexPulling.isEnabled)
+        {
+            // Same vertices as rockModel, which is kept for its dimensions
+            vk229::CookedMesh rockMesh;
+            std::string error;
+            if (!vk229::MeshCooker::cook(getAssetPath() + "models/rock01.dae", vertexLayout.components, INSTANCE_SCALE, rockMesh, error))
+            {
+                vks::tools::exitFatal(error, "Error");
+            }
+            vertexPulling.meshes.add(rockMesh, vertexLayout.components); // Mesh 0, first index 0 - as rockModel.
+            vertexPulling.meshes.upload(vulkanDevice, queue);
+        }
 
         // Textures
         std::string texFormatSuffix;
@@ -285,18 +789,23 @@ public:
 
     void setupDescriptorPool()
     {
-        // Example uses one ubo
+        // Example uses one ubo and two samplers (color map, shadow map) for graphics, one ubo and eight storage buffers for compute,
+        // one ubo, one dynamic and four storage buffers and a sampler (depth pyramid) for culling,
+        // one dynamic and two storage buffers and one ubo (previous instances and motion of temporal AA) for each vertex pulling set,
+        // one ubo, one dynamic and two storage buffers for shadow caster culling
         std::vector<VkDescriptorPoolSize> poolSizes =
         {
-            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, DESCRIPTOR_COUNT),
-            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, DESCRIPTOR_COUNT),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, DESCRIPTOR_COUNT + COMPUTE_DESCRIPTOR_COUNT + CULL_DESCRIPTOR_COUNT + PULLING_DESCRIPTOR_COUNT + SHADOW_CULL_DESCRIPTOR_COUNT),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * DESCRIPTOR_COUNT + CULL_DESCRIPTOR_COUNT),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8 * COMPUTE_DESCRIPTOR_COUNT + 4 * CULL_DESCRIPTOR_COUNT + 2 * PULLING_DESCRIPTOR_COUNT + 2 * SHADOW_CULL_DESCRIPTOR_COUNT),
+            vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, CULL_DESCRIPTOR_COUNT + PULLING_DESCRIPTOR_COUNT + SHADOW_CULL_DESCRIPTOR_COUNT),
         };
 
         VkDescriptorPoolCreateInfo descriptorPoolInfo =
             vks::initializers::descriptorPoolCreateInfo(
                 poolSizes.size(),
                 poolSizes.data(),
-                DESCRIPTOR_COUNT);
+                DESCRIPTOR_COUNT + COMPUTE_DESCRIPTOR_COUNT + CULL_DESCRIPTOR_COUNT + PULLING_DESCRIPTOR_COUNT + SHADOW_CULL_DESCRIPTOR_COUNT);
 
         VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
     }
@@ -315,6 +824,11 @@ public:
                 VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                 VK_SHADER_STAGE_FRAGMENT_BIT,
                 1),
+            // Binding 2 : Fragment shader rock shadow map
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                VK_SHADER_STAGE_FRAGMENT_BIT,
+                2),
         };
 
         VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -324,10 +838,48 @@ public:
 
         VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayout));
 
+        std::vector<VkDescriptorSetLayout> setLayouts = { descriptorSetLayout };
+        if (vertexPulling.isEnabled)
+        {
+            // Set 1 : Rocks geometry, bound only for the rocks pipeline
+            std::vector<VkDescriptorSetLayoutBinding> pullingSetLayoutBindings =
+            {
+                // Binding 0 : Vertex shader instance data, at dynamic offset
+                vks::initializers::descriptorSetLayoutBinding(
+                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                    VK_SHADER_STAGE_VERTEX_BIT,
+                    0),
+                // Binding 1 : Vertex shader mesh vertices
+                vks::initializers::descriptorSetLayoutBinding(
+                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_VERTEX_BIT,
+                    1),
+            };
+            if (temporalAA.isEnabled)
+            {
+                // Binding 2 : Motion vertex shader previous instances
+                pullingSetLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 2));
+                // Binding 3 : Motion vertex shader uniform buffer
+                pullingSetLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 3));
+            }
+            descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(pullingSetLayoutBindings.data(), pullingSetLayoutBindings.size());
+            VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &vertexPulling.descriptorSetLayout));
+            setLayouts.push_back(vertexPulling.descriptorSetLayout);
+        }
+
         VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
             vks::initializers::pipelineLayoutCreateInfo(
-                &descriptorSetLayout,
-                1);
+                setLayouts.data(),
+                setLayouts.size());
+
+        // Shadow pipeline selects cube face with push constants
+        VkPushConstantRange pushConstantRange =
+            vks::initializers::pushConstantRange(
+                VK_SHADER_STAGE_VERTEX_BIT,
+                sizeof(ShadowPushConsts),
+                0);
+        pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
         VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
     }
@@ -343,7 +895,8 @@ public:
         VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &descriptorSets.instancedRocksVkDescrSet));
         writeDescriptorSets = {
             vks::initializers::writeDescriptorSet(descriptorSets.instancedRocksVkDescrSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,	0, &uniformBuffers.scene.descriptor),	// Binding 0 : Vertex shader uniform buffer
-            vks::initializers::writeDescriptorSet(descriptorSets.instancedRocksVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.rocksTex2DArr.descriptor)	// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.instancedRocksVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.rocksTex2DArr.descriptor),	// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.instancedRocksVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &shadowMap.descriptor)			// Binding 2 : Rock shadow map
         };
         vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
 
@@ -351,7 +904,8 @@ public:
         VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &descriptorSets.planetVkDescrSet));
         writeDescriptorSets = {
             vks::initializers::writeDescriptorSet(descriptorSets.planetVkDescrSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,	0, &uniformBuffers.scene.descriptor),			// Binding 0 : Vertex shader uniform buffer
-            vks::initializers::writeDescriptorSet(descriptorSets.planetVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.planetTex2D.descriptor)			// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.planetVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.planetTex2D.descriptor),			// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.planetVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &shadowMap.descriptor)			// Binding 2 : Rock shadow map
         };
         vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
 
@@ -359,7 +913,8 @@ public:
         VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &descriptorSets.lightVkDescrSet));
         writeDescriptorSets = {
             vks::initializers::writeDescriptorSet(descriptorSets.lightVkDescrSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,	0, &uniformBuffers.scene.descriptor),			// Binding 0 : Vertex shader uniform buffer
-            vks::initializers::writeDescriptorSet(descriptorSets.lightVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.lightTex2D.descriptor)			// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.lightVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.lightTex2D.descriptor),			// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.lightVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &shadowMap.descriptor)			// Binding 2 : Rock shadow map
         };
         vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
 
@@ -367,7 +922,8 @@ public:
         VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &descriptorSets.constructVkDescrSet));
         writeDescriptorSets = {
             vks::initializers::writeDescriptorSet(descriptorSets.constructVkDescrSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,	0, &uniformBuffers.scene.descriptor),			// Binding 0 : Vertex shader uniform buffer
-            vks::initializers::writeDescriptorSet(descriptorSets.constructVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.constructTex2D.descriptor)			// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.constructVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &textures.constructTex2D.descriptor),			// Binding 1 : Color map
+            vks::initializers::writeDescriptorSet(descriptorSets.constructVkDescrSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &shadowMap.descriptor)			// Binding 2 : Rock shadow map
         };
         vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
 
@@ -470,100 +1026,415 @@ public:
             vks::initializers::vertexInputAttributeDescription(VERTEX_BUFFER_BIND_ID, 3, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 8),	// Location 3: Color
             // Per-Instance attributes
             // These are fetched for each instance rendered
-            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 5, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3),	// Location 4: Position
-            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 4, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Location 5: Rotation
-            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 6, VK_FORMAT_R32_SFLOAT,sizeof(float) * 6),			// Location 6: Scale
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 4, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Location 4: Position
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 5, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 4),	// Location 5: Rotation
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 6, VK_FORMAT_R32_SFLOAT,sizeof(float) * 3),			// Location 6: Scale
             vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 7, VK_FORMAT_R32_SINT, sizeof(float) * 7),			// Location 7: Texture array layer index
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 8, VK_FORMAT_R32_SFLOAT, sizeof(float) * 11),		// Location 8: Planet shadow
         };
         inputState.pVertexBindingDescriptions = bindingDescriptions.data();
         inputState.pVertexAttributeDescriptions = attributeDescriptions.data();
 
         pipelineCreateInfo.pVertexInputState = &inputState;
 
+        // Rocks and planet receive rock shadows, depth of the shadow map is reconstructed from the cube face projection
+        struct ShadowSpecializationData {
+            float nearPlane = SHADOW_NEAR;
+            float farPlane  = shadowMap.farPlane;
+        } shadowSpecializationData;
+
+        std::vector<VkSpecializationMapEntry> shadowSpecializationMapEntries = {
+            vks::initializers::specializationMapEntry(0, offsetof(ShadowSpecializationData, nearPlane), sizeof(float)),
+            vks::initializers::specializationMapEntry(1, offsetof(ShadowSpecializationData, farPlane),  sizeof(float)),
+        };
+
+        VkSpecializationInfo shadowSpecializationInfo =
+            vks::initializers::specializationInfo(
+                shadowSpecializationMapEntries.size(),
+                shadowSpecializationMapEntries.data(),
+                sizeof(shadowSpecializationData),
+                &shadowSpecializationData);
+
+        // Vertex pulling reads vertices of vertexLayout, its stride is a specialization constant
+        const uint32_t vertexStride = vertexLayout.stride() / sizeof(float);
+        VkSpecializationMapEntry pullingSpecializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+        VkSpecializationInfo pullingSpecializationInfo = vks::initializers::specializationInfo(1, &pullingSpecializationMapEntry, sizeof(vertexStride), &vertexStride);
+
         // Instancing pipeline
-        shaderStages[0] = loadShader(getAssetPath() + "shaders/instancing-229/instancing.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-        shaderStages[1] = loadShader(getAssetPath() + "shaders/instancing-229/instancing.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        const std::string rocksVertexShader = vertexPulling.isEnabled ? "instancing.pulling.vert.spv" : "instancing.vert.spv";
+        shaderStages[0] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/" + rocksVertexShader, VK_SHADER_STAGE_VERTEX_BIT);
+        shaderStages[1] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/instancing.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        shaderStages[1].pSpecializationInfo = &shadowSpecializationInfo;
         // Use all input bindings and attribute descriptions
         inputState.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
         inputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+        if (vertexPulling.isEnabled)
+        {
+            // No vertex input at all
+            shaderStages[0].pSpecializationInfo = &pullingSpecializationInfo;
+            inputState.vertexBindingDescriptionCount = 0;
+            inputState.vertexAttributeDescriptionCount = 0;
+        }
         VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.instancedRocksVkPipeline));
+        shaderCache.release(shaderStages[0].module);
+        shaderCache.release(shaderStages[1].module);
 
         // Planet rendering pipeline
-        shaderStages[0] = loadShader(getAssetPath() + "shaders/instancing-229/planet.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-        shaderStages[1] = loadShader(getAssetPath() + "shaders/instancing-229/planet.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        shaderStages[0] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/planet.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        shaderStages[1] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/planet.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        shaderStages[1].pSpecializationInfo = &shadowSpecializationInfo;
         // Only use the non-instanced input bindings and attribute descriptions
         inputState.vertexBindingDescriptionCount = 1;
         inputState.vertexAttributeDescriptionCount = 4;
         VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.planetVkPipeline));
+        shaderCache.release(shaderStages[0].module);
+        shaderCache.release(shaderStages[1].module);
 
         // Light rendering pipeline
-        shaderStages[0] = loadShader(getAssetPath() + "shaders/instancing-229/light.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-        shaderStages[1] = loadShader(getAssetPath() + "shaders/instancing-229/light.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        shaderStages[0] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/light.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        shaderStages[1] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/light.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
         // Only use the non-instanced input bindings and attribute descriptions
         inputState.vertexBindingDescriptionCount = 1;
         inputState.vertexAttributeDescriptionCount = 4;
         VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.lightVkPipeline));
+        shaderCache.release(shaderStages[0].module);
+        shaderCache.release(shaderStages[1].module);
+
+        // Construct rendering pipeline - planet shadow radii are specialization constants
+        struct ConstructSpecializationData {
+            float planetRadius = SHADOW_PLANET_RADIUS;
+            float lightRadius  = SHADOW_LIGHT_RADIUS;
+        } constructSpecializationData;
+
+        std::vector<VkSpecializationMapEntry> constructSpecializationMapEntries = {
+            vks::initializers::specializationMapEntry(0, offsetof(ConstructSpecializationData, planetRadius), sizeof(float)),
+            vks::initializers::specializationMapEntry(1, offsetof(ConstructSpecializationData, lightRadius),  sizeof(float)),
+        };
 
-        // Construct rendering pipeline
-        shaderStages[0] = loadShader(getAssetPath() + "shaders/instancing-229/construct.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
-        shaderStages[1] = loadShader(getAssetPath() + "shaders/instancing-229/construct.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        VkSpecializationInfo constructSpecializationInfo =
+            vks::initializers::specializationInfo(
+                constructSpecializationMapEntries.size(),
+                constructSpecializationMapEntries.data(),
+                sizeof(constructSpecializationData),
+                &constructSpecializationData);
+
+        shaderStages[0] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/construct.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        shaderStages[1] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/construct.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        shaderStages[1].pSpecializationInfo = &constructSpecializationInfo;
         // Only use the non-instanced input bindings and attribute descriptions
         inputState.vertexBindingDescriptionCount = 1;
         inputState.vertexAttributeDescriptionCount = 4;
         VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.constructVkPipeline));
+        shaderCache.release(shaderStages[0].module);
+        shaderCache.release(shaderStages[1].module);
+
+        if (!ENABLE_ROCK_SHADOWS)
+        {
+            return;
+        }
+
+        // Rock shadow pipeline - depth only, position-only mesh, instance data read from the same buffer as the rocks pipeline
+        bindingDescriptions = {
+            vks::initializers::vertexInputBindingDescription(VERTEX_BUFFER_BIND_ID, shadowVertexLayout.stride(), VK_VERTEX_INPUT_RATE_VERTEX),
+            vks::initializers::vertexInputBindingDescription(INSTANCE_BUFFER_BIND_ID, sizeof(InstanceData), VK_VERTEX_INPUT_RATE_INSTANCE)
+        };
+        attributeDescriptions = {
+            vks::initializers::vertexInputAttributeDescription(VERTEX_BUFFER_BIND_ID, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Location 0: Position
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 1, VK_FORMAT_R32G32B32_SFLOAT, 0),					// Location 1: Instance position
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 2, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 4),	// Location 2: Instance rotation
+            vks::initializers::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 3, VK_FORMAT_R32_SFLOAT, sizeof(float) * 3),		// Location 3: Instance scale
+        };
+        inputState.pVertexBindingDescriptions = bindingDescriptions.data();
+        inputState.pVertexAttributeDescriptions = attributeDescriptions.data();
+        inputState.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+        inputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+
+        // Rocks are thin from some sides, both faces are drawn; bias against acne on receivers
+        rasterizationState.cullMode = VK_CULL_MODE_NONE;
+        rasterizationState.depthBiasEnable = VK_TRUE;
+        rasterizationState.depthBiasConstantFactor = SHADOW_DEPTH_BIAS_CONSTANT;
+        rasterizationState.depthBiasSlopeFactor = SHADOW_DEPTH_BIAS_SLOPE;
+
+        // No color attachments
+        colorBlendState.attachmentCount = 0;
+
+        // Rocks sorted into faces by shadow_cull.comp need no per-vertex face test
+        const VkBool32 faceTest = shadowCulling.isEnabled ? VK_FALSE : VK_TRUE;
+        const VkSpecializationMapEntry faceTestMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(VkBool32));
+        const VkSpecializationInfo faceTestSpecializationInfo = vks::initializers::specializationInfo(1, &faceTestMapEntry, sizeof(faceTest), &faceTest);
+
+        shaderStages[0] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/shadow_rocks.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        shaderStages[0].pSpecializationInfo = &faceTestSpecializationInfo;
+        pipelineCreateInfo.stageCount = 1;
+        pipelineCreateInfo.renderPass = shadowMap.renderPass;
+        VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &shadowMap.pipeline));
+        shaderCache.release(shaderStages[0].module);
     }
 
-    float rnd(float range)
+    /// Cube depth map around the light, every face is a layer of one image with its own view and framebuffer.
+    /// Faces are rendered in separate render pass instances, ending in shader read layout.
+    void prepareShadowMap()
     {
-        return range * (rand() / double(RAND_MAX));
+        // 32 bit float depth keeps precision at the far rings, 16 bit is the fallback
+        shadowMap.format = VK_FORMAT_D16_UNORM;
+        VkFormatProperties formatProps;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_D32_SFLOAT, &formatProps);
+        const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        if ((formatProps.optimalTilingFeatures & requiredFeatures) == requiredFeatures)
+        {
+            shadowMap.format = VK_FORMAT_D32_SFLOAT;
+        }
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, shadowMap.format, &formatProps);
+        const bool isLinearFilterSupported = (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+
+        VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = shadowMap.format;
+        imageCreateInfo.extent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1 };
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 6;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageCreateInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+        VK_CHECK_RESULT(vkCreateImage(device, &imageCreateInfo, nullptr, &shadowMap.image));
+
+        VkMemoryRequirements memReqs;
+        vkGetImageMemoryRequirements(device, shadowMap.image, &memReqs);
+        VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+        memAlloc.allocationSize = memReqs.size;
+        memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &shadowMap.memory));
+        VK_CHECK_RESULT(vkBindImageMemory(device, shadowMap.image, shadowMap.memory, 0));
+
+        VkImageViewCreateInfo viewCreateInfo = vks::initializers::imageViewCreateInfo();
+        viewCreateInfo.image = shadowMap.image;
+        viewCreateInfo.format = shadowMap.format;
+        viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 6 };
+        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+        VK_CHECK_RESULT(vkCreateImageView(device, &viewCreateInfo, nullptr, &shadowMap.cubeView));
+
+        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewCreateInfo.subresourceRange.layerCount = 1;
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            viewCreateInfo.subresourceRange.baseArrayLayer = face;
+            VK_CHECK_RESULT(vkCreateImageView(device, &viewCreateInfo, nullptr, &shadowMap.faceViews[face]));
+        }
+
+        // Hardware depth comparison, filtered if possible (2x2 PCF)
+        const VkFilter filter = isLinearFilterSupported ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+        VkSamplerCreateInfo sampler = vks::initializers::samplerCreateInfo();
+        sampler.magFilter = filter;
+        sampler.minFilter = filter;
+        sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler.addressModeV = sampler.addressModeU;
+        sampler.addressModeW = sampler.addressModeU;
+        sampler.mipLodBias = 0.0f;
+        sampler.maxAnisotropy = 1.0f;
+        sampler.compareEnable = VK_TRUE;
+        sampler.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        sampler.minLod = 0.0f;
+        sampler.maxLod = 1.0f;
+        sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        VK_CHECK_RESULT(vkCreateSampler(device, &sampler, nullptr, &shadowMap.sampler));
+
+        shadowMap.descriptor.sampler = shadowMap.sampler;
+        shadowMap.descriptor.imageView = shadowMap.cubeView;
+        shadowMap.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        // Every face is cleared and fully rendered, nothing is kept
+        VkAttachmentDescription attachmentDescription = {};
+        attachmentDescription.format = shadowMap.format;
+        attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        VkAttachmentReference depthReference = {};
+        depthReference.attachment = 0;
+        depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 0;
+        subpass.pDepthStencilAttachment = &depthReference;
+
+        // Previous frame's reads before writes, writes before this frame's reads
+        std::array<VkSubpassDependency, 2> dependencies;
+
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+        VkRenderPassCreateInfo renderPassCreateInfo = vks::initializers::renderPassCreateInfo();
+        renderPassCreateInfo.attachmentCount = 1;
+        renderPassCreateInfo.pAttachments = &attachmentDescription;
+        renderPassCreateInfo.subpassCount = 1;
+        renderPassCreateInfo.pSubpasses = &subpass;
+        renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+        renderPassCreateInfo.pDependencies = dependencies.data();
+        VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &shadowMap.renderPass));
+
+        VkFramebufferCreateInfo frameBufferCreateInfo = vks::initializers::framebufferCreateInfo();
+        frameBufferCreateInfo.renderPass = shadowMap.renderPass;
+        frameBufferCreateInfo.attachmentCount = 1;
+        frameBufferCreateInfo.width = SHADOW_MAP_SIZE;
+        frameBufferCreateInfo.height = SHADOW_MAP_SIZE;
+        frameBufferCreateInfo.layers = 1;
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            frameBufferCreateInfo.pAttachments = &shadowMap.faceViews[face];
+            VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCreateInfo, nullptr, &shadowMap.frameBuffers[face]));
+        }
     }
 
-    void prepareInstanceData()
+    /// Light's view-projection for every face of the shadow map, in Vulkan cube face order and orientation.
+    void updateShadowFaces()
     {
-        std::vector<InstanceData> instanceData;
-        instanceData.resize(INSTANCE_COUNT);
+        static const glm::vec3 directions[6] = {
+            {  1.0f,  0.0f,  0.0f }, { -1.0f,  0.0f,  0.0f },
+            {  0.0f,  1.0f,  0.0f }, {  0.0f, -1.0f,  0.0f },
+            {  0.0f,  0.0f,  1.0f }, {  0.0f,  0.0f, -1.0f },
+        };
+        static const glm::vec3 ups[6] = {
+            {  0.0f, -1.0f,  0.0f }, {  0.0f, -1.0f,  0.0f },
+            {  0.0f,  0.0f,  1.0f }, {  0.0f,  0.0f, -1.0f },
+            {  0.0f, -1.0f,  0.0f }, {  0.0f, -1.0f,  0.0f },
+        };
 
-        std::mt19937 rndGenerator(time(NULL));
-        std::uniform_real_distribution<float> uniformDist(0.0, 1.0);
+        const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_NEAR, shadowMap.farPlane);
+        const glm::vec3 light(uboVS.lightPos);
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            uboVS.shadowFaces[face] = projection * glm::lookAt(light, light + directions[face], ups[face]);
+        }
+    }
 
-        // Distribute rocks randomly on two different rings
+    /// Rocks simulation (not in CPU mode), sorting of shadow casters into faces and the shadow map, recorded once per swapchain image,
+    /// since in CPU mode every image reads its own slice of instance data.
+    void buildUpdateCommandBuffers()
+    {
+        VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+            vks::initializers::commandBufferAllocateInfo(
+                cmdPool,
+                VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                static_cast<uint32_t>(drawCmdBuffers.size()));
 
-        std::vector<glm::vec2> rings = {
-            {   5.0f,   7.0f },
-            {   8.0f,  11.0f },
-            {  13.0f,  17.0f },
-            {  20.0f,  26.0f },
-            {  30.0f,  40.0f },
-            {  48.0f,  60.0f }
-        };
-        const auto numOfChunks = rings.size();
-        const auto numInChunk  = INSTANCE_COUNT / rings.size();
-        float rho, theta;
+        updateCmdBuffers.resize(drawCmdBuffers.size());
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, updateCmdBuffers.data()));
 
-        for (auto instIdInChunk = 0; instIdInChunk < numInChunk; instIdInChunk++)
+        VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+
+        VkClearValue clearValue;
+        clearValue.depthStencil = { 1.0f, 0u };
+
+        VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+        renderPassBeginInfo.renderPass = shadowMap.renderPass;
+        renderPassBeginInfo.renderArea.extent.width = SHADOW_MAP_SIZE;
+        renderPassBeginInfo.renderArea.extent.height = SHADOW_MAP_SIZE;
+        renderPassBeginInfo.clearValueCount = 1;
+        renderPassBeginInfo.pClearValues = &clearValue;
+
+        ShadowPushConsts pushConsts;
+        pushConsts.rockRadius = compute.ubo.rockRadius;
+
+        for (int32_t i = 0; i < updateCmdBuffers.size(); ++i)
         {
-            for (auto ringId = 0; ringId < numOfChunks; ringId++)
+            VK_CHECK_RESULT(vkBeginCommandBuffer(updateCmdBuffers[i], &cmdBufInfo));
+
+            // Rocks are moved and shaded before they are drawn, in the same submission
+            if (rocksSim != RocksSim::CPU)
             {
-                const auto instanceId    = instIdInChunk + ringId*numInChunk;
-                auto& currentInstanceRef = instanceData[instanceId];
+                recordRocksSimulation(updateCmdBuffers[i]);
+            }
 
-                rho   = sqrt((pow(rings.at(ringId)[1], 2.0f) - pow(rings.at(ringId)[0], 2.0f)) * uniformDist(rndGenerator) + pow(rings.at(ringId)[0], 2.0f));
-                theta = 2.0 * M_PI * uniformDist(rndGenerator);
+            if (shadowCulling.isEnabled)
+            {
+                recordShadowCulling(updateCmdBuffers[i], i);
+            }
 
-                currentInstanceRef.pos      = glm::vec3(rho*cos(theta), uniformDist(rndGenerator) * 0.05f - 0.25f, rho*sin(theta));
-                currentInstanceRef.rot      = glm::vec3(M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator));
-                currentInstanceRef.scale    = 1.5f + uniformDist(rndGenerator) - uniformDist(rndGenerator);
-                currentInstanceRef.texIndex = rnd(textures.rocksTex2DArr.layerCount);
-                currentInstanceRef.scale    *= 0.75f;
+            VkDeviceSize offsets[1] = { 0 };
+            VkBuffer     rocksInstanceBuffer     = instanceBuffer.buffer;
+            VkDeviceSize rocksInstanceOffsets[1] = { 0 };
+            if (shadowCulling.isEnabled)
+            {
+                rocksInstanceBuffer = shadowCulling.instances.buffer;
+            }
+            else if (rocksSim == RocksSim::CPU)
+            {
+                rocksInstanceBuffer     = dynamicInstanceBuffer.buffer;
+                rocksInstanceOffsets[0] = dynamicInstanceBuffer.getSliceOffset(i);
             }
-        }
 
-        instanceBuffer.size = instanceData.size() * sizeof(InstanceData);
+            // One instanced draw per face - of the rocks sorted into it, or of all rocks, and the ones outside of the face
+            // are dropped in the vertex shader
+            for (uint32_t face = 0; face < 6; face++)
+            {
+                renderPassBeginInfo.framebuffer = shadowMap.frameBuffers[face];
+                vkCmdBeginRenderPass(updateCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+                if (ENABLE_ROCK_SHADOWS)
+                {
+                    VkViewport viewport = vks::initializers::viewport((float)SHADOW_MAP_SIZE, (float)SHADOW_MAP_SIZE, 0.0f, 1.0f);
+                    vkCmdSetViewport(updateCmdBuffers[i], 0, 1, &viewport);
+
+                    VkRect2D scissor = vks::initializers::rect2D(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, 0);
+                    vkCmdSetScissor(updateCmdBuffers[i], 0, 1, &scissor);
+
+                    pushConsts.face = face;
+                    vkCmdPushConstants(updateCmdBuffers[i], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConsts), &pushConsts);
+
+                    vkCmdBindDescriptorSets(updateCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.instancedRocksVkDescrSet, 0, NULL);
+                    vkCmdBindPipeline(updateCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMap.pipeline);
+                    vkCmdBindVertexBuffers(updateCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.rockShadowModel.vertices.buffer, offsets);
+                    if (shadowCulling.isEnabled)
+                    {
+                        rocksInstanceOffsets[0] = face * instanceBuffer.size;
+                    }
+                    vkCmdBindVertexBuffers(updateCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &rocksInstanceBuffer, rocksInstanceOffsets);
+                    vkCmdBindIndexBuffer(updateCmdBuffers[i], models.rockShadowModel.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+                    if (shadowCulling.isEnabled)
+                    {
+                        vkCmdDrawIndexedIndirect(updateCmdBuffers[i], shadowCulling.commands.buffer, face * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+                    }
+                    else
+                    {
+                        vkCmdDrawIndexed(updateCmdBuffers[i], models.rockShadowModel.indexCount, INSTANCE_COUNT, 0, 0, 0);
+                    }
+                }
+
+                vkCmdEndRenderPass(updateCmdBuffers[i]);
+            }
+
+            VK_CHECK_RESULT(vkEndCommandBuffer(updateCmdBuffers[i]));
+        }
+    }
 
-        // Staging
-        // Instanced data is static, copy to device local memory
-        // This results in better performance
+    float rnd(float range)
+    {
+        return range * (rand() / double(RAND_MAX));
+    }
 
+    // Creates device local buffer and fills it with data through a one-shot staging copy.
+    void createDeviceLocalBuffer(VkBufferUsageFlags usage, VkDeviceSize size, void* data, VkBuffer* buffer, VkDeviceMemory* memory)
+    {
         struct {
             VkDeviceMemory memory;
             VkBuffer buffer;
@@ -572,85 +1443,1166 @@ public:
         VK_CHECK_RESULT(vulkanDevice->createBuffer(
             VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            instanceBuffer.size,
+            size,
             &stagingBuffer.buffer,
             &stagingBuffer.memory,
-            instanceData.data()));
+            data));
 
         VK_CHECK_RESULT(vulkanDevice->createBuffer(
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            instanceBuffer.size,
-            &instanceBuffer.buffer,
-            &instanceBuffer.memory));
+            size,
+            buffer,
+            memory));
 
         // Copy to staging buffer
         VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
         VkBufferCopy copyRegion = { };
-        copyRegion.size = instanceBuffer.size;
+        copyRegion.size = size;
         vkCmdCopyBuffer(
             copyCmd,
             stagingBuffer.buffer,
-            instanceBuffer.buffer,
+            *buffer,
             1,
             &copyRegion);
 
         VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
 
-        instanceBuffer.descriptor.range = instanceBuffer.size;
-        instanceBuffer.descriptor.buffer = instanceBuffer.buffer;
-        instanceBuffer.descriptor.offset = 0;
-
         // Destroy staging resources
         vkDestroyBuffer(device, stagingBuffer.buffer, nullptr);
         vkFreeMemory(device, stagingBuffer.memory, nullptr);
     }
 
-    void prepareUniformBuffers()
+    void prepareInstanceData()
     {
-        VK_CHECK_RESULT(vulkanDevice->createBuffer(
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &uniformBuffers.scene,
-            sizeof(uboVS)));
-
-        // Map persistent
-        VK_CHECK_RESULT(uniformBuffers.scene.map());
-
-        updateUniformBuffer(true);
-    }
+        std::vector<InstanceData> instanceData;
+        instanceData.resize(INSTANCE_COUNT);
 
-    void updateLight()
-    {
-        static float     G  = 2.5f;
-        static float     mi = 10.0f;
-        static float     mp = 100.0f;
-        static glm::vec3 pi = { 45.0f, 0.0f, 10.0f };
-        static glm::vec3 pp = { 0.0f,  0.0f, 0.0f };
-        static glm::vec3 vi = { -1.0f, -0.3f, 1.0f };
-        static glm::vec3 ai = { 0.0f,  0.0f, 0.0f };
-        static glm::vec3 fi = { 0.0f,  0.0f, 0.0f };
-
-        float r = glm::distance(pi, pp);
-        glm::vec3 dirVec = glm::normalize(pi - pp);
-        fi = -dirVec * G*mp*mi/(r*r);
-        ai = fi/mi;
-        vi = vi + ai*frameTimer;
-        pi = pi + vi*frameTimer;
+        // xyz - velocity, w - mass; used only by the N-body simulation.
+        std::vector<glm::vec4> velocityData;
+        velocityData.resize(INSTANCE_COUNT);
 
-        const float k = 0.25f * frameTimer;
-        uboVS.lightInt = LIGHT_INTENSITY*k + uboVS.lightInt*(1.0f - k);
-        uboVS.lightPos = glm::vec4(pi, 1.0f);
-    }
+        std::mt19937 rndGenerator(time(NULL));
+        std::uniform_real_distribution<float> uniformDist(0.0, 1.0);
 
-    void updateUniformBuffer(bool viewChanged)
-    {
-        if (viewChanged)
-        {
-//            std::cout << "  >> VulkanExample-229::updateUniformBuffer(bool viewChanged) cameraPos = {" << cameraPos.x << " , " << cameraPos.y << " , " << cameraPos.z << "}\n";
-//            std::cout << "  >> VulkanExample-229::updateUniformBuffer(bool viewChanged) rotation = {" << rotation.x << ",  " << rotation.y << " , " << rotation.z << "}\n";
-//            std::cout << "  >> VulkanExample-229::updateUniformBuffer(bool viewChanged) zoom = {" << zoom << "}\n";
+        // Distribute rocks randomly on two different rings
+
+        std::vector<glm::vec2> rings = {
+            {   5.0f,   7.0f },
+            {   8.0f,  11.0f },
+            {  13.0f,  17.0f },
+            {  20.0f,  26.0f },
+            {  30.0f,  40.0f },
+            {  48.0f,  60.0f }
+        };
+        const auto numOfChunks = rings.size();
+        const auto numInChunk  = INSTANCE_COUNT / rings.size();
+        float rho, theta;
+        float maxScale = 0.0f;
+
+        for (auto instIdInChunk = 0; instIdInChunk < numInChunk; instIdInChunk++)
+        {
+            for (auto ringId = 0; ringId < numOfChunks; ringId++)
+            {
+                const auto instanceId    = instIdInChunk + ringId*numInChunk;
+                auto& currentInstanceRef = instanceData[instanceId];
+
+                rho   = sqrt((pow(rings.at(ringId)[1], 2.0f) - pow(rings.at(ringId)[0], 2.0f)) * uniformDist(rndGenerator) + pow(rings.at(ringId)[0], 2.0f));
+                theta = 2.0 * M_PI * uniformDist(rndGenerator);
+
+                currentInstanceRef.pos      = glm::vec3(rho*cos(theta), uniformDist(rndGenerator) * 0.05f - 0.25f, rho*sin(theta));
+                currentInstanceRef.rot      = glm::vec3(M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator));
+                currentInstanceRef.scale    = 1.5f + uniformDist(rndGenerator) - uniformDist(rndGenerator);
+                currentInstanceRef.texIndex = rnd(textures.rocksTex2DArr.layerCount);
+                currentInstanceRef.scale    *= 0.75f;
+                currentInstanceRef.shadow   = 1.0f;
+                currentInstanceRef.reserved = glm::vec3(static_cast<float>(instanceId), 0.0f, 0.0f);
+                maxScale = std::max(maxScale, currentInstanceRef.scale);
+
+                // Circular orbit around the planet, in the direction globSpeed used to spin the rings.
+                const float orbitalSpeed  = sqrt(GRAVITY_CONST * PLANET_MASS / rho);
+                velocityData[instanceId]  = glm::vec4(-sin(theta) * orbitalSpeed, 0.0f, cos(theta) * orbitalSpeed, ROCK_MASS);
+            }
+        }
+
+        instanceBuffer.size = instanceData.size() * sizeof(InstanceData);
+
+        // Collision spheres - model dimensions are in file units, before scaling at load time
+        auto boundingRadius = [](const vks::Model& model, float scale)
+        {
+            return 0.5f * std::max(std::max(model.dim.size.x, model.dim.size.y), model.dim.size.z) * scale;
+        };
+        compute.ubo.rockRadius   = boundingRadius(models.rockModel, INSTANCE_SCALE);
+        compute.ubo.planetRadius = boundingRadius(models.planetModel, PLANET_SCALE);
+        compute.ubo.lightRadius  = boundingRadius(models.lightModel, LIGHT_SCALE);
+        compute.ubo.cellSize     = 4.0f * compute.ubo.rockRadius * maxScale;
+        compute.ubo.tableSize    = vk229::SpatialHashCollisions::tableSizeFor(INSTANCE_COUNT);
+
+        collisions.restitution = COLLISION_RESTITUTION;
+        collisions.correction  = COLLISION_CORRECTION;
+        collisions.obstacles   = {
+            { nbody.attractors[PLANET_ATTRACTOR_ID].pos, compute.ubo.planetRadius },
+            { nbody.attractors[LIGHT_ATTRACTOR_ID].pos,  compute.ubo.lightRadius  },
+        };
+
+        // Shadow far plane - light at the farthest point of its orbit around the planet (apoapsis, from energy and angular
+        // momentum), seeing the largest rock on the far side of the outer ring
+        const vk229::Attractor& planet = nbody.attractors[PLANET_ATTRACTOR_ID];
+        const vk229::Attractor& light  = nbody.attractors[LIGHT_ATTRACTOR_ID];
+        const glm::vec3 lightOffset   = light.pos - planet.pos;
+        const float     mu            = GRAVITY_CONST * planet.mass;
+        const float     energy        = 0.5f * glm::dot(light.vel, light.vel) - mu / glm::length(lightOffset);
+        float           lightDistance = glm::length(lightOffset);
+        if (energy < 0.0f)
+        {
+            const float semiMajorAxis   = -mu / (2.0f * energy);
+            const float angularMomentum = glm::length(glm::cross(lightOffset, light.vel));
+            const float eccentricity    = sqrt(std::max(1.0f + 2.0f * energy * angularMomentum * angularMomentum / (mu * mu), 0.0f));
+            lightDistance = std::max(lightDistance, semiMajorAxis * (1.0f + eccentricity));
+        }
+        shadowMap.farPlane = SHADOW_FAR_MARGIN * (lightDistance + rings.back()[1] + compute.ubo.rockRadius * maxScale);
+
+        if (rocksSim == RocksSim::CPU)
+        {
+            // Written by CPU simulation every frame, rotation, scale and texture index stay as they are
+            dynamicInstanceBuffer.create(
+                vulkanDevice,
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                instanceBuffer.size,
+                drawCmdBuffers.size(),
+                instanceData.data());
+
+            vk229::BodiesSoA& bodies = nbody.bodies;
+            bodies.resize(INSTANCE_COUNT);
+            for (size_t i = 0; i < INSTANCE_COUNT; i++)
+            {
+                bodies.px[i] = instanceData[i].pos.x;
+                bodies.py[i] = instanceData[i].pos.y;
+                bodies.pz[i] = instanceData[i].pos.z;
+                bodies.vx[i] = velocityData[i].x;
+                bodies.vy[i] = velocityData[i].y;
+                bodies.vz[i] = velocityData[i].z;
+                bodies.m[i]  = velocityData[i].w;
+                bodies.r[i]  = instanceData[i].scale * compute.ubo.rockRadius;
+            }
+            nbody.invalidate();
+        }
+        else
+        {
+            // Staging
+            // Instanced data is written only by the GPU, copy to device local memory
+            // This results in better performance
+            createDeviceLocalBuffer(
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                instanceBuffer.size,
+                instanceData.data(),
+                &instanceBuffer.buffer,
+                &instanceBuffer.memory);
+        }
+
+        instanceBuffer.descriptor.range = instanceBuffer.size;
+        instanceBuffer.descriptor.buffer = instanceBuffer.buffer;
+        instanceBuffer.descriptor.offset = 0;
+
+        // Instances of the previous frame, for motion vectors - copied from the instance buffer in use by every frame
+        if (temporalAA.isEnabled)
+        {
+            temporalAA.previousInstances.size = instanceBuffer.size;
+            createDeviceLocalBuffer(
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                temporalAA.previousInstances.size,
+                instanceData.data(),
+                &temporalAA.previousInstances.buffer,
+                &temporalAA.previousInstances.memory);
+
+            temporalAA.previousInstances.descriptor.range = temporalAA.previousInstances.size;
+            temporalAA.previousInstances.descriptor.buffer = temporalAA.previousInstances.buffer;
+            temporalAA.previousInstances.descriptor.offset = 0;
+        }
+
+        // Bound to compute even if rocks are rigid
+        if (rocksSim != RocksSim::CPU)
+        {
+            const VkDeviceSize velocityBufferSize = velocityData.size() * sizeof(glm::vec4);
+
+            createDeviceLocalBuffer(
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                velocityBufferSize,
+                velocityData.data(),
+                &compute.velocityBuffer,
+                &compute.velocityMemory);
+
+            compute.velocityDescriptor.range = velocityBufferSize;
+            compute.velocityDescriptor.buffer = compute.velocityBuffer;
+            compute.velocityDescriptor.offset = 0;
+        }
+    }
+
+    /// Rocks are simulated in the graphics queue, right before they are drawn,
+    /// so no semaphores nor queue family ownership transfers are needed.
+    /// Two pipelines are made of one shader, specialized by pass:
+    /// * calculate - gravity of planet, light and (optionally) other rocks, updates velocities,
+    /// * integrate - updates positions, which are then read as instance vertex attributes,
+    /// * shade     - planet shadow of every rock, so rock fragments don't evaluate it.
+    /// Collisions (collide.comp) follow in more pipelines, sharing the same layout:
+    /// * count, scan buckets, scan blocks, scatter - counting sort of rocks by spatial hash bucket, so buckets hold any number of them,
+    /// * resolve - rock-rock contacts, responses are stored aside, so nothing moves while other rocks are tested,
+    /// * apply   - moves rocks by their responses and out of planet and light.
+    void prepareCompute()
+    {
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &compute.uniformBuffer,
+            sizeof(compute.ubo)));
+
+        // Map persistent
+        VK_CHECK_RESULT(compute.uniformBuffer.map());
+
+        updateComputeUniformBuffer();
+
+        // Collision buffers, written and read only by GPU. Minimal when collisions are disabled, descriptors must be valid anyway.
+        const VkDeviceSize bucketCount = ENABLE_COLLISIONS ? compute.ubo.tableSize : 1;
+        const VkDeviceSize blockCount  = (bucketCount + NBODY_WORKGROUP_SIZE - 1) / NBODY_WORKGROUP_SIZE;
+        const VkDeviceSize rockCount   = ENABLE_COLLISIONS ? INSTANCE_COUNT : 1;
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &compute.bucketCounts,
+            bucketCount * sizeof(uint32_t)));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &compute.bucketStarts,
+            bucketCount * sizeof(uint32_t)));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &compute.blockSums,
+            blockCount * sizeof(uint32_t)));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &compute.rockSlots,
+            rockCount * sizeof(uint32_t)));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &compute.sortedRocks,
+            rockCount * sizeof(uint32_t)));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &compute.deltas,
+            rockCount * 2 * sizeof(glm::vec4)));
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings =
+        {
+            // Binding 0 : Instance data (positions)
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                0),
+            // Binding 1 : Velocities and masses
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                1),
+            // Binding 2 : Simulation parameters
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                2),
+            // Binding 3 : Bucket counts
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                3),
+            // Binding 4 : Rocks sorted by bucket
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                4),
+            // Binding 5 : Collision responses
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                5),
+            // Binding 6 : Bucket starts
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                6),
+            // Binding 7 : Block sums
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                7),
+            // Binding 8 : Rock slots
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                8),
+        };
+
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(
+                setLayoutBindings.data(),
+                setLayoutBindings.size());
+
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &compute.descriptorSetLayout));
+
+        VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(
+                &compute.descriptorSetLayout,
+                1);
+
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &compute.pipelineLayout));
+
+        VkDescriptorSetAllocateInfo descripotrSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(descriptorPool, &compute.descriptorSetLayout, 1);
+
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &compute.descriptorSet));
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &instanceBuffer.descriptor),            // Binding 0 : Instance data
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.velocityDescriptor),          // Binding 1 : Velocities
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &compute.uniformBuffer.descriptor),    // Binding 2 : Simulation parameters
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &compute.bucketCounts.descriptor),     // Binding 3 : Bucket counts
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &compute.sortedRocks.descriptor),      // Binding 4 : Rocks sorted by bucket
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5, &compute.deltas.descriptor),           // Binding 5 : Collision responses
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &compute.bucketStarts.descriptor),     // Binding 6 : Bucket starts
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &compute.blockSums.descriptor),        // Binding 7 : Block sums
+            vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8, &compute.rockSlots.descriptor),        // Binding 8 : Rock slots
+        };
+        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+
+        // Specialization constants - workgroup size, rock-rock interactions, pass
+        struct SpecializationData {
+            int32_t sharedDataSize   = NBODY_WORKGROUP_SIZE;
+            int32_t rockInteractions = ENABLE_ROCK_INTERACTION;
+            int32_t pass             = 0;
+        } specializationData;
+
+        std::vector<VkSpecializationMapEntry> specializationMapEntries = {
+            vks::initializers::specializationMapEntry(0, offsetof(SpecializationData, sharedDataSize),   sizeof(int32_t)),
+            vks::initializers::specializationMapEntry(1, offsetof(SpecializationData, rockInteractions), sizeof(int32_t)),
+            vks::initializers::specializationMapEntry(2, offsetof(SpecializationData, pass),             sizeof(int32_t)),
+        };
+
+        VkSpecializationInfo specializationInfo =
+            vks::initializers::specializationInfo(
+                specializationMapEntries.size(),
+                specializationMapEntries.data(),
+                sizeof(specializationData),
+                &specializationData);
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo =
+            vks::initializers::computePipelineCreateInfo(
+                compute.pipelineLayout,
+                0);
+
+        computePipelineCreateInfo.stage = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/nbody.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+
+        // Calculate pipeline
+        specializationData.pass = 0;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.calculatePipeline));
+
+        // Integrate pipeline
+        specializationData.pass = 1;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.integratePipeline));
+
+        // Shade pipeline
+        specializationData.pass = 2;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.shadePipeline));
+        shaderCache.release(computePipelineCreateInfo.stage.module);
+
+        if (!ENABLE_COLLISIONS)
+        {
+            return;
+        }
+
+        // Specialization constants - workgroup size, pass
+        struct CollisionSpecializationData {
+            int32_t workgroupSize  = NBODY_WORKGROUP_SIZE;
+            int32_t pass           = 0;
+        } collisionSpecializationData;
+
+        std::vector<VkSpecializationMapEntry> collisionSpecializationMapEntries = {
+            vks::initializers::specializationMapEntry(0, offsetof(CollisionSpecializationData, workgroupSize),  sizeof(int32_t)),
+            vks::initializers::specializationMapEntry(1, offsetof(CollisionSpecializationData, pass),           sizeof(int32_t)),
+        };
+
+        VkSpecializationInfo collisionSpecializationInfo =
+            vks::initializers::specializationInfo(
+                collisionSpecializationMapEntries.size(),
+                collisionSpecializationMapEntries.data(),
+                sizeof(collisionSpecializationData),
+                &collisionSpecializationData);
+
+        computePipelineCreateInfo.stage = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/collide.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        computePipelineCreateInfo.stage.pSpecializationInfo = &collisionSpecializationInfo;
+
+        // Counting sort pipelines
+        collisionSpecializationData.pass = 0;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.countPipeline));
+        collisionSpecializationData.pass = 1;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.scanBucketsPipeline));
+        collisionSpecializationData.pass = 2;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.scanBlocksPipeline));
+        collisionSpecializationData.pass = 3;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.scatterPipeline));
+
+        // Resolve pipeline
+        collisionSpecializationData.pass = 4;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.resolvePipeline));
+
+        // Apply pipeline
+        collisionSpecializationData.pass = 5;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.applyPipeline));
+        shaderCache.release(computePipelineCreateInfo.stage.module);
+    }
+
+    /// Rigid rocks only get their planet shadow computed, simulated rocks are moved and collided first.
+    void recordRocksSimulation(VkCommandBuffer cmdBuffer)
+    {
+        const uint32_t groupCount = (INSTANCE_COUNT + NBODY_WORKGROUP_SIZE - 1) / NBODY_WORKGROUP_SIZE;
+
+        // Previous frame must be done with the rocks - vertex input, or vertex shader with vertex pulling - before they are moved again
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, NULL);
+
+        VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+        bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = compute.velocityBuffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+
+        if (rocksSim == RocksSim::GPU)
+        {
+            // Empty buckets, overlaps with gravity
+            if (ENABLE_COLLISIONS)
+            {
+                vkCmdFillBuffer(cmdBuffer, compute.bucketCounts.buffer, 0, VK_WHOLE_SIZE, 0);
+            }
+
+            // Kick
+            vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.calculatePipeline);
+            vkCmdDispatch(cmdBuffer, groupCount, 1, 1);
+
+            vkCmdPipelineBarrier(
+                cmdBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                0, nullptr,
+                1, &bufferBarrier,
+                0, nullptr);
+
+            // Drift
+            vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.integratePipeline);
+            vkCmdDispatch(cmdBuffer, groupCount, 1, 1);
+
+            if (ENABLE_COLLISIONS)
+            {
+                // Every pass reads what the previous one wrote, cleared buckets included
+                memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                const uint32_t bucketGroupCount = (compute.ubo.tableSize + NBODY_WORKGROUP_SIZE - 1) / NBODY_WORKGROUP_SIZE;
+                const std::pair<VkPipeline, uint32_t> collisionPasses[] = {
+                    { compute.countPipeline,       groupCount       },
+                    { compute.scanBucketsPipeline, bucketGroupCount },
+                    { compute.scanBlocksPipeline,  1                },
+                    { compute.scatterPipeline,     groupCount       },
+                    { compute.resolvePipeline,     groupCount       },
+                    { compute.applyPipeline,       groupCount       },
+                };
+                for (const auto& [pipeline, passGroupCount] : collisionPasses)
+                {
+                    vkCmdPipelineBarrier(
+                        cmdBuffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        0,
+                        1, &memoryBarrier,
+                        0, nullptr,
+                        0, nullptr);
+
+                    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+                    vkCmdDispatch(cmdBuffer, passGroupCount, 1, 1);
+                }
+            }
+
+            // Shadows are computed at final positions
+            bufferBarrier.buffer = instanceBuffer.buffer;
+            bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(
+                cmdBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                0, nullptr,
+                1, &bufferBarrier,
+                0, nullptr);
+        }
+
+        // Planet shadow, once per rock
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.shadePipeline);
+        vkCmdDispatch(cmdBuffer, groupCount, 1, 1);
+
+        // New positions and shadows are consumed as per-instance vertex attributes, or read by the vertex shader with vertex pulling
+        bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        bufferBarrier.buffer = instanceBuffer.buffer;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+            0,
+            0, nullptr,
+            1, &bufferBarrier,
+            0, nullptr);
+    }
+
+    /// Buffers and both culling pipelines (cull.comp specialized by phase), and the depth pyramid.
+    /// Rocks are read from where they are drawn from otherwise - instance buffer, or CPU's slice of dynamic instance buffer,
+    /// selected by dynamic offset.
+    void prepareCulling()
+    {
+        const VkDeviceSize commandsSize = 2 * sizeof(VkDrawIndexedIndirectCommand);
+
+        // Model dimensions are in file units, rocks rotate around their origin
+        const vks::Model& rock = models.rockModel;
+        culling.rockRadius = glm::length(glm::max(glm::abs(rock.dim.min), glm::abs(rock.dim.max))) * INSTANCE_SCALE;
+
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &culling.visibility,
+            INSTANCE_COUNT * sizeof(uint32_t)));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &culling.earlyInstances,
+            instanceBuffer.size));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &culling.lateInstances,
+            instanceBuffer.size));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &culling.commands,
+            commandsSize));
+
+        // Everything is visible in the first frame, instance counts are cleared every frame
+        VkDrawIndexedIndirectCommand commands[2] = {};
+        for (VkDrawIndexedIndirectCommand& command : commands)
+        {
+            command.indexCount = models.rockModel.indexCount;
+        }
+        VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vkCmdUpdateBuffer(copyCmd, culling.commands.buffer, 0, commandsSize, commands);
+        vkCmdFillBuffer(copyCmd, culling.visibility.buffer, 0, VK_WHOLE_SIZE, 1);
+        VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings =
+        {
+            // Binding 0 : Instance data, simulated or streamed
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                0),
+            // Binding 1 : Scene uniform buffer (view, projection, rotation of rigid rings)
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                1),
+            // Binding 2 : Visibility
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                2),
+            // Binding 3 : Early instances
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                3),
+            // Binding 4 : Late instances
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                4),
+            // Binding 5 : Indirect draw commands
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                5),
+            // Binding 6 : Depth pyramid
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                6),
+        };
+
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(
+                setLayoutBindings.data(),
+                setLayoutBindings.size());
+
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &culling.descriptorSetLayout));
+
+        VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(
+                &culling.descriptorSetLayout,
+                1);
+        VkPushConstantRange pushConstantRange =
+            vks::initializers::pushConstantRange(
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                sizeof(CullPushConsts),
+                0);
+        pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &culling.pipelineLayout));
+
+        VkDescriptorSetAllocateInfo descripotrSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(descriptorPool, &culling.descriptorSetLayout, 1);
+
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &culling.descriptorSet));
+
+        // One slice of dynamic instance buffer, at dynamic offset
+        VkDescriptorBufferInfo instancesDescriptor = instanceBuffer.descriptor;
+        if (rocksSim == RocksSim::CPU)
+        {
+            instancesDescriptor.buffer = dynamicInstanceBuffer.buffer;
+        }
+
+        // Binding 6 is written once the pyramid exists, in buildCommandBuffers()
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0, &instancesDescriptor),       // Binding 0 : Instance data
+            vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &uniformBuffers.scene.descriptor),    // Binding 1 : Scene uniform buffer
+            vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &culling.visibility.descriptor),      // Binding 2 : Visibility
+            vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &culling.earlyInstances.descriptor),  // Binding 3 : Early instances
+            vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &culling.lateInstances.descriptor),   // Binding 4 : Late instances
+            vks::initializers::writeDescriptorSet(culling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5, &culling.commands.descriptor),        // Binding 5 : Indirect draw commands
+        };
+        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+
+        // Specialization constants - workgroup size, phase
+        struct CullSpecializationData {
+            int32_t workgroupSize = CULL_WORKGROUP_SIZE;
+            int32_t phase         = 0;
+        } cullSpecializationData;
+
+        std::vector<VkSpecializationMapEntry> specializationMapEntries = {
+            vks::initializers::specializationMapEntry(0, offsetof(CullSpecializationData, workgroupSize), sizeof(int32_t)),
+            vks::initializers::specializationMapEntry(1, offsetof(CullSpecializationData, phase),         sizeof(int32_t)),
+        };
+        VkSpecializationInfo specializationInfo =
+            vks::initializers::specializationInfo(specializationMapEntries.size(), specializationMapEntries.data(), sizeof(cullSpecializationData), &cullSpecializationData);
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo =
+            vks::initializers::computePipelineCreateInfo(
+                culling.pipelineLayout,
+                0);
+        computePipelineCreateInfo.stage = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+
+        cullSpecializationData.phase = 0;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &culling.earlyPipeline));
+        cullSpecializationData.phase = 1;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &culling.latePipeline));
+        shaderCache.release(computePipelineCreateInfo.stage.module);
+
+        const VkPipelineShaderStageCreateInfo reduceShaderStage =
+            shaderCache.acquire(device, getAssetPath() + "shaders/base/hiz.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        culling.depthPyramid.prepare(vulkanDevice, pipelineCache, reduceShaderStage);
+        shaderCache.release(reduceShaderStage.module);
+    }
+
+    /// Buffers and pipeline of shadow caster sorting (shadow_cull.comp). Rocks are read from where the shadow pass would read
+    /// them otherwise - instance buffer, or CPU's slice of dynamic instance buffer, selected by dynamic offset.
+    void prepareShadowCulling()
+    {
+        const VkDeviceSize commandsSize = 6 * sizeof(VkDrawIndexedIndirectCommand);
+
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &shadowCulling.instances,
+            6 * instanceBuffer.size));
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            &shadowCulling.commands,
+            commandsSize));
+
+        // Instance counts are cleared before every dispatch
+        VkDrawIndexedIndirectCommand commands[6] = {};
+        for (VkDrawIndexedIndirectCommand& command : commands)
+        {
+            command.indexCount = models.rockShadowModel.indexCount;
+        }
+        VkCommandBuffer copyCmd = VulkanExampleBase::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vkCmdUpdateBuffer(copyCmd, shadowCulling.commands.buffer, 0, commandsSize, commands);
+        VulkanExampleBase::flushCommandBuffer(copyCmd, queue, true);
+
+        std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings =
+        {
+            // Binding 0 : Instance data, simulated or streamed
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                0),
+            // Binding 1 : Scene uniform buffer (light position, rotation of rigid rings)
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                1),
+            // Binding 2 : Instances of faces
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                2),
+            // Binding 3 : Indirect draw commands
+            vks::initializers::descriptorSetLayoutBinding(
+                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                3),
+        };
+
+        VkDescriptorSetLayoutCreateInfo descriptorLayout =
+            vks::initializers::descriptorSetLayoutCreateInfo(
+                setLayoutBindings.data(),
+                setLayoutBindings.size());
+
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &shadowCulling.descriptorSetLayout));
+
+        VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo =
+            vks::initializers::pipelineLayoutCreateInfo(
+                &shadowCulling.descriptorSetLayout,
+                1);
+        VkPushConstantRange pushConstantRange =
+            vks::initializers::pushConstantRange(
+                VK_SHADER_STAGE_COMPUTE_BIT,
+                sizeof(CullPushConsts),
+                0);
+        pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &shadowCulling.pipelineLayout));
+
+        VkDescriptorSetAllocateInfo descripotrSetAllocInfo =
+            vks::initializers::descriptorSetAllocateInfo(descriptorPool, &shadowCulling.descriptorSetLayout, 1);
+
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &shadowCulling.descriptorSet));
+
+        // One slice of dynamic instance buffer, at dynamic offset
+        VkDescriptorBufferInfo instancesDescriptor = instanceBuffer.descriptor;
+        if (rocksSim == RocksSim::CPU)
+        {
+            instancesDescriptor.buffer = dynamicInstanceBuffer.buffer;
+        }
+
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(shadowCulling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0, &instancesDescriptor),      // Binding 0 : Instance data
+            vks::initializers::writeDescriptorSet(shadowCulling.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &uniformBuffers.scene.descriptor),   // Binding 1 : Scene uniform buffer
+            vks::initializers::writeDescriptorSet(shadowCulling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &shadowCulling.instances.descriptor), // Binding 2 : Instances of faces
+            vks::initializers::writeDescriptorSet(shadowCulling.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &shadowCulling.commands.descriptor),  // Binding 3 : Indirect draw commands
+        };
+        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+
+        // Specialization constants - workgroup size, instances in one face's slice
+        struct ShadowCullSpecializationData {
+            int32_t  workgroupSize = SHADOW_CULL_WORKGROUP_SIZE;
+            uint32_t faceCapacity  = INSTANCE_COUNT;
+        } shadowCullSpecializationData;
+
+        std::vector<VkSpecializationMapEntry> specializationMapEntries = {
+            vks::initializers::specializationMapEntry(0, offsetof(ShadowCullSpecializationData, workgroupSize), sizeof(int32_t)),
+            vks::initializers::specializationMapEntry(1, offsetof(ShadowCullSpecializationData, faceCapacity),  sizeof(uint32_t)),
+        };
+        VkSpecializationInfo specializationInfo =
+            vks::initializers::specializationInfo(specializationMapEntries.size(), specializationMapEntries.data(), sizeof(shadowCullSpecializationData), &shadowCullSpecializationData);
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo =
+            vks::initializers::computePipelineCreateInfo(
+                shadowCulling.pipelineLayout,
+                0);
+        computePipelineCreateInfo.stage = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/shadow_cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+        computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &shadowCulling.pipeline));
+        shaderCache.release(computePipelineCreateInfo.stage.module);
+    }
+
+    /// Offscreen frame, the upscaler and the motion pipeline of rocks - its render pass comes from the upscaler.
+    /// Previous instances are created with the instance data, sets 1 get them by setupVertexPullingDescriptorSets().
+    void prepareTemporalAA()
+    {
+        const VkPipelineShaderStageCreateInfo fullscreenStage =
+            shaderCache.acquire(device, getAssetPath() + "shaders/base/fullscreen.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        const VkPipelineShaderStageCreateInfo upscaleStage =
+            shaderCache.acquire(device, getAssetPath() + "shaders/base/upscale.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        const VkPipelineShaderStageCreateInfo resolveStage =
+            shaderCache.acquire(device, getAssetPath() + "shaders/base/temporal_upscale.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        temporalAA.frame.prepare(vulkanDevice, pipelineCache, swapChain.colorFormat, drawCmdBuffers.size(), fullscreenStage, upscaleStage);
+        temporalAA.upscaler.prepare(vulkanDevice, pipelineCache, swapChain.colorFormat, depthFormat, fullscreenStage, resolveStage);
+        temporalAA.upscaler.isEnabled = true;
+        shaderCache.release(fullscreenStage.module);
+        shaderCache.release(upscaleStage.module);
+        shaderCache.release(resolveStage.module);
+
+        vk229::DepthPyramid::createRenderPasses(device, swapChain.colorFormat, depthFormat, temporalAA.renderPass, temporalAA.lateRenderPass,
+                                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &temporalAA.uniformBuffer,
+            sizeof(temporalAA.ubo)));
+
+        // Map persistent
+        VK_CHECK_RESULT(temporalAA.uniformBuffer.map());
+
+        // Rocks as in the scene, no vertex input - depth of the late pass is tested for EQUAL, not written
+        VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
+            vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+        VkPipelineRasterizationStateCreateInfo rasterizationState =
+            vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE, 0);
+        VkPipelineColorBlendAttachmentState blendAttachmentState =
+            vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+        VkPipelineColorBlendStateCreateInfo colorBlendState =
+            vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
+        VkPipelineDepthStencilStateCreateInfo depthStencilState =
+            vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_FALSE, VK_COMPARE_OP_EQUAL);
+        VkPipelineViewportStateCreateInfo viewportState =
+            vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+        VkPipelineMultisampleStateCreateInfo multisampleState =
+            vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+        std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        VkPipelineDynamicStateCreateInfo dynamicState =
+            vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables.data(), dynamicStateEnables.size(), 0);
+        VkPipelineVertexInputStateCreateInfo inputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+        const uint32_t vertexStride = vertexLayout.stride() / sizeof(float);
+        VkSpecializationMapEntry pullingSpecializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+        VkSpecializationInfo pullingSpecializationInfo = vks::initializers::specializationInfo(1, &pullingSpecializationMapEntry, sizeof(vertexStride), &vertexStride);
+
+        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
+        shaderStages[0] = shaderCache.acquire(device, getAssetPath() + "shaders/instancing-229/instancing.motion.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        shaderStages[0].pSpecializationInfo = &pullingSpecializationInfo;
+        shaderStages[1] = shaderCache.acquire(device, getAssetPath() + "shaders/base/motion.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        VkGraphicsPipelineCreateInfo pipelineCreateInfo =
+            vks::initializers::pipelineCreateInfo(pipelineLayout, temporalAA.upscaler.motionRenderPass, 0);
+        pipelineCreateInfo.pVertexInputState = &inputState;
+        pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+        pipelineCreateInfo.pRasterizationState = &rasterizationState;
+        pipelineCreateInfo.pColorBlendState = &colorBlendState;
+        pipelineCreateInfo.pMultisampleState = &multisampleState;
+        pipelineCreateInfo.pViewportState = &viewportState;
+        pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+        pipelineCreateInfo.pDynamicState = &dynamicState;
+        pipelineCreateInfo.stageCount = shaderStages.size();
+        pipelineCreateInfo.pStages = shaderStages.data();
+        VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &temporalAA.pipeline));
+        shaderCache.release(shaderStages[0].module);
+        shaderCache.release(shaderStages[1].module);
+    }
+
+    /// Sets 1 of early and late rocks - the instances they draw and the rock vertices.
+    void setupVertexPullingDescriptorSets()
+    {
+        // Instances the vertex input would read: one slice of dynamic instance buffer (at dynamic offset) or the compacted ones
+        VkDescriptorBufferInfo earlyInstancesDescriptor = instanceBuffer.descriptor;
+        if (rocksSim == RocksSim::CPU)
+        {
+            earlyInstancesDescriptor.buffer = dynamicInstanceBuffer.buffer;
+        }
+        if (culling.isEnabled)
+        {
+            earlyInstancesDescriptor = culling.earlyInstances.descriptor;
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo =
+            vks::initializers::descriptorSetAllocateInfo(descriptorPool, &vertexPulling.descriptorSetLayout, 1);
+
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &vertexPulling.earlyDescriptorSet));
+        std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+            vks::initializers::writeDescriptorSet(vertexPulling.earlyDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0, &earlyInstancesDescriptor),            // Binding 0 : Instance data
+            vks::initializers::writeDescriptorSet(vertexPulling.earlyDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &vertexPulling.meshes.verticesDescriptor),     // Binding 1 : Vertices
+        };
+
+        if (culling.isEnabled)
+        {
+            VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &vertexPulling.lateDescriptorSet));
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(vertexPulling.lateDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0, &culling.lateInstances.descriptor)); // Binding 0 : Late instances
+            writeDescriptorSets.push_back(
+                vks::initializers::writeDescriptorSet(vertexPulling.lateDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &vertexPulling.meshes.verticesDescriptor)); // Binding 1 : Vertices
+        }
+
+        // Rocks of both draws find their previous instance by rock index
+        std::vector<VkDescriptorSet> motionDescriptorSets = { vertexPulling.earlyDescriptorSet };
+        if (culling.isEnabled)
+        {
+            motionDescriptorSets.push_back(vertexPulling.lateDescriptorSet);
+        }
+        if (temporalAA.isEnabled)
+        {
+            for (VkDescriptorSet descriptorSet : motionDescriptorSets)
+            {
+                writeDescriptorSets.push_back(
+                    vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &temporalAA.previousInstances.descriptor)); // Binding 2 : Previous instances
+                writeDescriptorSets.push_back(
+                    vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &temporalAA.uniformBuffer.descriptor));     // Binding 3 : Motion
+            }
+        }
+        vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+    }
+
+    /// Early phase also clears instance counts of both draws, after the previous frame has drawn them.
+    void recordCulling(VkCommandBuffer cmdBuffer, uint32_t bufferIndex, VkPipeline phasePipeline)
+    {
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+
+        if (phasePipeline == culling.earlyPipeline)
+        {
+            // Previous frame's draws and culling, and this frame's simulation
+            memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(
+                cmdBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0,
+                1, &memoryBarrier,
+                0, nullptr,
+                0, nullptr);
+
+            for (uint32_t draw = 0; draw < 2; draw++)
+            {
+                vkCmdFillBuffer(cmdBuffer, culling.commands.buffer, draw * sizeof(VkDrawIndexedIndirectCommand) + offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+            }
+
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(
+                cmdBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0,
+                1, &memoryBarrier,
+                0, nullptr,
+                0, nullptr);
+        }
+
+        const uint32_t dynamicOffset = rocksSim == RocksSim::CPU ? static_cast<uint32_t>(dynamicInstanceBuffer.getSliceOffset(bufferIndex)) : 0;
+
+        CullPushConsts pushConsts;
+        pushConsts.instanceCount = INSTANCE_COUNT;
+        pushConsts.rockRadius    = culling.rockRadius;
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, phasePipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.pipelineLayout, 0, 1, &culling.descriptorSet, 1, &dynamicOffset);
+        vkCmdPushConstants(cmdBuffer, culling.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConsts), &pushConsts);
+        vkCmdDispatch(cmdBuffer, (INSTANCE_COUNT + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+        // Draw commands and compacted instances - read as vertex attributes, or by the vertex shader with vertex pulling
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+    }
+
+    /// Clears instance counts of the faces after the previous shadow pass has drawn them, and sorts rocks into faces.
+    void recordShadowCulling(VkCommandBuffer cmdBuffer, uint32_t bufferIndex)
+    {
+        // Previous shadow pass, and this frame's simulation
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            vkCmdFillBuffer(cmdBuffer, shadowCulling.commands.buffer, face * sizeof(VkDrawIndexedIndirectCommand) + offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+        }
+
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+
+        const uint32_t dynamicOffset = rocksSim == RocksSim::CPU ? static_cast<uint32_t>(dynamicInstanceBuffer.getSliceOffset(bufferIndex)) : 0;
+
+        CullPushConsts pushConsts;
+        pushConsts.instanceCount = INSTANCE_COUNT;
+        pushConsts.rockRadius    = compute.ubo.rockRadius;
+
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadowCulling.pipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shadowCulling.pipelineLayout, 0, 1, &shadowCulling.descriptorSet, 1, &dynamicOffset);
+        vkCmdPushConstants(cmdBuffer, shadowCulling.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConsts), &pushConsts);
+        vkCmdDispatch(cmdBuffer, (INSTANCE_COUNT + SHADOW_CULL_WORKGROUP_SIZE - 1) / SHADOW_CULL_WORKGROUP_SIZE, 1, 1);
+
+        // Draw commands and instances of faces
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+    }
+
+    /// Temporal AA is prepared and on.
+    bool isTemporalAA() const
+    {
+        return temporalAA.isEnabled && temporalAA.upscaler.isEnabled;
+    }
+
+    /// Early and late rocks again, with the motion pipeline - they read the same instances as in the scene's passes.
+    void recordRocksMotion(VkCommandBuffer cmdBuffer, uint32_t bufferIndex)
+    {
+        uint32_t dynamicOffset = 0;
+        if (rocksSim == RocksSim::CPU && !culling.isEnabled)
+        {
+            dynamicOffset = static_cast<uint32_t>(dynamicInstanceBuffer.getSliceOffset(bufferIndex));
+        }
+
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.instancedRocksVkDescrSet, 0, NULL);
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, temporalAA.pipeline);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &vertexPulling.earlyDescriptorSet, 1, &dynamicOffset);
+        vertexPulling.meshes.bindIndexBuffer(cmdBuffer);
+        if (!culling.isEnabled)
+        {
+            vkCmdDrawIndexed(cmdBuffer, models.rockModel.indexCount, INSTANCE_COUNT, 0, 0, 0);
+            return;
+        }
+        vkCmdDrawIndexedIndirect(cmdBuffer, culling.commands.buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+
+        dynamicOffset = 0;
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &vertexPulling.lateDescriptorSet, 1, &dynamicOffset);
+        vkCmdDrawIndexedIndirect(cmdBuffer, culling.commands.buffer, sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    /// Instances of this frame become the previous ones of the next - copied from the instance buffer in use (the slice of this
+    /// command buffer in CPU mode), after the motion pass read the previous ones.
+    void recordPreviousInstances(VkCommandBuffer cmdBuffer, uint32_t bufferIndex)
+    {
+        // Simulation wrote the instances, motion pass read the previous ones
+        VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+
+        VkBuffer     source     = instanceBuffer.buffer;
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = temporalAA.previousInstances.size;
+        if (rocksSim == RocksSim::CPU)
+        {
+            source               = dynamicInstanceBuffer.buffer;
+            copyRegion.srcOffset = dynamicInstanceBuffer.getSliceOffset(bufferIndex);
+        }
+        vkCmdCopyBuffer(cmdBuffer, source, temporalAA.previousInstances.buffer, 1, &copyRegion);
+
+        // Read by the next frame's motion pass, whose simulation writes the instances again
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            cmdBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1, &memoryBarrier,
+            0, nullptr,
+            0, nullptr);
+    }
+
+    void prepareUniformBuffers()
+    {
+        VK_CHECK_RESULT(vulkanDevice->createBuffer(
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &uniformBuffers.scene,
+            sizeof(uboVS)));
+
+        // Map persistent
+        VK_CHECK_RESULT(uniformBuffers.scene.map());
+
+        updateUniformBuffer(true);
+    }
+
+    void updateLight()
+    {
+        // Moves light and, in CPU mode, rocks - they are written to instance buffer in draw()
+        nbody.step(frameTimer);
+
+        if (rocksSim == RocksSim::CPU && ENABLE_COLLISIONS)
+        {
+            // Accelerations stay from the step - positions are corrected only slightly
+            collisions.obstacles[LIGHT_ATTRACTOR_ID].center = nbody.attractors[LIGHT_ATTRACTOR_ID].pos;
+            collisions.resolve(nbody.getThreadPool(), nbody.bodies);
+        }
+
+        const float k = 0.25f * frameTimer;
+        uboVS.lightInt = LIGHT_INTENSITY*k + uboVS.lightInt*(1.0f - k);
+        uboVS.lightPos = glm::vec4(nbody.attractors[LIGHT_ATTRACTOR_ID].pos, 1.0f);
+    }
+
+    void updateUniformBuffer(bool viewChanged)
+    {
+        if (viewChanged)
+        {
+//            std::cout << "  >> VulkanExample-229::updateUniformBuffer(bool viewChanged) cameraPos = {" << cameraPos.x << " , " << cameraPos.y << " , " << cameraPos.z << "}\n";
+//            std::cout << "  >> VulkanExample-229::updateUniformBuffer(bool viewChanged) rotation = {" << rotation.x << ",  " << rotation.y << " , " << rotation.z << "}\n";
+//            std::cout << "  >> VulkanExample-229::updateUniformBuffer(bool viewChanged) zoom = {" << zoom << "}\n";
 
             uboVS.projection = camera.matrices.perspective;
 
@@ -668,22 +2620,86 @@ public:
         if (!paused)
         {
             uboVS.locSpeed  += frameTimer * 0.35f;
-            uboVS.globSpeed += frameTimer * 0.01f;
+            if (rocksSim == RocksSim::RIGID)
+            {
+                uboVS.globSpeed += frameTimer * 0.01f;
+            }
             updateLight();
         }
+        updateShadowFaces();
+        memcpy(uniformBuffers.scene.mapped, &uboVS, sizeof(uboVS));
+
+        if (rocksSim != RocksSim::CPU && compute.uniformBuffer.mapped)
+        {
+            updateComputeUniformBuffer();
+        }
+    }
+
+    void updateComputeUniformBuffer()
+    {
+        // Simulation is dispatched every frame, zero time step freezes the rocks.
+        compute.ubo.deltaT   = paused ? 0.0f : frameTimer;
+        compute.ubo.lightPos = uboVS.lightPos;
+        if (rocksSim == RocksSim::RIGID)
+        {
+            // Rigid rocks are rotated by globSpeed only in the vertex shader - light is rotated back into their space,
+            // planet shadow is symmetric around the axis.
+            const float s = sin(uboVS.globSpeed);
+            const float c = cos(uboVS.globSpeed);
+            const glm::vec4 l = uboVS.lightPos;
+            compute.ubo.lightPos = glm::vec4(c * l.x + s * l.z, l.y, -s * l.x + c * l.z, 1.0f);
+        }
+        memcpy(compute.uniformBuffer.mapped, &compute.ubo, sizeof(compute.ubo));
+    }
+
+    /// Jittered projection of this frame, and motion from what the previous one was drawn with - right before it is submitted.
+    void updateTemporalAA()
+    {
+        uboVS.projection = temporalAA.upscaler.beginFrame(uboVS.view, camera.matrices.perspective, width, height);
         memcpy(uniformBuffers.scene.mapped, &uboVS, sizeof(uboVS));
+
+        temporalAA.ubo.viewProjection         = temporalAA.upscaler.viewProjection;
+        temporalAA.ubo.previousViewProjection = temporalAA.upscaler.previousViewProjection;
+        memcpy(temporalAA.uniformBuffer.mapped, &temporalAA.ubo, sizeof(temporalAA.ubo));
+
+        // Spin of this frame is the previous one of the next
+        temporalAA.ubo.previousLocSpeed  = uboVS.locSpeed;
+        temporalAA.ubo.previousGlobSpeed = uboVS.globSpeed;
     }
 
     void draw()
     {
         VulkanExampleBase::prepareFrame();
 
-        // Command buffer to be sumitted to the queue
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+        // Rocks simulated on CPU go to the slice read by this frame's command buffer
+        VkFence frameFence = VK_NULL_HANDLE;
+        if (rocksSim == RocksSim::CPU)
+        {
+            uint8_t* slice = static_cast<uint8_t*>(dynamicInstanceBuffer.beginWrite(currentBuffer));
+            nbody.writePositions(slice + offsetof(InstanceData, pos), sizeof(InstanceData));
+
+            const vk229::BodiesSoA& bodies = nbody.bodies;
+            planetShadow.setup(glm::vec3(uboVS.lightPos), SHADOW_LIGHT_RADIUS, nbody.attractors[PLANET_ATTRACTOR_ID].pos, SHADOW_PLANET_RADIUS);
+            planetShadow.writeLightFactors(nbody.getThreadPool(), bodies.px.data(), bodies.py.data(), bodies.pz.data(), bodies.size(),
+                                           slice + offsetof(InstanceData, shadow), sizeof(InstanceData));
+            dynamicInstanceBuffer.endWrite(currentBuffer);
+            frameFence = dynamicInstanceBuffer.getFence(currentBuffer);
+        }
+
+        if (isTemporalAA())
+        {
+            updateTemporalAA();
+        }
+
+        // Command buffers to be sumitted to the queue - nothing to update while nothing moves
+        const VkCommandBuffer cmdBuffers[2] = { updateCmdBuffers[currentBuffer], drawCmdBuffers[currentBuffer] };
+        const bool isUpdated = !paused || !shadowMap.isValid;
+        submitInfo.commandBufferCount = isUpdated ? 2 : 1;
+        submitInfo.pCommandBuffers = isUpdated ? &cmdBuffers[0] : &cmdBuffers[1];
+        shadowMap.isValid = true;
 
         // Submit to queue
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, frameFence));
 
         VulkanExampleBase::submitFrame();
     }
@@ -691,13 +2707,48 @@ public:
     void prepare() override
     {
         VulkanExampleBase::prepare();
+
+        // Rocks are simulated and shaded in the graphics queue, fall back to CPU when it can't do compute
+        const VkQueueFlags graphicsQueueFlags = vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].queueFlags;
+        if (rocksSim != RocksSim::CPU && !(graphicsQueueFlags & VK_QUEUE_COMPUTE_BIT))
+        {
+            std::cout << "Graphics queue does not support compute, rocks will be simulated on CPU\n";
+            rocksSim = RocksSim::CPU;
+        }
+        culling.isEnabled = ENABLE_OCCLUSION_CULLING && (graphicsQueueFlags & VK_QUEUE_COMPUTE_BIT) &&
+                            vk229::DepthPyramid::isDepthFormatSupported(physicalDevice, depthFormat);
+        shadowCulling.isEnabled = ENABLE_ROCK_SHADOWS && (graphicsQueueFlags & VK_QUEUE_COMPUTE_BIT);
+        temporalAA.isEnabled = ENABLE_TEMPORAL_AA && vertexPulling.isEnabled;
+
         loadAssets();
         prepareInstanceData();
         prepareUniformBuffers();
         setupDescriptorSetLayout();
+        prepareShadowMap();
         preparePipelines();
         setupDescriptorPool();
         setupDescriptorSet();
+        if (rocksSim != RocksSim::CPU)
+        {
+            prepareCompute();
+        }
+        if (culling.isEnabled)
+        {
+            prepareCulling();
+        }
+        if (shadowCulling.isEnabled)
+        {
+            prepareShadowCulling();
+        }
+        if (temporalAA.isEnabled)
+        {
+            prepareTemporalAA();
+        }
+        if (vertexPulling.isEnabled)
+        {
+            setupVertexPullingDescriptorSets();
+        }
+        buildUpdateCommandBuffers();
         buildCommandBuffers();
         prepared = true;
     }
@@ -716,6 +2767,10 @@ public:
         {
             updateUniformBuffer(false);
         }
+        else if (rocksSim != RocksSim::CPU)
+        {
+            updateComputeUniformBuffer();
+        }
     }
 
     virtual void viewChanged() override
@@ -725,8 +2780,12 @@ public:
 
     virtual void getOverlayText(VulkanTextOverlay *textOverlay) override
     {
-        textOverlay->addText("Rendering " + std::to_string(INSTANCE_COUNT) + " instances", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
-        textOverlay->addText("LMB to rotate, MMB to move, RMB or numpad +/- to zoom", 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+        textOverlay->addText("Rendering " + std::to_string(INSTANCE_COUNT) + " instances" + (rocksSim == RocksSim::GPU ? ", simulated on GPU" : rocksSim == RocksSim::CPU ? ", simulated on CPU" : ""), 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+        textOverlay->addText(std::string("LMB to rotate, MMB to move, RMB or numpad +/- to zoom") + (temporalAA.isEnabled ? ", T for temporal AA" : ""), 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+        if (isTemporalAA())
+        {
+            textOverlay->addText("Temporal anti-aliasing", 5.0f, 125.0f, VulkanTextOverlay::alignLeft);
+        }
     }
 
     virtual void keyPressed(uint32_t key) override
@@ -741,6 +2800,15 @@ public:
             zoom *= 1.41f;
             updateUniformBuffer(true);
         break;
+        case KEY_T:
+            if (temporalAA.isEnabled)
+            {
+                // Projection is jittered by draw() only while it is on
+                temporalAA.upscaler.isEnabled = !temporalAA.upscaler.isEnabled;
+                buildCommandBuffers();
+                updateUniformBuffer(true);
+            }
+        break;
         }
     }
 };
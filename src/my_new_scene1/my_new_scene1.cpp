@@ -7,10 +7,15 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <iomanip>
+#include <sstream>
 #include <vector>
 #include <map>
 #include <random>
+#include <thread>
 #include <HelperStructsAndFuncs.hpp>
+#include <DynamicResolution.hpp>
+#include <TemporalUpscaler.hpp>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -25,12 +30,57 @@
 
 #define VERTEX_BUFFER_BIND_ID   0
 #define ENABLE_VALIDATION       false
+#define ENABLE_OCCLUSION_CULLING true  // Two-phase Hi-Z culling of entities on GPU. Needs compute in the graphics queue.
+#define ENABLE_FRUSTUM_CULLING   true  // SIMD frustum culling of entities on CPU, when they are not culled on GPU.
+#define SCENE_FILENAME           "my_new_scene1.scene"
+#define ENABLE_HOT_RELOAD        true  // Scene file, textures, meshes and shaders are reloaded when they change (inotify).
+#define ENABLE_ASYNC_PIPELINES   true  // Pipelines are created on worker threads, entities are drawn when theirs are ready.
+#define DRAW_FALLBACK_PIPELINES  true  // Meanwhile entities are drawn untextured (fallback.frag), instead of not at all.
+#define ENABLE_VERTEX_PULLING    true  // All meshes in one buffer, vertex shaders read vertices by gl_VertexIndex - no vertex input.
+#define ENABLE_OVERDRAW_DIAGNOSTICS true // O toggles overdraw heatmap, overdraw of the view is measured per entity and printed.
+#define ENABLE_VISIBILITY_BUFFER true  // B toggles shading through a visibility buffer - ids of entities and triangles, then materials per pixel. Needs vertex pulling.
+#define ENABLE_CLUSTERED_LIGHTS  true  // Dynamic point and spot lights, binned into clusters of the view by compute - pixels shade only nearby ones.
+#define MOVING_LIGHT_COUNT       1024  // Lights circling over the scene, with clustered lights.
+#define ANIMATE_DROID            true  // Droid turns to and fro through the transform hierarchy, entities attached to it follow.
+#define DROID_TURN_ANGLE         0.35f // Radians, to either side.
+#define DROID_TURN_SPEED         0.8f  // Radians of the sway's phase per second.
+#define ENABLE_DYNAMIC_RESOLUTION true // Scene is rendered at a resolution which holds TARGET_FRAME_TIME of GPU time, then upscaled with sharpening.
+#define TARGET_FRAME_TIME        16.6f // Milliseconds.
+#define MIN_RESOLUTION_SCALE     0.5f  // Of the window size, on every axis.
+#define UPSCALE_SHARPNESS        0.5f  // 0 .. 1.
+#define ENABLE_TEMPORAL_UPSCALING true // T toggles temporal anti-aliasing of the scene at dynamic resolution - jittered frames accumulate into the window size. Needs vertex pulling.
 
 class VulkanExample : public VulkanExampleBase
 {
 public:
     vk229::SceneData sceneData;
 
+    // Late render pass draws entities which were culled by the early one, but are visible now.
+    VkRenderPass lateRenderPass = VK_NULL_HANDLE;
+
+    // Circle of a moving light, around the vertical axis.
+    struct MovingLight
+    {
+        uint32_t  lightIndex;
+        glm::vec3 center;
+        float     radius;
+        float     angularSpeed; // Radians per second.
+        float     phase;
+    };
+    std::vector<MovingLight> movingLights;
+    float                    animationTime = 0.0f; // Seconds of moving lights and the droid, stops when paused.
+
+    // Scene render passes into the offscreen frame of dynamic resolution - the late one leaves it for upscaling.
+    vk229::DynamicResolution dynamicResolution;
+    VkRenderPass             offscreenRenderPass     = VK_NULL_HANDLE;
+    VkRenderPass             offscreenLateRenderPass = VK_NULL_HANDLE;
+    bool                     isFrameScaled           = false; // Command buffers draw at dynamic resolution.
+
+    // Frames at dynamic resolution are jittered, accumulated and upscaled by history, instead of sharpened.
+    vk229::TemporalUpscaler temporalUpscaler;
+    bool                    isFrameTemporal = false;           // Command buffers resolve the frame temporally.
+    glm::mat4               projection      = glm::mat4(1.0f); // Of the scene - the camera's, jittered with temporal upscaling.
+
     VulkanExample() :
         VulkanExampleBase(ENABLE_VALIDATION)
       // {
@@ -108,6 +158,11 @@ public:
     ~VulkanExample()
     {
         sceneData.destroy(device);
+        vkDestroyRenderPass(device, lateRenderPass, nullptr);
+        dynamicResolution.destroy();
+        temporalUpscaler.destroy();
+        vkDestroyRenderPass(device, offscreenRenderPass, nullptr);
+        vkDestroyRenderPass(device, offscreenLateRenderPass, nullptr);
     }
 
 
@@ -115,196 +170,14 @@ public:
 
     void initSceneCreateInfo()
     {
-        // Scene definition here.
-        // Structured like this for future reading from JSON-like file.
-
-    // INPUT_DATA_RETRIEVED_FROM_FILE {
-
-        std::vector<vk229::MeshInfo> meshesInfoVec = {
-            {"box",    "box.obj"},
-            {"light",  "light.obj"},
-            {"floor",  "floor.obj"},
-            {"cube1",  "cube1.obj"},
-            {"cube2",  "cube2.obj"},
-            {"cube3",  "cube3.obj"},
-            {"monkey", "monkey.obj"},
-            {"s1",     "s1.obj"},
-            {"s2",     "s2.obj"},
-            {"s3",     "s3.obj"},
-            {"s4",     "s4.obj"},
-            {"s5",     "s5.obj"},
-            {"s6",     "s6.obj"},
-            {"droid",  "full_droid_2.obj"},
-            {"fluid",  "fluid.obj"},
-            {"debugsc0", "debugscreen0.obj"},
-        };
-
-        std::vector<vk229::ShaderInfo> shadersInfoVec = {
-            {"vert1", VK_SHADER_STAGE_VERTEX_BIT,   "default_transforms.vert.spv"},
-            {"frag1", VK_SHADER_STAGE_FRAGMENT_BIT, "default_material.frag.spv"},
-        };
-
-        std::vector<vk229::TextureInfo> texturesInfoVec = {
-            {"all_diffuse_C",       VK_FORMAT_BC3_UNORM_BLOCK, vk229::TexT::COLOR,        "all_diffuse_C_bc3_1k.dds"},
-            {"all_diffuse_DI",      VK_FORMAT_BC3_UNORM_BLOCK, vk229::TexT::DIFFUSE_DI,   "all_diffuse_DI_bc3_2k.dds"},
-            {"all_ao",              VK_FORMAT_BC4_UNORM_BLOCK, vk229::TexT::AO,           "all_ao_bc4_2k.dds"},
-            {"all_emit",            VK_FORMAT_BC3_UNORM_BLOCK, vk229::TexT::EMIT,         "all_emit_bc3_1k.dds"},
-            {"all_normal",          VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::NORMAL,       "all_normal_bgra_2k.dds"},
-            {"reflection_center",   VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_center_bgra_2kx1k.dds"},
-            {"reflection_droid",    VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_droid_bgra_2kx1k.dds"},
-            {"reflection_monkey",   VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_monkey_bgra_2kx1k.dds"},
-            {"reflection_s1",       VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_s1_bgra_2kx1k.dds"},
-            {"reflection_s2",       VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_s2_bgra_2kx1k.dds"},
-            {"reflection_s3",       VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_s3_bgra_2kx1k.dds"},
-            {"reflection_s4",       VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_s4_bgra_2kx1k.dds"},
-            {"reflection_s5",       VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_s5_bgra_2kx1k.dds"},
-            {"reflection_s6",       VK_FORMAT_B8G8R8A8_UNORM,  vk229::TexT::REFLECTION,   "reflection_s6_bgra_2kx1k.dds"},
-        };
-
-        std::vector<vk229::MatrixInfo> matricesInfoVec = {
-            {"mat1", glm::mat4x4()}, // TODO: make it used, fill correctly.
-        };
-
-        std::vector<vk229::TextureSetInfo> textureSetsInfoVec = {
-            {
-                "TEX_COMMON", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_center",
-                }
-            },
-            {
-                "TEX_DROID", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_droid",
-                }
-            },
-            {
-                "TEX_MONKEY", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_monkey",
-                }
-            },
-            {
-                "TEX_S1", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_s1",
-                }
-            },
-            {
-                "TEX_S2", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_s2",
-                }
-            },
-            {
-                "TEX_S3", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_s3",
-                }
-            },
-            {
-                "TEX_S4", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_s4",
-                }
-            },
-            {
-                "TEX_S5", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_s5",
-                }
-            },
-            {
-                "TEX_S6", {
-                    "all_diffuse_C",
-                    "all_diffuse_DI",
-                    "all_ao",
-                    "all_emit",
-                    "all_normal",
-                    "reflection_s6",
-                }
-            },
-        };
-
-        std::vector<vk229::ShaderSetInfo> shadersSetsInfoVec = {
-            {
-                "SHADER_SET0", {
-                    "frag1",
-                    "vert1",
-                }
-            },
-            {
-                "SHADER_SET1", {
-                    "frag1",
-                    "vert1",
-                }
-            },
-        };
-
-        std::vector<vk229::Entity3dInfo> entitiesInfoVec = {
-            {"Box",     "box",      "mat1", "TEX_COMMON",   "SHADER_SET0"},
-            {"Light",   "light",    "mat1", "TEX_COMMON",   "SHADER_SET0"},
-            {"Floor",   "floor",    "mat1", "TEX_COMMON",   "SHADER_SET0"},
-            {"Cube1",   "cube1",    "mat1", "TEX_MONKEY",   "SHADER_SET0"},
-            {"Cube2",   "cube2",    "mat1", "TEX_MONKEY",   "SHADER_SET0"},
-            {"Cube3",   "cube3",    "mat1", "TEX_MONKEY",   "SHADER_SET0"},
-            {"Monkey",  "monkey",   "mat1", "TEX_MONKEY",   "SHADER_SET0"},
-            {"S1",      "s1",       "mat1", "TEX_S1",       "SHADER_SET0"},
-            {"S2",      "s2",       "mat1", "TEX_S2",       "SHADER_SET0"},
-            {"S3",      "s3",       "mat1", "TEX_S3",       "SHADER_SET0"},
-            {"S4",      "s4",       "mat1", "TEX_S4",       "SHADER_SET0"},
-            {"S5",      "s5",       "mat1", "TEX_S5",       "SHADER_SET0"},
-            {"S6",      "s6",       "mat1", "TEX_S6",       "SHADER_SET0"},
-            {"Droid",   "droid",    "mat1", "TEX_DROID",    "SHADER_SET0"},
-            {"Fluid",   "fluid",    "mat1", "TEX_COMMON",   "SHADER_SET0"},
-            {"Debugsc0","debugsc0", "mat1", "TEX_COMMON",   "SHADER_SET0"},
-        };
-
-    // } // INPUT_DATA_RETRIEVED_FROM_FILE
-
-    // PUTTING_DATA_INTO_MAPS {
-
-        sceneData.sceneInfo.fillMeshesInfoMap(meshesInfoVec);
-        sceneData.sceneInfo.fillShadersInfoMap(shadersInfoVec);
-        sceneData.sceneInfo.fillTexturesInfoMap(texturesInfoVec);
-        sceneData.sceneInfo.fillMatricesInfoMap(matricesInfoVec);
-        sceneData.sceneInfo.fillTexturesSetInfoMap(textureSetsInfoVec);
-        sceneData.sceneInfo.fillShadersSetInfoMap(shadersSetsInfoVec);
-        sceneData.sceneInfo.fillEntities3dInfoMap(entitiesInfoVec);
-
-    // } // PUTTING_DATA_INTO_MAPS
+        // Scene definition is in data/scenes - text form is compiled into binary one when it changes.
+        vk229::SceneFile sceneFile;
+        std::string error;
+        if (!sceneFile.loadOrCompile(getAssetPath() + "scenes/" + SCENE_FILENAME, error))
+        {
+            vks::tools::exitFatal(error, "Error");
+        }
+        sceneData.sceneInfo.fillFromSceneFile(sceneFile);
     }
 
     // void VulkanExampleBase::initVulkan();
@@ -327,14 +200,55 @@ public:
         //     // Setup text overlay (shaders + whole pipeline).
         // }
 
+        const VkQueueFlags graphicsQueueFlags = vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].queueFlags;
+        sceneData.culling.isEnabled = ENABLE_OCCLUSION_CULLING && (graphicsQueueFlags & VK_QUEUE_COMPUTE_BIT) &&
+                                      vk229::DepthPyramid::isDepthFormatSupported(physicalDevice, depthFormat);
+        sceneData.frustumCulling.isEnabled = ENABLE_FRUSTUM_CULLING && !sceneData.culling.isEnabled;
+
+        if (ENABLE_ASYNC_PIPELINES)
+        {
+            sceneData.enableAsyncPipelines(std::max(2u, std::thread::hardware_concurrency()) - 1, DRAW_FALLBACK_PIPELINES); // Main thread keeps a core.
+        }
+        if (ENABLE_VERTEX_PULLING)
+        {
+            sceneData.enableVertexPulling();
+        }
+        if (ENABLE_OVERDRAW_DIAGNOSTICS)
+        {
+            sceneData.enableOverdrawDiagnostics();
+        }
+        if (ENABLE_VISIBILITY_BUFFER && ENABLE_VERTEX_PULLING)
+        {
+            sceneData.enableVisibilityBuffer();
+        }
+        if (ENABLE_CLUSTERED_LIGHTS && (graphicsQueueFlags & VK_QUEUE_COMPUTE_BIT))
+        {
+            sceneData.enableClusteredLights();
+        }
+        const bool isTemporalUpscaling = ENABLE_TEMPORAL_UPSCALING && ENABLE_DYNAMIC_RESOLUTION && ENABLE_VERTEX_PULLING;
+        if (isTemporalUpscaling)
+        {
+            sceneData.enableMotionVectors();
+        }
+
         loadAssets();
         prepareUniformBuffers();
+        prepareVisibilityBuffer();
+        prepareClusteredLights();
+        prepareTemporalUpscaling();
         setupDescriptorSetLayout();
         setupDescriptorPool();
         setupDescriptorSet();
         preparePipelineLayout();
+        prepareDepthPrepass();
         preparePipelines();
+        prepareCulling();
+        prepareDynamicResolution();
         buildCommandBuffers(); // Overriden.
+        if (ENABLE_HOT_RELOAD)
+        {
+            sceneData.enableHotReload(getAssetPath(), getAssetPath() + "scenes/" + SCENE_FILENAME);
+        }
         prepared = true;
     }
 
@@ -346,8 +260,8 @@ public:
     void loadAssets()
     {
         sceneData.loadTextures(vulkanDevice, queue, getAssetPath());
+        sceneData.loadShaders(vulkanDevice, queue, getAssetPath()); // Before meshes - they store vertex components the shaders read.
         sceneData.loadModels(vulkanDevice, queue, getAssetPath());
-        sceneData.loadShaders(vulkanDevice, queue, getAssetPath(), shaderModules);
     }
 
     void prepareUniformBuffers()
@@ -355,6 +269,83 @@ public:
         sceneData.prepareUniformBuffers(vulkanDevice, camera.matrices.view, camera.matrices.perspective);
     }
 
+    /// Render graph of visibility buffer frames - its ids image is in descriptor sets.
+    void prepareVisibilityBuffer()
+    {
+        if (sceneData.visibilityBuffer.isEnabled)
+        {
+            sceneData.prepareVisibilityBuffer(vulkanDevice, swapChain.colorFormat, depthFormat, width, height, { { 0.8f, 0.9f, 1.0f, 0.0f } });
+        }
+    }
+
+    /// Light buffers are in descriptor sets. The lamp prop lights its surroundings, other lights circle over the scene.
+    void prepareClusteredLights()
+    {
+        sceneData.prepareClusteredLights(vulkanDevice, queue, pipelineCache, getAssetPath());
+        if (!sceneData.lights.isEnabled)
+        {
+            return;
+        }
+
+        glm::vec3 sceneMin(std::numeric_limits<float>::max());
+        glm::vec3 sceneMax(std::numeric_limits<float>::lowest());
+        for (uint32_t i = 0; i < sceneData.entityBounds.size(); i++)
+        {
+            sceneMin = glm::min(sceneMin, sceneData.entityBounds.getMin(i));
+            sceneMax = glm::max(sceneMax, sceneData.entityBounds.getMax(i));
+        }
+        const float sceneSize = glm::length(sceneMax - sceneMin);
+
+        if (sceneData.sceneInfo.entities3dInfoMap.count("Light"))
+        {
+            const uint32_t lamp = sceneData.getEntityIndex("Light");
+            const glm::vec3 lampCenter = 0.5f * (sceneData.meshBounds.getMin(lamp) + sceneData.meshBounds.getMax(lamp));
+            sceneData.addLight(vk229::ClusteredLights::Light::point(lampCenter, 0.25f * sceneSize, { 1.0f, 0.8f, 0.6f }, 4.0f), "Light");
+        }
+
+        std::mt19937 random(229);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (uint32_t i = 0; i < MOVING_LIGHT_COUNT; i++)
+        {
+            MovingLight moving;
+            moving.center       = glm::mix(sceneMin, sceneMax, glm::vec3(unit(random), 0.1f + 0.5f * unit(random), unit(random)));
+            moving.radius       = 0.05f * sceneSize * (0.5f + unit(random));
+            moving.angularSpeed = (unit(random) - 0.5f) * 2.0f;
+            moving.phase        = 6.2831853f * unit(random);
+            const glm::vec3 color = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + 0.1f);
+            const float     range = 0.04f * sceneSize * (0.5f + unit(random));
+            if (i % 4 == 0) // Pointing down.
+            {
+                moving.lightIndex = sceneData.addLight(vk229::ClusteredLights::Light::spot(moving.center, { 0.0f, -1.0f, 0.0f }, 2.0f * range, color, 1.0f, 0.3f, 0.5f));
+            }
+            else
+            {
+                moving.lightIndex = sceneData.addLight(vk229::ClusteredLights::Light::point(moving.center, range, color, 0.5f));
+            }
+            movingLights.push_back(moving);
+        }
+    }
+
+    /// Motion vectors are drawn by the scene's pipelines - their render pass and buffers come before the descriptor set layout.
+    void prepareTemporalUpscaling()
+    {
+        if (!sceneData.motionVectors.isEnabled)
+        {
+            return;
+        }
+        temporalUpscaler.isEnabled = true;
+
+        const VkPipelineShaderStageCreateInfo vertexStage =
+            sceneData.shaderCache.acquire(device, getAssetPath() + "shaders/base/fullscreen.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        const VkPipelineShaderStageCreateInfo fragmentStage =
+            sceneData.shaderCache.acquire(device, getAssetPath() + "shaders/base/temporal_upscale.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        temporalUpscaler.prepare(vulkanDevice, pipelineCache, swapChain.colorFormat, depthFormat, vertexStage, fragmentStage);
+        sceneData.shaderCache.release(vertexStage.module);
+        sceneData.shaderCache.release(fragmentStage.module);
+
+        sceneData.prepareMotionVectors(vulkanDevice, temporalUpscaler.motionRenderPass);
+    }
+
     void setupDescriptorSetLayout()
     {
         sceneData.setupDescriptorSetLayout(vulkanDevice);
@@ -375,9 +366,74 @@ public:
         sceneData.setupPipelineLayout(vulkanDevice);
     }
 
+    /// Whether entities are drawn after a depth pre-pass (scene file, "prepass") - with auto, overdraw measured from the start view decides.
+    void prepareDepthPrepass()
+    {
+        sceneData.prepareDepthPrepass(vulkanDevice, queue, renderPass, pipelineCache, VERTEX_BUFFER_BIND_ID, getAssetPath(), depthFormat, width, height);
+    }
+
     void preparePipelines()
     {
-        sceneData.preparePipelines(vulkanDevice, renderPass, pipelineCache, VERTEX_BUFFER_BIND_ID, getAssetPath(), shaderModules);
+        sceneData.preparePipelines(vulkanDevice, renderPass, pipelineCache, VERTEX_BUFFER_BIND_ID, getAssetPath());
+    }
+
+    void prepareCulling()
+    {
+        if (sceneData.culling.isEnabled)
+        {
+            sceneData.prepareCulling(vulkanDevice, queue, descriptorPool, pipelineCache, getAssetPath());
+        }
+        if (sceneData.frustumCulling.isEnabled)
+        {
+            sceneData.prepareFrustumCulling(vulkanDevice, drawCmdBuffers.size());
+        }
+    }
+
+    /// GPU time is measured by timestamps - without them the scene is rendered at the window size, through the offscreen frame
+    /// only for temporal upscaling (at scale 1, as anti-aliasing).
+    void prepareDynamicResolution()
+    {
+        if (!ENABLE_DYNAMIC_RESOLUTION ||
+            (!vk229::DynamicResolution::isSupported(vulkanDevice, vulkanDevice->queueFamilyIndices.graphics) && !temporalUpscaler.isEnabled))
+        {
+            return;
+        }
+        dynamicResolution.isEnabled       = true;
+        dynamicResolution.targetFrameTime = TARGET_FRAME_TIME;
+        dynamicResolution.minScale        = MIN_RESOLUTION_SCALE;
+        dynamicResolution.sharpness       = UPSCALE_SHARPNESS;
+        if (temporalUpscaler.isEnabled) // History fills in at most that many output pixels per rendered one.
+        {
+            dynamicResolution.minScale = std::max(MIN_RESOLUTION_SCALE, 1.0f / vk229::TemporalUpscaler::MAX_UPSCALE);
+        }
+
+        const VkPipelineShaderStageCreateInfo vertexStage =
+            sceneData.shaderCache.acquire(device, getAssetPath() + "shaders/base/fullscreen.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+        const VkPipelineShaderStageCreateInfo fragmentStage =
+            sceneData.shaderCache.acquire(device, getAssetPath() + "shaders/base/upscale.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+        dynamicResolution.prepare(vulkanDevice, pipelineCache, swapChain.colorFormat, drawCmdBuffers.size(), vertexStage, fragmentStage);
+        sceneData.shaderCache.release(vertexStage.module);
+        sceneData.shaderCache.release(fragmentStage.module);
+
+        vk229::DepthPyramid::createRenderPasses(device, swapChain.colorFormat, depthFormat, offscreenRenderPass, offscreenLateRenderPass,
+                                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    /// Depth buffer is sampled by the depth pyramid.
+    void setupDepthStencil() override
+    {
+        if (!ENABLE_OCCLUSION_CULLING || !vk229::DepthPyramid::isDepthFormatSupported(physicalDevice, depthFormat))
+        {
+            VulkanExampleBase::setupDepthStencil();
+            return;
+        }
+        vk229::DepthPyramid::createDepthStencil(vulkanDevice, depthFormat, width, height, depthStencil.image, depthStencil.mem, depthStencil.view);
+    }
+
+    /// Early pass (renderPass) and late pass, sharing the framebuffers.
+    void setupRenderPass() override
+    {
+        vk229::DepthPyramid::createRenderPasses(device, swapChain.colorFormat, depthFormat, renderPass, lateRenderPass);
     }
 
     void buildCommandBuffers() override
@@ -387,39 +443,158 @@ public:
         VkClearValue clearValues[2];
         clearValues[0].color = { { 0.8f, 0.9f, 1.0f, 0.0f } };
         clearValues[1].depthStencil = { 1.0f, 0u };
+        if (sceneData.overdraw.isHeatmapShown) // Fragments add up from black.
+        {
+            clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+        }
+
+        if (sceneData.visibilityBuffer.isEnabled)
+        {
+            sceneData.updateVisibilityBuffer(vulkanDevice, width, height);
+        }
+        const bool isVisibilityFrame = sceneData.visibilityBuffer.isActive && !sceneData.overdraw.isHeatmapShown;
+
+        // Heatmap is shown as drawn, visibility buffer frames have their own passes - frames resolved otherwise don't continue the history
+        const bool isTemporal = temporalUpscaler.isEnabled && !sceneData.overdraw.isHeatmapShown && !isVisibilityFrame;
+
+        // With dynamic resolution the scene is drawn into the top left corner of the offscreen frame, then upscaled - at scale 1
+        // (no timestamps) only to be resolved temporally
+        isFrameScaled = dynamicResolution.isEnabled && !isVisibilityFrame && (dynamicResolution.isMeasured || isTemporal);
+        if (isFrameScaled)
+        {
+            std::vector<VkImageView> swapchainViews;
+            for (uint32_t i = 0; i < swapChain.imageCount; i++)
+            {
+                swapchainViews.push_back(swapChain.buffers[i].view);
+            }
+            dynamicResolution.resize(renderPass, depthStencil.view, swapchainViews, width, height);
+        }
+
+        isFrameTemporal = isFrameScaled && isTemporal;
+        if (isFrameTemporal)
+        {
+            std::vector<VkImageView> swapchainViews;
+            for (uint32_t i = 0; i < swapChain.imageCount; i++)
+            {
+                swapchainViews.push_back(swapChain.buffers[i].view);
+            }
+            temporalUpscaler.resize(queue, depthStencil.view, dynamicResolution.view, swapchainViews, width, height);
+        }
+        else
+        {
+            temporalUpscaler.invalidateHistory();
+        }
+        const uint32_t frameWidth  = getFrameWidth();
+        const uint32_t frameHeight = getFrameHeight();
 
         VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-        renderPassBeginInfo.renderPass = renderPass;
-        renderPassBeginInfo.renderArea.extent.width = width;
-        renderPassBeginInfo.renderArea.extent.height = height;
+        renderPassBeginInfo.renderPass = isFrameScaled ? offscreenRenderPass : renderPass;
+        renderPassBeginInfo.renderArea.extent.width = frameWidth;
+        renderPassBeginInfo.renderArea.extent.height = frameHeight;
         renderPassBeginInfo.clearValueCount = 2;
         renderPassBeginInfo.pClearValues = clearValues;
 
+        // Late pass loads everything
+        VkRenderPassBeginInfo lateRenderPassBeginInfo = renderPassBeginInfo;
+        lateRenderPassBeginInfo.renderPass = isFrameScaled ? offscreenLateRenderPass : lateRenderPass;
+        lateRenderPassBeginInfo.clearValueCount = 0;
+        lateRenderPassBeginInfo.pClearValues = nullptr;
+
+        // Depth buffer is new after resize, its drawn part changes with the render size
+        if (sceneData.culling.isEnabled)
+        {
+            sceneData.updateDepthPyramid(vulkanDevice, depthStencil.image, depthFormat, frameWidth, frameHeight);
+        }
+
         for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
         {
             // Set target frame buffer
-            renderPassBeginInfo.framebuffer = frameBuffers[i];
+            renderPassBeginInfo.framebuffer = isFrameScaled ? dynamicResolution.framebuffer : frameBuffers[i];
+            lateRenderPassBeginInfo.framebuffer = renderPassBeginInfo.framebuffer;
 
             VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+            // GPU time of the frame, which the render size follows
+            if (isFrameScaled)
+            {
+                dynamicResolution.recordBegin(drawCmdBuffers[i], i);
+            }
+
+            // Light lists of this frame's clusters, for both ways of drawing it
+            sceneData.recordLightBinning(drawCmdBuffers[i]);
+
+            // Its own passes, into the swapchain image
+            if (isVisibilityFrame)
+            {
+                sceneData.recordVisibilityFrame(drawCmdBuffers[i], i, swapChain.buffers[i].image, swapChain.buffers[i].view);
+                VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
+                continue;
+            }
+
+            if (sceneData.culling.isEnabled)
+            {
+                sceneData.recordCulling(drawCmdBuffers[i], vk229::DrawPhase::EARLY);
+            }
+
             vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-            VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+            VkViewport viewport = vks::initializers::viewport((float)frameWidth, (float)frameHeight, 0.0f, 1.0f);
             vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
 
-            VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+            VkRect2D scissor = vks::initializers::rect2D(frameWidth, frameHeight, 0, 0);
             vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
             VkDeviceSize offsets[1] = { 0 };
 
-            // Scene part.
-            sceneData.recordDrawCommandsForEntities(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, offsets);
+            // Scene part - visible in the last frame.
+            sceneData.recordDrawCommandsForEntities(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, offsets, vk229::DrawPhase::EARLY, i);
 
             vkCmdEndRenderPass(drawCmdBuffers[i]);
+
+            if (sceneData.culling.isEnabled)
+            {
+                sceneData.culling.depthPyramid.record(drawCmdBuffers[i]);
+                sceneData.recordCulling(drawCmdBuffers[i], vk229::DrawPhase::LATE);
+            }
+
+            // Scene part - disoccluded since the last frame.
+            vkCmdBeginRenderPass(drawCmdBuffers[i], &lateRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+            vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+            sceneData.recordDrawCommandsForEntities(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, offsets, vk229::DrawPhase::LATE, i);
+            vkCmdEndRenderPass(drawCmdBuffers[i]);
+
+            // Motion vectors over the scene's depth, then history and the swapchain image
+            if (isFrameTemporal)
+            {
+                temporalUpscaler.recordMotionPass(drawCmdBuffers[i], frameWidth, frameHeight, [&](VkCommandBuffer cmdBuffer) {
+                    sceneData.recordMotionVectors(cmdBuffer, VERTEX_BUFFER_BIND_ID, offsets, i);
+                });
+                temporalUpscaler.recordResolve(drawCmdBuffers[i], i);
+            }
+            else if (isFrameScaled)
+            {
+                dynamicResolution.recordUpscale(drawCmdBuffers[i], i);
+            }
+            if (isFrameScaled)
+            {
+                dynamicResolution.recordEnd(drawCmdBuffers[i], i);
+            }
             VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
         }
     }
 
+    /// Size the scene is drawn at - of the window, or the render size of dynamic resolution.
+    uint32_t getFrameWidth() const
+    {
+        return isFrameScaled ? dynamicResolution.renderWidth : width;
+    }
+
+    uint32_t getFrameHeight() const
+    {
+        return isFrameScaled ? dynamicResolution.renderHeight : height;
+    }
+
 // } // PREPARE
 
 // RUNTIME {
@@ -464,7 +639,38 @@ public:
             zoom *= 1.41f;
             updateUniformBuffer(true);
         break;
+        case KEY_O:
+            if (ENABLE_OVERDRAW_DIAGNOSTICS)
+            {
+                toggleOverdrawHeatmap();
+            }
+        break;
+        case KEY_B:
+            if (sceneData.visibilityBuffer.isEnabled)
+            {
+                sceneData.visibilityBuffer.isActive = !sceneData.visibilityBuffer.isActive;
+                buildCommandBuffers();
+            }
+        break;
+        case KEY_T:
+            if (sceneData.motionVectors.isEnabled)
+            {
+                temporalUpscaler.isEnabled = !temporalUpscaler.isEnabled;
+                buildCommandBuffers();
+            }
+        break;
+        }
+    }
+
+    /// Heatmap of the view is shown with its overdraw measured - per entity in the report on stdout.
+    void toggleOverdrawHeatmap()
+    {
+        sceneData.overdraw.isHeatmapShown = !sceneData.overdraw.isHeatmapShown;
+        if (sceneData.overdraw.isHeatmapShown)
+        {
+            sceneData.measureOverdrawDiagnostics(queue, VERTEX_BUFFER_BIND_ID);
         }
+        buildCommandBuffers();
     }
 
     virtual void render() override
@@ -476,11 +682,49 @@ public:
         {
             return;
         }
+        // Queue is idle here - submitFrame() waits for it
+        const bool isReloaded        = sceneData.reloadChangedFiles(vulkanDevice, queue, renderPass, pipelineCache, VERTEX_BUFFER_BIND_ID, drawCmdBuffers.size());
+        const bool isPipelineChanged = sceneData.updatePipelines(vulkanDevice); // Pipelines created meanwhile.
+        if (isReloaded || isPipelineChanged)
+        {
+            buildCommandBuffers();
+        }
         draw();
+        sceneData.destroyRetired(0);
         if (!paused)
         {
             updateUniformBuffer(false);
+            animationTime += frameTimer;
+        }
+    }
+
+    /// Moving lights go on along their circles.
+    void animateLights()
+    {
+        for (const MovingLight& moving : movingLights)
+        {
+            vk229::ClusteredLights::Light light = sceneData.lights.locals[moving.lightIndex];
+            const float angle = moving.phase + moving.angularSpeed * animationTime;
+            const glm::vec3 position = moving.center + moving.radius * glm::vec3(std::cos(angle), 0.0f, std::sin(angle));
+            light.positionRange = glm::vec4(position, light.positionRange.w);
+            sceneData.setLight(moving.lightIndex, light);
+        }
+    }
+
+    /// Droid turns around the vertical axis through the middle of its mesh, from its matrix in the scene file.
+    void animateDroid()
+    {
+        auto it = sceneData.sceneInfo.entities3dInfoMap.find("Droid");
+        if (!ANIMATE_DROID || it == sceneData.sceneInfo.entities3dInfoMap.end())
+        {
+            return;
         }
+        const uint32_t  droid  = sceneData.getEntityIndex("Droid");
+        const glm::vec3 center = 0.5f * (sceneData.meshBounds.getMin(droid) + sceneData.meshBounds.getMax(droid));
+        const float     angle  = DROID_TURN_ANGLE * std::sin(DROID_TURN_SPEED * animationTime);
+        const glm::mat4 rest   = sceneData.sceneInfo.matriciesInfoMap[it->second.matrixName].matrix;
+        sceneData.setEntityMatrix("Droid", rest * glm::translate(glm::mat4(1.0f), center) *
+                                           glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::translate(glm::mat4(1.0f), -center));
     }
 
     void draw()
@@ -489,19 +733,58 @@ public:
         // Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
         VulkanExampleBase::prepareFrame();
 
+        // Entities moved by setEntityMatrix() - their subtrees, bounds and world matrices
+        if (!paused)
+        {
+            animateDroid();
+        }
+        sceneData.updateTransforms();
+
+        // Lights follow their entities, binned for the current view by the command buffer
+        animateLights();
+        sceneData.updateLights(camera.matrices.view, camera.matrices.perspective, getFrameWidth(), getFrameHeight());
+
+        // Jittered within the rendered pixel, every frame differently - culling and drawing see the same projection
+        projection = camera.matrices.perspective;
+        if (isFrameTemporal)
+        {
+            projection = temporalUpscaler.beginFrame(camera.matrices.view, camera.matrices.perspective, getFrameWidth(), getFrameHeight());
+            sceneData.updateMotionVectors(temporalUpscaler.viewProjection, temporalUpscaler.previousViewProjection);
+        }
+        sceneData.updateUniformBuffers(true, camera.matrices.view, projection);
+
+        // Visible entities of this frame go to the slice read by its command buffer
+        VkFence frameFence = VK_NULL_HANDLE;
+        if (sceneData.frustumCulling.isEnabled)
+        {
+            frameFence = sceneData.cullEntities(currentBuffer);
+        }
+
         // Command buffer to be sumitted to the queue
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 
         // Submit to queue
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, frameFence));
 
         VulkanExampleBase::submitFrame();
+
+        // Queue is idle - GPU time of this frame may change the render size of the next ones
+        if (isFrameScaled && dynamicResolution.onFrameDone(currentBuffer))
+        {
+            sceneData.isDrawRecordingLogged = false;
+            buildCommandBuffers();
+            sceneData.isDrawRecordingLogged = true;
+        }
     }
 
     void updateUniformBuffer(bool viewChanged)
     {
-        sceneData.updateUniformBuffers(viewChanged, camera.matrices.view, camera.matrices.perspective);
+        if (!isFrameTemporal) // Otherwise projection is jittered by the next draw().
+        {
+            projection = camera.matrices.perspective;
+        }
+        sceneData.updateUniformBuffers(viewChanged, camera.matrices.view, projection);
     }
 
     // Camera::update(frameTimer);
@@ -510,7 +793,52 @@ public:
 
     virtual void getOverlayText(VulkanTextOverlay *textOverlay) override
     {
-        textOverlay->addText("LMB to rotate, WSAD to move", 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
+        if (sceneData.frustumCulling.isEnabled)
+        {
+            textOverlay->addText("Drawing " + std::to_string(sceneData.frustumCulling.visibleCount) + " of " + std::to_string(sceneData.entityBounds.size()) + " objects", 5.0f, 85.0f, VulkanTextOverlay::alignLeft);
+        }
+        if (sceneData.depthPrepass.measuredOverdraw > 0.0f || sceneData.depthPrepass.isActive)
+        {
+            std::stringstream prepass;
+            prepass << "Depth pre-pass " << (sceneData.depthPrepass.isActive ? "on" : "off");
+            if (sceneData.depthPrepass.measuredOverdraw > 0.0f)
+            {
+                prepass << " (overdraw " << std::fixed << std::setprecision(2) << sceneData.depthPrepass.measuredOverdraw << ")";
+            }
+            textOverlay->addText(prepass.str(), 5.0f, 125.0f, VulkanTextOverlay::alignLeft);
+        }
+        if (sceneData.overdraw.isHeatmapShown)
+        {
+            std::stringstream overdraw;
+            overdraw << "Overdraw heatmap, " << std::fixed << std::setprecision(2) << sceneData.overdraw.result.getOverdraw()
+                     << " fragments per pixel (max " << sceneData.overdraw.result.maxCount << ")";
+            textOverlay->addText(overdraw.str(), 5.0f, 145.0f, VulkanTextOverlay::alignLeft);
+        }
+        if (sceneData.lights.isEnabled)
+        {
+            textOverlay->addText(std::to_string(sceneData.lights.clusters.lightCount) + " dynamic lights in " +
+                                 std::to_string(vk229::ClusteredLights::CLUSTER_COUNT) + " clusters, " +
+                                 std::to_string(sceneData.lights.clusters.overflowingClusters) + " full", 5.0f, 185.0f, VulkanTextOverlay::alignLeft);
+        }
+        if (isFrameScaled)
+        {
+            std::stringstream resolution;
+            resolution << "Resolution " << dynamicResolution.renderWidth << "x" << dynamicResolution.renderHeight << " ("
+                       << static_cast<int>(dynamicResolution.scale * 100.0f + 0.5f) << "%)";
+            if (dynamicResolution.isMeasured)
+            {
+                resolution << ", GPU " << std::fixed << std::setprecision(1) << dynamicResolution.lastFrameTime << " ms";
+            }
+            resolution << (isFrameTemporal ? ", temporal AA" : "");
+            textOverlay->addText(resolution.str(), 5.0f, 205.0f, VulkanTextOverlay::alignLeft);
+        }
+        if (sceneData.visibilityBuffer.isActive)
+        {
+            textOverlay->addText("Visibility buffer, " + std::to_string(sceneData.visibilityBuffer.batches.size()) + " material batches", 5.0f, 165.0f, VulkanTextOverlay::alignLeft);
+        }
+        textOverlay->addText(std::string("LMB to rotate, WSAD to move") + (ENABLE_OVERDRAW_DIAGNOSTICS ? ", O for overdraw" : "") +
+                             (ENABLE_VISIBILITY_BUFFER ? ", B for visibility buffer" : "") +
+                             (ENABLE_TEMPORAL_UPSCALING ? ", T for temporal AA" : ""), 5.0f, 105.0f, VulkanTextOverlay::alignLeft);
     }
 
 // } // RUNTIME